@@ -549,6 +549,9 @@ int char_mmo_char_tosql(uint32 char_id, struct mmo_charstatus* p){
 int char_memitemdata_to_sql(const struct item items[], int max, int id, int tableswitch){
 	StringBuf buf;
 	SqlStmt* stmt;
+	SqlStmt* update_stmt;
+	SqlStmt* delete_stmt;
+	struct SqlParam params[8+MAX_SLOTS];
 	int i;
 	int j;
 	const char* tablename;
@@ -578,10 +581,11 @@ int char_memitemdata_to_sql(const struct item items[], int max, int id, int tabl
 	StringBuf_AppendStr(&buf, "SELECT `id`, `nameid`, `amount`, `equip`, `identify`, `refine`, `attribute`, `expire_time`, `bound`");
 	for( j = 0; j < MAX_SLOTS; ++j )
 		StringBuf_Printf(&buf, ", `card%d`", j);
-	StringBuf_Printf(&buf, " FROM `%s` WHERE `%s`='%d'", tablename, selectoption, id);
+	StringBuf_Printf(&buf, " FROM `%s` WHERE `%s`=?", tablename, selectoption);
 
-	stmt = SqlStmt_Malloc(sql_handle);
-	if( SQL_ERROR == SqlStmt_PrepareStr(stmt, StringBuf_Value(&buf))
+	stmt = Sql_PrepareCached(sql_handle, "%s", StringBuf_Value(&buf));
+	if( stmt == NULL
+	||  SQL_ERROR == SqlStmt_BindParam(stmt, 0, SQLDT_INT, &id, 0)
 	||  SQL_ERROR == SqlStmt_Execute(stmt) )
 	{
 		SqlStmt_ShowDebug(stmt);
@@ -602,6 +606,21 @@ int char_memitemdata_to_sql(const struct item items[], int max, int id, int tabl
 	for( j = 0; j < MAX_SLOTS; ++j )
 		SqlStmt_BindColumn(stmt, 9+j, SQLDT_USHORT, &item.card[j], 0, NULL, NULL);
 
+	// statements of the changed and removed items (cached, prepared once)
+	StringBuf_Clear(&buf);
+	StringBuf_Printf(&buf, "UPDATE `%s` SET `amount`=?, `equip`=?, `identify`=?, `refine`=?, `attribute`=?, `expire_time`=?, `bound`=?", tablename);
+	for( j = 0; j < MAX_SLOTS; ++j )
+		StringBuf_Printf(&buf, ", `card%d`=?", j);
+	StringBuf_AppendStr(&buf, " WHERE `id`=? LIMIT 1");
+	update_stmt = Sql_PrepareCached(sql_handle, "%s", StringBuf_Value(&buf));
+	delete_stmt = Sql_PrepareCached(sql_handle, "DELETE FROM `%s` WHERE `id`=? LIMIT 1", tablename);
+	if( update_stmt == NULL || delete_stmt == NULL )
+	{
+		SqlStmt_Free(stmt);
+		StringBuf_Destroy(&buf);
+		return 1;
+	}
+
 	// bit array indicating which inventory items have already been matched
 	flag = (bool*) aCalloc(max, sizeof(bool));
 
@@ -633,16 +652,22 @@ int char_memitemdata_to_sql(const struct item items[], int max, int id, int tabl
 				else
 				{
 					// update all fields.
-					StringBuf_Clear(&buf);
-					StringBuf_Printf(&buf, "UPDATE `%s` SET `amount`='%d', `equip`='%d', `identify`='%d', `refine`='%d',`attribute`='%d', `expire_time`='%u', `bound`='%d'",
-						tablename, items[i].amount, items[i].equip, items[i].identify, items[i].refine, items[i].attribute, items[i].expire_time, items[i].bound);
+					struct SqlParam* param = params;
+
+					SqlParam_Set(param++, SQLDT_SHORT, (void*)&items[i].amount, 0);
+					SqlParam_Set(param++, SQLDT_UINT, (void*)&items[i].equip, 0);
+					SqlParam_Set(param++, SQLDT_CHAR, (void*)&items[i].identify, 0);
+					SqlParam_Set(param++, SQLDT_CHAR, (void*)&items[i].refine, 0);
+					SqlParam_Set(param++, SQLDT_CHAR, (void*)&items[i].attribute, 0);
+					SqlParam_Set(param++, SQLDT_UINT, (void*)&items[i].expire_time, 0);
+					SqlParam_Set(param++, SQLDT_CHAR, (void*)&items[i].bound, 0);
 					for( j = 0; j < MAX_SLOTS; ++j )
-						StringBuf_Printf(&buf, ", `card%d`=%hu", j, items[i].card[j]);
-					StringBuf_Printf(&buf, " WHERE `id`='%d' LIMIT 1", item.id);
+						SqlParam_Set(param++, SQLDT_USHORT, (void*)&items[i].card[j], 0);
+					SqlParam_Set(param++, SQLDT_INT, &item.id, 0);
 
-					if( SQL_ERROR == Sql_QueryStr(sql_handle, StringBuf_Value(&buf)) )
+					if( SQL_ERROR == SqlStmt_ExecuteParams(update_stmt, params, param - params) )
 					{
-						Sql_ShowDebug(sql_handle);
+						SqlStmt_ShowDebug(update_stmt);
 						errors++;
 					}
 				}
@@ -653,9 +678,10 @@ int char_memitemdata_to_sql(const struct item items[], int max, int id, int tabl
 		}
 		if( !found )
 		{// Item not present in inventory, remove it.
-			if( SQL_ERROR == Sql_Query(sql_handle, "DELETE from `%s` where `id`='%d' LIMIT 1", tablename, item.id) )
+			if( SQL_ERROR == SqlStmt_BindParam(delete_stmt, 0, SQLDT_INT, &item.id, 0)
+			||  SQL_ERROR == SqlStmt_Execute(delete_stmt) )
 			{
-				Sql_ShowDebug(sql_handle);
+				SqlStmt_ShowDebug(delete_stmt);
 				errors++;
 			}
 		}
@@ -704,6 +730,9 @@ int char_memitemdata_to_sql(const struct item items[], int max, int id, int tabl
 int char_inventory_to_sql(const struct item items[], int max, int id) {
 	StringBuf buf;
 	SqlStmt* stmt;
+	SqlStmt* update_stmt;
+	SqlStmt* delete_stmt;
+	struct SqlParam params[9+MAX_SLOTS];
 	int i;
 	int j;
 	struct item item; // temp storage variable
@@ -721,10 +750,11 @@ int char_inventory_to_sql(const struct item items[], int max, int id) {
 	StringBuf_AppendStr(&buf, "SELECT `id`, `nameid`, `amount`, `equip`, `identify`, `refine`, `attribute`, `expire_time`, `favorite`, `bound`");
 	for( j = 0; j < MAX_SLOTS; ++j )
 		StringBuf_Printf(&buf, ", `card%d`", j);
-	StringBuf_Printf(&buf, " FROM `%s` WHERE `char_id`='%d'", schema_config.inventory_db, id);
+	StringBuf_Printf(&buf, " FROM `%s` WHERE `char_id`=?", schema_config.inventory_db);
 
-	stmt = SqlStmt_Malloc(sql_handle);
-	if( SQL_ERROR == SqlStmt_PrepareStr(stmt, StringBuf_Value(&buf))
+	stmt = Sql_PrepareCached(sql_handle, "%s", StringBuf_Value(&buf));
+	if( stmt == NULL
+	   ||  SQL_ERROR == SqlStmt_BindParam(stmt, 0, SQLDT_INT, &id, 0)
 	   ||  SQL_ERROR == SqlStmt_Execute(stmt) )
 	{
 		SqlStmt_ShowDebug(stmt);
@@ -746,6 +776,20 @@ int char_inventory_to_sql(const struct item items[], int max, int id) {
 	for( j = 0; j < MAX_SLOTS; ++j )
 		SqlStmt_BindColumn(stmt, 10+j, SQLDT_USHORT, &item.card[j], 0, NULL, NULL);
 
+	// statements of the changed and removed items (cached, prepared once)
+	StringBuf_Clear(&buf);
+	StringBuf_Printf(&buf, "UPDATE `%s` SET `amount`=?, `equip`=?, `identify`=?, `refine`=?, `attribute`=?, `expire_time`=?, `favorite`=?, `bound`=?", schema_config.inventory_db);
+	for( j = 0; j < MAX_SLOTS; ++j )
+		StringBuf_Printf(&buf, ", `card%d`=?", j);
+	StringBuf_AppendStr(&buf, " WHERE `id`=? LIMIT 1");
+	update_stmt = Sql_PrepareCached(sql_handle, "%s", StringBuf_Value(&buf));
+	delete_stmt = Sql_PrepareCached(sql_handle, "DELETE FROM `%s` WHERE `id`=? LIMIT 1", schema_config.inventory_db);
+	if( update_stmt == NULL || delete_stmt == NULL ) {
+		SqlStmt_Free(stmt);
+		StringBuf_Destroy(&buf);
+		return 1;
+	}
+
 	// bit array indicating which inventory items have already been matched
 	flag = (bool*) aCalloc(max, sizeof(bool));
 
@@ -775,15 +819,22 @@ int char_inventory_to_sql(const struct item items[], int max, int id) {
 					;	//Do nothing.
 				else {
 					// update all fields.
-					StringBuf_Clear(&buf);
-					StringBuf_Printf(&buf, "UPDATE `%s` SET `amount`='%d', `equip`='%d', `identify`='%d', `refine`='%d',`attribute`='%d', `expire_time`='%u', `favorite`='%d', `bound`='%d'",
-					    schema_config.inventory_db, items[i].amount, items[i].equip, items[i].identify, items[i].refine, items[i].attribute, items[i].expire_time, items[i].favorite, items[i].bound);
+					struct SqlParam* param = params;
+
+					SqlParam_Set(param++, SQLDT_SHORT, (void*)&items[i].amount, 0);
+					SqlParam_Set(param++, SQLDT_UINT, (void*)&items[i].equip, 0);
+					SqlParam_Set(param++, SQLDT_CHAR, (void*)&items[i].identify, 0);
+					SqlParam_Set(param++, SQLDT_CHAR, (void*)&items[i].refine, 0);
+					SqlParam_Set(param++, SQLDT_CHAR, (void*)&items[i].attribute, 0);
+					SqlParam_Set(param++, SQLDT_UINT, (void*)&items[i].expire_time, 0);
+					SqlParam_Set(param++, SQLDT_CHAR, (void*)&items[i].favorite, 0);
+					SqlParam_Set(param++, SQLDT_CHAR, (void*)&items[i].bound, 0);
 					for( j = 0; j < MAX_SLOTS; ++j )
-						StringBuf_Printf(&buf, ", `card%d`=%hu", j, items[i].card[j]);
-					StringBuf_Printf(&buf, " WHERE `id`='%d' LIMIT 1", item.id);
+						SqlParam_Set(param++, SQLDT_USHORT, (void*)&items[i].card[j], 0);
+					SqlParam_Set(param++, SQLDT_INT, &item.id, 0);
 
-					if( SQL_ERROR == Sql_QueryStr(sql_handle, StringBuf_Value(&buf)) ) {
-						Sql_ShowDebug(sql_handle);
+					if( SQL_ERROR == SqlStmt_ExecuteParams(update_stmt, params, param - params) ) {
+						SqlStmt_ShowDebug(update_stmt);
 						errors++;
 					}
 				}
@@ -793,8 +844,9 @@ int char_inventory_to_sql(const struct item items[], int max, int id) {
 			}
 		}
 		if( !found ) {// Item not present in inventory, remove it.
-			if( SQL_ERROR == Sql_Query(sql_handle, "DELETE from `%s` where `id`='%d' LIMIT 1", schema_config.inventory_db, item.id) ) {
-				Sql_ShowDebug(sql_handle);
+			if( SQL_ERROR == SqlStmt_BindParam(delete_stmt, 0, SQLDT_INT, &item.id, 0)
+			   ||  SQL_ERROR == SqlStmt_Execute(delete_stmt) ) {
+				SqlStmt_ShowDebug(delete_stmt);
 				errors++;
 			}
 		}
@@ -2611,6 +2663,8 @@ bool char_config_read(const char* cfgName, bool normal){
 				ShowInfo("Console Silent Setting: %d\n", atoi(w2));
 		} else if(strcmpi(w1,"stdout_with_ansisequence")==0){
 			stdout_with_ansisequence = config_switch(w2);
+		} else if(strcmpi(w1,"console_msg_async")==0){
+			console_msg_async = config_switch(w2);
 		} else if (strcmpi(w1, "char_maintenance") == 0) {
 			charserv_config.char_maintenance = atoi(w2);
 		} else if (strcmpi(w1, "char_new") == 0) {
@@ -2828,7 +2882,8 @@ int do_init(int argc, char **argv)
 {
 	//Read map indexes
 	runflag = CHARSERVER_ST_STARTING;
-	mapindex_init();
+	initstat_begin("do_init");
+	initstat_stage(mapindex_init());
 
 	CHAR_CONF_NAME =   "conf/char_athena.conf";
 	LAN_CONF_NAME =    "conf/subnet_athena.conf";
@@ -2837,12 +2892,14 @@ int do_init(int argc, char **argv)
 
 	cli_get_options(argc,argv);
 
+	initstat_begin("config files");
 	char_set_defaults();
 	char_config_read(CHAR_CONF_NAME, true);
 	char_lan_config_read(LAN_CONF_NAME);
 	char_set_default_sql();
 	char_sql_config_read(SQL_CONF_NAME);
 	msg_config_read(MSG_CONF_NAME_EN);
+	initstat_end();
 
 	if (strcmp(charserv_config.userid, "s1")==0 && strcmp(charserv_config.passwd, "p1")==0) {
 		ShowWarning("Using the default user/password s1/p1 is NOT RECOMMENDED.\n");
@@ -2850,12 +2907,12 @@ int do_init(int argc, char **argv)
 		ShowNotice("And then change the user/password to use in conf/char_athena.conf (or conf/import/char_conf.txt)\n");
 	}
 
-	inter_init_sql((argc > 2) ? argv[2] : inter_cfgName); // inter server configuration
+	initstat_stage(inter_init_sql((argc > 2) ? argv[2] : inter_cfgName)); // inter server configuration
 
 	auth_db = idb_alloc(DB_OPT_RELEASE_DATA);
 	online_char_db = idb_alloc(DB_OPT_RELEASE_DATA);
-	char_mmo_sql_init();
-	char_read_fame_list(); //Read fame lists.
+	initstat_stage(char_mmo_sql_init());
+	initstat_stage(char_read_fame_list()); //Read fame lists.
 
 	if ((naddr_ != 0) && (!(charserv_config.login_ip) || !(charserv_config.char_ip) ))
 	{
@@ -2891,11 +2948,14 @@ int do_init(int argc, char **argv)
 	add_timer_interval(gettick() + 1000, char_online_data_cleanup, 0, 0, 600 * 1000);
 
 	//chek db tables
+	initstat_begin("char_checkdb()");
 	if(charserv_config.char_check_db && char_checkdb() == 0){
 		ShowFatalError("char : A tables is missing in sql-server, please fix it, see (sql-files main.sql for structure) \n");
 		exit(EXIT_FAILURE);
 	}
+	initstat_end();
 	//Cleaning the tables for NULL entrys @ startup [Sirius]
+	initstat_begin("table cleanup");
 	//Chardb clean
 	if( SQL_ERROR == Sql_Query(sql_handle, "DELETE FROM `%s` WHERE `account_id` = '0'", schema_config.char_db) )
 		Sql_ShowDebug(sql_handle);
@@ -2907,6 +2967,7 @@ int do_init(int argc, char **argv)
 	//guildmemberdb clean
 	if( SQL_ERROR == Sql_Query(sql_handle, "DELETE FROM `%s` WHERE `guild_id` = '0' AND `account_id` = '0' AND `char_id` = '0'", schema_config.guild_member_db) )
 		Sql_ShowDebug(sql_handle);
+	initstat_end();
 
 	set_defaultparse(chclif_parse);
 
@@ -2924,6 +2985,8 @@ int do_init(int argc, char **argv)
 	do_init_chcnslif();
 	mapindex_check_mapdefault(charserv_config.default_map);
 	ShowInfo("Default map: '"CL_WHITE"%s %d,%d"CL_RESET"'\n", charserv_config.default_map, charserv_config.default_map_x, charserv_config.default_map_y);
+	initstat_end();
+	initstat_report();
 
 	ShowStatus("The char-server is "CL_GREEN"ready"CL_RESET" (Server is listening on the port %d).\n\n", charserv_config.char_port);
 
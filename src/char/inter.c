@@ -517,6 +517,7 @@ void mapif_accinfo_ack(bool success, int map_fd, int u_fd, int u_aid, int accoun
 int inter_accreg_tosql(uint32 account_id, uint32 char_id, struct accreg* reg, int type)
 {
 	StringBuf buf;
+	SqlStmt* stmt;
 	int i;
 
 	if( account_id <= 0 )
@@ -527,13 +528,19 @@ int inter_accreg_tosql(uint32 account_id, uint32 char_id, struct accreg* reg, in
 	//`global_reg_value` (`type`, `account_id`, `char_id`, `str`, `value`)
 	switch( type ) {
 		case 3: //Char Reg
-			if( SQL_ERROR == Sql_Query(sql_handle, "DELETE FROM `%s` WHERE `type`=3 AND `char_id`='%d'", schema_config.reg_db, char_id) )
-				Sql_ShowDebug(sql_handle);
+			stmt = Sql_PrepareCached(sql_handle, "DELETE FROM `%s` WHERE `type`=3 AND `char_id`=?", schema_config.reg_db);
+			if( stmt == NULL
+			||  SQL_ERROR == SqlStmt_BindParam(stmt, 0, SQLDT_UINT32, &char_id, 0)
+			||  SQL_ERROR == SqlStmt_Execute(stmt) )
+				SqlStmt_ShowDebug(stmt);
 			account_id = 0;
 			break;
 		case 2: //Account Reg
-			if( SQL_ERROR == Sql_Query(sql_handle, "DELETE FROM `%s` WHERE `type`=2 AND `account_id`='%d'", schema_config.reg_db, account_id) )
-				Sql_ShowDebug(sql_handle);
+			stmt = Sql_PrepareCached(sql_handle, "DELETE FROM `%s` WHERE `type`=2 AND `account_id`=?", schema_config.reg_db);
+			if( stmt == NULL
+			||  SQL_ERROR == SqlStmt_BindParam(stmt, 0, SQLDT_UINT32, &account_id, 0)
+			||  SQL_ERROR == SqlStmt_Execute(stmt) )
+				SqlStmt_ShowDebug(stmt);
 			char_id = 0;
 			break;
 		case 1: //Account2 Reg
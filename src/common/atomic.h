@@ -147,6 +147,13 @@ static forceinline int32 InterlockedExchange(volatile int32 *target, int32 val){
 }//end: InterlockedExchange()
 
 
+static forceinline void *InterlockedExchangePointer(void * volatile *target, void *val){
+	// __sync_lock_test_and_set is only an acquire barrier, the winapi version is a full barrier
+	__sync_synchronize();
+	return __sync_lock_test_and_set(target, val);
+}//end: InterlockedExchangePointer()
+
+
 #endif //endif compiler decission
 
 
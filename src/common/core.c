@@ -11,6 +11,7 @@
 #include "timer.h"
 #include "thread.h"
 #include "mempool.h"
+#include "threadpool.h"
 #include "sql.h"
 #endif
 #include <stdlib.h>
@@ -355,15 +356,25 @@ int main (int argc, char **argv)
 
 	timer_init();
 	socket_init();
+	threadpool_init();
 
 	do_init(argc,argv);
+	showmsg_async_init(); // console_msg_async is read by do_init
 
 	// Main runtime cycle
 	while (runflag != CORE_ST_STOP) { 
-		int next = do_timer(gettick_nocache());
+		int next;
+		tickstat_begin();
+		next = do_timer(gettick_nocache());
+		threadpool_do_completions();
+		if( threadpool_pending() > 0 && next > THREADPOOL_POLL_INTERVAL )
+			next = THREADPOOL_POLL_INTERVAL;
 		do_sockets(next);
+		tickstat_end();
 	}
 
+	showmsg_async_final(); // shutdown messages are synchronous
+	threadpool_final(); // jobs submitted from now on run on the main thread
 	do_final();
 
 	timer_final();
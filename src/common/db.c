@@ -2,14 +2,17 @@
  *  Copyright (c) Athena Dev Teams - Licensed under GNU GPL
  *  For more information, see LICENCE in the main folder
  *
- *  This file is separated in five sections:
+ *  This file is separated in six sections:
  *  (1) Private typedefs, enums, structures, defines and gblobal variables
  *  (2) Private functions
  *  (3) Protected functions used internally
  *  (4) Protected functions used in the interface of the database
- *  (5) Public functions
+ *  (5) Protected functions used in the interface of flat databases
+ *  (6) Public functions
  *
  *  The databases are structured as a hashtable of RED-BLACK trees.
+ *  Numeric databases allocated with DB_OPT_FLAT are instead a single
+ *  open addressing table (linear probing), see section (5).
  *
  *  <B>Properties of the RED-BLACK trees being used:</B>
  *  1. The value of any node is greater than the value of its left child and
@@ -47,6 +50,7 @@
  *  - create a db that organizes itself by splaying
  *
  *  HISTORY:
+ *    2026/10/16 - Added flat (open addressing) numeric databases.
  *    2012/03/09 - Added enum for data types (int, uint, void*)
  *    2008/02/19 - Fixed db_obj_get not handling deleted entries correctly.
  *    2007/11/09 - Added an iterator to the database.
@@ -83,6 +87,7 @@
  *  DBNode          - Structure of a node in RED-BLACK trees.                *
  *  struct db_free  - Structure that holds a deleted node to be freed.       *
  *  DBMap_impl      - Struture of the database.                              *
+ *  DBFlat_impl     - Struture of a flat database.                           *
  *  stats           - Statistics about the database system.                  *
 \*****************************************************************************/
 
@@ -218,6 +223,96 @@ typedef struct DBIterator_impl {
 	DBNode node;
 } DBIterator_impl;
 
+/**
+ * Base 2 logarithm of the initial number of slots of a flat database.
+ * @private
+ * @see DBFlat_impl#slots
+ */
+#define DB_FLAT_MIN_BITS 6
+
+/**
+ * State of a slot of a flat database.
+ * @private
+ * @see struct db_flat_slot
+ */
+enum db_flat_state {
+	DB_FLAT_EMPTY,
+	DB_FLAT_USED,
+	DB_FLAT_DELETED
+};
+
+/**
+ * A slot of a flat database.
+ * @param data Data of this database entry
+ * @param key Key of this database entry (DB_INT and DB_UINT keys have the same size)
+ * @param state State of the slot
+ * @private
+ * @see DBFlat_impl#slots
+ */
+struct db_flat_slot {
+	DBData data;
+	int key;
+	unsigned char state;
+};
+
+/**
+ * Complete flat database structure.
+ * Entries are kept in one array and found by linear probing. Removed entries
+ * leave a DB_FLAT_DELETED slot behind, so the slots never move while the
+ * database is locked. The array is only rebuilt by an insertion, and only
+ * while unlocked unless it is completely full.
+ * @param vtable Interface of the database
+ * @param alloc_file File where the database was allocated
+ * @param alloc_line Line in the file where the database was allocated
+ * @param slots Array of slots
+ * @param size Number of slots (power of 2)
+ * @param bits Base 2 logarithm of size
+ * @param used Number of slots that are not DB_FLAT_EMPTY
+ * @param lock Number of iterators and foreach calls in progress
+ * @param release Releaser of the database
+ * @param type Type of the database
+ * @param options Options of the database
+ * @param item_count Number of items in the database
+ * @param global_lock Global lock of the database
+ * @private
+ * @see #db_flat_alloc(const char*,int,DBType,DBOptions)
+ */
+typedef struct DBFlat_impl {
+	// Database interface
+	struct DBMap vtable;
+	// File and line of allocation
+	const char *alloc_file;
+	int alloc_line;
+	// Table
+	struct db_flat_slot *slots;
+	uint32 size;
+	uint32 bits;
+	uint32 used;
+	unsigned int lock;
+	// Other
+	DBReleaser release;
+	DBType type;
+	DBOptions options;
+	uint32 item_count;
+	unsigned global_lock : 1;
+} DBFlat_impl;
+
+/**
+ * Complete flat iterator structure.
+ * @param vtable Interface of the iterator
+ * @param db Parent database
+ * @param index Current slot, -1 before the first and size after the last
+ * @private
+ * @see #DBIterator
+ * @see #DBFlat_impl
+ */
+typedef struct DBFlatIterator_impl {
+	// Iterator interface
+	struct DBIterator vtable;
+	DBFlat_impl* db;
+	int index;
+} DBFlatIterator_impl;
+
 #if defined(DB_ENABLE_STATS)
 /**
  * Structure with what is counted when the database statistics are enabled.
@@ -2228,187 +2323,972 @@ static DBOptions db_obj_options(DBMap* self)
 }
 
 /*****************************************************************************\
- *  (5) Section with public functions.
- *  db_fix_options     - Apply database type restrictions to the options.
- *  db_default_cmp     - Get the default comparator for a type of database.
- *  db_default_hash    - Get the default hasher for a type of database.
- *  db_default_release - Get the default releaser for a type of database with the specified options.
- *  db_custom_release  - Get a releaser that behaves a certains way.
- *  db_alloc           - Allocate a new database.
- *  db_i2key           - Manual cast from 'int' to 'DBKey'.
- *  db_ui2key          - Manual cast from 'unsigned int' to 'DBKey'.
- *  db_str2key         - Manual cast from 'unsigned char *' to 'DBKey'.
- *  db_i2data          - Manual cast from 'int' to 'DBData'.
- *  db_ui2data         - Manual cast from 'unsigned int' to 'DBData'.
- *  db_ptr2data        - Manual cast from 'void*' to 'DBData'.
- *  db_data2i          - Gets 'int' value from 'DBData'.
- *  db_data2ui         - Gets 'unsigned int' value from 'DBData'.
- *  db_data2ptr        - Gets 'void*' value from 'DBData'.
- *  db_init            - Initializes the database system.
- *  db_final           - Finalizes the database system.
+ *  (5) Section with protected functions used in the interface of flat       *
+ *  databases (DB_OPT_FLAT).                                                 *
+ *  db_flat_hash      - Home slot of a key.                                  *
+ *  db_flat_key       - Key of a slot as a DBKey.                            *
+ *  db_flat_resize    - Rebuild the table with room for one more entry.      *
+ *  db_flat_lookup    - Find the slot of a key or the slot to insert it in.  *
+ *  db_flat_erase     - Remove the entry of a slot.                          *
+ *  dbit_flat_first   - Fetch the first entry in the database.               *
+ *  dbit_flat_last    - Fetch the last entry in the database.                *
+ *  dbit_flat_next    - Fetch the next entry in the database.                *
+ *  dbit_flat_prev    - Fetch the previous entry in the database.            *
+ *  dbit_flat_exists  - Check if the current entry exists.                   *
+ *  dbit_flat_remove  - Remove the current entry from the database.          *
+ *  dbit_flat_destroy - Destroy the iterator and unlock the database.        *
+ *  db_flat_*         - Implementation of the DBMap interface, see (4).      *
+ *  db_flat_alloc     - Allocate a new flat database.                        *
 \*****************************************************************************/
 
 /**
- * Returns the fixed options according to the database type.
- * Sets required options and unsets unsupported options.
- * For numeric databases DB_OPT_DUP_KEY and DB_OPT_RELEASE_KEY are unset.
- * @param type Type of the database
- * @param options Original options of the database
- * @return Fixed options of the database
+ * Returns the home slot of a key (fibonacci hashing).
+ * @param db Database
+ * @param key Key
+ * @return Index of the first slot to probe
  * @private
- * @see #db_default_release(DBType,DBOptions)
- * @see #db_alloc(const char *,int,DBType,DBOptions,unsigned short)
  */
-DBOptions db_fix_options(DBType type, DBOptions options)
+static inline uint32 db_flat_hash(DBFlat_impl* db, int key)
 {
-	DB_COUNTSTAT(db_fix_options);
-	switch (type) {
-		case DB_INT:
-		case DB_UINT: // Numeric database, do nothing with the keys
-			return (DBOptions)(options&~(DB_OPT_DUP_KEY|DB_OPT_RELEASE_KEY));
+	return ((uint32)key * 2654435769U) >> (32 - db->bits);
+}
 
-		default:
-			ShowError("db_fix_options: Unknown database type %u with options %x\n", type, options);
-		case DB_STRING:
-		case DB_ISTRING: // String databases, no fix required
-			return options;
-	}
+/**
+ * Returns the key of a slot as a DBKey.
+ * DB_INT and DB_UINT keys share the same representation.
+ * @param slot Slot in use
+ * @return Key of the slot
+ * @private
+ */
+static inline DBKey db_flat_key(struct db_flat_slot* slot)
+{
+	DBKey key;
+	key.i = slot->key;
+	return key;
 }
 
 /**
- * Returns the default comparator for the specified type of database.
- * @param type Type of database
- * @return Comparator for the type of database or NULL if unknown database
- * @public
- * @see #db_int_cmp(DBKey,DBKey,unsigned short)
- * @see #db_uint_cmp(DBKey,DBKey,unsigned short)
- * @see #db_string_cmp(DBKey,DBKey,unsigned short)
- * @see #db_istring_cmp(DBKey,DBKey,unsigned short)
+ * Rebuilds the table so that it holds the current entries plus one at 
+ * most half full, dropping the DB_FLAT_DELETED slots.
+ * @param db Database
+ * @private
  */
-DBComparator db_default_cmp(DBType type)
+static void db_flat_resize(DBFlat_impl* db)
 {
-	DB_COUNTSTAT(db_default_cmp);
-	switch (type) {
-		case DB_INT:     return &db_int_cmp;
-		case DB_UINT:    return &db_uint_cmp;
-		case DB_STRING:  return &db_string_cmp;
-		case DB_ISTRING: return &db_istring_cmp;
-		default:
-			ShowError("db_default_cmp: Unknown database type %u\n", type);
-			return NULL;
+	struct db_flat_slot* old_slots = db->slots;
+	uint32 old_size = db->size;
+	uint32 i;
+
+	db->bits = DB_FLAT_MIN_BITS;
+	db->size = 1<<db->bits;
+	while( db->size/2 < db->item_count+1 )
+	{
+		db->size <<= 1;
+		db->bits++;
+	}
+	CREATE(db->slots, struct db_flat_slot, db->size);
+	db->used = 0;
+	for( i = 0; i < old_size; ++i )
+	{
+		struct db_flat_slot* slot = &old_slots[i];
+		uint32 j;
+
+		if( slot->state != DB_FLAT_USED )
+			continue;
+		j = db_flat_hash(db, slot->key);
+		while( db->slots[j].state != DB_FLAT_EMPTY )
+			j = (j+1)&(db->size-1);
+		memcpy(&db->slots[j], slot, sizeof(*slot));
+		db->used++;
 	}
+	aFree(old_slots);
 }
 
 /**
- * Returns the default hasher for the specified type of database.
- * @param type Type of database
- * @return Hasher of the type of database or NULL if unknown database
- * @public
- * @see #db_int_hash(DBKey,unsigned short)
- * @see #db_uint_hash(DBKey,unsigned short)
- * @see #db_string_hash(DBKey,unsigned short)
- * @see #db_istring_hash(DBKey,unsigned short)
+ * Finds the slot of the entry identified by the key.
+ * If the entry does not exist and insert is true, returns the slot where it 
+ * should be inserted instead (not DB_FLAT_USED), rebuilding the table first 
+ * if it is getting full. The table is not rebuilt while the database is 
+ * locked unless that would leave no empty slot.
+ * @param db Database
+ * @param key Key that identifies the entry
+ * @param insert If a free slot should be returned when the entry does not exist
+ * @return Slot or NULL
+ * @private
  */
-DBHasher db_default_hash(DBType type)
+static struct db_flat_slot* db_flat_lookup(DBFlat_impl* db, int key, bool insert)
 {
-	DB_COUNTSTAT(db_default_hash);
-	switch (type) {
-		case DB_INT:     return &db_int_hash;
-		case DB_UINT:    return &db_uint_hash;
-		case DB_STRING:  return &db_string_hash;
-		case DB_ISTRING: return &db_istring_hash;
-		default:
-			ShowError("db_default_hash: Unknown database type %u\n", type);
-			return NULL;
+	struct db_flat_slot* slot;
+	struct db_flat_slot* deleted = NULL;
+	uint32 i = db_flat_hash(db, key);
+
+	for(;;)
+	{
+		slot = &db->slots[i];
+		if( slot->state == DB_FLAT_EMPTY )
+			break;
+		if( slot->state == DB_FLAT_USED )
+		{
+			if( slot->key == key )
+				return slot;
+		}
+		else if( deleted == NULL )
+			deleted = slot;
+		i = (i+1)&(db->size-1);
+	}
+	if( !insert )
+		return NULL;
+	if( deleted )
+		return deleted;
+	if( (db->used+1)*4 > db->size*3 && (db->lock == 0 || db->used+2 > db->size) )
+	{
+		db_flat_resize(db);
+		return db_flat_lookup(db, key, true);
 	}
+	return slot;
 }
 
 /**
- * Returns the default releaser for the specified type of database with the 
- * specified options.
- * NOTE: the options are fixed with {@link #db_fix_options(DBType,DBOptions)}
- * before choosing the releaser.
- * @param type Type of database
- * @param options Options of the database
- * @return Default releaser for the type of database with the specified options
- * @public
- * @see #db_release_nothing(DBKey,DBData,DBRelease)
- * @see #db_release_key(DBKey,DBData,DBRelease)
- * @see #db_release_data(DBKey,DBData,DBRelease)
- * @see #db_release_both(DBKey,DBData,DBRelease)
- * @see #db_custom_release(DBRelease)
+ * Removes the entry of a slot, releasing its data.
+ * The slot becomes DB_FLAT_DELETED, or DB_FLAT_EMPTY along with the deleted 
+ * slots before it when it is the end of a probe sequence.
+ * @param db Database
+ * @param slot Slot in use
+ * @private
  */
-DBReleaser db_default_release(DBType type, DBOptions options)
+static void db_flat_erase(DBFlat_impl* db, struct db_flat_slot* slot)
 {
-	DB_COUNTSTAT(db_default_release);
-	options = db_fix_options(type, options);
-	if (options&DB_OPT_RELEASE_DATA) { // Release data, what about the key?
-		if (options&(DB_OPT_DUP_KEY|DB_OPT_RELEASE_KEY))
-			return &db_release_both; // Release both key and data
-		return &db_release_data; // Only release data
+	uint32 i = (uint32)(slot - db->slots);
+
+	db->release(db_flat_key(slot), slot->data, DB_RELEASE_DATA);
+	slot->state = DB_FLAT_DELETED;
+	db->item_count--;
+	if( db->slots[(i+1)&(db->size-1)].state != DB_FLAT_EMPTY )
+		return;
+	while( db->slots[i].state == DB_FLAT_DELETED )
+	{
+		db->slots[i].state = DB_FLAT_EMPTY;
+		db->used--;
+		i = (i-1)&(db->size-1);
 	}
-	if (options&(DB_OPT_DUP_KEY|DB_OPT_RELEASE_KEY))
-		return &db_release_key; // Only release key
-	return &db_release_nothing; // Release nothing
 }
 
 /**
- * Returns the releaser that releases the specified release options.
- * @param which Options that specified what the releaser releases
- * @return Releaser for the specified release options
- * @public
- * @see #db_release_nothing(DBKey,DBData,DBRelease)
- * @see #db_release_key(DBKey,DBData,DBRelease)
- * @see #db_release_data(DBKey,DBData,DBRelease)
- * @see #db_release_both(DBKey,DBData,DBRelease)
- * @see #db_default_release(DBType,DBOptions)
+ * Fetches the first entry in the database.
+ * @see DBIterator#first
  */
-DBReleaser db_custom_release(DBRelease which)
+static DBData* dbit_flat_first(DBIterator* self, DBKey* out_key)
 {
-	DB_COUNTSTAT(db_custom_release);
-	switch (which) {
-		case DB_RELEASE_NOTHING: return &db_release_nothing;
-		case DB_RELEASE_KEY:     return &db_release_key;
-		case DB_RELEASE_DATA:    return &db_release_data;
-		case DB_RELEASE_BOTH:    return &db_release_both;
-		default:
-			ShowError("db_custom_release: Unknown release options %u\n", which);
-			return NULL;
+	DBFlatIterator_impl* it = (DBFlatIterator_impl*)self;
+
+	DB_COUNTSTAT(dbit_first);
+	it->index = -1;
+	return self->next(self, out_key);
+}
+
+/**
+ * Fetches the last entry in the database.
+ * @see DBIterator#last
+ */
+static DBData* dbit_flat_last(DBIterator* self, DBKey* out_key)
+{
+	DBFlatIterator_impl* it = (DBFlatIterator_impl*)self;
+
+	DB_COUNTSTAT(dbit_last);
+	it->index = (int)it->db->size;
+	return self->prev(self, out_key);
+}
+
+/**
+ * Fetches the next entry in the database.
+ * NOTE: if the table was rebuilt since the last call, entries can be 
+ * skipped or fetched twice.
+ * @see DBIterator#next
+ */
+static DBData* dbit_flat_next(DBIterator* self, DBKey* out_key)
+{
+	DBFlatIterator_impl* it = (DBFlatIterator_impl*)self;
+	DBFlat_impl* db = it->db;
+
+	DB_COUNTSTAT(dbit_next);
+	if( it->index < -1 )
+		it->index = -1;
+	while( ++it->index < (int)db->size )
+	{
+		struct db_flat_slot* slot = &db->slots[it->index];
+		if( slot->state == DB_FLAT_USED )
+		{
+			if( out_key )
+				*out_key = db_flat_key(slot);
+			return &slot->data;
+		}
 	}
+	it->index = (int)db->size;
+	return NULL;
 }
 
 /**
- * Allocate a new database of the specified type.
- * NOTE: the options are fixed by {@link #db_fix_options(DBType,DBOptions)}
- * before creating the database.
- * @param file File where the database is being allocated
- * @param line Line of the file where the database is being allocated
- * @param type Type of database
- * @param options Options of the database
- * @param maxlen Maximum length of the string to be used as key in string 
- *          databases. If 0, the maximum number of maxlen is used (64K).
- * @return The interface of the database
- * @public
- * @see #DBMap_impl
- * @see #db_fix_options(DBType,DBOptions)
+ * Fetches the previous entry in the database.
+ * NOTE: if the table was rebuilt since the last call, entries can be 
+ * skipped or fetched twice.
+ * @see DBIterator#prev
  */
-DBMap* db_alloc(const char *file, int line, DBType type, DBOptions options, unsigned short maxlen)
+static DBData* dbit_flat_prev(DBIterator* self, DBKey* out_key)
 {
-	DBMap_impl* db;
-	unsigned int i;
+	DBFlatIterator_impl* it = (DBFlatIterator_impl*)self;
+	DBFlat_impl* db = it->db;
 
-#ifdef DB_ENABLE_STATS
-	DB_COUNTSTAT(db_alloc);
-	switch (type) {
-		case DB_INT: DB_COUNTSTAT(db_int_alloc); break;
-		case DB_UINT: DB_COUNTSTAT(db_uint_alloc); break;
-		case DB_STRING: DB_COUNTSTAT(db_string_alloc); break;
-		case DB_ISTRING: DB_COUNTSTAT(db_istring_alloc); break;
+	DB_COUNTSTAT(dbit_prev);
+	if( it->index > (int)db->size )
+		it->index = (int)db->size;
+	while( --it->index >= 0 )
+	{
+		struct db_flat_slot* slot = &db->slots[it->index];
+		if( slot->state == DB_FLAT_USED )
+		{
+			if( out_key )
+				*out_key = db_flat_key(slot);
+			return &slot->data;
+		}
 	}
-#endif /* DB_ENABLE_STATS */
-	CREATE(db, struct DBMap_impl, 1);
+	it->index = -1;
+	return NULL;
+}
 
-	options = db_fix_options(type, options);
+/**
+ * Returns true if the fetched entry exists.
+ * @see DBIterator#exists
+ */
+static bool dbit_flat_exists(DBIterator* self)
+{
+	DBFlatIterator_impl* it = (DBFlatIterator_impl*)self;
+
+	DB_COUNTSTAT(dbit_exists);
+	return (it->index >= 0 && it->index < (int)it->db->size && it->db->slots[it->index].state == DB_FLAT_USED);
+}
+
+/**
+ * Removes the current entry from the database.
+ * @see DBIterator#remove
+ */
+static int dbit_flat_remove(DBIterator* self, DBData *out_data)
+{
+	DBFlatIterator_impl* it = (DBFlatIterator_impl*)self;
+	struct db_flat_slot* slot;
+
+	DB_COUNTSTAT(dbit_remove);
+	if( !self->exists(self) )
+		return 0;
+	slot = &it->db->slots[it->index];
+	if( out_data )
+		memcpy(out_data, &slot->data, sizeof(DBData));
+	db_flat_erase(it->db, slot);
+	return 1;
+}
+
+/**
+ * Destroys this iterator and unlocks the database.
+ * @see DBIterator#destroy
+ */
+static void dbit_flat_destroy(DBIterator* self)
+{
+	DBFlatIterator_impl* it = (DBFlatIterator_impl*)self;
+
+	DB_COUNTSTAT(dbit_destroy);
+	it->db->lock--;
+	aFree(self);
+}
+
+/**
+ * Returns a new iterator for this database.
+ * The iterator keeps the database locked until it is destroyed.
+ * @see DBMap#iterator
+ */
+static DBIterator* db_flat_iterator(DBMap* self)
+{
+	DBFlat_impl* db = (DBFlat_impl*)self;
+	DBFlatIterator_impl* it;
+
+	DB_COUNTSTAT(db_iterator);
+	CREATE(it, struct DBFlatIterator_impl, 1);
+	/* Interface of the iterator **/
+	it->vtable.first   = dbit_flat_first;
+	it->vtable.last    = dbit_flat_last;
+	it->vtable.next    = dbit_flat_next;
+	it->vtable.prev    = dbit_flat_prev;
+	it->vtable.exists  = dbit_flat_exists;
+	it->vtable.remove  = dbit_flat_remove;
+	it->vtable.destroy = dbit_flat_destroy;
+	/* Initial state (before the first entry) */
+	it->db = db;
+	it->index = -1;
+	/* Lock the database */
+	db->lock++;
+	return &it->vtable;
+}
+
+/**
+ * Returns true if the entry exists.
+ * @see DBMap#exists
+ */
+static bool db_flat_exists(DBMap* self, DBKey key)
+{
+	DBFlat_impl* db = (DBFlat_impl*)self;
+
+	DB_COUNTSTAT(db_exists);
+	if (db == NULL) return false; // nullpo candidate
+	return (db_flat_lookup(db, key.i, false) != NULL);
+}
+
+/**
+ * Get the data of the entry identified by the key.
+ * NOTE: the returned pointer is valid until the next insertion.
+ * @see DBMap#get
+ */
+static DBData* db_flat_get(DBMap* self, DBKey key)
+{
+	DBFlat_impl* db = (DBFlat_impl*)self;
+	struct db_flat_slot* slot;
+
+	DB_COUNTSTAT(db_get);
+	if (db == NULL) return NULL; // nullpo candidate
+	slot = db_flat_lookup(db, key.i, false);
+	return ( slot ) ? &slot->data : NULL;
+}
+
+/**
+ * Get the data of the entries matched by <code>match</code>.
+ * @see DBMap#vgetall
+ */
+static unsigned int db_flat_vgetall(DBMap* self, DBData **buf, unsigned int max, DBMatcher match, va_list args)
+{
+	DBFlat_impl* db = (DBFlat_impl*)self;
+	unsigned int ret = 0;
+	uint32 i;
+
+	DB_COUNTSTAT(db_vgetall);
+	if (db == NULL) return 0; // nullpo candidate
+	if (match == NULL) return 0; // nullpo candidate
+
+	db->lock++;
+	for( i = 0; i < db->size; ++i )
+	{
+		struct db_flat_slot* slot = &db->slots[i];
+		va_list argscopy;
+
+		if( slot->state != DB_FLAT_USED )
+			continue;
+		va_copy(argscopy, args);
+		if( match(db_flat_key(slot), slot->data, argscopy) == 0 )
+		{
+			if( buf && ret < max )
+				buf[ret] = &slot->data;
+			ret++;
+		}
+		va_end(argscopy);
+	}
+	db->lock--;
+	return ret;
+}
+
+/**
+ * Just calls {@link DBMap#vgetall}.
+ * @see DBMap#getall
+ */
+static unsigned int db_flat_getall(DBMap* self, DBData **buf, unsigned int max, DBMatcher match, ...)
+{
+	va_list args;
+	unsigned int ret;
+
+	DB_COUNTSTAT(db_getall);
+	if (self == NULL) return 0; // nullpo candidate
+
+	va_start(args, match);
+	ret = self->vgetall(self, buf, max, match, args);
+	va_end(args);
+	return ret;
+}
+
+/**
+ * Get the data of the entry identified by the key.
+ * If the entry does not exist, an entry is added with the data returned by 
+ * <code>create</code>.
+ * @see DBMap#vensure
+ */
+static DBData* db_flat_vensure(DBMap* self, DBKey key, DBCreateData create, va_list args)
+{
+	DBFlat_impl* db = (DBFlat_impl*)self;
+	struct db_flat_slot* slot;
+	va_list argscopy;
+	DBData data;
+
+	DB_COUNTSTAT(db_vensure);
+	if (db == NULL) return NULL; // nullpo candidate
+	if (create == NULL) {
+		ShowError("db_ensure: Create function is NULL for db allocated at %s:%d\n",db->alloc_file, db->alloc_line);
+		return NULL; // nullpo candidate
+	}
+
+	slot = db_flat_lookup(db, key.i, false);
+	if( slot )
+		return &slot->data;
+
+	if (db->item_count == UINT32_MAX) {
+		ShowError("db_vensure: item_count overflow, aborting item insertion.\n"
+				"Database allocated at %s:%d",
+				db->alloc_file, db->alloc_line);
+		return NULL;
+	}
+	// create the data before looking for a slot, create might use the database
+	va_copy(argscopy, args);
+	data = create(key, argscopy);
+	va_end(argscopy);
+	slot = db_flat_lookup(db, key.i, true);
+	if( slot->state != DB_FLAT_USED )
+	{
+		if( slot->state == DB_FLAT_EMPTY )
+			db->used++;
+		db->item_count++;
+		slot->key = key.i;
+		slot->state = DB_FLAT_USED;
+	}
+	slot->data = data;
+	return &slot->data;
+}
+
+/**
+ * Just calls {@link DBMap#vensure}.
+ * @see DBMap#ensure
+ */
+static DBData* db_flat_ensure(DBMap* self, DBKey key, DBCreateData create, ...)
+{
+	va_list args;
+	DBData *ret = NULL;
+
+	DB_COUNTSTAT(db_ensure);
+	if (self == NULL) return NULL; // nullpo candidate
+
+	va_start(args, create);
+	ret = self->vensure(self, key, create, args);
+	va_end(args);
+	return ret;
+}
+
+/**
+ * Put the data identified by the key in the database.
+ * Puts the previous data in out_data, if out_data is not NULL.
+ * @see DBMap#put
+ */
+static int db_flat_put(DBMap* self, DBKey key, DBData data, DBData *out_data)
+{
+	DBFlat_impl* db = (DBFlat_impl*)self;
+	struct db_flat_slot* slot;
+	int retval = 0;
+
+	DB_COUNTSTAT(db_put);
+	if (db == NULL) return 0; // nullpo candidate
+	if (db->global_lock) {
+		ShowError("db_put: Database is being destroyed, aborting entry insertion.\n"
+				"Database allocated at %s:%d\n",
+				db->alloc_file, db->alloc_line);
+		return 0; // nullpo candidate
+	}
+	if (!(db->options&DB_OPT_ALLOW_NULL_DATA) && (data.type == DB_DATA_PTR && data.u.ptr == NULL)) {
+		ShowError("db_put: Attempted to use non-allowed NULL data for db allocated at %s:%d\n",db->alloc_file, db->alloc_line);
+		return 0; // nullpo candidate
+	}
+
+	if (db->item_count == UINT32_MAX) {
+		ShowError("db_put: item_count overflow, aborting item insertion.\n"
+				"Database allocated at %s:%d",
+				db->alloc_file, db->alloc_line);
+		return 0;
+	}
+
+	slot = db_flat_lookup(db, key.i, true);
+	if( slot->state == DB_FLAT_USED )
+	{// equal entry, replace
+		db->release(key, slot->data, DB_RELEASE_BOTH);
+		if( out_data )
+			memcpy(out_data, &slot->data, sizeof(*out_data));
+		retval = 1;
+	}
+	else
+	{
+		if( slot->state == DB_FLAT_EMPTY )
+			db->used++;
+		db->item_count++;
+		slot->key = key.i;
+		slot->state = DB_FLAT_USED;
+	}
+	slot->data = data;
+	return retval;
+}
+
+/**
+ * Remove an entry from the database.
+ * Puts the previous data in out_data, if out_data is not NULL.
+ * @see DBMap#remove
+ */
+static int db_flat_remove(DBMap* self, DBKey key, DBData *out_data)
+{
+	DBFlat_impl* db = (DBFlat_impl*)self;
+	struct db_flat_slot* slot;
+
+	DB_COUNTSTAT(db_remove);
+	if (db == NULL) return 0; // nullpo candidate
+	if (db->global_lock) {
+		ShowError("db_remove: Database is being destroyed. Aborting entry deletion.\n"
+				"Database allocated at %s:%d\n",
+				db->alloc_file, db->alloc_line);
+		return 0; // nullpo candidate
+	}
+
+	slot = db_flat_lookup(db, key.i, false);
+	if( slot == NULL )
+		return 0;
+	if( out_data )
+		memcpy(out_data, &slot->data, sizeof(*out_data));
+	db_flat_erase(db, slot);
+	return 1;
+}
+
+/**
+ * Apply <code>func</code> to every entry in the database.
+ * Returns the sum of values returned by func.
+ * @see DBMap#vforeach
+ */
+static int db_flat_vforeach(DBMap* self, DBApply func, va_list args)
+{
+	DBFlat_impl* db = (DBFlat_impl*)self;
+	int sum = 0;
+	uint32 i;
+
+	DB_COUNTSTAT(db_vforeach);
+	if (db == NULL) return 0; // nullpo candidate
+	if (func == NULL) {
+		ShowError("db_foreach: Passed function is NULL for db allocated at %s:%d\n",db->alloc_file, db->alloc_line);
+		return 0; // nullpo candidate
+	}
+
+	db->lock++;
+	for( i = 0; i < db->size; ++i )
+	{
+		struct db_flat_slot* slot = &db->slots[i];
+		va_list argscopy;
+
+		if( slot->state != DB_FLAT_USED )
+			continue;
+		va_copy(argscopy, args);
+		sum += func(db_flat_key(slot), &slot->data, argscopy);
+		va_end(argscopy);
+	}
+	db->lock--;
+	return sum;
+}
+
+/**
+ * Just calls {@link DBMap#vforeach}.
+ * @see DBMap#foreach
+ */
+static int db_flat_foreach(DBMap* self, DBApply func, ...)
+{
+	va_list args;
+	int ret;
+
+	DB_COUNTSTAT(db_foreach);
+	if (self == NULL) return 0; // nullpo candidate
+
+	va_start(args, func);
+	ret = self->vforeach(self, func, args);
+	va_end(args);
+	return ret;
+}
+
+/**
+ * Removes all entries from the database.
+ * Before deleting an entry, func is applied to it.
+ * Releases the key and the data.
+ * @see DBMap#vclear
+ */
+static int db_flat_vclear(DBMap* self, DBApply func, va_list args)
+{
+	DBFlat_impl* db = (DBFlat_impl*)self;
+	int sum = 0;
+	uint32 i;
+
+	DB_COUNTSTAT(db_vclear);
+	if (db == NULL) return 0; // nullpo candidate
+
+	db->lock++;
+	for( i = 0; i < db->size; ++i )
+	{
+		struct db_flat_slot* slot = &db->slots[i];
+
+		if( slot->state != DB_FLAT_USED )
+			continue;
+		if( func )
+		{
+			va_list argscopy;
+			va_copy(argscopy, args);
+			sum += func(db_flat_key(slot), &slot->data, argscopy);
+			va_end(argscopy);
+		}
+		db->release(db_flat_key(slot), slot->data, DB_RELEASE_BOTH);
+		slot->state = DB_FLAT_DELETED;
+	}
+	memset(db->slots, 0, db->size*sizeof(db->slots[0]));
+	db->used = 0;
+	db->item_count = 0;
+	db->lock--;
+	return sum;
+}
+
+/**
+ * Just calls {@link DBMap#vclear}.
+ * @see DBMap#clear
+ */
+static int db_flat_clear(DBMap* self, DBApply func, ...)
+{
+	va_list args;
+	int ret;
+
+	DB_COUNTSTAT(db_clear);
+	if (self == NULL) return 0; // nullpo candidate
+
+	va_start(args, func);
+	ret = self->vclear(self, func, args);
+	va_end(args);
+	return ret;
+}
+
+/**
+ * Finalize the database, feeing all the memory it uses.
+ * Before deleting an entry, func is applied to it.
+ * @see DBMap#vdestroy
+ */
+static int db_flat_vdestroy(DBMap* self, DBApply func, va_list args)
+{
+	DBFlat_impl* db = (DBFlat_impl*)self;
+	int sum;
+
+	DB_COUNTSTAT(db_vdestroy);
+	if (db == NULL) return 0; // nullpo candidate
+	if (db->global_lock) {
+		ShowError("db_vdestroy: Database is already locked for destruction. Aborting second database destruction.\n"
+				"Database allocated at %s:%d\n",
+				db->alloc_file, db->alloc_line);
+		return 0;
+	}
+	if (db->lock)
+		ShowWarning("db_vdestroy: Database is still in use, %u lock(s) left. Continuing database destruction.\n"
+				"Database allocated at %s:%d\n",
+				db->lock, db->alloc_file, db->alloc_line);
+
+#ifdef DB_ENABLE_STATS
+	switch (db->type) {
+		case DB_INT: DB_COUNTSTAT(db_int_destroy); break;
+		case DB_UINT: DB_COUNTSTAT(db_uint_destroy); break;
+		default: break;
+	}
+#endif /* DB_ENABLE_STATS */
+	db->global_lock = 1;
+	sum = self->vclear(self, func, args);
+	aFree(db->slots);
+	aFree(db);
+	return sum;
+}
+
+/**
+ * Just calls {@link DBMap#db_vdestroy}.
+ * @see DBMap#destroy
+ */
+static int db_flat_destroy(DBMap* self, DBApply func, ...)
+{
+	va_list args;
+	int ret;
+
+	DB_COUNTSTAT(db_destroy);
+	if (self == NULL) return 0; // nullpo candidate
+
+	va_start(args, func);
+	ret = self->vdestroy(self, func, args);
+	va_end(args);
+	return ret;
+}
+
+/**
+ * Return the size of the database (number of items in the database).
+ * @see DBMap#size
+ */
+static unsigned int db_flat_size(DBMap* self)
+{
+	DB_COUNTSTAT(db_size);
+	if (self == NULL) return 0; // nullpo candidate
+	return ((DBFlat_impl*)self)->item_count;
+}
+
+/**
+ * Return the type of database.
+ * @see DBMap#type
+ */
+static DBType db_flat_type(DBMap* self)
+{
+	DB_COUNTSTAT(db_type);
+	if (self == NULL) return (DBType)-1; // nullpo candidate - TODO what should this return?
+	return ((DBFlat_impl*)self)->type;
+}
+
+/**
+ * Return the options of the database.
+ * @see DBMap#options
+ */
+static DBOptions db_flat_options(DBMap* self)
+{
+	DB_COUNTSTAT(db_options);
+	if (self == NULL) return DB_OPT_BASE; // nullpo candidate - TODO what should this return?
+	return ((DBFlat_impl*)self)->options;
+}
+
+/**
+ * Allocate a new flat database.
+ * @param file File where the database is being allocated
+ * @param line Line of the file where the database is being allocated
+ * @param type Type of database (DB_INT or DB_UINT)
+ * @param options Fixed options of the database
+ * @return The interface of the database
+ * @private
+ * @see #db_alloc(const char *,int,DBType,DBOptions,unsigned short)
+ */
+static DBMap* db_flat_alloc(const char *file, int line, DBType type, DBOptions options)
+{
+	DBFlat_impl* db;
+
+	CREATE(db, struct DBFlat_impl, 1);
+	/* Interface of the database */
+	db->vtable.iterator = db_flat_iterator;
+	db->vtable.exists   = db_flat_exists;
+	db->vtable.get      = db_flat_get;
+	db->vtable.getall   = db_flat_getall;
+	db->vtable.vgetall  = db_flat_vgetall;
+	db->vtable.ensure   = db_flat_ensure;
+	db->vtable.vensure  = db_flat_vensure;
+	db->vtable.put      = db_flat_put;
+	db->vtable.remove   = db_flat_remove;
+	db->vtable.foreach  = db_flat_foreach;
+	db->vtable.vforeach = db_flat_vforeach;
+	db->vtable.clear    = db_flat_clear;
+	db->vtable.vclear   = db_flat_vclear;
+	db->vtable.destroy  = db_flat_destroy;
+	db->vtable.vdestroy = db_flat_vdestroy;
+	db->vtable.size     = db_flat_size;
+	db->vtable.type     = db_flat_type;
+	db->vtable.options  = db_flat_options;
+	/* File and line of allocation */
+	db->alloc_file = file;
+	db->alloc_line = line;
+	/* Table */
+	db->bits = DB_FLAT_MIN_BITS;
+	db->size = 1<<db->bits;
+	CREATE(db->slots, struct db_flat_slot, db->size);
+	db->used = 0;
+	db->lock = 0;
+	/* Other */
+	db->release = db_default_release(type, options);
+	db->type = type;
+	db->options = options;
+	db->item_count = 0;
+	db->global_lock = 0;
+
+	return &db->vtable;
+}
+
+/*****************************************************************************\
+ *  (6) Section with public functions.
+ *  db_fix_options     - Apply database type restrictions to the options.
+ *  db_default_cmp     - Get the default comparator for a type of database.
+ *  db_default_hash    - Get the default hasher for a type of database.
+ *  db_default_release - Get the default releaser for a type of database with the specified options.
+ *  db_custom_release  - Get a releaser that behaves a certains way.
+ *  db_alloc           - Allocate a new database.
+ *  db_i2key           - Manual cast from 'int' to 'DBKey'.
+ *  db_ui2key          - Manual cast from 'unsigned int' to 'DBKey'.
+ *  db_str2key         - Manual cast from 'unsigned char *' to 'DBKey'.
+ *  db_i2data          - Manual cast from 'int' to 'DBData'.
+ *  db_ui2data         - Manual cast from 'unsigned int' to 'DBData'.
+ *  db_ptr2data        - Manual cast from 'void*' to 'DBData'.
+ *  db_data2i          - Gets 'int' value from 'DBData'.
+ *  db_data2ui         - Gets 'unsigned int' value from 'DBData'.
+ *  db_data2ptr        - Gets 'void*' value from 'DBData'.
+ *  db_init            - Initializes the database system.
+ *  db_final           - Finalizes the database system.
+\*****************************************************************************/
+
+/**
+ * Returns the fixed options according to the database type.
+ * Sets required options and unsets unsupported options.
+ * For numeric databases DB_OPT_DUP_KEY and DB_OPT_RELEASE_KEY are unset.
+ * For string databases DB_OPT_FLAT is unset.
+ * @param type Type of the database
+ * @param options Original options of the database
+ * @return Fixed options of the database
+ * @private
+ * @see #db_default_release(DBType,DBOptions)
+ * @see #db_alloc(const char *,int,DBType,DBOptions,unsigned short)
+ */
+DBOptions db_fix_options(DBType type, DBOptions options)
+{
+	DB_COUNTSTAT(db_fix_options);
+	switch (type) {
+		case DB_INT:
+		case DB_UINT: // Numeric database, do nothing with the keys
+			return (DBOptions)(options&~(DB_OPT_DUP_KEY|DB_OPT_RELEASE_KEY));
+
+		default:
+			ShowError("db_fix_options: Unknown database type %u with options %x\n", type, options);
+		case DB_STRING:
+		case DB_ISTRING: // String databases, only numeric keys can be flat
+			return (DBOptions)(options&~DB_OPT_FLAT);
+	}
+}
+
+/**
+ * Returns the default comparator for the specified type of database.
+ * @param type Type of database
+ * @return Comparator for the type of database or NULL if unknown database
+ * @public
+ * @see #db_int_cmp(DBKey,DBKey,unsigned short)
+ * @see #db_uint_cmp(DBKey,DBKey,unsigned short)
+ * @see #db_string_cmp(DBKey,DBKey,unsigned short)
+ * @see #db_istring_cmp(DBKey,DBKey,unsigned short)
+ */
+DBComparator db_default_cmp(DBType type)
+{
+	DB_COUNTSTAT(db_default_cmp);
+	switch (type) {
+		case DB_INT:     return &db_int_cmp;
+		case DB_UINT:    return &db_uint_cmp;
+		case DB_STRING:  return &db_string_cmp;
+		case DB_ISTRING: return &db_istring_cmp;
+		default:
+			ShowError("db_default_cmp: Unknown database type %u\n", type);
+			return NULL;
+	}
+}
+
+/**
+ * Returns the default hasher for the specified type of database.
+ * @param type Type of database
+ * @return Hasher of the type of database or NULL if unknown database
+ * @public
+ * @see #db_int_hash(DBKey,unsigned short)
+ * @see #db_uint_hash(DBKey,unsigned short)
+ * @see #db_string_hash(DBKey,unsigned short)
+ * @see #db_istring_hash(DBKey,unsigned short)
+ */
+DBHasher db_default_hash(DBType type)
+{
+	DB_COUNTSTAT(db_default_hash);
+	switch (type) {
+		case DB_INT:     return &db_int_hash;
+		case DB_UINT:    return &db_uint_hash;
+		case DB_STRING:  return &db_string_hash;
+		case DB_ISTRING: return &db_istring_hash;
+		default:
+			ShowError("db_default_hash: Unknown database type %u\n", type);
+			return NULL;
+	}
+}
+
+/**
+ * Returns the default releaser for the specified type of database with the 
+ * specified options.
+ * NOTE: the options are fixed with {@link #db_fix_options(DBType,DBOptions)}
+ * before choosing the releaser.
+ * @param type Type of database
+ * @param options Options of the database
+ * @return Default releaser for the type of database with the specified options
+ * @public
+ * @see #db_release_nothing(DBKey,DBData,DBRelease)
+ * @see #db_release_key(DBKey,DBData,DBRelease)
+ * @see #db_release_data(DBKey,DBData,DBRelease)
+ * @see #db_release_both(DBKey,DBData,DBRelease)
+ * @see #db_custom_release(DBRelease)
+ */
+DBReleaser db_default_release(DBType type, DBOptions options)
+{
+	DB_COUNTSTAT(db_default_release);
+	options = db_fix_options(type, options);
+	if (options&DB_OPT_RELEASE_DATA) { // Release data, what about the key?
+		if (options&(DB_OPT_DUP_KEY|DB_OPT_RELEASE_KEY))
+			return &db_release_both; // Release both key and data
+		return &db_release_data; // Only release data
+	}
+	if (options&(DB_OPT_DUP_KEY|DB_OPT_RELEASE_KEY))
+		return &db_release_key; // Only release key
+	return &db_release_nothing; // Release nothing
+}
+
+/**
+ * Returns the releaser that releases the specified release options.
+ * @param which Options that specified what the releaser releases
+ * @return Releaser for the specified release options
+ * @public
+ * @see #db_release_nothing(DBKey,DBData,DBRelease)
+ * @see #db_release_key(DBKey,DBData,DBRelease)
+ * @see #db_release_data(DBKey,DBData,DBRelease)
+ * @see #db_release_both(DBKey,DBData,DBRelease)
+ * @see #db_default_release(DBType,DBOptions)
+ */
+DBReleaser db_custom_release(DBRelease which)
+{
+	DB_COUNTSTAT(db_custom_release);
+	switch (which) {
+		case DB_RELEASE_NOTHING: return &db_release_nothing;
+		case DB_RELEASE_KEY:     return &db_release_key;
+		case DB_RELEASE_DATA:    return &db_release_data;
+		case DB_RELEASE_BOTH:    return &db_release_both;
+		default:
+			ShowError("db_custom_release: Unknown release options %u\n", which);
+			return NULL;
+	}
+}
+
+/**
+ * Allocate a new database of the specified type.
+ * NOTE: the options are fixed by {@link #db_fix_options(DBType,DBOptions)}
+ * before creating the database.
+ * @param file File where the database is being allocated
+ * @param line Line of the file where the database is being allocated
+ * @param type Type of database
+ * @param options Options of the database
+ * @param maxlen Maximum length of the string to be used as key in string 
+ *          databases. If 0, the maximum number of maxlen is used (64K).
+ * @return The interface of the database
+ * @public
+ * @see #DBMap_impl
+ * @see #DBFlat_impl
+ * @see #db_fix_options(DBType,DBOptions)
+ */
+DBMap* db_alloc(const char *file, int line, DBType type, DBOptions options, unsigned short maxlen)
+{
+	DBMap_impl* db;
+	unsigned int i;
+
+#ifdef DB_ENABLE_STATS
+	DB_COUNTSTAT(db_alloc);
+	switch (type) {
+		case DB_INT: DB_COUNTSTAT(db_int_alloc); break;
+		case DB_UINT: DB_COUNTSTAT(db_uint_alloc); break;
+		case DB_STRING: DB_COUNTSTAT(db_string_alloc); break;
+		case DB_ISTRING: DB_COUNTSTAT(db_istring_alloc); break;
+	}
+#endif /* DB_ENABLE_STATS */
+	options = db_fix_options(type, options);
+	if( options&DB_OPT_FLAT )
+		return db_flat_alloc(file, line, type, options);
+
+	CREATE(db, struct DBMap_impl, 1);
 	/* Interface of the database */
 	db->vtable.iterator = db_obj_iterator;
 	db->vtable.exists   = db_obj_exists;
@@ -115,6 +115,12 @@ typedef enum DBType {
  * @param DB_OPT_RELEASE_BOTH Releases both key and data.
  * @param DB_OPT_ALLOW_NULL_KEY Allow NULL keys in the database.
  * @param DB_OPT_ALLOW_NULL_DATA Allow NULL data in the database.
+ * @param DB_OPT_FLAT Numeric databases only: store the entries in a single 
+ *          open addressing table instead of a hashtable of trees. Faster 
+ *          lookups and less memory per entry, but the data pointers returned 
+ *          by DBMap::get and DBMap::ensure are only valid until the next 
+ *          insertion, and an iterator or foreach that inserts entries can 
+ *          skip or revisit entries if the table has to grow.
  * @public
  * @see #db_fix_options(DBType,DBOptions)
  * @see #db_default_release(DBType,DBOptions)
@@ -128,6 +134,7 @@ typedef enum DBOptions {
 	DB_OPT_RELEASE_BOTH    = 6,
 	DB_OPT_ALLOW_NULL_KEY  = 8,
 	DB_OPT_ALLOW_NULL_DATA = 16,
+	DB_OPT_FLAT            = 32,
 } DBOptions;
 
 /**
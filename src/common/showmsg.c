@@ -6,6 +6,13 @@
 #include "showmsg.h"
 #include "core.h" //[Ind] - For SERVER_TYPE
 
+#ifndef MINICORE
+#include "../common/atomic.h"
+#include "../common/malloc.h"
+#include "../common/mutex.h"
+#include "../common/thread.h"
+#endif
+
 #include <time.h>
 #include <stdlib.h> // atexit
 
@@ -64,7 +71,12 @@ int console_msg_log = 0;//[Ind] msg error logging
 //define NEWBUF
 
 #define BUFVPRINTF(buf,fmt,args)						\
-	buf.l_ = vsnprintf(buf.s_, SBUF_SIZE, fmt, args);	\
+	{/* args is used again by the dynamic buffer */	\
+		va_list apcopy_;								\
+		va_copy(apcopy_, args);							\
+		buf.l_ = vsnprintf(buf.s_, SBUF_SIZE, fmt, apcopy_);\
+		va_end(apcopy_);								\
+	}													\
 	if( buf.l_ >= 0 && buf.l_ < SBUF_SIZE )				\
 	{/* static buffer */								\
 		buf.v_ = buf.s_;								\
@@ -660,13 +672,253 @@ int	FPRINTF(FILE *file, const char *fmt, ...)
 
 char timestamp_format[20] = ""; //For displaying Timestamps
 
-int _vShowMessage(enum msg_type flag, const char *string, va_list ap)
+/// Writes a formatted message to the console and the log files.
+/// @param logtime Timestamp of the console_msg_log entry (only used when logged)
+/// @param flush If the console is flushed after the message
+static void showmsg_output(enum msg_type flag, const char* logtime, const char* prefix, const char* text, bool logged, bool printed, bool flush)
 {
-	va_list apcopy;
-	char prefix[100];
 #if defined(DEBUGLOGMAP) || defined(DEBUGLOGCHAR) || defined(DEBUGLOGLOGIN)
 	FILE *fp;
 #endif
+
+	if( logged ) {//[Ind]
+		FILE *log = NULL;
+		if( (log = fopen(SERVER_TYPE == ATHENA_SERVER_MAP ? "./log/map-msg_log.log" : "./log/unknown.log","a+")) ) {
+			fprintf(log,"(%s) [ %s ] : %s",
+				logtime,
+				flag == MSG_WARNING ? "Warning" :
+				flag == MSG_ERROR ? "Error" :
+				flag == MSG_SQL ? "SQL Error" :
+				flag == MSG_DEBUG ? "Debug" :
+				"Unknown",
+				text);
+			fclose(log);
+		}
+	}
+	if( !printed )
+		return;
+
+	if (flag == MSG_ERROR || flag == MSG_FATALERROR || flag == MSG_SQL)
+	{	//Send Errors to StdErr [Skotlex]
+		FPRINTF(STDERR, "%s ", prefix);
+		FPRINTF(STDERR, "%s", text);
+		if( flush )
+			FFLUSH(STDERR);
+	} else {
+		if (flag != MSG_NONE)
+			FPRINTF(STDOUT, "%s ", prefix);
+		FPRINTF(STDOUT, "%s", text);
+		if( flush )
+			FFLUSH(STDOUT);
+	}
+
+#if defined(DEBUGLOGMAP) || defined(DEBUGLOGCHAR) || defined(DEBUGLOGLOGIN)
+	if(strlen(DEBUGLOGPATH) > 0) {
+		fp=fopen(DEBUGLOGPATH,"a");
+		if (fp == NULL)	{
+			FPRINTF(STDERR, CL_RED"[ERROR]"CL_RESET": Could not open '"CL_WHITE"%s"CL_RESET"', access denied.\n", DEBUGLOGPATH);
+			FFLUSH(STDERR);
+		} else {
+			fprintf(fp,"%s %s", prefix, text);
+			fclose(fp);
+		}
+	} else {
+		FPRINTF(STDERR, CL_RED"[ERROR]"CL_RESET": DEBUGLOGPATH not defined!\n");
+		FFLUSH(STDERR);
+	}
+#endif
+}
+
+#ifndef MINICORE
+///////////////////////////////////////////////////////////////////////////////
+/// Asynchronous console output.
+/// Messages are formatted by the calling thread into a bounded lock-free ring
+/// (multi producer / single consumer, one sequence number per slot) and written
+/// by a separate thread, so slow terminals and log files don't stall the server loop.
+/// When the ring is full the message is dropped and counted instead of waiting.
+/// Fatal errors and messages that don't fit in a slot are written synchronously
+/// after the queued messages.
+
+#define SHOWMSG_ASYNC_SLOTS 512 // must be a power of 2
+#define SHOWMSG_ASYNC_TEXT 2048 // less than SBUF_SIZE, so the writer never allocates
+#define SHOWMSG_ASYNC_POLL 10 // ms the writer sleeps when there is nothing to write
+
+int console_msg_async = 0;
+
+struct showmsg_slot {
+	volatile int32 seq; // pos: free for pos, pos+1: written for pos
+	enum msg_type flag;
+	bool logged, printed;
+	char logtime[20];
+	char prefix[100];
+	char text[SHOWMSG_ASYNC_TEXT];
+};
+
+static struct showmsg_slot* showmsg_ring = NULL;
+static volatile int32 showmsg_head = 0; // next position to claim (producers)
+static volatile int32 showmsg_tail = 0; // next position to write (writer thread)
+static volatile int32 showmsg_dropped = 0;
+static volatile int32 showmsg_terminate = 0;
+static volatile bool showmsg_async_running = false;
+static rAthread showmsg_thread = NULL;
+static ramutex showmsg_lock = NULL; // held while writing, by the writer thread and by synchronous output
+static racond showmsg_cond = NULL;
+
+/// Queues a message.
+/// Returns false if it must be written synchronously.
+static bool showmsg_async_push(enum msg_type flag, const char* logtime, const char* prefix, const char* text, size_t len, bool logged, bool printed)
+{
+	struct showmsg_slot* slot;
+	int32 pos, diff;
+
+	if( flag == MSG_FATALERROR || len >= SHOWMSG_ASYNC_TEXT )
+		return false;
+
+	pos = showmsg_head;
+	while( 1 ) {
+		slot = &showmsg_ring[pos&(SHOWMSG_ASYNC_SLOTS-1)];
+		diff = (int32)((uint32)InterlockedExchangeAdd(&slot->seq, 0) - (uint32)pos);
+		if( diff == 0 ) {
+			if( InterlockedCompareExchange(&showmsg_head, (int32)((uint32)pos + 1), pos) == pos )
+				break;
+			pos = showmsg_head;
+		} else if( diff < 0 ) {// full, drop it
+			InterlockedIncrement(&showmsg_dropped);
+			return true;
+		} else// claimed by another thread
+			pos = showmsg_head;
+	}
+
+	slot->flag = flag;
+	slot->logged = logged;
+	slot->printed = printed;
+	safestrncpy(slot->logtime, logtime, sizeof(slot->logtime));
+	safestrncpy(slot->prefix, prefix, sizeof(slot->prefix));
+	memcpy(slot->text, text, len + 1);
+	InterlockedExchangeAdd(&slot->seq, 1); // publish (full barrier)
+	return true;
+}
+
+/// Writes the queued messages (writer thread, showmsg_lock held).
+/// Returns the number of written messages.
+static int showmsg_async_drain(void)
+{
+	int count = 0;
+	int32 dropped;
+
+	while( 1 ) {
+		struct showmsg_slot* slot = &showmsg_ring[showmsg_tail&(SHOWMSG_ASYNC_SLOTS-1)];
+		if( InterlockedExchangeAdd(&slot->seq, 0) != (int32)((uint32)showmsg_tail + 1) )
+			break;// empty, or the next message is still being written by its producer
+		showmsg_output(slot->flag, slot->logtime, slot->prefix, slot->text, slot->logged, slot->printed, false);
+		InterlockedExchangeAdd(&slot->seq, SHOWMSG_ASYNC_SLOTS - 1); // free for the next round
+		InterlockedExchange(&showmsg_tail, (int32)((uint32)showmsg_tail + 1));
+		count++;
+	}
+
+	if( showmsg_dropped > 0 && (dropped = InterlockedExchange(&showmsg_dropped, 0)) > 0 ) {
+		char text[128];
+		snprintf(text, sizeof(text), "showmsg: "CL_WHITE"%d"CL_RESET" message(s) dropped, the console could not keep up.\n", dropped);
+		showmsg_output(MSG_WARNING, "", CL_YELLOW"[Warning]"CL_RESET":", text, false, true, false);
+		count++;
+	}
+
+	if( count > 0 ) {// once per batch instead of once per message
+		FFLUSH(STDOUT);
+		FFLUSH(STDERR);
+	}
+
+	return count;
+}
+
+static void *showmsg_async_main(void *param)
+{
+	ramutex_lock(showmsg_lock);
+	while( 1 ) {
+		if( showmsg_async_drain() > 0 )
+			continue;
+		if( showmsg_terminate > 0 )
+			break;
+		racond_wait(showmsg_cond, showmsg_lock, SHOWMSG_ASYNC_POLL);
+	}
+	ramutex_unlock(showmsg_lock);
+	return NULL;
+}
+
+/// Waits until the writer thread wrote every queued message.
+static void showmsg_async_flush(void)
+{
+	while( showmsg_tail != showmsg_head )
+		rathread_yield();
+}
+
+/// Starts the writer thread if console_msg_async is set.
+void showmsg_async_init(void)
+{
+	int i;
+
+	if( !console_msg_async || showmsg_async_running )
+		return;
+
+	CREATE(showmsg_ring, struct showmsg_slot, SHOWMSG_ASYNC_SLOTS);
+	for( i = 0; i < SHOWMSG_ASYNC_SLOTS; i++ )
+		showmsg_ring[i].seq = i;
+	showmsg_head = showmsg_tail = 0;
+	showmsg_dropped = 0;
+	showmsg_terminate = 0;
+	showmsg_lock = ramutex_create();
+	showmsg_cond = racond_create();
+
+	showmsg_thread = rathread_createEx(showmsg_async_main, NULL, 256*1024, RAT_PRIO_NORMAL);
+	if( showmsg_thread == NULL ) {
+		racond_destroy(showmsg_cond);
+		ramutex_destroy(showmsg_lock);
+		aFree(showmsg_ring);
+		showmsg_cond = NULL;
+		showmsg_lock = NULL;
+		showmsg_ring = NULL;
+		ShowError("showmsg_async_init: cannot spawn the console writer thread, the console output stays synchronous.\n");
+		return;
+	}
+
+	showmsg_async_running = true;
+	atexit(showmsg_async_final);
+	ShowStatus("Console output is written by a separate thread.\n");
+}
+
+/// Writes the queued messages and stops the writer thread, the output is synchronous afterwards.
+void showmsg_async_final(void)
+{
+	if( !showmsg_async_running )
+		return;
+
+	showmsg_async_running = false;
+	InterlockedIncrement(&showmsg_terminate);
+	ramutex_lock(showmsg_lock);
+	racond_signal(showmsg_cond);
+	ramutex_unlock(showmsg_lock);
+	rathread_wait(showmsg_thread, NULL);
+
+	racond_destroy(showmsg_cond);
+	ramutex_destroy(showmsg_lock);
+	aFree(showmsg_ring);
+	showmsg_thread = NULL;
+	showmsg_cond = NULL;
+	showmsg_lock = NULL;
+	showmsg_ring = NULL;
+}
+#endif
+
+int _vShowMessage(enum msg_type flag, const char *string, va_list ap)
+{
+	va_list apcopy;
+	char prefix[100];
+	char logtime[20];
+	char sbuf[SBUF_SIZE];
+	StringBuf dbuf;
+	const char* text;
+	int len;
+	bool logged, printed;
 	
 	if (!string || *string == '\0') {
 		ShowError("Empty string passed to _vShowMessage().\n");
@@ -682,30 +934,11 @@ int _vShowMessage(enum msg_type flag, const char *string, va_list ap)
 		buildbotflag = 1;
 	}
 #endif
-	if(
+	logged = (
 		( flag == MSG_WARNING && console_msg_log&1 ) ||
 		( ( flag == MSG_ERROR || flag == MSG_SQL ) && console_msg_log&2 ) ||
-		( flag == MSG_DEBUG && console_msg_log&4 ) ) {//[Ind]
-		FILE *log = NULL;
-		if( (log = fopen(SERVER_TYPE == ATHENA_SERVER_MAP ? "./log/map-msg_log.log" : "./log/unknown.log","a+")) ) {
-			char timestring[255];
-			time_t curtime;
-			time(&curtime);
-			strftime(timestring, 254, "%m/%d/%Y %H:%M:%S", localtime(&curtime));
-			fprintf(log,"(%s) [ %s ] : ",
-				timestring,
-				flag == MSG_WARNING ? "Warning" :
-				flag == MSG_ERROR ? "Error" :
-				flag == MSG_SQL ? "SQL Error" :
-				flag == MSG_DEBUG ? "Debug" :
-				"Unknown");
-			va_copy(apcopy, ap);
-			vfprintf(log,string,apcopy);
-			va_end(apcopy);
-			fclose(log);
-		}
-	}
-	if(
+		( flag == MSG_DEBUG && console_msg_log&4 ) );//[Ind]
+	printed = !(
 	    (flag == MSG_INFORMATION && msg_silent&1) ||
 	    (flag == MSG_STATUS && msg_silent&2) ||
 	    (flag == MSG_NOTICE && msg_silent&4) ||
@@ -713,9 +946,16 @@ int _vShowMessage(enum msg_type flag, const char *string, va_list ap)
 	    (flag == MSG_ERROR && msg_silent&16) ||
 	    (flag == MSG_SQL && msg_silent&16) ||
 	    (flag == MSG_DEBUG && msg_silent&32)
-	)
+	);
+	if( !logged && !printed )
 		return 0; //Do not print it.
 
+	if( logged ) {
+		time_t curtime;
+		time(&curtime);
+		strftime(logtime, sizeof(logtime), "%m/%d/%Y %H:%M:%S", localtime(&curtime));
+	} else logtime[0] = '\0';
+
 	if (timestamp_format[0] && flag != MSG_NONE)
 	{	//Display time format. [Skotlex]
 		time_t t = time(NULL);
@@ -754,41 +994,38 @@ int _vShowMessage(enum msg_type flag, const char *string, va_list ap)
 			return 1;
 	}
 
-	if (flag == MSG_ERROR || flag == MSG_FATALERROR || flag == MSG_SQL)
-	{	//Send Errors to StdErr [Skotlex]
-		FPRINTF(STDERR, "%s ", prefix);
-		va_copy(apcopy, ap);
-		VFPRINTF(STDERR, string, apcopy);
-		va_end(apcopy);
-		FFLUSH(STDERR);
-	} else {
-		if (flag != MSG_NONE)
-			FPRINTF(STDOUT, "%s ", prefix);
+	// format the message once, for the console and the log files
+	va_copy(apcopy, ap);
+	len = vsnprintf(sbuf, sizeof(sbuf), string, apcopy);
+	va_end(apcopy);
+	if( len >= 0 && len < (int)sizeof(sbuf) )
+		text = sbuf;
+	else {// dynamic buffer
+		StringBuf_Init(&dbuf);
 		va_copy(apcopy, ap);
-		VFPRINTF(STDOUT, string, apcopy);
+		len = StringBuf_Vprintf(&dbuf, string, apcopy);
 		va_end(apcopy);
-		FFLUSH(STDOUT);
+		text = StringBuf_Value(&dbuf);
 	}
 
-#if defined(DEBUGLOGMAP) || defined(DEBUGLOGCHAR) || defined(DEBUGLOGLOGIN)
-	if(strlen(DEBUGLOGPATH) > 0) {
-		fp=fopen(DEBUGLOGPATH,"a");
-		if (fp == NULL)	{
-			FPRINTF(STDERR, CL_RED"[ERROR]"CL_RESET": Could not open '"CL_WHITE"%s"CL_RESET"', access denied.\n", DEBUGLOGPATH);
-			FFLUSH(STDERR);
-		} else {
-			fprintf(fp,"%s ", prefix);
-			va_copy(apcopy, ap);
-			vfprintf(fp,string,apcopy);
-			va_end(apcopy);
-			fclose(fp);
+#ifndef MINICORE
+	if( showmsg_async_running ) {
+		if( !showmsg_async_push(flag, logtime, prefix, text, (size_t)len, logged, printed) ) {
+			// keep the order, write it after the queued messages
+			showmsg_async_flush();
+			ramutex_lock(showmsg_lock);
+			showmsg_output(flag, logtime, prefix, text, logged, printed, true);
+			ramutex_unlock(showmsg_lock);
 		}
-	} else {
-		FPRINTF(STDERR, CL_RED"[ERROR]"CL_RESET": DEBUGLOGPATH not defined!\n");
-		FFLUSH(STDERR);
+		if( text != sbuf )
+			StringBuf_Destroy(&dbuf);
+		return 0;
 	}
 #endif
 
+	showmsg_output(flag, logtime, prefix, text, logged, printed, true);
+	if( text != sbuf )
+		StringBuf_Destroy(&dbuf);
 	return 0;
 }
 
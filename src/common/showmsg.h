@@ -71,6 +71,9 @@ extern int stdout_with_ansisequence; //If the color ansi sequences are to be use
 extern int msg_silent; //Specifies how silent the console is. [Skotlex]
 extern int console_msg_log; //Specifies what error messages to log. [Ind]
 extern char timestamp_format[20]; //For displaying Timestamps [Skotlex]
+#ifndef MINICORE
+extern int console_msg_async; //If the console output is written by a separate thread.
+#endif
 
 enum msg_type {
 	MSG_NONE,
@@ -96,4 +99,9 @@ extern void ShowError(const char *, ...);
 extern void ShowFatalError(const char *, ...);
 extern void ShowConfigWarning(config_setting_t *config, const char *string, ...);
 
+#ifndef MINICORE
+extern void showmsg_async_init(void);
+extern void showmsg_async_final(void);
+#endif
+
 #endif /* _SHOWMSG_H_ */
@@ -7,6 +7,8 @@
 #include "../common/malloc.h"
 #include "../common/showmsg.h"
 #include "../common/strlib.h"
+#include "../common/ers.h"
+#include "../common/threadpool.h"
 #include "socket.h"
 
 #include <stdlib.h>
@@ -19,6 +21,7 @@
 	#include <net/if.h>
 	#include <unistd.h>
 #include <sys/ioctl.h>
+	#include <sys/uio.h>
 	#include <netdb.h>
 	#include <arpa/inet.h>
 
@@ -32,6 +35,10 @@
 	#ifdef HAVE_SETRLIMIT
 	#include <sys/resource.h>
 	#endif
+
+	#ifdef SOCKET_EPOLL
+	#include <sys/epoll.h>
+	#endif
 #endif
 
 /////////////////////////////////////////////////////////////////////
@@ -202,7 +209,15 @@ char* sErr(int code)
 	#define MSG_NOSIGNAL 0
 #endif
 
+#ifdef SOCKET_EPOLL
+// epoll instance and the buffer of events returned by epoll_wait
+static int epoll_fd = -1;
+static struct epoll_event* epoll_events = NULL;
+// Maximum number of events that are handled per call to do_sockets
+static int epoll_maxevents = 1024;
+#else
 fd_set readfds;
+#endif
 int fd_max;
 time_t last_tick;
 time_t stall_time = 60;
@@ -231,15 +246,60 @@ static time_t socket_data_last_tick = 0;
 // The connection is closed if it goes over the limit.
 #define WFIFO_MAX (1*1024*1024)
 
-struct socket_data* session[FD_SETSIZE];
+// Maximum number of write fifo chunks that are sent in one call.
+#define WFIFO_IOV_MAX 64
+
+/// Chunk of the write fifo that is waiting to be sent.
+/// When the buffer of a session runs out of space, it is queued as a chunk
+/// and a new buffer is started, so pending data is never moved around.
+/// Shared packets are queued as chunks that reference the packet data.
+struct wfifo_chunk {
+	struct wfifo_chunk* next;
+	uint8* data;
+	size_t pos;// bytes that were already sent
+	size_t size;// bytes in the chunk
+	uint8* buffer;// memory released with the chunk, NULL if the data is owned by someone else
+	struct shared_packet* shared;// shared packet referenced by the chunk
+};
+
+/// Packet that is queued on the write fifo of several sessions.
+/// Released when the last reference is dropped.
+struct shared_packet {
+	int refcount;
+	size_t len;
+	uint8* data;
+};
+
+static ERS wfifo_chunk_ers;
+
+/// Returns the number of bytes that are waiting to be sent.
+#define WFIFO_PENDING(s) ( (s)->wqueue_size + (s)->wdata_size - (s)->wdata_pos )
+
+struct socket_data* session[MAXCONN];
 
 #ifdef SEND_SHORTLIST
-int send_shortlist_array[FD_SETSIZE];// we only support FD_SETSIZE sockets, limit the array to that
+int send_shortlist_array[MAXCONN];// we only support MAXCONN sockets, limit the array to that
 int send_shortlist_count = 0;// how many fd's are in the shortlist
-uint32 send_shortlist_set[(FD_SETSIZE+31)/32];// to know if specific fd's are already in the shortlist
+uint32 send_shortlist_set[(MAXCONN+31)/32];// to know if specific fd's are already in the shortlist
 #endif
 
+// Sockets that need to be parsed: pending data, eof or stall handling.
+// Uses a static array like the send shortlist, so idle sessions are never visited.
+static int parse_shortlist_array[MAXCONN];
+static int parse_shortlist_count = 0;// how many fd's are in the shortlist
+static uint32 parse_shortlist_set[(MAXCONN+31)/32];// to know if specific fd's are already in the shortlist
+
+// Coarse timing wheel for stall detection, one slot per second.
+// Each slot holds a list of sessions (linked through timeout_prev/timeout_next)
+// that are due for a stall check at a tick that maps to that slot.
+#define TIMEOUT_WHEEL_SIZE 64
+static int timeout_wheel[TIMEOUT_WHEEL_SIZE];// first fd of each slot (zero when empty)
+static time_t timeout_wheel_tick;// last tick that was processed
+
 static int create_session(int fd, RecvFunc func_recv, SendFunc func_send, ParseFunc func_parse);
+static void parse_shortlist_add_fd(int fd);
+static void timeout_wheel_add(int fd, time_t tick);
+static void timeout_wheel_remove(int fd);
 
 #ifndef MINICORE
 	int ip_rules = 1;
@@ -330,9 +390,39 @@ void set_eof(int fd)
 		send_shortlist_add_fd(fd);
 #endif
 		session[fd]->flag.eof = 1;
+		parse_shortlist_add_fd(fd);
 	}
 }
 
+/// Starts watching the socket for incoming data (or connections).
+static void socket_watch(int fd)
+{
+#ifdef SOCKET_EPOLL
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	if( epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0 )
+		ShowError("socket_watch: Failed to add socket #%d to the epoll event dispatcher (%s)!\n", fd, error_msg());
+#else
+	sFD_SET(fd, &readfds);
+#endif
+}
+
+/// Stops watching the socket.
+/// Needs to be done before the socket is closed.
+static void socket_unwatch(int fd)
+{
+#ifdef SOCKET_EPOLL
+	struct epoll_event ev;// non-NULL for kernels older than 2.6.9
+
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, &ev);
+#else
+	sFD_CLR(fd, &readfds);
+#endif
+}
+
 int recv_to_fifo(int fd)
 {
 	int len;
@@ -359,6 +449,7 @@ int recv_to_fifo(int fd)
 
 	session[fd]->rdata_size += len;
 	session[fd]->rdata_tick = last_tick;
+	parse_shortlist_add_fd(fd);
 #ifdef SHOW_SERVER_STATS
 	socket_data_i += len;
 	socket_data_qi += len;
@@ -370,26 +461,177 @@ int recv_to_fifo(int fd)
 	return 0;
 }
 
+/// Releases a chunk of the write fifo and the data it holds.
+static void wfifo_chunk_free(struct wfifo_chunk* chunk)
+{
+	if( chunk->shared )
+		shared_packet_release(chunk->shared);
+	if( chunk->buffer )
+		aFree(chunk->buffer);
+	ers_free(wfifo_chunk_ers, chunk);
+}
+
+/// Appends a chunk to the write fifo queue.
+static struct wfifo_chunk* wfifo_chunk_push(struct socket_data* s, uint8* data, size_t pos, size_t size)
+{
+	struct wfifo_chunk* chunk = ers_alloc(wfifo_chunk_ers, struct wfifo_chunk);
+
+	chunk->next = NULL;
+	chunk->data = data;
+	chunk->pos  = pos;
+	chunk->size = size;
+	chunk->buffer = NULL;
+	chunk->shared = NULL;
+	if( s->wqueue_last )
+		s->wqueue_last->next = chunk;
+	else
+		s->wqueue = chunk;
+	s->wqueue_last = chunk;
+	s->wqueue_size += size - pos;
+	return chunk;
+}
+
+/// Frees all the data of the write fifo.
+static void wfifo_clear(struct socket_data* s)
+{
+	while( s->wqueue )
+	{
+		struct wfifo_chunk* chunk = s->wqueue;
+		s->wqueue = chunk->next;
+		wfifo_chunk_free(chunk);
+	}
+	s->wqueue_last = NULL;
+	s->wqueue_size = 0;
+	s->wdata_size = s->wdata_pos = 0;
+}
+
+/// Marks len bytes of the write fifo as sent.
+/// Chunks that were sent completely are released.
+static void wfifo_consume(struct socket_data* s, size_t len)
+{
+	while( s->wqueue )
+	{
+		struct wfifo_chunk* chunk = s->wqueue;
+		size_t n = min(len, chunk->size - chunk->pos);
+
+		chunk->pos += n;
+		s->wqueue_size -= n;
+		len -= n;
+		if( chunk->pos < chunk->size )
+			return;// partially sent
+
+		s->wqueue = chunk->next;
+		if( s->wqueue == NULL )
+			s->wqueue_last = NULL;
+		wfifo_chunk_free(chunk);
+	}
+
+	s->wdata_pos += len;
+	if( s->wdata_pos == s->wdata_size )
+		s->wdata_size = s->wdata_pos = 0;// everything was sent, reuse the buffer from the start
+}
+
 int send_from_fifo(int fd)
 {
+	struct socket_data* s;
 	int len;
 
 	if( !session_isValid(fd) )
 		return -1;
 
-	if( session[fd]->wdata_size == 0 )
+	s = session[fd];
+	if( WFIFO_PENDING(s) == 0 )
 		return 0; // nothing to send
 
-	len = sSend(fd, (const char *) session[fd]->wdata, (int)session[fd]->wdata_size, MSG_NOSIGNAL);
+#ifdef WIN32
+	{// no scatter/gather send, send the chunks one at a time until one is sent partially
+		struct wfifo_chunk* chunk = s->wqueue;
+		int sent = 0;
+
+		for(;;)
+		{
+			const uint8* buf;
+			size_t size;
+
+			if( chunk != NULL )
+			{
+				buf = chunk->data + chunk->pos;
+				size = chunk->size - chunk->pos;
+				chunk = chunk->next;
+			}
+			else if( s->wdata_size > s->wdata_pos )
+			{
+				buf = s->wdata + s->wdata_pos;
+				size = s->wdata_size - s->wdata_pos;
+			}
+			else
+				break;
+
+			len = sSend(fd, (const char *)buf, (int)size, MSG_NOSIGNAL);
+			if( len == SOCKET_ERROR )
+				break;
+			sent += len;
+			if( (size_t)len < size || buf == s->wdata + s->wdata_pos )
+				break;// partially sent or nothing else to send
+		}
+		if( sent > 0 )
+			len = sent;
+	}
+#else
+	{// send the chunks with one call, more calls are only needed when there are more than WFIFO_IOV_MAX chunks
+		struct iovec iov[WFIFO_IOV_MAX];
+		struct msghdr msg;
+		struct wfifo_chunk* chunk;
+		size_t size;
+		int n;
+
+		for(;;)
+		{
+			n = 0;
+			size = 0;
+			for( chunk = s->wqueue; chunk != NULL && n < WFIFO_IOV_MAX; chunk = chunk->next, ++n )
+			{
+				iov[n].iov_base = chunk->data + chunk->pos;
+				iov[n].iov_len = chunk->size - chunk->pos;
+				size += iov[n].iov_len;
+			}
+			if( n < WFIFO_IOV_MAX && s->wdata_size > s->wdata_pos )
+			{
+				iov[n].iov_base = s->wdata + s->wdata_pos;
+				iov[n].iov_len = s->wdata_size - s->wdata_pos;
+				size += iov[n].iov_len;
+				++n;
+			}
+
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_iov = iov;
+			msg.msg_iovlen = n;
+			len = (int)sendmsg(fd, &msg, MSG_NOSIGNAL);
+			if( len == SOCKET_ERROR || (size_t)len < size || WFIFO_PENDING(s) == size )
+				break;// failed, partially sent or nothing else to send
+
+			// the whole batch was sent, continue with the next one
+			wfifo_consume(s, (size_t)len);
+#ifdef SHOW_SERVER_STATS
+			socket_data_o += len;
+			socket_data_qo -= len;
+			if (!s->flag.server)
+			{
+				socket_data_co += len;
+			}
+#endif
+		}
+	}
+#endif
 
 	if( len == SOCKET_ERROR )
 	{//An exception has occured
 		if( sErrno != S_EWOULDBLOCK ) {
 			//ShowDebug("send_from_fifo: %s, ending connection #%d\n", error_msg(), fd);
 #ifdef SHOW_SERVER_STATS
-			socket_data_qo -= session[fd]->wdata_size;
+			socket_data_qo -= WFIFO_PENDING(s);
 #endif
-			session[fd]->wdata_size = 0; //Clear the send queue as we can't send anymore. [Skotlex]
+			wfifo_clear(s); //Clear the send queue as we can't send anymore. [Skotlex]
 			set_eof(fd);
 		}
 		return 0;
@@ -397,16 +639,12 @@ int send_from_fifo(int fd)
 
 	if( len > 0 )
 	{
-		// some data could not be transferred?
-		// shift unsent data to the beginning of the queue
-		if( (size_t)len < session[fd]->wdata_size )
-			memmove(session[fd]->wdata, session[fd]->wdata + len, session[fd]->wdata_size - len);
-
-		session[fd]->wdata_size -= len;
+		// release what was sent, unsent data stays where it is
+		wfifo_consume(s, (size_t)len);
 #ifdef SHOW_SERVER_STATS
 		socket_data_o += len;
 		socket_data_qo -= len;
-		if (!session[fd]->flag.server)
+		if (!s->flag.server)
 		{
 			socket_data_co += len;
 		}
@@ -452,9 +690,9 @@ int connect_client(int listen_fd)
 		sClose(fd);
 		return -1;
 	}
-	if( fd >= FD_SETSIZE )
+	if( fd >= MAXCONN )
 	{// socket number too big
-		ShowError("connect_client: New socket #%d is greater than can we handle! Increase the value of FD_SETSIZE (currently %d) for your OS to fix this!\n", fd, FD_SETSIZE);
+		ShowError("connect_client: New socket #%d is greater than can we handle! Increase the value of MAXCONN (currently %d) for your OS to fix this!\n", fd, MAXCONN);
 		sClose(fd);
 		return -1;
 	}
@@ -470,7 +708,7 @@ int connect_client(int listen_fd)
 #endif
 
 	if( fd_max <= fd ) fd_max = fd + 1;
-	sFD_SET(fd,&readfds);
+	socket_watch(fd);
 
 	create_session(fd, recv_to_fifo, send_from_fifo, default_func_parse);
 	session[fd]->client_addr = ntohl(client_address.sin_addr.s_addr);
@@ -497,9 +735,9 @@ int make_listen_bind(uint32 ip, uint16 port)
 		sClose(fd);
 		return -1;
 	}
-	if( fd >= FD_SETSIZE )
+	if( fd >= MAXCONN )
 	{// socket number too big
-		ShowError("make_listen_bind: New socket #%d is greater than can we handle! Increase the value of FD_SETSIZE (currently %d) for your OS to fix this!\n", fd, FD_SETSIZE);
+		ShowError("make_listen_bind: New socket #%d is greater than can we handle! Increase the value of MAXCONN (currently %d) for your OS to fix this!\n", fd, MAXCONN);
 		sClose(fd);
 		return -1;
 	}
@@ -523,7 +761,7 @@ int make_listen_bind(uint32 ip, uint16 port)
 	}
 
 	if(fd_max <= fd) fd_max = fd + 1;
-	sFD_SET(fd, &readfds);
+	socket_watch(fd);
 
 	create_session(fd, connect_client, null_send, null_parse);
 	session[fd]->client_addr = 0; // just listens
@@ -549,9 +787,9 @@ int make_connection(uint32 ip, uint16 port, bool silent,int timeout) {
 		sClose(fd);
 		return -1;
 	}
-	if( fd >= FD_SETSIZE )
+	if( fd >= MAXCONN )
 	{// socket number too big
-		ShowError("make_connection: New socket #%d is greater than can we handle! Increase the value of FD_SETSIZE (currently %d) for your OS to fix this!\n", fd, FD_SETSIZE);
+		ShowError("make_connection: New socket #%d is greater than can we handle! Increase the value of MAXCONN (currently %d) for your OS to fix this!\n", fd, MAXCONN);
 		sClose(fd);
 		return -1;
 	}
@@ -576,7 +814,7 @@ int make_connection(uint32 ip, uint16 port, bool silent,int timeout) {
 	set_nonblocking(fd, 1);
 
 	if (fd_max <= fd) fd_max = fd + 1;
-	sFD_SET(fd,&readfds);
+	socket_watch(fd);
 
 	create_session(fd, recv_to_fifo, send_from_fifo, default_func_parse);
 	session[fd]->client_addr = ntohl(remote_address.sin_addr.s_addr);
@@ -595,6 +833,7 @@ static int create_session(int fd, RecvFunc func_recv, SendFunc func_send, ParseF
 	session[fd]->func_send  = func_send;
 	session[fd]->func_parse = func_parse;
 	session[fd]->rdata_tick = last_tick;
+	timeout_wheel_add(fd, last_tick + stall_time + 1);
 	return 0;
 }
 
@@ -604,8 +843,10 @@ static void delete_session(int fd)
 	{
 #ifdef SHOW_SERVER_STATS
 		socket_data_qi -= session[fd]->rdata_size - session[fd]->rdata_pos;
-		socket_data_qo -= session[fd]->wdata_size;
+		socket_data_qo -= WFIFO_PENDING(session[fd]);
 #endif
+		timeout_wheel_remove(fd);
+		wfifo_clear(session[fd]);
 		aFree(session[fd]->rdata);
 		aFree(session[fd]->wdata);
 		aFree(session[fd]->session_data);
@@ -624,7 +865,7 @@ int realloc_fifo(int fd, unsigned int rfifo_size, unsigned int wfifo_size)
 		session[fd]->max_rdata  = rfifo_size;
 	}
 
-	if( session[fd]->max_wdata != wfifo_size && session[fd]->wdata_size < wfifo_size) {
+	if( session[fd]->max_wdata != wfifo_size && session[fd]->wdata_size < wfifo_size && session[fd]->wdata_pos == 0 ) {
 		RECREATE(session[fd]->wdata, unsigned char, wfifo_size);
 		session[fd]->max_wdata  = wfifo_size;
 	}
@@ -633,27 +874,48 @@ int realloc_fifo(int fd, unsigned int rfifo_size, unsigned int wfifo_size)
 
 int realloc_writefifo(int fd, size_t addition)
 {
+	struct socket_data* s;
 	size_t newsize;
 
 	if( !session_isValid(fd) ) // might not happen
 		return 0;
 
-	if( session[fd]->wdata_size + addition  > session[fd]->max_wdata )
-	{	// grow rule; grow in multiples of WFIFO_SIZE
+	s = session[fd];
+	if( s->wdata_size + addition  > s->max_wdata )
+	{
+		if( s->wdata_size > 0 )
+		{// queue the current buffer as a chunk and continue on a new one
+			size_t reserve = s->flag.server ? FIFOSIZE_SERVERLINK / 4 : WFIFO_SIZE;
+
+			wfifo_chunk_push(s, s->wdata, s->wdata_pos, s->wdata_size)->buffer = s->wdata;
+
+			// grow rule; new buffers hold twice the reserve, in multiples of WFIFO_SIZE
+			newsize = 2*reserve;
+			while( addition > newsize ) newsize += WFIFO_SIZE;
+
+			CREATE(s->wdata, unsigned char, newsize);
+			s->max_wdata = newsize;
+			s->wdata_size = s->wdata_pos = 0;
+			return 0;
+		}
+		// grow rule; grow in multiples of WFIFO_SIZE
 		newsize = WFIFO_SIZE;
-		while( session[fd]->wdata_size + addition > newsize ) newsize += WFIFO_SIZE;
+		while( s->wdata_size + addition > newsize ) newsize += WFIFO_SIZE;
 	}
 	else
-	if( session[fd]->max_wdata >= (size_t)2*(session[fd]->flag.server?FIFOSIZE_SERVERLINK:WFIFO_SIZE)
-		&& (session[fd]->wdata_size+addition)*4 < session[fd]->max_wdata )
+	if( s->wdata_size == 0
+		&& s->max_wdata >= (size_t)2*(s->flag.server?FIFOSIZE_SERVERLINK:WFIFO_SIZE)
+		&& addition*4 < s->max_wdata )
 	{	// shrink rule, shrink by 2 when only a quarter of the fifo is used, don't shrink below nominal size.
-		newsize = session[fd]->max_wdata / 2;
+		newsize = s->max_wdata / 2;
 	}
 	else // no change
 		return 0;
 
-	RECREATE(session[fd]->wdata, unsigned char, newsize);
-	session[fd]->max_wdata  = newsize;
+	// the buffer is empty, nothing to copy
+	aFree(s->wdata);
+	CREATE(s->wdata, unsigned char, newsize);
+	s->max_wdata  = newsize;
 
 	return 0;
 }
@@ -722,7 +984,7 @@ int WFIFOSET(int fd, size_t len)
 			return 0;
 		}
 
-		if( s->wdata_size+len > WFIFO_MAX ) {// reached maximum write fifo size
+		if( WFIFO_PENDING(s)+len > WFIFO_MAX ) {// reached maximum write fifo size
 			ShowError("WFIFOSET: Maximum write buffer size for client connection %d exceeded, most likely caused by packet 0x%04x (len=%u, ip=%lu.%lu.%lu.%lu).\n", fd, WFIFOW(fd,0), len, CONVIP(s->client_addr));
 			set_eof(fd);
 			return 0;
@@ -734,7 +996,7 @@ int WFIFOSET(int fd, size_t len)
 	socket_data_qo += len;
 #endif
 	//If the interserver has 200% of its normal size full, flush the data.
-	if( s->flag.server && s->wdata_size >= 2*FIFOSIZE_SERVERLINK )
+	if( s->flag.server && WFIFO_PENDING(s) >= 2*FIFOSIZE_SERVERLINK )
 		flush_fifo(fd);
 
 	// always keep a WFIFO_SIZE reserve in the buffer
@@ -751,12 +1013,242 @@ int WFIFOSET(int fd, size_t len)
 	return 0;
 }
 
+/// Creates a packet that can be queued on the write fifo of several sessions.
+/// The data is copied once, the caller holds the first reference.
+struct shared_packet* shared_packet_create(const void* buf, size_t len)
+{
+	struct shared_packet* sp = (struct shared_packet*)aMalloc(sizeof(struct shared_packet) + len);
+
+	sp->refcount = 1;
+	sp->len = len;
+	sp->data = (uint8*)(sp + 1);
+	memcpy(sp->data, buf, len);
+	return sp;
+}
+
+/// Drops a reference to the shared packet, it is freed when nobody uses it anymore.
+void shared_packet_release(struct shared_packet* sp)
+{
+	if( --sp->refcount == 0 )
+		aFree(sp);
+}
+
+/// Queues a shared packet on the write fifo of a session.
+/// Big packets are referenced instead of copied, small ones are copied like with WFIFOSET.
+int shared_packet_send(int fd, struct shared_packet* sp)
+{
+	struct socket_data* s;
+
+	if( !session_isValid(fd) || session[fd]->wdata == NULL )
+		return 0;
+
+	s = session[fd];
+	if( sp->len < SHARED_PACKET_MIN_SIZE )
+	{
+		WFIFOHEAD(fd, sp->len);
+		memcpy(WFIFOP(fd,0), sp->data, sp->len);
+		return WFIFOSET(fd, sp->len);
+	}
+
+	if( !s->flag.server ) {
+
+		if( sp->len > socket_max_client_packet ) {// see declaration of socket_max_client_packet for details
+			ShowError("shared_packet_send: Dropped too large client packet 0x%04x (length=%u, max=%u).\n", *(uint16*)sp->data, (unsigned int)sp->len, socket_max_client_packet);
+			return 0;
+		}
+
+		if( WFIFO_PENDING(s)+sp->len > WFIFO_MAX ) {// reached maximum write fifo size
+			ShowError("shared_packet_send: Maximum write buffer size for client connection %d exceeded, most likely caused by packet 0x%04x (len=%u, ip=%lu.%lu.%lu.%lu).\n", fd, *(uint16*)sp->data, (unsigned int)sp->len, CONVIP(s->client_addr));
+			set_eof(fd);
+			return 0;
+		}
+
+	}
+
+	// unsent data of the buffer goes first, it is queued as a chunk that borrows the buffer
+	// the buffer is kept until the queue is empty, new data is appended after it
+	if( s->wdata_size > s->wdata_pos )
+	{
+		wfifo_chunk_push(s, s->wdata, s->wdata_pos, s->wdata_size);
+		s->wdata_pos = s->wdata_size;
+	}
+
+	wfifo_chunk_push(s, sp->data, 0, sp->len)->shared = sp;
+	++sp->refcount;
+#ifdef SHOW_SERVER_STATS
+	socket_data_qo += sp->len;
+#endif
+	if( s->flag.server && WFIFO_PENDING(s) >= 2*FIFOSIZE_SERVERLINK )
+		flush_fifo(fd);
+
+#ifdef SEND_SHORTLIST
+	send_shortlist_add_fd(fd);
+#endif
+
+	return 0;
+}
+
+/// Adds a fd to the parse shortlist.
+static void parse_shortlist_add_fd(int fd)
+{
+	int i;
+	int bit;
+
+	if( !session_isValid(fd) )
+		return;// out of range
+
+	i = fd/32;
+	bit = fd%32;
+
+	if( (parse_shortlist_set[i]>>bit)&1 )
+		return;// already in the list
+
+	// set the bit
+	parse_shortlist_set[i] |= 1<<bit;
+	// Add to the end of the shortlist array.
+	parse_shortlist_array[parse_shortlist_count++] = fd;
+}
+
+/// Parses input data on the sockets of the shortlist.
+/// Sockets that still hold unparsed data after parsing stay in the shortlist.
+static void parse_shortlist_do_parse(void)
+{
+	int i;
+
+	for( i = parse_shortlist_count-1; i >= 0; --i )
+	{
+		int fd = parse_shortlist_array[i];
+
+		// Remove fd from shortlist, move the last fd to the current position
+		--parse_shortlist_count;
+		parse_shortlist_array[i] = parse_shortlist_array[parse_shortlist_count];
+		parse_shortlist_array[parse_shortlist_count] = 0;
+		parse_shortlist_set[fd/32] &= ~(1<<(fd%32));// unset fd
+
+		if( !session[fd] )
+			continue;
+
+		session[fd]->func_parse(fd);
+
+		if( !session[fd] )
+			continue;
+
+		// after parse, check client's RFIFO size to know if there is an invalid packet (too big and not parsed)
+		if( session[fd]->rdata_pos == 0 && session[fd]->rdata_size == RFIFO_SIZE && session[fd]->max_rdata == RFIFO_SIZE ) {
+			set_eof(fd);
+			continue;
+		}
+		RFIFOFLUSH(fd);
+
+		// Incomplete or deferred packets are parsed again in the next loop
+		if( session[fd]->rdata_size )
+			parse_shortlist_add_fd(fd);
+	}
+}
+
+/// Schedules a stall check for the session at the target tick.
+static void timeout_wheel_add(int fd, time_t tick)
+{
+	struct socket_data* s;
+	int slot;
+
+	if( !session_isValid(fd) )
+		return;
+
+	timeout_wheel_remove(fd);
+
+	s = session[fd];
+	slot = (int)(tick%TIMEOUT_WHEEL_SIZE);
+	s->timeout_tick = tick;
+	s->timeout_prev = 0;
+	s->timeout_next = timeout_wheel[slot];
+	if( timeout_wheel[slot] )
+		session[timeout_wheel[slot]]->timeout_prev = fd;
+	timeout_wheel[slot] = fd;
+}
+
+/// Removes the session from the timeout wheel.
+static void timeout_wheel_remove(int fd)
+{
+	struct socket_data* s = session[fd];
+
+	if( s->timeout_tick == 0 )
+		return;// not scheduled
+
+	if( s->timeout_prev )
+		session[s->timeout_prev]->timeout_next = s->timeout_next;
+	else
+		timeout_wheel[s->timeout_tick%TIMEOUT_WHEEL_SIZE] = s->timeout_next;
+	if( s->timeout_next )
+		session[s->timeout_next]->timeout_prev = s->timeout_prev;
+	s->timeout_tick = 0;
+	s->timeout_prev = s->timeout_next = 0;
+}
+
+/// Checks a session that reached its scheduled stall check.
+static void timeout_check(int fd)
+{
+	struct socket_data* s = session[fd];
+
+	if( s->rdata_tick == 0 )
+		return;// timeout is disabled
+
+	if( DIFF_TICK(last_tick, s->rdata_tick) <= stall_time )
+	{// received data since it was scheduled, check again when it can stall
+		timeout_wheel_add(fd, s->rdata_tick + stall_time + 1);
+		return;
+	}
+
+	if( s->flag.server ) {/* server is special */
+		if( s->flag.ping != 2 )/* only update if necessary otherwise it'd resend the ping unnecessarily */
+			s->flag.ping = 1;
+		// let the parse function handle the ping state every second until data is received
+		parse_shortlist_add_fd(fd);
+		timeout_wheel_add(fd, last_tick + 1);
+	} else {
+		ShowInfo("Session #%d timed out\n", fd);
+		set_eof(fd);
+	}
+}
+
+/// Processes the slots of the timeout wheel up to last_tick.
+static void timeout_wheel_do_checks(void)
+{
+	if( DIFF_TICK(last_tick, timeout_wheel_tick) > TIMEOUT_WHEEL_SIZE )
+		timeout_wheel_tick = last_tick - TIMEOUT_WHEEL_SIZE;// clock jumped, one round is enough
+	else if( DIFF_TICK(last_tick, timeout_wheel_tick) < 0 )
+		timeout_wheel_tick = last_tick;// clock went back
+
+	while( timeout_wheel_tick != last_tick )
+	{
+		int fd;
+
+		++timeout_wheel_tick;
+		fd = timeout_wheel[timeout_wheel_tick%TIMEOUT_WHEEL_SIZE];
+		while( fd )
+		{
+			int next = session[fd]->timeout_next;
+
+			if( DIFF_TICK(session[fd]->timeout_tick, last_tick) <= 0 )
+			{// due (entries of later rounds stay in the slot)
+				timeout_wheel_remove(fd);
+				timeout_check(fd);
+			}
+			fd = next;
+		}
+	}
+}
+
 int do_sockets(int next)
 {
+#ifndef SOCKET_EPOLL
 	fd_set rfd;
 	struct timeval timeout;
+#endif
 	int ret,i;
 
+	tickstat_phase(TICKSTAT_SEND);
+
 	// PRESEND Timers are executed before do_sendrecv and can send packets and/or set sessions to eof.
 	// Send remaining data and process client-side disconnects here.
 #ifdef SEND_SHORTLIST
@@ -767,11 +1259,44 @@ int do_sockets(int next)
 		if(!session[i])
 			continue;
 
-		if(session[i]->wdata_size)
+		if(WFIFO_PENDING(session[i]))
 			session[i]->func_send(i);
 	}
 #endif
 
+	tickstat_phase(TICKSTAT_WAIT);
+
+#ifdef SOCKET_EPOLL
+	// can timeout until the next tick
+	ret = epoll_wait(epoll_fd, epoll_events, epoll_maxevents, next);
+
+	if( ret == SOCKET_ERROR )
+	{
+		if( sErrno != S_EINTR )
+		{
+			ShowFatalError("do_sockets: epoll_wait() failed, %s!\n", error_msg());
+			exit(EXIT_FAILURE);
+		}
+		return 0; // interrupted by a signal, just loop and try again
+	}
+
+	last_tick = time(NULL);
+	tickstat_phase(TICKSTAT_RECV);
+
+	// only the sockets that have pending events are visited
+	for( i = 0; i < ret; ++i )
+	{
+		int fd = epoll_events[i].data.fd;
+
+		if( !session[fd] )
+			continue;
+
+		if( (epoll_events[i].events&(EPOLLERR|EPOLLHUP)) && !(epoll_events[i].events&EPOLLIN) )
+			set_eof(fd);// connection error without pending data
+		else
+			session[fd]->func_recv(fd);
+	}
+#else
 	// can timeout until the next tick
 	timeout.tv_sec  = next/1000;
 	timeout.tv_usec = next%1000*1000;
@@ -790,6 +1315,7 @@ int do_sockets(int next)
 	}
 
 	last_tick = time(NULL);
+	tickstat_phase(TICKSTAT_RECV);
 
 #if defined(WIN32)
 	// on windows, enumerating all members of the fd_set is way faster if we access the internals
@@ -810,6 +1336,9 @@ int do_sockets(int next)
 		}
 	}
 #endif
+#endif // SOCKET_EPOLL
+
+	tickstat_phase(TICKSTAT_SEND);
 
 	// POSTSEND Send remaining data and handle eof sessions.
 #ifdef SEND_SHORTLIST
@@ -820,7 +1349,7 @@ int do_sockets(int next)
 		if(!session[i])
 			continue;
 
-		if(session[i]->wdata_size)
+		if(WFIFO_PENDING(session[i]))
 			session[i]->func_send(i);
 
 		if(session[i]->flag.eof) //func_send can't free a session, this is safe.
@@ -830,34 +1359,13 @@ int do_sockets(int next)
 	}
 #endif
 
-	// parse input data on each socket
-	for(i = 1; i < fd_max; i++)
-	{
-		if(!session[i])
-			continue;
-
-		if (session[i]->rdata_tick && DIFF_TICK(last_tick, session[i]->rdata_tick) > stall_time) {
-			if( session[i]->flag.server ) {/* server is special */
-				if( session[i]->flag.ping != 2 )/* only update if necessary otherwise it'd resend the ping unnecessarily */
-					session[i]->flag.ping = 1;
-			} else {
-				ShowInfo("Session #%d timed out\n", i);
-				set_eof(i);
-			}
-		}
-
-		session[i]->func_parse(i);
+	tickstat_phase(TICKSTAT_PARSE);
 
-		if(!session[i])
-			continue;
+	// check the sessions that are due for a stall check
+	timeout_wheel_do_checks();
 
-		// after parse, check client's RFIFO size to know if there is an invalid packet (too big and not parsed)
-		if (session[i]->rdata_size == RFIFO_SIZE && session[i]->max_rdata == RFIFO_SIZE) {
-			set_eof(i);
-			continue;
-		}
-		RFIFOFLUSH(i);
-	}
+	// parse input data on sockets that have pending data, eof or stall handling
+	parse_shortlist_do_parse();
 
 #ifdef SHOW_SERVER_STATS
 	if (last_tick != socket_data_last_tick)
@@ -1140,7 +1648,20 @@ int socket_config_read(const char* cfgName)
 			if( stall_time < 3 )
 				stall_time = 3;/* a minimum is required to refrain it from killing itself */
 		}
+		else if (!strcmpi(w1, "slow_tick_threshold"))
+			tickstat_set_threshold(atoi(w2));
+		else if (!strcmpi(w1, "tick_report_interval"))
+			tickstat_set_report_interval(atoi(w2));
+		else if (!strcmpi(w1, "epoll_maxevents")) {
+#ifdef SOCKET_EPOLL
+			epoll_maxevents = atoi(w2);
+			if( epoll_maxevents < 16 )
+				epoll_maxevents = 16;
+#endif
+		}
 #ifndef MINICORE
+		else if (!strcmpi(w1, "worker_threads"))
+			threadpool_set_workers(atoi(w2));
 		else if (!strcmpi(w1, "enable_ip_rules")) {
 			ip_rules = config_switch(w2);
 		} else if (!strcmpi(w1, "order")) {
@@ -1216,16 +1737,29 @@ void socket_final(void)
 	aFree(session[0]->session_data);
 	aFree(session[0]);
 	session[0] = NULL;
+
+	ers_destroy(wfifo_chunk_ers);
+
+#ifdef SOCKET_EPOLL
+	if( epoll_fd != -1 )
+	{
+		close(epoll_fd);
+		epoll_fd = -1;
+	}
+	if( epoll_events )
+		aFree(epoll_events);
+	epoll_events = NULL;
+#endif
 }
 
 /// Closes a socket.
 void do_close(int fd)
 {
-	if( fd <= 0 ||fd >= FD_SETSIZE )
+	if( fd <= 0 ||fd >= MAXCONN )
 		return;// invalid
 
 	flush_fifo(fd); // Try to send what's left (although it might not succeed since it's a nonblocking socket)
-	sFD_CLR(fd, &readfds);// this needs to be done before closing the socket
+	socket_unwatch(fd);// this needs to be done before closing the socket
 	sShutdown(fd, SHUT_RDWR); // Disallow further reads/writes
 	sClose(fd); // We don't really care if these closing functions return an error, we are just shutting down and not reusing this socket.
 	if (session[fd]) delete_session(fd);
@@ -1320,7 +1854,7 @@ int socket_getips(uint32* ips, int max)
 void socket_init(void)
 {
 	char *SOCKET_CONF_FILENAME = "conf/packet_athena.conf";
-	unsigned int rlim_cur = FD_SETSIZE;
+	unsigned int rlim_cur = MAXCONN;
 
 #ifdef WIN32
 	{// Start up windows networking
@@ -1340,14 +1874,14 @@ void socket_init(void)
 #elif defined(HAVE_SETRLIMIT) && !defined(CYGWIN)
 	// NOTE: getrlimit and setrlimit have bogus behaviour in cygwin.
 	//       "Number of fds is virtually unlimited in cygwin" (sys/param.h)
-	{// set socket limit to FD_SETSIZE
+	{// set socket limit to MAXCONN
 		struct rlimit rlp;
 		if( 0 == getrlimit(RLIMIT_NOFILE, &rlp) )
 		{
-			rlp.rlim_cur = FD_SETSIZE;
+			rlp.rlim_cur = MAXCONN;
 			if( 0 != setrlimit(RLIMIT_NOFILE, &rlp) )
 			{// failed, try setting the maximum too (permission to change system limits is required)
-				rlp.rlim_max = FD_SETSIZE;
+				rlp.rlim_max = MAXCONN;
 				if( 0 != setrlimit(RLIMIT_NOFILE, &rlp) )
 				{// failed
 					const char *errmsg = error_msg();
@@ -1360,7 +1894,7 @@ void socket_init(void)
 					// report limit
 					getrlimit(RLIMIT_NOFILE, &rlp);
 					rlim_cur = rlp.rlim_cur;
-					ShowWarning("socket_init: failed to set socket limit to %d, setting to maximum allowed (original limit=%d, current limit=%d, maximum allowed=%d, %s).\n", FD_SETSIZE, rlim_ori, (int)rlp.rlim_cur, (int)rlp.rlim_max, errmsg);
+					ShowWarning("socket_init: failed to set socket limit to %d, setting to maximum allowed (original limit=%d, current limit=%d, maximum allowed=%d, %s).\n", MAXCONN, rlim_ori, (int)rlp.rlim_cur, (int)rlp.rlim_max, errmsg);
 				}
 			}
 		}
@@ -1370,15 +1904,32 @@ void socket_init(void)
 	// Get initial local ips
 	naddr_ = socket_getips(addr_,16);
 
-	sFD_ZERO(&readfds);
 #if defined(SEND_SHORTLIST)
 	memset(send_shortlist_set, 0, sizeof(send_shortlist_set));
 #endif
+	memset(parse_shortlist_set, 0, sizeof(parse_shortlist_set));
+	memset(timeout_wheel, 0, sizeof(timeout_wheel));
 
 	socket_config_read(SOCKET_CONF_FILENAME);
 
+#ifdef SOCKET_EPOLL
+	// Create the epoll instance and the buffer for the events it reports
+	epoll_fd = epoll_create(MAXCONN);// size is only a hint (ignored since 2.6.8)
+	if( epoll_fd == -1 )
+	{
+		ShowFatalError("socket_init: Failed to create the epoll event dispatcher (%s)!\n", error_msg());
+		exit(EXIT_FAILURE);
+	}
+	CREATE(epoll_events, struct epoll_event, epoll_maxevents);
+#else
+	sFD_ZERO(&readfds);
+#endif
+
 	// initialise last send-receive tick
 	last_tick = time(NULL);
+	timeout_wheel_tick = last_tick;
+
+	wfifo_chunk_ers = ers_new(sizeof(struct wfifo_chunk),"socket.c::wfifo_chunk_ers",ERS_OPT_NONE);
 
 	// session[0] is now currently used for disconnected sessions of the map server, and as such,
 	// should hold enough buffer (it is a vacuum so to speak) as it is never flushed. [Skotlex]
@@ -1391,13 +1942,16 @@ void socket_init(void)
 	add_timer_interval(gettick()+1000, connect_check_clear, 0, 0, 5*60*1000);
 #endif
 
+#ifdef SOCKET_EPOLL
+	ShowInfo("Server uses '"CL_WHITE"epoll"CL_RESET"' to wait for network events (max '"CL_WHITE"%d"CL_RESET"' events per loop).\n", epoll_maxevents);
+#endif
 	ShowInfo("Server supports up to '"CL_WHITE"%u"CL_RESET"' concurrent connections.\n", rlim_cur);
 }
 
 
 bool session_isValid(int fd)
 {
-	return ( fd > 0 && fd < FD_SETSIZE && session[fd] != NULL );
+	return ( fd > 0 && fd < MAXCONN && session[fd] != NULL );
 }
 
 bool session_isActive(int fd)
@@ -1479,7 +2033,7 @@ void send_shortlist_do_sends()
 		send_shortlist_array[i] = send_shortlist_array[send_shortlist_count];
 		send_shortlist_array[send_shortlist_count] = 0;
 
-		if( fd <= 0 || fd >= FD_SETSIZE )
+		if( fd <= 0 || fd >= MAXCONN )
 		{
 			ShowDebug("send_shortlist_do_sends: fd is out of range, corrupted memory? (fd=%d)\n", fd);
 			continue;
@@ -1495,7 +2049,7 @@ void send_shortlist_do_sends()
 		if( session[fd] )
 		{
 			// Send data
-			if( session[fd]->wdata_size )
+			if( WFIFO_PENDING(session[fd]) )
 				session[fd]->func_send(fd);
 
 			// If it's been marked as eof, call the parse func on it so that
@@ -1505,7 +2059,7 @@ void send_shortlist_do_sends()
 
 			// If the session still exists, is not eof and has things left to
 			// be sent from it we'll re-add it to the shortlist.
-			if( session[fd] && !session[fd]->flag.eof && session[fd]->wdata_size )
+			if( session[fd] && !session[fd]->flag.eof && WFIFO_PENDING(session[fd]) )
 				send_shortlist_add_fd(fd);
 		}
 	}
@@ -17,6 +17,25 @@
 
 #include <time.h>
 
+/// Use epoll() instead of select() to wait for network events (Linux only).
+/// Only the sockets that are ready are visited and the number of sockets is
+/// bound by MAXCONN instead of FD_SETSIZE.
+/// Enabled with --enable-epoll (configure) or ENABLE_EPOLL (cmake).
+#ifdef SOCKET_EPOLL
+	#ifdef WIN32
+		#error "SOCKET_EPOLL is not supported on windows"
+	#endif
+	#ifndef MAXCONN
+		#define MAXCONN 16384
+	#endif
+#else
+	// select() can't handle sockets past FD_SETSIZE
+	#ifdef MAXCONN
+		#undef MAXCONN
+	#endif
+	#define MAXCONN FD_SETSIZE
+#endif
+
 #define FIFOSIZE_SERVERLINK 256*1024
 
 // socket I/O macros
@@ -37,11 +56,12 @@
 #define WFIFOSPACE(fd) (session[fd]->max_wdata - session[fd]->wdata_size)
 
 #define RFIFOREST(fd)  (session[fd]->flag.eof ? 0 : session[fd]->rdata_size - session[fd]->rdata_pos)
+// Unparsed data is only moved to the beginning of the buffer when less than a quarter of it is left free.
 #define RFIFOFLUSH(fd) \
 	do { \
 		if(session[fd]->rdata_size == session[fd]->rdata_pos){ \
 			session[fd]->rdata_size = session[fd]->rdata_pos = 0; \
-		} else { \
+		} else if(session[fd]->rdata_pos && RFIFOSPACE(fd) < session[fd]->max_rdata/4) { \
 			session[fd]->rdata_size -= session[fd]->rdata_pos; \
 			memmove(session[fd]->rdata, session[fd]->rdata+session[fd]->rdata_pos, session[fd]->rdata_size); \
 			session[fd]->rdata_pos = 0; \
@@ -67,6 +87,7 @@
 
 
 // Struct declaration
+struct wfifo_chunk;
 typedef int (*RecvFunc)(int fd);
 typedef int (*SendFunc)(int fd);
 typedef int (*ParseFunc)(int fd);
@@ -85,7 +106,12 @@ struct socket_data
 	size_t max_rdata, max_wdata;
 	size_t rdata_size, wdata_size;
 	size_t rdata_pos;
+	size_t wdata_pos; // bytes of wdata that were already sent
+	struct wfifo_chunk *wqueue, *wqueue_last; // full chunks of the write fifo that are waiting to be sent, wdata is the last one
+	size_t wqueue_size; // bytes waiting to be sent in wqueue
 	time_t rdata_tick; // time of last recv (for detecting timeouts); zero when timeout is disabled
+	time_t timeout_tick; // time of the next stall check in the timeout wheel
+	int timeout_prev, timeout_next; // neighbours in the timeout wheel slot (zero when none)
 
 	RecvFunc func_recv;
 	SendFunc func_send;
@@ -97,7 +123,7 @@ struct socket_data
 
 // Data prototype declaration
 
-extern struct socket_data* session[FD_SETSIZE];
+extern struct socket_data* session[MAXCONN];
 
 extern int fd_max;
 
@@ -119,6 +145,16 @@ int realloc_writefifo(int fd, size_t addition);
 int WFIFOSET(int fd, size_t len);
 int RFIFOSKIP(int fd, size_t len);
 
+// Shared packets, for sending the same packet to several sessions
+// Minimum size of a shared packet to be queued without being copied.
+// Smaller packets are cheaper to copy than to queue as a separate chunk,
+// senders should copy them to each session without a shared packet.
+#define SHARED_PACKET_MIN_SIZE 128
+struct shared_packet;
+struct shared_packet* shared_packet_create(const void* buf, size_t len);
+int shared_packet_send(int fd, struct shared_packet* sp);
+void shared_packet_release(struct shared_packet* sp);
+
 int do_sockets(int next);
 void do_close(int fd);
 void socket_init(void);
@@ -2,9 +2,11 @@
 // For more information, see LICENCE in the main folder
 
 #include "../common/cbasetypes.h"
+#include "../common/db.h"
 #include "../common/malloc.h"
 #include "../common/showmsg.h"
 #include "../common/strlib.h"
+#include "../common/threadpool.h"
 #include "../common/timer.h"
 #include "sql.h"
 
@@ -30,6 +32,7 @@ struct Sql
 	MYSQL_ROW row;
 	unsigned long* lengths;
 	int keepalive;
+	DBMap* stmts;// statement cache (query -> SqlStmt*)
 };
 
 
@@ -57,6 +60,9 @@ struct SqlStmt
 	size_t max_columns;
 	bool bind_params;
 	bool bind_columns;
+	Sql* sql;
+	bool cached;// owned by the statement cache of sql
+	unsigned long thread_id;// connection the statement was prepared on (cached statements)
 };
 
 
@@ -79,6 +85,7 @@ Sql* Sql_Malloc(void)
 	self->result = NULL;
 	self->keepalive = INVALID_TIMER;
 	self->handle.reconnect = 1;
+	self->stmts = NULL;
 	return self;
 }
 
@@ -421,11 +428,26 @@ void Sql_ShowDebug_(Sql* self, const char* debug_file, const unsigned long debug
 
 
 
+static void SqlStmt_P_Free(SqlStmt* self);
+
+/// Frees a cached statement.
+///
+/// @private
+static int Sql_P_FreeCachedStmt(DBKey key, DBData* data, va_list ap)
+{
+	SqlStmt_P_Free((SqlStmt*)db_data2ptr(data));
+	return 0;
+}
+
+
+
 /// Frees a Sql handle returned by Sql_Malloc.
 void Sql_Free(Sql* self)
 {
 	if( self )
 	{
+		if( self->stmts )
+			self->stmts->destroy(self->stmts, Sql_P_FreeCachedStmt);
 		Sql_FreeResult(self);
 		StringBuf_Destroy(&self->buf);
 		if( self->keepalive != INVALID_TIMER ) delete_timer(self->keepalive, Sql_P_KeepaliveTimer);
@@ -623,12 +645,95 @@ SqlStmt* SqlStmt_Malloc(Sql* sql)
 	self->max_columns = 0;
 	self->bind_params = false;
 	self->bind_columns = false;
+	self->sql = sql;
+	self->cached = false;
+	self->thread_id = 0;
 
 	return self;
 }
 
 
 
+/// Prepares the text of the statement again, on the current connection.
+///
+/// @private
+static int SqlStmt_P_Reprepare(SqlStmt* self)
+{
+	MYSQL_STMT* stmt;
+
+	mysql_stmt_close(self->stmt);
+	stmt = mysql_stmt_init(&self->sql->handle);
+	if( stmt == NULL )
+	{// prepared again on the next lookup
+		ShowSQL("DB error - %s\n", mysql_error(&self->sql->handle));
+		self->stmt = NULL;
+		self->thread_id = 0;
+		return SQL_ERROR;
+	}
+	self->stmt = stmt;
+	self->thread_id = mysql_thread_id(&self->sql->handle);
+	if( mysql_stmt_prepare(self->stmt, StringBuf_Value(&self->buf), (unsigned long)StringBuf_Length(&self->buf)) )
+	{
+		ShowSQL("DB error - %s\n", mysql_stmt_error(self->stmt));
+		ra_mysql_error_handler(mysql_stmt_errno(self->stmt));
+		return SQL_ERROR;
+	}
+	return SQL_SUCCESS;
+}
+
+
+
+/// Returns the cached prepared statement of a query.
+SqlStmt* Sql_PrepareCached(Sql* self, const char* query, ...)
+{
+	SqlStmt* stmt;
+	StringBuf buf;
+	va_list args;
+
+	if( self == NULL )
+		return NULL;
+
+	if( self->stmts == NULL )
+		self->stmts = strdb_alloc(DB_OPT_DUP_KEY, 0);// the copied keys are freed with the entries
+
+	StringBuf_Init(&buf);
+	va_start(args, query);
+	StringBuf_Vprintf(&buf, query, args);
+	va_end(args);
+
+	stmt = (SqlStmt*)strdb_get(self->stmts, StringBuf_Value(&buf));
+	if( stmt == NULL )
+	{
+		stmt = SqlStmt_Malloc(self);
+		if( stmt == NULL || SQL_ERROR == SqlStmt_PrepareStr(stmt, StringBuf_Value(&buf)) )
+		{
+			SqlStmt_Free(stmt);
+			StringBuf_Destroy(&buf);
+			return NULL;
+		}
+		stmt->cached = true;
+		stmt->thread_id = mysql_thread_id(&self->handle);
+		strdb_put(self->stmts, StringBuf_Value(&buf), stmt);
+	}
+	else if( stmt->thread_id != mysql_thread_id(&self->handle) )
+	{// reconnected since it was prepared, the server forgot the statement
+		SqlStmt_FreeResult(stmt);
+		if( SQL_ERROR == SqlStmt_P_Reprepare(stmt) )
+		{
+			strdb_remove(self->stmts, StringBuf_Value(&buf));
+			SqlStmt_P_Free(stmt);
+			StringBuf_Destroy(&buf);
+			return NULL;
+		}
+		stmt->bind_params = false;
+	}
+	StringBuf_Destroy(&buf);
+
+	return stmt;
+}
+
+
+
 /// Prepares the statement.
 int SqlStmt_Prepare(SqlStmt* self, const char* query, ...)
 {
@@ -732,17 +837,27 @@ int SqlStmt_BindParam(SqlStmt* self, size_t idx, enum SqlDataType buffer_type, v
 /// Executes the prepared statement.
 int SqlStmt_Execute(SqlStmt* self)
 {
-	if( self == NULL )
+	if( self == NULL || self->stmt == NULL )
 		return SQL_ERROR;
 
 	SqlStmt_FreeResult(self);
 	if( (self->bind_params && mysql_stmt_bind_param(self->stmt, self->params)) ||
 		mysql_stmt_execute(self->stmt) )
 	{
+		if( self->cached && self->thread_id != mysql_thread_id(&self->sql->handle) )
+		{// the connection was reestablished, prepare it again on the new one and retry once
+			if( SQL_SUCCESS == SqlStmt_P_Reprepare(self) &&
+				!(self->bind_params && mysql_stmt_bind_param(self->stmt, self->params)) &&
+				!mysql_stmt_execute(self->stmt) )
+				goto executed;
+			if( self->stmt == NULL )
+				return SQL_ERROR;
+		}
 		ShowSQL("DB error - %s\n", mysql_stmt_error(self->stmt));
 		ra_mysql_error_handler(mysql_stmt_errno(self->stmt));
 		return SQL_ERROR;
 	}
+executed:
 	self->bind_columns = false;
 	if( mysql_stmt_store_result(self->stmt) )// store all the data
 	{
@@ -756,6 +871,34 @@ int SqlStmt_Execute(SqlStmt* self)
 
 
 
+/// Sets a parameter of SqlStmt_ExecuteParams.
+void SqlParam_Set(struct SqlParam* self, enum SqlDataType type, void* buffer, size_t length)
+{
+	self->type = type;
+	self->buffer = buffer;
+	self->length = length;
+}
+
+
+
+/// Binds the parameters and executes the prepared statement.
+int SqlStmt_ExecuteParams(SqlStmt* self, const struct SqlParam* params, size_t count)
+{
+	size_t i;
+
+	if( self == NULL )
+		return SQL_ERROR;
+
+	for( i = 0; i < count; ++i )
+	{
+		if( SQL_ERROR == SqlStmt_BindParam(self, i, params[i].type, params[i].buffer, params[i].length) )
+			return SQL_ERROR;
+	}
+	return SqlStmt_Execute(self);
+}
+
+
+
 /// Returns the number of the AUTO_INCREMENT column of the last INSERT/UPDATE statement.
 uint64 SqlStmt_LastInsertId(SqlStmt* self)
 {
@@ -929,7 +1072,7 @@ int SqlStmt_NextRow(SqlStmt* self)
 /// Frees the result of the statement execution.
 void SqlStmt_FreeResult(SqlStmt* self)
 {
-	if( self )
+	if( self && self->stmt )
 		mysql_stmt_free_result(self->stmt);
 }
 
@@ -948,14 +1091,17 @@ void SqlStmt_ShowDebug_(SqlStmt* self, const char* debug_file, const unsigned lo
 
 
 
-/// Frees a SqlStmt returned by SqlStmt_Malloc.
-void SqlStmt_Free(SqlStmt* self)
+/// Frees a SqlStmt.
+///
+/// @private
+static void SqlStmt_P_Free(SqlStmt* self)
 {
 	if( self )
 	{
 		SqlStmt_FreeResult(self);
 		StringBuf_Destroy(&self->buf);
-		mysql_stmt_close(self->stmt);
+		if( self->stmt )
+			mysql_stmt_close(self->stmt);
 		if( self->params )
 			aFree(self->params);
 		if( self->columns )
@@ -969,6 +1115,695 @@ void SqlStmt_Free(SqlStmt* self)
 
 
 
+/// Frees a SqlStmt returned by SqlStmt_Malloc.
+/// Cached statements stay in the cache, only their result is freed.
+void SqlStmt_Free(SqlStmt* self)
+{
+	if( self && self->cached )
+		SqlStmt_FreeResult(self);
+	else
+		SqlStmt_P_Free(self);
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Asynchronous queries
+///////////////////////////////////////////////////////////////////////////////
+
+
+
+/// Connection of a worker thread
+struct SqlAsyncConn
+{
+	MYSQL handle;
+	bool connected;
+};
+
+
+
+/// Asynchronous Sql handle
+struct SqlAsync
+{
+	char* user;
+	char* passwd;
+	char* host;
+	char* db;
+	char* encoding;
+	uint16 port;
+	struct SqlAsyncConn* conns;// one per worker, allocated on the first execution
+	int max_conns;
+	int pending;
+	bool release;// free after the last pending statement
+};
+
+
+
+/// Asynchronous Sql statement
+struct SqlAsyncStmt
+{
+	SqlAsync* sql;
+	StringBuf buf;
+	bool prepared;// has parameter markers, executed as a prepared statement
+	MYSQL_BIND* params;
+	size_t max_params;
+	SqlAsyncProc callback;
+	void* data;
+	// result, written by the worker (malloc/free, not aMalloc/aFree)
+	int result;
+	unsigned int error_code;
+	char error[256];
+	uint64 insert_id;
+	uint64 affected_rows;
+	uint32 num_columns;
+	uint64 num_rows;
+	char** rows;// num_rows*num_columns values
+	unsigned long* lengths;
+	uint64 next_row;
+	char** row;
+	unsigned long* row_lengths;
+};
+
+
+
+/// Allocates a new asynchronous Sql handle.
+SqlAsync* SqlAsync_Create(const char* user, const char* passwd, const char* host, uint16 port, const char* db, const char* encoding)
+{
+	SqlAsync* self;
+
+	CREATE(self, SqlAsync, 1);
+	self->user = aStrdup(user);
+	self->passwd = aStrdup(passwd);
+	self->host = aStrdup(host);
+	self->db = aStrdup(db);
+	self->encoding = ( encoding && *encoding ) ? aStrdup(encoding) : NULL;
+	self->port = port;
+	self->conns = NULL;
+	self->max_conns = 0;
+	self->pending = 0;
+	self->release = false;
+	return self;
+}
+
+
+
+/// Returns the number of submitted statements whose callback was not called yet.
+int SqlAsync_Pending(SqlAsync* self)
+{
+	return self ? self->pending : 0;
+}
+
+
+
+/// Closes the connections and frees the handle.
+///
+/// @private
+static void SqlAsync_P_Destroy(SqlAsync* self)
+{
+	int i;
+
+	for( i = 0; i < self->max_conns; ++i )
+		mysql_close(&self->conns[i].handle);
+	if( self->conns )
+		aFree(self->conns);
+	aFree(self->user);
+	aFree(self->passwd);
+	aFree(self->host);
+	aFree(self->db);
+	if( self->encoding )
+		aFree(self->encoding);
+	aFree(self);
+}
+
+
+
+/// Frees an asynchronous Sql handle returned by SqlAsync_Create.
+void SqlAsync_Free(SqlAsync* self)
+{
+	if( self == NULL )
+		return;
+	self->release = true;
+	if( self->pending == 0 )
+		SqlAsync_P_Destroy(self);
+}
+
+
+
+/// Submits a query.
+int SqlAsync_Query(SqlAsync* self, uint32 key, SqlAsyncProc callback, void* data, const char* query, ...)
+{
+	SqlAsyncStmt* stmt;
+	va_list args;
+
+	stmt = SqlAsyncStmt_Malloc(self);
+	if( stmt == NULL )
+		return SQL_ERROR;
+
+	va_start(args, query);
+	StringBuf_Vprintf(&stmt->buf, query, args);
+	va_end(args);
+
+	if( SQL_ERROR == SqlAsyncStmt_Execute(stmt, key, callback, data) )
+	{
+		SqlAsyncStmt_Free(stmt);
+		return SQL_ERROR;
+	}
+	return SQL_SUCCESS;
+}
+
+
+
+/// Allocates a new asynchronous statement.
+SqlAsyncStmt* SqlAsyncStmt_Malloc(SqlAsync* sql)
+{
+	SqlAsyncStmt* self;
+
+	if( sql == NULL )
+		return NULL;
+
+	CREATE(self, SqlAsyncStmt, 1);
+	self->sql = sql;
+	StringBuf_Init(&self->buf);
+	self->prepared = false;
+	self->params = NULL;
+	self->max_params = 0;
+	self->result = SQL_SUCCESS;
+	self->error_code = 0;
+	self->error[0] = '\0';
+	self->rows = NULL;
+	self->lengths = NULL;
+	self->row = NULL;
+	self->row_lengths = NULL;
+	return self;
+}
+
+
+
+/// Sets the statement, with parameter markers.
+int SqlAsyncStmt_Prepare(SqlAsyncStmt* self, const char* query, ...)
+{
+	va_list args;
+
+	if( self == NULL )
+		return SQL_ERROR;
+
+	StringBuf_Clear(&self->buf);
+	va_start(args, query);
+	StringBuf_Vprintf(&self->buf, query, args);
+	va_end(args);
+	self->prepared = true;
+	return SQL_SUCCESS;
+}
+
+
+
+/// Sets the statement, without parameter markers.
+int SqlAsyncStmt_PrepareQuery(SqlAsyncStmt* self, const char* query, ...)
+{
+	va_list args;
+
+	if( self == NULL )
+		return SQL_ERROR;
+
+	StringBuf_Clear(&self->buf);
+	va_start(args, query);
+	StringBuf_Vprintf(&self->buf, query, args);
+	va_end(args);
+	self->prepared = false;
+	return SQL_SUCCESS;
+}
+
+
+
+/// Binds a copy of the data to a parameter.
+int SqlAsyncStmt_BindParam(SqlAsyncStmt* self, size_t idx, enum SqlDataType buffer_type, void* buffer, size_t buffer_len)
+{
+	MYSQL_BIND* bind;
+	void* copy;
+
+	if( self == NULL )
+		return SQL_ERROR;
+
+	if( idx >= self->max_params )
+	{// grow the bindings, unbound parameters are NULL
+		size_t i;
+
+		RECREATE(self->params, MYSQL_BIND, idx+1);
+		memset(self->params+self->max_params, 0, (idx+1-self->max_params)*sizeof(MYSQL_BIND));
+		for( i = self->max_params; i <= idx; ++i )
+			self->params[i].buffer_type = MYSQL_TYPE_NULL;
+		self->max_params = idx+1;
+	}
+
+	bind = &self->params[idx];
+	if( bind->buffer )
+		aFree(bind->buffer);
+	if( SQL_ERROR == Sql_P_BindSqlDataType(bind, buffer_type, buffer, buffer_len, NULL, NULL) )
+	{
+		memset(bind, 0, sizeof(MYSQL_BIND));
+		bind->buffer_type = MYSQL_TYPE_NULL;
+		return SQL_ERROR;
+	}
+	copy = aMalloc(bind->buffer_length + 1);
+	if( bind->buffer_length > 0 )
+		memcpy(copy, buffer, bind->buffer_length);
+	bind->buffer = copy;
+	return SQL_SUCCESS;
+}
+
+
+
+/// Records an error (worker thread).
+///
+/// @private
+static void SqlAsyncStmt_P_SetError(SqlAsyncStmt* self, unsigned int error_code, const char* error)
+{
+	self->result = SQL_ERROR;
+	self->error_code = error_code;
+	safestrncpy(self->error, error, sizeof(self->error));
+}
+
+
+
+/// Allocates the result (worker thread).
+///
+/// @private
+static void SqlAsyncStmt_P_AllocRows(SqlAsyncStmt* self, uint32 num_columns, uint64 num_rows)
+{
+	size_t count = (size_t)(num_columns*num_rows);
+
+	self->num_columns = num_columns;
+	self->num_rows = num_rows;
+	if( count > 0 )
+	{
+		self->rows = (char**)calloc(count, sizeof(char*));
+		self->lengths = (unsigned long*)calloc(count, sizeof(unsigned long));
+	}
+}
+
+
+
+/// Copies a value of the result (worker thread).
+///
+/// @private
+static void SqlAsyncStmt_P_SetData(SqlAsyncStmt* self, uint64 row, uint32 col, const char* data, unsigned long len)
+{
+	size_t i = (size_t)(row*self->num_columns + col);
+
+	if( data == NULL )
+		return;// NULL value
+	self->rows[i] = (char*)malloc(len + 1);
+	memcpy(self->rows[i], data, len);
+	self->rows[i][len] = '\0';
+	self->lengths[i] = len;
+}
+
+
+
+/// Executes a plain query (worker thread).
+///
+/// @private
+static void SqlAsyncStmt_P_RunQuery(SqlAsyncStmt* self, MYSQL* handle)
+{
+	MYSQL_RES* res;
+
+	if( mysql_real_query(handle, StringBuf_Value(&self->buf), (unsigned long)StringBuf_Length(&self->buf)) )
+	{
+		SqlAsyncStmt_P_SetError(self, mysql_errno(handle), mysql_error(handle));
+		return;
+	}
+	res = mysql_store_result(handle);
+	if( res == NULL && mysql_field_count(handle) != 0 )
+	{
+		SqlAsyncStmt_P_SetError(self, mysql_errno(handle), mysql_error(handle));
+		return;
+	}
+	self->insert_id = (uint64)mysql_insert_id(handle);
+	self->affected_rows = (uint64)mysql_affected_rows(handle);
+	if( res )
+	{
+		MYSQL_ROW row;
+		uint64 i;
+		uint32 j;
+
+		SqlAsyncStmt_P_AllocRows(self, (uint32)mysql_num_fields(res), (uint64)mysql_num_rows(res));
+		for( i = 0; i < self->num_rows && (row = mysql_fetch_row(res)) != NULL; ++i )
+		{
+			unsigned long* lengths = mysql_fetch_lengths(res);
+			for( j = 0; j < self->num_columns; ++j )
+				SqlAsyncStmt_P_SetData(self, i, j, row[j], lengths[j]);
+		}
+		mysql_free_result(res);
+	}
+}
+
+
+
+/// Executes a prepared statement, the columns are fetched as strings (worker thread).
+///
+/// @private
+static void SqlAsyncStmt_P_RunPrepared(SqlAsyncStmt* self, MYSQL* handle)
+{
+	MYSQL_STMT* stmt;
+	MYSQL_RES* meta;
+
+	stmt = mysql_stmt_init(handle);
+	if( stmt == NULL )
+	{
+		SqlAsyncStmt_P_SetError(self, mysql_errno(handle), mysql_error(handle));
+		return;
+	}
+	if( mysql_stmt_prepare(stmt, StringBuf_Value(&self->buf), (unsigned long)StringBuf_Length(&self->buf)) )
+	{
+		SqlAsyncStmt_P_SetError(self, mysql_stmt_errno(stmt), mysql_stmt_error(stmt));
+		mysql_stmt_close(stmt);
+		return;
+	}
+	if( mysql_stmt_param_count(stmt) > self->max_params )
+	{
+		SqlAsyncStmt_P_SetError(self, 0, "not all parameters were bound");
+		mysql_stmt_close(stmt);
+		return;
+	}
+	if( (self->max_params > 0 && mysql_stmt_bind_param(stmt, self->params)) ||
+		mysql_stmt_execute(stmt) )
+	{
+		SqlAsyncStmt_P_SetError(self, mysql_stmt_errno(stmt), mysql_stmt_error(stmt));
+		mysql_stmt_close(stmt);
+		return;
+	}
+	self->insert_id = (uint64)mysql_stmt_insert_id(stmt);
+	self->affected_rows = (uint64)mysql_stmt_affected_rows(stmt);
+
+	meta = mysql_stmt_result_metadata(stmt);
+	if( meta )
+	{
+		MYSQL_FIELD* fields;
+		MYSQL_BIND* columns;
+		unsigned long* lengths;
+		my_bool* is_null;
+		my_bool update_max_length = 1;
+		uint32 num_columns = (uint32)mysql_num_fields(meta);
+		uint64 i;
+		uint32 j;
+
+		mysql_stmt_attr_set(stmt, STMT_ATTR_UPDATE_MAX_LENGTH, &update_max_length);
+		if( mysql_stmt_store_result(stmt) )
+		{
+			SqlAsyncStmt_P_SetError(self, mysql_stmt_errno(stmt), mysql_stmt_error(stmt));
+			mysql_free_result(meta);
+			mysql_stmt_close(stmt);
+			return;
+		}
+
+		// fetch every column as a string, big enough for the longest value
+		fields = mysql_fetch_fields(meta);
+		columns = (MYSQL_BIND*)calloc(num_columns, sizeof(MYSQL_BIND));
+		lengths = (unsigned long*)calloc(num_columns, sizeof(unsigned long));
+		is_null = (my_bool*)calloc(num_columns, sizeof(my_bool));
+		for( j = 0; j < num_columns; ++j )
+		{
+			columns[j].buffer_type = MYSQL_TYPE_STRING;
+			columns[j].buffer_length = fields[j].max_length + 1;
+			columns[j].buffer = malloc(columns[j].buffer_length);
+			columns[j].length = &lengths[j];
+			columns[j].is_null = &is_null[j];
+		}
+
+		if( mysql_stmt_bind_result(stmt, columns) )
+			SqlAsyncStmt_P_SetError(self, mysql_stmt_errno(stmt), mysql_stmt_error(stmt));
+		else
+		{
+			int err = 0;
+
+			SqlAsyncStmt_P_AllocRows(self, num_columns, (uint64)mysql_stmt_num_rows(stmt));
+			for( i = 0; i < self->num_rows && ((err = mysql_stmt_fetch(stmt)) == 0 || err == MYSQL_DATA_TRUNCATED); ++i )
+			{
+				for( j = 0; j < num_columns; ++j )
+					SqlAsyncStmt_P_SetData(self, i, j, is_null[j] ? NULL : (const char*)columns[j].buffer, min(lengths[j], columns[j].buffer_length - 1));
+			}
+			if( err == 1 )
+				SqlAsyncStmt_P_SetError(self, mysql_stmt_errno(stmt), mysql_stmt_error(stmt));
+		}
+
+		for( j = 0; j < num_columns; ++j )
+			free(columns[j].buffer);
+		free(columns);
+		free(lengths);
+		free(is_null);
+		mysql_free_result(meta);
+	}
+	else if( mysql_stmt_errno(stmt) != 0 )
+		SqlAsyncStmt_P_SetError(self, mysql_stmt_errno(stmt), mysql_stmt_error(stmt));
+
+	mysql_stmt_close(stmt);
+}
+
+
+
+/// Worker threads that called mysql_thread_init (only touched by the worker itself).
+static bool SqlAsync_thread_init[THREADPOOL_MAX_WORKERS];
+
+
+
+/// Releases the mysql state of a worker thread when it exits (worker thread).
+///
+/// @private
+static void SqlAsync_P_ThreadEnd(int worker)
+{
+	if( SqlAsync_thread_init[worker] )
+	{
+		mysql_thread_end();
+		SqlAsync_thread_init[worker] = false;
+	}
+}
+
+
+
+/// Executes the statement on the connection of the worker (worker thread).
+///
+/// @private
+static void SqlAsyncStmt_P_Run(int worker, void* param)
+{
+	SqlAsyncStmt* self = (SqlAsyncStmt*)param;
+	SqlAsync* sql = self->sql;
+	struct SqlAsyncConn* conn;
+
+	if( worker >= sql->max_conns )
+	{
+		SqlAsyncStmt_P_SetError(self, 0, "no connection for this worker thread");
+		return;
+	}
+
+	if( threadpool_workers() > 0 && !SqlAsync_thread_init[worker] )
+	{// once per worker thread, the main thread is set up by mysql_init
+		mysql_thread_init();
+		SqlAsync_thread_init[worker] = true;
+	}
+
+	conn = &sql->conns[worker];
+	if( !conn->connected )
+	{
+		if( sql->encoding )// kept when the connection is reestablished, unlike SET NAMES
+			mysql_options(&conn->handle, MYSQL_SET_CHARSET_NAME, sql->encoding);
+		if( !mysql_real_connect(&conn->handle, sql->host, sql->user, sql->passwd, sql->db, (unsigned int)sql->port, NULL/*unix_socket*/, 0/*clientflag*/) )
+		{
+			SqlAsyncStmt_P_SetError(self, mysql_errno(&conn->handle), mysql_error(&conn->handle));
+			// start over with a clean handle on the next statement
+			mysql_close(&conn->handle);
+			mysql_init(&conn->handle);
+			conn->handle.reconnect = 1;
+			return;
+		}
+		conn->connected = true;
+	}
+
+	if( self->prepared )
+		SqlAsyncStmt_P_RunPrepared(self, &conn->handle);
+	else
+		SqlAsyncStmt_P_RunQuery(self, &conn->handle);
+}
+
+
+
+/// Reports errors and calls the callback (main thread).
+///
+/// @private
+static void SqlAsyncStmt_P_Done(void* param)
+{
+	SqlAsyncStmt* self = (SqlAsyncStmt*)param;
+	SqlAsync* sql = self->sql;
+
+	if( self->result == SQL_ERROR )
+	{
+		ShowSQL("DB error - %s\n", self->error);
+		ShowDebug("at async statement - %s\n", StringBuf_Value(&self->buf));
+		ra_mysql_error_handler(self->error_code);
+	}
+	if( self->callback )
+		self->callback(self, self->result, self->data);
+	SqlAsyncStmt_Free(self);
+
+	if( --sql->pending == 0 && sql->release )
+		SqlAsync_P_Destroy(sql);
+}
+
+
+
+/// Submits the statement.
+int SqlAsyncStmt_Execute(SqlAsyncStmt* self, uint32 key, SqlAsyncProc callback, void* data)
+{
+	SqlAsync* sql;
+
+	if( self == NULL )
+		return SQL_ERROR;
+
+	sql = self->sql;
+	if( sql->release || StringBuf_Length(&self->buf) == 0 )
+	{
+		ShowSQL("DB error - statement is empty or the handle is being freed\n");
+		return SQL_ERROR;
+	}
+
+	if( sql->conns == NULL )
+	{// the thread pool is running by now, one connection per worker
+		int i;
+
+		sql->max_conns = max(1, threadpool_workers());
+		CREATE(sql->conns, struct SqlAsyncConn, sql->max_conns);
+		threadpool_atexit(SqlAsync_P_ThreadEnd);
+		for( i = 0; i < sql->max_conns; ++i )
+		{
+			mysql_init(&sql->conns[i].handle);
+			sql->conns[i].handle.reconnect = 1;
+			sql->conns[i].connected = false;
+		}
+	}
+
+	self->callback = callback;
+	self->data = data;
+	sql->pending++;
+	threadpool_submit_ordered(key, SqlAsyncStmt_P_Run, SqlAsyncStmt_P_Done, self);
+	return SQL_SUCCESS;
+}
+
+
+
+/// Returns the number of the AUTO_INCREMENT column of the executed INSERT/UPDATE statement.
+uint64 SqlAsyncStmt_LastInsertId(SqlAsyncStmt* self)
+{
+	return self ? self->insert_id : 0;
+}
+
+
+
+/// Returns the number of rows changed, deleted or inserted by the statement.
+uint64 SqlAsyncStmt_AffectedRows(SqlAsyncStmt* self)
+{
+	return self ? self->affected_rows : 0;
+}
+
+
+
+/// Returns the number of columns in each row of the result.
+uint32 SqlAsyncStmt_NumColumns(SqlAsyncStmt* self)
+{
+	return self ? self->num_columns : 0;
+}
+
+
+
+/// Returns the number of rows in the result.
+uint64 SqlAsyncStmt_NumRows(SqlAsyncStmt* self)
+{
+	return self ? self->num_rows : 0;
+}
+
+
+
+/// Fetches the next row.
+int SqlAsyncStmt_NextRow(SqlAsyncStmt* self)
+{
+	if( self == NULL || self->result == SQL_ERROR )
+		return SQL_ERROR;
+	if( self->next_row >= self->num_rows )
+	{
+		self->row = NULL;
+		self->row_lengths = NULL;
+		return SQL_NO_DATA;
+	}
+	self->row = self->rows + self->next_row*self->num_columns;
+	self->row_lengths = self->lengths + self->next_row*self->num_columns;
+	self->next_row++;
+	return SQL_SUCCESS;
+}
+
+
+
+/// Gets the data of a column of the current row.
+int SqlAsyncStmt_GetData(SqlAsyncStmt* self, size_t col, char** out_buf, size_t* out_len)
+{
+	if( self && self->row )
+	{
+		if( col < self->num_columns )
+		{
+			if( out_buf ) *out_buf = self->row[col];
+			if( out_len ) *out_len = (size_t)self->row_lengths[col];
+		}
+		else
+		{// out of range - ignore
+			if( out_buf ) *out_buf = NULL;
+			if( out_len ) *out_len = 0;
+		}
+		return SQL_SUCCESS;
+	}
+	return SQL_ERROR;
+}
+
+
+
+/// Shows debug information (with statement).
+void SqlAsyncStmt_ShowDebug_(SqlAsyncStmt* self, const char* debug_file, const unsigned long debug_line)
+{
+	if( self == NULL )
+		ShowDebug("at %s:%lu - self is NULL\n", debug_file, debug_line);
+	else if( StringBuf_Length(&self->buf) > 0 )
+		ShowDebug("at %s:%lu - %s\n", debug_file, debug_line, StringBuf_Value(&self->buf));
+	else
+		ShowDebug("at %s:%lu\n", debug_file, debug_line);
+}
+
+
+
+/// Frees an asynchronous statement.
+void SqlAsyncStmt_Free(SqlAsyncStmt* self)
+{
+	size_t i;
+
+	if( self == NULL )
+		return;
+
+	StringBuf_Destroy(&self->buf);
+	for( i = 0; i < self->max_params; ++i )
+	{
+		if( self->params[i].buffer )
+			aFree(self->params[i].buffer);
+	}
+	if( self->params )
+		aFree(self->params);
+	if( self->rows )
+	{
+		size_t count = (size_t)(self->num_rows*self->num_columns);
+		for( i = 0; i < count; ++i )
+			free(self->rows[i]);
+		free(self->rows);
+		free(self->lengths);
+	}
+	aFree(self);
+}
+
+
+
 /// Receives MySQL error codes during runtime (not on first-time-connects).
 void ra_mysql_error_handler(unsigned int ecode) {
 	switch( ecode ) {
@@ -58,10 +58,14 @@ enum SqlDataType
 
 struct Sql;// Sql handle (private access)
 struct SqlStmt;// Sql statement (private access)
+struct SqlAsync;// Asynchronous Sql handle (private access)
+struct SqlAsyncStmt;// Asynchronous Sql statement (private access)
 
 typedef enum SqlDataType SqlDataType;
 typedef struct Sql Sql;
 typedef struct SqlStmt SqlStmt;
+typedef struct SqlAsync SqlAsync;
+typedef struct SqlAsyncStmt SqlAsyncStmt;
 
 
 /// Allocates and initializes a new Sql handle.
@@ -231,6 +235,21 @@ struct SqlStmt* SqlStmt_Malloc(Sql* sql);
 
 
 
+/// Returns the prepared statement of a query from the statement cache of the handle.
+/// The statement is prepared the first time the query is used, and again when
+/// the connection was reestablished since then.
+/// The query is formatted with the arguments like SqlStmt_Prepare, the
+/// formatted text is the key of the cache: format constants (table names, ...)
+/// into it and bind the values as parameters.
+///
+/// The statement belongs to the handle and is valid until the next call with
+/// the same query. SqlStmt_Free only frees its result, do not prepare it again.
+///
+/// @return SqlStmt handle or NULL if an error occured
+struct SqlStmt* Sql_PrepareCached(Sql* self, const char* query, ...);
+
+
+
 /// Prepares the statement.
 /// Any previous result is freed and all parameter bindings are removed.
 /// The query is constructed as if it was sprintf.
@@ -282,6 +301,28 @@ int SqlStmt_Execute(SqlStmt* self);
 
 
 
+/// Parameter of SqlStmt_ExecuteParams, see SqlStmt_BindParam.
+struct SqlParam
+{
+	SqlDataType type;
+	void* buffer;
+	size_t length;// string, enum and blob types
+};
+
+
+
+/// Sets a parameter of SqlStmt_ExecuteParams.
+void SqlParam_Set(struct SqlParam* self, SqlDataType type, void* buffer, size_t length);
+
+
+
+/// Binds the parameters (in order, starting at index 0) and executes the prepared statement.
+///
+/// @return SQL_SUCCESS or SQL_ERROR
+int SqlStmt_ExecuteParams(SqlStmt* self, const struct SqlParam* params, size_t count);
+
+
+
 /// Returns the number of the AUTO_INCREMENT column of the last INSERT/UPDATE statement.
 ///
 /// @return Value of the auto-increment column
@@ -339,6 +380,150 @@ void SqlStmt_ShowDebug_(SqlStmt* self, const char* debug_file, const unsigned lo
 /// Frees a SqlStmt returned by SqlStmt_Malloc.
 void SqlStmt_Free(SqlStmt* self);
 
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Asynchronous queries
+///////////////////////////////////////////////////////////////////////////////
+//
+// Queries are executed by the worker threads of the thread pool (threadpool.h),
+// each worker with its own connection to the database. The connections are
+// opened by the workers when they run their first query.
+// The callback is called by the main thread once the query is done, the
+// statement (and its result) is freed when the callback returns.
+// Errors are reported on the main thread like the synchronous functions do.
+//
+// Statements submitted with the same key are executed in submission order,
+// statements with different keys may run concurrently on different connections.
+// Without worker threads the statement is executed (and the callback called)
+// before SqlAsyncStmt_Execute returns.
+
+
+
+/// Callback of an asynchronous statement, called on the main thread.
+///
+/// @param stmt Executed statement, use it to read the result
+/// @param result SQL_SUCCESS or SQL_ERROR
+/// @param data Data given to SqlAsyncStmt_Execute
+typedef void (*SqlAsyncProc)(SqlAsyncStmt* stmt, int result, void* data);
+
+
+
+/// Allocates a new asynchronous Sql handle.
+/// Nothing is connected until a worker runs the first query.
+///
+/// @param encoding Character set of the connections (NULL or "" for the server default)
+SqlAsync* SqlAsync_Create(const char* user, const char* passwd, const char* host, uint16 port, const char* db, const char* encoding);
+
+
+
+/// Returns the number of submitted statements whose callback was not called yet.
+int SqlAsync_Pending(SqlAsync* self);
+
+
+
+/// Frees an asynchronous Sql handle returned by SqlAsync_Create.
+/// When statements are still pending the handle is freed after the last callback.
+void SqlAsync_Free(SqlAsync* self);
+
+
+
+/// Submits a query, with the same arguments as Sql_Query.
+/// Shortcut for SqlAsyncStmt_Malloc + SqlAsyncStmt_PrepareQuery + SqlAsyncStmt_Execute.
+///
+/// @param key Ordering key (see above)
+/// @param callback Called once the query is done, NULL for fire-and-forget queries
+/// @return SQL_SUCCESS or SQL_ERROR
+int SqlAsync_Query(SqlAsync* self, uint32 key, SqlAsyncProc callback, void* data, const char* query, ...);
+
+
+
+/// Allocates a new asynchronous statement.
+SqlAsyncStmt* SqlAsyncStmt_Malloc(SqlAsync* self);
+
+
+
+/// Sets the statement, with '?' parameter markers (prepared statement).
+///
+/// @return SQL_SUCCESS or SQL_ERROR
+int SqlAsyncStmt_Prepare(SqlAsyncStmt* self, const char* query, ...);
+
+
+
+/// Sets the statement, a plain query without parameter markers.
+///
+/// @return SQL_SUCCESS or SQL_ERROR
+int SqlAsyncStmt_PrepareQuery(SqlAsyncStmt* self, const char* query, ...);
+
+
+
+/// Binds a parameter, see SqlStmt_BindParam.
+/// The data is copied, the buffer can be reused as soon as this returns.
+///
+/// @return SQL_SUCCESS or SQL_ERROR
+int SqlAsyncStmt_BindParam(SqlAsyncStmt* self, size_t idx, SqlDataType buffer_type, void* buffer, size_t buffer_len);
+
+
+
+/// Submits the statement.
+/// On success the statement belongs to the handle and is freed after the callback,
+/// on error it still has to be freed with SqlAsyncStmt_Free.
+///
+/// @param key Ordering key (see above)
+/// @param callback Called once the statement is done, NULL for fire-and-forget statements
+/// @return SQL_SUCCESS or SQL_ERROR
+int SqlAsyncStmt_Execute(SqlAsyncStmt* self, uint32 key, SqlAsyncProc callback, void* data);
+
+
+
+/// Returns the number of the AUTO_INCREMENT column of the executed INSERT/UPDATE statement.
+uint64 SqlAsyncStmt_LastInsertId(SqlAsyncStmt* self);
+
+
+
+/// Returns the number of rows changed, deleted or inserted by the statement.
+uint64 SqlAsyncStmt_AffectedRows(SqlAsyncStmt* self);
+
+
+
+/// Returns the number of columns in each row of the result.
+uint32 SqlAsyncStmt_NumColumns(SqlAsyncStmt* self);
+
+
+
+/// Returns the number of rows in the result.
+uint64 SqlAsyncStmt_NumRows(SqlAsyncStmt* self);
+
+
+
+/// Fetches the next row.
+///
+/// @return SQL_SUCCESS, SQL_ERROR or SQL_NO_DATA
+int SqlAsyncStmt_NextRow(SqlAsyncStmt* self);
+
+
+
+/// Gets the data of a column of the current row, as a nul-terminated string.
+/// NULL values have a NULL buffer.
+///
+/// @return SQL_SUCCESS or SQL_ERROR
+int SqlAsyncStmt_GetData(SqlAsyncStmt* self, size_t col, char** out_buf, size_t* out_len);
+
+
+
+#if defined(SQL_REMOVE_SHOWDEBUG)
+#define SqlAsyncStmt_ShowDebug(self) (void)0
+#else
+#define SqlAsyncStmt_ShowDebug(self) SqlAsyncStmt_ShowDebug_(self, __FILE__, __LINE__)
+#endif
+/// Shows debug information (with statement).
+void SqlAsyncStmt_ShowDebug_(SqlAsyncStmt* self, const char* debug_file, const unsigned long debug_line);
+
+
+
+/// Frees a statement that was not submitted.
+void SqlAsyncStmt_Free(SqlAsyncStmt* self);
+
 void Sql_Init(void);
 
 
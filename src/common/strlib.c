@@ -5,8 +5,20 @@
 #include "../common/malloc.h"
 #include "../common/showmsg.h"
 #include "strlib.h"
+#ifndef MINICORE
+#include "../common/atomic.h"
+#include "../common/thread.h"
+#include "../common/threadpool.h"
+#include "../common/utils.h" // cap_value
+#endif
 
 #include <stdlib.h>
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 
 #define J_MAX_MALLOC_SIZE 65535
@@ -967,9 +979,97 @@ const char* skip_escaped_c(const char* p)
 }
 
 
+/// Row of a file read by sv_readdb
+struct sv_readdb_row {
+	char* line; // start of the line
+	int len; // length of the line, comments excluded
+	int lineno; // line number in the file
+	int columns; // result of sv_split
+};
+
+/// Rows split by one sv_readdb job
+struct sv_readdb_job {
+	struct sv_readdb_row* rows;
+	char** fields; // nb_cols fields per row
+	int start, end; // rows [start, end[
+	int nb_cols;
+	char delim;
+	volatile int32* remaining; // jobs that are not done yet
+};
+
+#define SV_READDB_JOB_ROWS 256 // minimum number of rows split by a job
+
+/// Splits the fields of a range of rows (any thread).
+static void sv_readdb_split(int worker, void* param)
+{
+	struct sv_readdb_job* job = (struct sv_readdb_job*)param;
+	int i;
+
+	for( i = job->start; i < job->end; ++i )
+		job->rows[i].columns = sv_split(job->rows[i].line, job->rows[i].len, 0, job->delim, job->fields + (size_t)i*job->nb_cols, job->nb_cols, (e_svopt)(SV_TERMINATE_LF|SV_TERMINATE_CRLF));
+
+#ifndef MINICORE
+	if( job->remaining != NULL )
+		InterlockedDecrement(job->remaining);
+#endif
+}
+
+/// Loads a whole file in memory, followed by a '\0'.
+/// The file is mapped with copy-on-write when possible, the content can be modified.
+/// @param out_mapped Set to true if the buffer must be released with munmap instead of aFree
+/// @return Content of the file or NULL if it can't be read
+static char* sv_readdb_load(const char* path, size_t* out_len, bool* out_mapped)
+{
+	FILE* fp;
+	char* buf;
+	long len;
+
+	*out_mapped = false;
+#ifndef WIN32
+	{
+		struct stat st;
+		int fd = open(path, O_RDONLY);
+		if( fd == -1 )
+			return NULL;
+		if( fstat(fd, &st) == 0 && st.st_size > 0 && st.st_size % getpagesize() != 0 )
+		{// the rest of the last page is zero-filled, it terminates the content
+			buf = (char*)mmap(NULL, (size_t)st.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+			if( buf != MAP_FAILED )
+			{
+				close(fd);
+				*out_len = (size_t)st.st_size;
+				*out_mapped = true;
+				return buf;
+			}
+		}
+		close(fd);
+	}
+#endif
+
+	fp = fopen(path, "rb");
+	if( fp == NULL )
+		return NULL;
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	if( len < 0 )
+	{
+		fclose(fp);
+		return NULL;
+	}
+	buf = (char*)aMalloc(len + 1);
+	len = (long)fread(buf, 1, len, fp);
+	buf[len] = '\0';
+	fclose(fp);
+	*out_len = (size_t)len;
+	return buf;
+}
+
 /**
  * Opens and parses a file containing delim-separated columns, feeding them to the specified callback function row by row.
  * Tracks the progress of the operation (current line number, number of successfully processed rows).
+ * The file is loaded at once and its rows are split by the thread pool (if there are workers),
+ * parseproc is always called by the calling thread, in file order.
  * Returns 'true' if it was able to process the specified file, or 'false' if it could not be read.
  * @param directory : Directory
  * @param filename : filename File to process
@@ -983,55 +1083,121 @@ const char* skip_escaped_c(const char* p)
  */
 bool sv_readdb(const char* directory, const char* filename, char delim, int mincols, int maxcols, int maxrows, bool (*parseproc)(char* fields[], int columns, int current), bool silent)
 {
-	FILE* fp;
+	char* buf;
+	char* p, *eol, *end;
+	size_t len;
+	bool mapped;
 	int lines = 0;
 	int entries = 0;
+	struct sv_readdb_row* rows;
+	int row_count = 0, row_max = 256;
 	char** fields; // buffer for fields ([0] is reserved)
-	int columns, nb_cols;
-	char path[1024], *line;
-	const short colsize=512;
+	int i, nb_cols;
+	char path[1024];
 
 	snprintf(path, sizeof(path), "%s/%s", directory, filename);
 
 	// open file
-	fp = fopen(path, "r");
-	if( fp == NULL )
+	buf = sv_readdb_load(path, &len, &mapped);
+	if( buf == NULL )
 	{
 		if(silent == 0) ShowError("sv_readdb: can't read %s\n", path);
 		return false;
 	}
 
-	// allocate enough memory for the maximum requested amount of columns plus the reserved one
-	nb_cols = maxcols+1;
-	fields = (char**)aMalloc(nb_cols*sizeof(char*));
-	line = (char*)aMalloc(nb_cols*colsize);
-
-	// process rows one by one
-	while( fgets(line, maxcols*colsize, fp) )
+	// find the rows
+	CREATE(rows, struct sv_readdb_row, row_max);
+	for( p = buf, end = buf + len; p < end; p = eol )
 	{
-		char *match;
+		char* comment = NULL;
+		char* match;
 		lines++;
 
-		if( ( match = strstr(line, "//") ) != NULL )
+		eol = (char*)memchr(p, '\n', end - p);
+		if( eol == NULL )
+			eol = end; // last line, followed by the '\0'
+		else
+			eol++; // keep the terminator, sv_split needs it
+
+		for( match = p; match + 1 < eol; ++match )
 		{// strip comments
-			match[0] = 0;
+			if( match[0] == '/' && match[1] == '/' )
+			{
+				comment = match;
+				comment[0] = 0;
+				break;
+			}
 		}
 
 		//trim(line); //TODO: strip trailing whitespace
 		//trim2(line,1); //removing trailing actually break mob_skill_db
-		if( line[0] == '\0' || line[0] == '\n' || line[0] == '\r')
+		if( p[0] == '\0' || p[0] == '\n' || p[0] == '\r' )
 			continue;
 
-		columns = sv_split(line, strlen(line), 0, delim, fields, nb_cols, (e_svopt)(SV_TERMINATE_LF|SV_TERMINATE_CRLF));
+		if( row_count == row_max )
+		{
+			row_max *= 2;
+			RECREATE(rows, struct sv_readdb_row, row_max);
+		}
+		rows[row_count].line = p;
+		rows[row_count].len = (int)((comment ? comment : eol) - p);
+		rows[row_count].lineno = lines;
+		row_count++;
+	}
+
+	// allocate enough memory for the maximum requested amount of columns plus the reserved one
+	nb_cols = maxcols+1;
+	fields = (char**)aMalloc(max(row_count,1)*nb_cols*sizeof(char*));
+
+	// split the fields
+	{
+		struct sv_readdb_job* jobs;
+		int job_count = 1;
+		volatile int32 remaining = 0;
+
+#ifndef MINICORE
+		if( threadpool_workers() > 0 )
+			job_count = cap_value(row_count/SV_READDB_JOB_ROWS, 1, threadpool_workers()+1);
+#endif
+		CREATE(jobs, struct sv_readdb_job, job_count);
+		for( i = 0; i < job_count; ++i )
+		{
+			jobs[i].rows = rows;
+			jobs[i].fields = fields;
+			jobs[i].start = (int)((int64)row_count*i/job_count);
+			jobs[i].end = (int)((int64)row_count*(i+1)/job_count);
+			jobs[i].nb_cols = nb_cols;
+			jobs[i].delim = delim;
+			jobs[i].remaining = &remaining;
+		}
+		remaining = job_count - 1;
+#ifndef MINICORE
+		for( i = 1; i < job_count; ++i )
+			threadpool_submit(sv_readdb_split, NULL, &jobs[i]);
+#endif
+		jobs[0].remaining = NULL;
+		sv_readdb_split(0, &jobs[0]); // the first range is split by this thread
+#ifndef MINICORE
+		while( remaining > 0 )
+			rathread_yield();
+#endif
+		aFree(jobs);
+	}
+
+	// process rows one by one
+	for( i = 0; i < row_count; ++i )
+	{
+		char** row_fields = fields + (size_t)i*nb_cols;
+		int columns = rows[i].columns;
 
 		if( columns < mincols )
 		{
-			ShowError("sv_readdb: Insufficient columns in line %d of \"%s\" (found %d, need at least %d).\n", lines, path, columns, mincols);
+			ShowError("sv_readdb: Insufficient columns in line %d of \"%s\" (found %d, need at least %d).\n", rows[i].lineno, path, columns, mincols);
 			continue; // not enough columns
 		}
 		if( columns > maxcols )
 		{
-			ShowError("sv_readdb: Too many columns in line %d of \"%s\" (found %d, maximum is %d).\n", lines, path, columns, maxcols );
+			ShowError("sv_readdb: Too many columns in line %d of \"%s\" (found %d, maximum is %d).\n", rows[i].lineno, path, columns, maxcols );
 			continue; // too many columns
 		}
 		if( entries == maxrows )
@@ -1041,9 +1207,9 @@ bool sv_readdb(const char* directory, const char* filename, char delim, int minc
 		}
 
 		// parse this row
-		if( !parseproc(fields+1, columns, entries) )
+		if( !parseproc(row_fields+1, columns, entries) )
 		{
-			ShowError("sv_readdb: Could not process contents of line %d of \"%s\".\n", lines, path);
+			ShowError("sv_readdb: Could not process contents of line %d of \"%s\".\n", rows[i].lineno, path);
 			continue; // invalid row contents
 		}
 
@@ -1052,8 +1218,13 @@ bool sv_readdb(const char* directory, const char* filename, char delim, int minc
 	}
 
 	aFree(fields);
-	aFree(line);
-	fclose(fp);
+	aFree(rows);
+#ifndef WIN32
+	if( mapped )
+		munmap(buf, len);
+	else
+#endif
+		aFree(buf);
 	ShowStatus("Done reading '"CL_WHITE"%d"CL_RESET"' entries in '"CL_WHITE"%s"CL_RESET"'.\n", entries, path);
 
 	return true;
@@ -0,0 +1,359 @@
+
+//
+// Worker Thread Pool
+//
+// Jobs are queued per worker (ordered jobs) or in a shared queue, both
+// protected by one mutex. Finished jobs are pushed by the workers to a
+// lock-free multi producer / single consumer queue that is drained by the
+// main thread, so the main thread never waits for a worker.
+//
+// Copyright (c) rAthena Project (www.rathena.org) - Licensed under GNU GPL
+// For more information, see LICENCE in the main folder
+//
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../common/cbasetypes.h"
+#include "../common/atomic.h"
+#include "../common/ers.h"
+#include "../common/malloc.h"
+#include "../common/mutex.h"
+#include "../common/showmsg.h"
+#include "../common/thread.h"
+#include "../common/threadpool.h"
+#include "../common/utils.h"
+
+#define THREADPOOL_DEFAULT_WORKERS 4
+#define THREADPOOL_STACK_SIZE (1024*1024)
+#define THREADPOOL_MAX_EXIT_PROCS 8
+
+struct threadpool_job{
+	struct threadpool_job * volatile next; // job queue, then completion queue
+	threadpoolJobProc	job;
+	threadpoolDoneProc	done;
+	void	*param;
+};
+
+struct threadpool_worker{
+	int		id;
+	rAthread	thread;
+	racond	cond;
+	bool	idle;
+
+	// ordered jobs of this worker
+	struct threadpool_job	*head;
+	struct threadpool_job	*tail;
+};
+
+
+///
+// Implementation:
+//
+static int	l_num_workers_cfg = THREADPOOL_DEFAULT_WORKERS;
+static int	l_num_workers = 0;
+static struct threadpool_worker	*l_workers = NULL;
+static ramutex	l_lock = NULL; // protects the job queues and the idle flags
+static volatile int32	l_terminate = 0;
+static int	l_next_worker = 0; // round robin start for idle workers
+
+// shared job queue
+static struct threadpool_job	*l_shared_head = NULL;
+static struct threadpool_job	*l_shared_tail = NULL;
+
+// completion queue (MPSC, intrusive, with a stub node)
+static struct threadpool_job	l_done_stub;
+static struct threadpool_job * volatile l_done_head = &l_done_stub; // producers
+static struct threadpool_job	*l_done_tail = &l_done_stub; // consumer
+
+// main thread only
+static ERS	l_job_ers = NULL;
+static int	l_pending = 0;
+
+// called by the workers when they exit, registered before threadpool_final
+static threadpoolExitProc	l_exit_procs[THREADPOOL_MAX_EXIT_PROCS];
+static int	l_num_exit_procs = 0;
+
+
+/// Pushes a finished job to the completion queue (any thread).
+static void threadpool_done_push(struct threadpool_job *j){
+	struct threadpool_job *prev;
+
+	j->next = NULL;
+	prev = (struct threadpool_job*)InterlockedExchangePointer((void * volatile *)&l_done_head, j);
+	// the consumer waits for this link when it reaches prev
+	prev->next = j;
+}//end: threadpool_done_push()
+
+
+/// Pops a finished job from the completion queue (main thread).
+/// Returns NULL when empty, or when a producer is between the exchange and the link.
+static struct threadpool_job *threadpool_done_pop(){
+	struct threadpool_job *tail = l_done_tail;
+	struct threadpool_job *next = tail->next;
+
+	if(tail == &l_done_stub){
+		if(next == NULL)
+			return NULL;
+		l_done_tail = next;
+		tail = next;
+		next = next->next;
+	}
+
+	if(next != NULL){
+		l_done_tail = next;
+		return tail;
+	}
+
+	if(tail != l_done_head)
+		return NULL; // link not visible yet, try again in the next loop
+
+	// tail is the last job, put the stub behind it so it can be detached
+	threadpool_done_push(&l_done_stub);
+	next = tail->next;
+	if(next != NULL){
+		l_done_tail = next;
+		return tail;
+	}
+
+	return NULL;
+}//end: threadpool_done_pop()
+
+
+/// Takes the next job of a worker, NULL if there is none (l_lock held).
+static struct threadpool_job *threadpool_job_take(struct threadpool_worker *w){
+	struct threadpool_job *j;
+
+	if(w->head != NULL){
+		j = w->head;
+		w->head = j->next;
+		if(w->head == NULL)
+			w->tail = NULL;
+	}else if(l_shared_head != NULL){
+		j = l_shared_head;
+		l_shared_head = j->next;
+		if(l_shared_head == NULL)
+			l_shared_tail = NULL;
+	}else
+		return NULL;
+
+	return j;
+}//end: threadpool_job_take()
+
+
+static void *threadpool_worker_main(void *x){
+	struct threadpool_worker *w = (struct threadpool_worker*)x;
+	struct threadpool_job *j;
+	int i;
+
+	while(1){
+		ramutex_lock(l_lock);
+		while( (j = threadpool_job_take(w)) == NULL ){
+			if(l_terminate > 0){ // every queued job is done
+				ramutex_unlock(l_lock);
+				for(i = 0; i < l_num_exit_procs; i++)
+					l_exit_procs[i](w->id);
+				return NULL;
+			}
+			w->idle = true;
+			racond_wait(w->cond, l_lock, -1);
+			w->idle = false;
+		}
+		ramutex_unlock(l_lock);
+
+		j->job(w->id, j->param);
+		threadpool_done_push(j);
+	}
+
+	return NULL;
+}//end: threadpool_worker_main()
+
+
+void threadpool_init(){
+	int i;
+
+	l_done_stub.next = NULL;
+	l_done_head = &l_done_stub;
+	l_done_tail = &l_done_stub;
+	l_shared_head = l_shared_tail = NULL;
+	l_terminate = 0;
+	l_pending = 0;
+	l_next_worker = 0;
+	l_job_ers = ers_new(sizeof(struct threadpool_job), "threadpool.c::l_job_ers", ERS_OPT_NONE);
+
+	if(l_num_workers_cfg <= 0)
+		return;
+
+	l_lock = ramutex_create();
+	CREATE(l_workers, struct threadpool_worker, l_num_workers_cfg);
+	for(i = 0; i < l_num_workers_cfg; i++){
+		struct threadpool_worker *w = &l_workers[i];
+
+		w->id = i;
+		w->cond = racond_create();
+		w->idle = false;
+		w->head = w->tail = NULL;
+		w->thread = rathread_createEx(threadpool_worker_main, w, THREADPOOL_STACK_SIZE, RAT_PRIO_NORMAL);
+		if(w->thread == NULL){
+			ShowError("threadpool_init: cannot spawn worker thread #%d, continuing with %d worker(s).\n", i, i);
+			racond_destroy(w->cond);
+			break;
+		}
+		l_num_workers++;
+	}
+
+	if(l_num_workers == 0){
+		aFree(l_workers);
+		l_workers = NULL;
+		ramutex_destroy(l_lock);
+		l_lock = NULL;
+		return;
+	}
+
+	ShowInfo("Thread pool: started "CL_WHITE"%d"CL_RESET" worker thread(s).\n", l_num_workers);
+}//end: threadpool_init()
+
+
+void threadpool_final(){
+	int i;
+
+	if(l_num_workers > 0){
+		// workers finish their queues before exiting
+		InterlockedIncrement(&l_terminate);
+		ramutex_lock(l_lock);
+		for(i = 0; i < l_num_workers; i++)
+			racond_signal(l_workers[i].cond);
+		ramutex_unlock(l_lock);
+
+		for(i = 0; i < l_num_workers; i++){
+			rathread_wait(l_workers[i].thread, NULL);
+			racond_destroy(l_workers[i].cond);
+		}
+		l_num_workers = 0;
+
+		threadpool_do_completions();
+
+		aFree(l_workers);
+		l_workers = NULL;
+		ramutex_destroy(l_lock);
+		l_lock = NULL;
+	}
+
+	if(l_pending != 0)
+		ShowWarning("threadpool_final: %d job(s) were not completed.\n", l_pending);
+
+	if(l_job_ers != NULL){
+		ers_destroy(l_job_ers);
+		l_job_ers = NULL;
+	}
+}//end: threadpool_final()
+
+
+void threadpool_set_workers( int count ){
+	l_num_workers_cfg = cap_value(count, 0, THREADPOOL_MAX_WORKERS);
+}//end: threadpool_set_workers()
+
+
+int threadpool_workers(){
+	return l_num_workers;
+}//end: threadpool_workers()
+
+
+void threadpool_atexit( threadpoolExitProc proc ){
+	int i;
+
+	for(i = 0; i < l_num_exit_procs; i++)
+		if(l_exit_procs[i] == proc)
+			return; // already registered
+	if(l_num_exit_procs == THREADPOOL_MAX_EXIT_PROCS){
+		ShowError("threadpool_atexit: too many exit procedures (max %d).\n", THREADPOOL_MAX_EXIT_PROCS);
+		return;
+	}
+	l_exit_procs[l_num_exit_procs++] = proc;
+}//end: threadpool_atexit()
+
+
+/// Queues a job for worker 'w', or in the shared queue if w is NULL.
+static bool threadpool_queue( struct threadpool_worker *w,  threadpoolJobProc job,  threadpoolDoneProc done,  void *param ){
+	struct threadpool_job *j;
+	int i;
+
+	if(l_num_workers == 0){ // no workers, run it now
+		job(0, param);
+		if(done != NULL)
+			done(param);
+		return false;
+	}
+
+	j = ers_alloc(l_job_ers, struct threadpool_job);
+	j->next = NULL;
+	j->job = job;
+	j->done = done;
+	j->param = param;
+	l_pending++;
+
+	ramutex_lock(l_lock);
+	if(w != NULL){
+		if(w->tail != NULL)
+			w->tail->next = j;
+		else
+			w->head = j;
+		w->tail = j;
+		if(w->idle)
+			racond_signal(w->cond);
+	}else{
+		if(l_shared_tail != NULL)
+			l_shared_tail->next = j;
+		else
+			l_shared_head = j;
+		l_shared_tail = j;
+		// wake one idle worker, the busy ones check the shared queue when they are done
+		for(i = 0; i < l_num_workers; i++){
+			struct threadpool_worker *iw = &l_workers[(l_next_worker + i) % l_num_workers];
+			if(iw->idle){
+				iw->idle = false; // don't pick it again before it runs
+				racond_signal(iw->cond);
+				break;
+			}
+		}
+		l_next_worker = (l_next_worker + 1) % l_num_workers;
+	}
+	ramutex_unlock(l_lock);
+
+	return true;
+}//end: threadpool_queue()
+
+
+bool threadpool_submit( threadpoolJobProc job,  threadpoolDoneProc done,  void *param ){
+	return threadpool_queue(NULL, job, done, param);
+}//end: threadpool_submit()
+
+
+bool threadpool_submit_ordered( uint32 key,  threadpoolJobProc job,  threadpoolDoneProc done,  void *param ){
+	if(l_num_workers == 0)
+		return threadpool_queue(NULL, job, done, param);
+	return threadpool_queue(&l_workers[key % l_num_workers], job, done, param);
+}//end: threadpool_submit_ordered()
+
+
+int threadpool_do_completions(){
+	struct threadpool_job *j;
+	int count = 0;
+
+	while( (j = threadpool_done_pop()) != NULL ){
+		l_pending--;
+		count++;
+		if(j->done != NULL)
+			j->done(j->param);
+		ers_free(l_job_ers, j);
+	}
+
+	return count;
+}//end: threadpool_do_completions()
+
+
+int threadpool_pending(){
+	return l_pending;
+}//end: threadpool_pending()
@@ -0,0 +1,132 @@
+// Copyright (c) rAthena Project (www.rathena.org) - Licensed under GNU GPL
+// For more information, see LICENCE in the main folder
+
+#pragma once
+#ifndef _rA_THREADPOOL_H_
+#define _rA_THREADPOOL_H_
+
+#include "../common/cbasetypes.h"
+
+/// Maximum wait of the server loop while jobs are pending, in milliseconds.
+#define THREADPOOL_POLL_INTERVAL 10
+
+/// Maximum number of worker threads.
+#define THREADPOOL_MAX_WORKERS 32
+
+//
+// Worker Thread Pool
+//
+// Runs blocking work (sql, file i/o, compression, ...) on worker threads and
+// calls back on the main thread once it is done.
+// The callbacks are called by threadpool_do_completions, which the core
+// calls in every server loop right after do_timer.
+//
+// Rules:
+//  - threadpool_submit may only be called from the main thread.
+//  - The job procedure runs on a worker thread. It must not touch any game
+//    state, use aMalloc/aFree (use malloc/free), Show* messages, timers or
+//    sockets. Everything it needs should be in param.
+//  - The done procedure runs on the main thread and usually frees param.
+//
+
+/**
+ * Work done by a worker thread.
+ *
+ * @param worker - index of the worker running the job (0 .. threadpool_workers()-1)
+ * @param param - parameter given to threadpool_submit
+ */
+typedef void (*threadpoolJobProc)(int worker, void *param);
+
+/**
+ * Called on the main thread after the job is done.
+ *
+ * @param param - parameter given to threadpool_submit
+ */
+typedef void (*threadpoolDoneProc)(void *param);
+
+/**
+ * Called on a worker thread right before it exits.
+ *
+ * @param worker - index of the worker (0 .. threadpool_workers()-1)
+ */
+typedef void (*threadpoolExitProc)(int worker);
+
+
+/**
+ * Starts the worker threads.
+ */
+void threadpool_init();
+
+
+/**
+ * Waits for the submitted jobs, calls their done procedures and stops the worker threads.
+ */
+void threadpool_final();
+
+
+/**
+ * Sets the number of worker threads started by threadpool_init (default: THREADPOOL_DEFAULT_WORKERS).
+ * 0 runs every job on the main thread when it is submitted.
+ *
+ * @param count - number of workers
+ */
+void threadpool_set_workers( int count );
+
+
+/**
+ * Returns the number of running worker threads.
+ */
+int threadpool_workers();
+
+
+/**
+ * Queues a job, it runs on the first idle worker.
+ *
+ * @param job - work to do on the worker thread
+ * @param done - [OPTIONAL] called on the main thread once the job is done
+ * @param param - parameter of both procedures
+ *
+ * @return true when queued, false if it ran on the main thread (no workers)
+ */
+bool threadpool_submit( threadpoolJobProc job,  threadpoolDoneProc done,  void *param );
+
+
+/**
+ * Queues a job that must run after the previous jobs submitted with the same key.
+ * Jobs with the same key always run on the same worker, in submission order.
+ *
+ * @param key - ordering key (an account id, a table, ...)
+ * @param job - work to do on the worker thread
+ * @param done - [OPTIONAL] called on the main thread once the job is done
+ * @param param - parameter of both procedures
+ *
+ * @return true when queued, false if it ran on the main thread (no workers)
+ */
+bool threadpool_submit_ordered( uint32 key,  threadpoolJobProc job,  threadpoolDoneProc done,  void *param );
+
+
+/**
+ * Registers a procedure that every worker thread calls right before it exits,
+ * to release the per-thread state of a library (mysql_thread_end, ...).
+ * May only be called from the main thread.
+ *
+ * @param proc - procedure to call
+ */
+void threadpool_atexit( threadpoolExitProc proc );
+
+
+/**
+ * Calls the done procedures of the finished jobs (main thread).
+ *
+ * @return number of completed jobs
+ */
+int threadpool_do_completions();
+
+
+/**
+ * Returns the number of submitted jobs whose done procedure was not called yet.
+ */
+int threadpool_pending();
+
+
+#endif
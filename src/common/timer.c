@@ -7,6 +7,7 @@
 #include "../common/showmsg.h"
 #include "../common/utils.h"
 #include "../common/nullpo.h"
+#include "../common/strlib.h"
 #include "timer.h"
 
 #include <stdlib.h>
@@ -15,6 +16,7 @@
 #ifdef WIN32
 #include "../common/winapi.h" // GetTickCount()
 #else
+#include <sys/resource.h> // getrusage()
 #endif
 
 // If the server can't handle processing thousands of monsters
@@ -43,8 +45,42 @@ static int free_timer_list_pos = 0;
 /// @return negative if tid1 is top, positive if tid2 is top, 0 if equal
 #define DIFFTICK_MINTOPCMP(tid1,tid2) DIFF_TICK(timer_data[tid1].tick,timer_data[tid2].tick)
 
+#ifdef TIMER_WHEEL
+// Hashed hierarchical timing wheel (O(1) insert and cancel).
+// The first level has one slot per millisecond, every other level has slots
+// that span a full turn of the previous level. Timers are moved (cascaded)
+// to the lower levels when their slot is reached.
+#define TIMER_WHEEL_ROOT_BITS 8
+#define TIMER_WHEEL_LEVEL_BITS 6
+#define TIMER_WHEEL_ROOT_SIZE (1<<TIMER_WHEEL_ROOT_BITS)
+#define TIMER_WHEEL_LEVEL_SIZE (1<<TIMER_WHEEL_LEVEL_BITS)
+#define TIMER_WHEEL_LEVELS 4 // levels after the root, covers the 32 bits of the tick
+#define TIMER_WHEEL_SLOTS (TIMER_WHEEL_ROOT_SIZE + TIMER_WHEEL_LEVELS*TIMER_WHEEL_LEVEL_SIZE)
+
+/// Index of the slot of level 'lv' (1..TIMER_WHEEL_LEVELS) that covers 'tick'.
+#define TIMER_WHEEL_INDEX(tick,lv) ( TIMER_WHEEL_ROOT_SIZE + ((lv)-1)*TIMER_WHEEL_LEVEL_SIZE + \
+	(((tick) >> (TIMER_WHEEL_ROOT_BITS + ((lv)-1)*TIMER_WHEEL_LEVEL_BITS)) & (TIMER_WHEEL_LEVEL_SIZE-1)) )
+
+/// Link of a timer in the list of a wheel slot.
+struct timer_wheel_link {
+	int next;
+	int prev;
+	int slot;// -1 if the timer is not in the wheel
+};
+
+// links of the timers (array, same size as timer_data)
+static struct timer_wheel_link* timer_wheel_link = NULL;
+
+// first and last timer of each slot, -1 if the slot is empty
+static int timer_wheel_head[TIMER_WHEEL_SLOTS];
+static int timer_wheel_tail[TIMER_WHEEL_SLOTS];
+
+// tick of the slot that is processed next
+static unsigned int timer_wheel_tick;
+#else
 // timer heap (binary heap of tid's)
 static BHEAP_VAR(int, timer_heap);
+#endif
 
 
 // server startup time
@@ -94,6 +130,474 @@ char* search_timer_func_list(TimerFunc func)
 	return "unknown timer function";
 }
 
+/*----------------------------
+ * 	Timer profiling
+ *----------------------------*/
+#define TIMER_PROFILE_SIZE 1024 // size of the hash table of timer functions, power of 2
+#define TIMER_PROFILE_BUCKETS 6 // execution time histogram: <10us, <100us, <1ms, <10ms, <100ms, >=100ms
+
+/// Execution statistics of a timer function.
+struct timer_profile {
+	TimerFunc func;
+	unsigned int calls;
+	uint64 total;// microseconds
+	uint64 max;// microseconds
+	unsigned int hist[TIMER_PROFILE_BUCKETS];
+};
+
+static struct timer_profile timer_profile[TIMER_PROFILE_SIZE];
+static bool timer_profile_enabled = false;
+
+/// Returns the statistics of a timer function, NULL if the table is full.
+static struct timer_profile* timer_profile_get(TimerFunc func)
+{
+	unsigned int hash = (unsigned int)(((uintptr_t)func >> 4) & (TIMER_PROFILE_SIZE-1));
+	unsigned int i;
+
+	for( i = 0; i < TIMER_PROFILE_SIZE; ++i )
+	{// linear probing
+		struct timer_profile* tp = &timer_profile[(hash + i) & (TIMER_PROFILE_SIZE-1)];
+		if( tp->func == func )
+			return tp;
+		if( tp->func == NULL )
+		{
+			tp->func = func;
+			return tp;
+		}
+	}
+	return NULL;
+}
+
+/// Records an execution of a timer function.
+static void timer_profile_add(TimerFunc func, uint64 usec)
+{
+	struct timer_profile* tp = timer_profile_get(func);
+	uint64 limit = 10;
+	int i;
+
+	if( tp == NULL )
+		return;
+	tp->calls++;
+	tp->total += usec;
+	if( tp->max < usec )
+		tp->max = usec;
+	for( i = 0; i < TIMER_PROFILE_BUCKETS-1 && usec >= limit; ++i )
+		limit *= 10;
+	tp->hist[i]++;
+}
+
+/// Starts or stops recording the execution time of the timer functions.
+void timer_profile_enable(bool enable)
+{
+	timer_profile_enabled = enable;
+}
+
+bool timer_profile_isenabled(void)
+{
+	return timer_profile_enabled;
+}
+
+/// Clears the recorded statistics.
+void timer_profile_reset(void)
+{
+	memset(timer_profile, 0, sizeof(timer_profile));
+}
+
+static int timer_profile_cmp(const void* a, const void* b)
+{
+	const struct timer_profile* tp1 = *(const struct timer_profile**)a;
+	const struct timer_profile* tp2 = *(const struct timer_profile**)b;
+
+	if( tp1->total == tp2->total )
+		return 0;
+	return ( tp1->total < tp2->total ) ? 1 : -1;
+}
+
+/// Reports the 'count' timer functions that took the most time, one line at a time.
+void timer_profile_report(int count, void (*print)(const char* line, void* ctx), void* ctx)
+{
+	struct timer_profile* list[TIMER_PROFILE_SIZE];
+	char line[256];
+	int i, n = 0;
+
+	for( i = 0; i < TIMER_PROFILE_SIZE; ++i )
+		if( timer_profile[i].calls > 0 )
+			list[n++] = &timer_profile[i];
+	qsort(list, n, sizeof(list[0]), timer_profile_cmp);
+
+	print("function                           calls   total ms   avg us   max us  <10us/<100us/<1ms/<10ms/<100ms/more", ctx);
+	for( i = 0; i < n && i < count; ++i )
+	{
+		struct timer_profile* tp = list[i];
+		snprintf(line, sizeof(line), "%-30.30s %9u %10.1f %8u %8u  %u/%u/%u/%u/%u/%u",
+			search_timer_func_list(tp->func), tp->calls, tp->total/1000.,
+			(unsigned int)(tp->total/tp->calls), (unsigned int)tp->max,
+			tp->hist[0], tp->hist[1], tp->hist[2], tp->hist[3], tp->hist[4], tp->hist[5]);
+		print(line, ctx);
+	}
+}
+
+/*----------------------------
+ * 	Main loop statistics
+ *----------------------------*/
+#define TICKSTAT_WINDOW 1024 // number of loop iterations in the rolling report
+#define TICKSTAT_TOP 16 // number of timer functions and packets tracked per iteration
+#define TICKSTAT_SHOW 5 // number of timer functions and packets shown for a slow iteration
+
+/// Time spent in a timer function or packet handler during the current iteration.
+struct tickstat_entry {
+	intptr_t key;
+	unsigned int calls;
+	uint64 usec;
+};
+
+static const char* tickstat_phase_name[TICKSTAT_MAX] = { "timer", "send", "wait", "recv", "parse" };
+
+static int tickstat_threshold = 0;// iterations that are busy for longer are reported (ms), 0 to disable
+static int tickstat_report_interval = 0;// seconds between rolling reports, 0 to disable
+static unsigned int tickstat_last_report = 0;
+
+// current iteration
+static enum tickstat_phase tickstat_cur = TICKSTAT_TIMER;
+static uint64 tickstat_mark = 0;
+static uint64 tickstat_usec[TICKSTAT_MAX];
+static struct tickstat_entry tickstat_timers[TICKSTAT_TOP];
+static struct tickstat_entry tickstat_packets[TICKSTAT_TOP];
+static int tickstat_timers_num = 0;
+static int tickstat_packets_num = 0;
+
+// last iterations, time of each phase and busy time (usec)
+static uint32 tickstat_window[TICKSTAT_WINDOW][TICKSTAT_MAX+1];
+static int tickstat_window_pos = 0;
+static int tickstat_window_len = 0;
+
+/// Adds time to an entry of the current iteration.
+/// When the list is full, the entry with the least time is replaced.
+static void tickstat_entry_add(struct tickstat_entry* list, int* num, intptr_t key, uint64 usec)
+{
+	int i, min = 0;
+
+	for( i = 0; i < *num; ++i )
+	{
+		if( list[i].key == key )
+		{
+			list[i].calls++;
+			list[i].usec += usec;
+			return;
+		}
+		if( list[i].usec < list[min].usec )
+			min = i;
+	}
+	if( *num < TICKSTAT_TOP )
+		i = (*num)++;
+	else if( list[min].usec < usec )
+		i = min;
+	else
+		return;
+	list[i].key = key;
+	list[i].calls = 1;
+	list[i].usec = usec;
+}
+
+static int tickstat_entry_cmp(const void* a, const void* b)
+{
+	const struct tickstat_entry* e1 = (const struct tickstat_entry*)a;
+	const struct tickstat_entry* e2 = (const struct tickstat_entry*)b;
+
+	if( e1->usec == e2->usec )
+		return 0;
+	return ( e1->usec < e2->usec ) ? 1 : -1;
+}
+
+static int tickstat_uint32_cmp(const void* a, const void* b)
+{
+	uint32 v1 = *(const uint32*)a;
+	uint32 v2 = *(const uint32*)b;
+
+	return ( v1 < v2 ) ? -1 : ( v1 > v2 );
+}
+
+/// Logs the breakdown of a slow iteration.
+static void tickstat_slow(uint64 busy)
+{
+	int i;
+
+	ShowWarning("Slow tick: %.1f ms busy (timer %.1f ms, send %.1f ms, recv %.1f ms, parse %.1f ms)\n",
+		busy/1000., tickstat_usec[TICKSTAT_TIMER]/1000., tickstat_usec[TICKSTAT_SEND]/1000.,
+		tickstat_usec[TICKSTAT_RECV]/1000., tickstat_usec[TICKSTAT_PARSE]/1000.);
+
+	qsort(tickstat_timers, tickstat_timers_num, sizeof(tickstat_timers[0]), tickstat_entry_cmp);
+	for( i = 0; i < tickstat_timers_num && i < TICKSTAT_SHOW; ++i )
+		ShowMessage("\ttimer %s: %u calls, %.1f ms\n", search_timer_func_list((TimerFunc)tickstat_timers[i].key), tickstat_timers[i].calls, tickstat_timers[i].usec/1000.);
+
+	qsort(tickstat_packets, tickstat_packets_num, sizeof(tickstat_packets[0]), tickstat_entry_cmp);
+	for( i = 0; i < tickstat_packets_num && i < TICKSTAT_SHOW; ++i )
+		ShowMessage("\tpacket 0x%04x: %u calls, %.1f ms\n", (int)tickstat_packets[i].key, tickstat_packets[i].calls, tickstat_packets[i].usec/1000.);
+}
+
+static void tickstat_console_print(const char* line, void* ctx)
+{
+	ShowInfo("%s\n", line);
+}
+
+/// Starts a main loop iteration, in the timer phase.
+void tickstat_begin(void)
+{
+	tickstat_cur = TICKSTAT_TIMER;
+	tickstat_mark = gettick_usec();
+}
+
+/// Switches to another phase of the main loop iteration.
+void tickstat_phase(enum tickstat_phase phase)
+{
+	uint64 now = gettick_usec();
+
+	tickstat_usec[tickstat_cur] += now - tickstat_mark;
+	tickstat_mark = now;
+	tickstat_cur = phase;
+}
+
+/// Ends a main loop iteration.
+/// Slow iterations and the rolling report are logged here.
+void tickstat_end(void)
+{
+	uint64 busy = 0;
+	int i;
+
+	tickstat_phase(TICKSTAT_TIMER);
+
+	for( i = 0; i < TICKSTAT_MAX; ++i )
+	{
+		if( i != TICKSTAT_WAIT )
+			busy += tickstat_usec[i];
+		tickstat_window[tickstat_window_pos][i] = (uint32)min(tickstat_usec[i], UINT32_MAX);
+	}
+	tickstat_window[tickstat_window_pos][TICKSTAT_MAX] = (uint32)min(busy, UINT32_MAX);
+	tickstat_window_pos = (tickstat_window_pos + 1)%TICKSTAT_WINDOW;
+	if( tickstat_window_len < TICKSTAT_WINDOW )
+		tickstat_window_len++;
+
+	if( tickstat_threshold > 0 && busy >= (uint64)tickstat_threshold*1000 )
+		tickstat_slow(busy);
+
+	if( tickstat_report_interval > 0 && DIFF_TICK(gettick(), tickstat_last_report) >= tickstat_report_interval*1000 )
+	{
+		tickstat_report(tickstat_console_print, NULL);
+		tickstat_last_report = gettick();
+	}
+
+	memset(tickstat_usec, 0, sizeof(tickstat_usec));
+	tickstat_timers_num = tickstat_packets_num = 0;
+}
+
+/// Returns true if the timer functions and packet handlers are measured.
+bool tickstat_isenabled(void)
+{
+	return ( tickstat_threshold > 0 );
+}
+
+/// Records the execution of a packet handler in the current iteration.
+void tickstat_add_packet(int cmd, uint64 usec)
+{
+	tickstat_entry_add(tickstat_packets, &tickstat_packets_num, cmd, usec);
+}
+
+/// Sets the busy time after which an iteration is reported (ms), 0 to disable.
+void tickstat_set_threshold(int ms)
+{
+	tickstat_threshold = max(ms, 0);
+}
+
+/// Sets the interval of the rolling report (seconds), 0 to disable.
+void tickstat_set_report_interval(int seconds)
+{
+	tickstat_report_interval = max(seconds, 0);
+	tickstat_last_report = gettick();
+}
+
+/// Reports the p50/p99/max time of each phase over the last iterations, one line at a time.
+void tickstat_report(void (*print)(const char* line, void* ctx), void* ctx)
+{
+	uint32 values[TICKSTAT_WINDOW];
+	char line[256];
+	int i, j, n = tickstat_window_len;
+
+	if( n == 0 )
+		return;
+
+	snprintf(line, sizeof(line), "Main loop, last %d iterations:       p50        p99        max", n);
+	print(line, ctx);
+	for( i = 0; i <= TICKSTAT_MAX; ++i )
+	{
+		int col = ( i == 0 ) ? TICKSTAT_MAX : i-1;// busy time first, then the phases
+
+		for( j = 0; j < n; ++j )
+			values[j] = tickstat_window[j][col];
+		qsort(values, n, sizeof(values[0]), tickstat_uint32_cmp);
+		snprintf(line, sizeof(line), "%-30s %7.1f ms %7.1f ms %7.1f ms", ( col == TICKSTAT_MAX ) ? "busy" : tickstat_phase_name[col],
+			values[n*50/100]/1000., values[n*99/100]/1000., values[n-1]/1000.);
+		print(line, ctx);
+	}
+}
+
+/*----------------------------
+ * 	Startup statistics
+ *----------------------------*/
+#define INITSTAT_STAGES 64 // number of stages tracked per report
+#define INITSTAT_DEPTH 8 // maximum depth of nested stages
+#define INITSTAT_FILES 10 // number of slowest files shown
+
+/// Time and memory used by a startup stage.
+struct initstat_stage {
+	const char* name;
+	int depth;
+	uint64 start;
+	uint64 usec;
+	long rss_start;// peak RSS when the stage started (KB)
+	long rss;// peak RSS when the stage ended (KB)
+};
+
+/// Time spent loading a file.
+struct initstat_file {
+	char name[256];
+	uint64 usec;
+};
+
+static struct initstat_stage initstat_stages[INITSTAT_STAGES];
+static int initstat_stages_num = 0;
+static int initstat_open[INITSTAT_DEPTH];// stages that are not done yet
+static int initstat_depth = 0;
+static struct initstat_file initstat_files[INITSTAT_FILES];
+static int initstat_files_num = 0;
+static int initstat_files_total = 0;
+static uint64 initstat_files_usec = 0;
+
+/// Returns the peak resident set size of the process (KB), 0 if unknown.
+static long initstat_peak_rss(void)
+{
+#if defined(WIN32)
+	return 0;
+#else
+	struct rusage usage;
+
+	if( getrusage(RUSAGE_SELF, &usage) != 0 )
+		return 0;
+#if defined(__APPLE__)
+	return (long)(usage.ru_maxrss/1024);// bytes
+#else
+	return (long)usage.ru_maxrss;
+#endif
+#endif
+}
+
+/// Forgets the recorded stages and files.
+void initstat_reset(void)
+{
+	initstat_stages_num = 0;
+	initstat_depth = 0;
+	initstat_files_num = 0;
+	initstat_files_total = 0;
+	initstat_files_usec = 0;
+}
+
+/// Starts a startup stage, stages can be nested.
+void initstat_begin(const char* name)
+{
+	struct initstat_stage* stage;
+
+	if( initstat_depth == INITSTAT_DEPTH )
+		return;
+	if( initstat_stages_num == INITSTAT_STAGES )
+	{
+		initstat_open[initstat_depth++] = -1;// not recorded
+		return;
+	}
+	stage = &initstat_stages[initstat_stages_num];
+	stage->name = name;
+	stage->depth = initstat_depth;
+	stage->usec = 0;
+	stage->rss_start = stage->rss = initstat_peak_rss();
+	stage->start = gettick_usec();
+	initstat_open[initstat_depth++] = initstat_stages_num++;
+}
+
+/// Ends the last started stage.
+void initstat_end(void)
+{
+	struct initstat_stage* stage;
+	int i;
+
+	if( initstat_depth == 0 )
+		return;
+	i = initstat_open[--initstat_depth];
+	if( i < 0 )
+		return;
+	stage = &initstat_stages[i];
+	stage->usec = gettick_usec() - stage->start;
+	stage->rss = initstat_peak_rss();
+}
+
+/// Records the time spent loading a file, the slowest ones are reported.
+void initstat_add_file(const char* name, uint64 usec)
+{
+	int i, min = 0;
+
+	initstat_files_total++;
+	initstat_files_usec += usec;
+	if( initstat_files_num < INITSTAT_FILES )
+		i = initstat_files_num++;
+	else
+	{
+		for( i = 1; i < INITSTAT_FILES; ++i )
+			if( initstat_files[i].usec < initstat_files[min].usec )
+				min = i;
+		if( initstat_files[min].usec >= usec )
+			return;
+		i = min;
+	}
+	safestrncpy(initstat_files[i].name, name, sizeof(initstat_files[i].name));
+	initstat_files[i].usec = usec;
+}
+
+static int initstat_file_cmp(const void* a, const void* b)
+{
+	const struct initstat_file* f1 = (const struct initstat_file*)a;
+	const struct initstat_file* f2 = (const struct initstat_file*)b;
+
+	if( f1->usec == f2->usec )
+		return 0;
+	return ( f1->usec < f2->usec ) ? 1 : -1;
+}
+
+/// Shows the time and peak RSS of each stage and the slowest files on the console.
+void initstat_report(void)
+{
+	int i;
+
+	if( initstat_stages_num == 0 )
+		return;
+
+	ShowInfo("Startup profile:                       time      peak RSS\n");
+	for( i = 0; i < initstat_stages_num; ++i )
+	{
+		struct initstat_stage* stage = &initstat_stages[i];
+		char name[64];
+
+		snprintf(name, sizeof(name), "%*s%s", stage->depth*2, "", stage->name);
+		if( stage->rss > 0 )
+			ShowMessage("\t%-30s %9.1f ms %7.1f MB (+%.1f)\n", name, stage->usec/1000., stage->rss/1024., (stage->rss - stage->rss_start)/1024.);
+		else
+			ShowMessage("\t%-30s %9.1f ms\n", name, stage->usec/1000.);
+	}
+
+	if( initstat_files_num == 0 )
+		return;
+	qsort(initstat_files, initstat_files_num, sizeof(initstat_files[0]), initstat_file_cmp);
+	ShowInfo("Slowest of %d files (%.1f ms in total):\n", initstat_files_total, initstat_files_usec/1000.);
+	for( i = 0; i < initstat_files_num; ++i )
+		ShowMessage("\t%9.1f ms  %s\n", initstat_files[i].usec/1000., initstat_files[i].name);
+}
+
 /*----------------------------
  * 	Get tick time
  *----------------------------*/
@@ -155,6 +659,27 @@ static unsigned int tick(void)
 #endif
 }
 
+/// Returns a tick in microseconds, for measuring short durations.
+uint64 gettick_usec(void)
+{
+#if defined(WIN32)
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER count;
+	if( freq.QuadPart == 0 )
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return (uint64)(count.QuadPart * 1000000 / freq.QuadPart);
+#elif defined(HAVE_MONOTONIC_CLOCK)
+	struct timespec tval;
+	clock_gettime(CLOCK_MONOTONIC, &tval);
+	return (uint64)tval.tv_sec * 1000000 + tval.tv_nsec / 1000;
+#else
+	struct timeval tval;
+	gettimeofday(&tval, NULL);
+	return (uint64)tval.tv_sec * 1000000 + tval.tv_usec;
+#endif
+}
+
 //////////////////////////////////////////////////////////////////////////
 #if defined(TICK_CACHE) && TICK_CACHE > 1
 //////////////////////////////////////////////////////////////////////////
@@ -190,6 +715,94 @@ unsigned int gettick(void)
 #endif
 //////////////////////////////////////////////////////////////////////////
 
+#ifdef TIMER_WHEEL
+/*======================================
+ * 	CORE : Timer Wheel
+ *--------------------------------------*/
+
+/// Returns the slot where a timer that expires at 'tick' belongs.
+/// Expired timers go to the slot that is processed next.
+static int timer_wheel_slot(unsigned int tick)
+{
+	int diff = DIFF_TICK(tick, timer_wheel_tick);
+
+	if( diff < 0 )
+		return timer_wheel_tick & (TIMER_WHEEL_ROOT_SIZE-1);
+	if( diff < TIMER_WHEEL_ROOT_SIZE )
+		return tick & (TIMER_WHEEL_ROOT_SIZE-1);
+	if( diff < 1<<(TIMER_WHEEL_ROOT_BITS + TIMER_WHEEL_LEVEL_BITS) )
+		return TIMER_WHEEL_INDEX(tick, 1);
+	if( diff < 1<<(TIMER_WHEEL_ROOT_BITS + 2*TIMER_WHEEL_LEVEL_BITS) )
+		return TIMER_WHEEL_INDEX(tick, 2);
+	if( diff < 1<<(TIMER_WHEEL_ROOT_BITS + 3*TIMER_WHEEL_LEVEL_BITS) )
+		return TIMER_WHEEL_INDEX(tick, 3);
+	return TIMER_WHEEL_INDEX(tick, 4);
+}
+
+/// Adds a timer to the end of its wheel slot.
+static void push_timer_heap(int tid)
+{
+	int slot = timer_wheel_slot(timer_data[tid].tick);
+	struct timer_wheel_link* link = &timer_wheel_link[tid];
+
+	link->slot = slot;
+	link->next = -1;
+	link->prev = timer_wheel_tail[slot];
+	if( link->prev != -1 )
+		timer_wheel_link[link->prev].next = tid;
+	else
+		timer_wheel_head[slot] = tid;
+	timer_wheel_tail[slot] = tid;
+}
+
+/// Removes a timer from its wheel slot.
+static void pop_timer_heap(int tid)
+{
+	struct timer_wheel_link* link = &timer_wheel_link[tid];
+
+	if( link->prev != -1 )
+		timer_wheel_link[link->prev].next = link->next;
+	else
+		timer_wheel_head[link->slot] = link->next;
+	if( link->next != -1 )
+		timer_wheel_link[link->next].prev = link->prev;
+	else
+		timer_wheel_tail[link->slot] = link->prev;
+	link->slot = -1;
+}
+
+/// Moves the timers of a slot to the lower levels.
+/// Returns the index of the slot within its level.
+static int timer_wheel_cascade(int lv)
+{
+	int slot = TIMER_WHEEL_INDEX(timer_wheel_tick, lv);
+	int tid = timer_wheel_head[slot];
+
+	timer_wheel_head[slot] = timer_wheel_tail[slot] = -1;
+	while( tid != -1 )
+	{
+		int next = timer_wheel_link[tid].next;
+		push_timer_heap(tid);
+		tid = next;
+	}
+	return slot - TIMER_WHEEL_INDEX(0, lv);
+}
+
+/// Returns the number of milliseconds until the next timer might expire.
+/// Only the first level is checked, timers of the other levels don't expire before it turns.
+static int timer_wheel_next(void)
+{
+	int diff;
+
+	for( diff = 0; diff < TIMER_WHEEL_ROOT_SIZE; ++diff )
+	{
+		int slot = (timer_wheel_tick + diff) & (TIMER_WHEEL_ROOT_SIZE-1);
+		if( timer_wheel_head[slot] != -1 || slot == 0 )
+			break;// slot 0 is where the other levels cascade
+	}
+	return diff + 1;// timer_wheel_tick is one tick ahead of the last processed tick
+}
+#else
 /*======================================
  * 	CORE : Timer Heap
  *--------------------------------------*/
@@ -200,6 +813,7 @@ static void push_timer_heap(int tid)
 	BHEAP_ENSURE(timer_heap, 1, 256);
 	BHEAP_PUSH(timer_heap, tid, DIFFTICK_MINTOPCMP, swap);
 }
+#endif
 
 /*==========================
  * 	Timer Management
@@ -209,6 +823,9 @@ static void push_timer_heap(int tid)
 static int acquire_timer(void)
 {
 	int tid;
+#ifdef TIMER_WHEEL
+	int i;
+#endif
 
 	// select a free timer
 	if (free_timer_list_pos) {
@@ -229,6 +846,11 @@ static int acquire_timer(void)
 		else
 			CREATE(timer_data, struct TimerData, timer_data_max);
 		memset(timer_data + (timer_data_max - 256), 0, sizeof(struct TimerData)*256);
+#ifdef TIMER_WHEEL
+		RECREATE(timer_wheel_link, struct timer_wheel_link, timer_data_max);
+		for( i = timer_data_max - 256; i < timer_data_max; ++i )
+			timer_wheel_link[i].slot = -1;
+#endif
 	}
 
 	if( tid >= timer_data_num )
@@ -237,6 +859,18 @@ static int acquire_timer(void)
 	return tid;
 }
 
+/// Returns a timer to the list of free timers.
+static void release_timer(int tid)
+{
+	timer_data[tid].type = 0;
+	if (free_timer_list_pos >= free_timer_list_max) {
+		free_timer_list_max += 256;
+		RECREATE(free_timer_list,int,free_timer_list_max);
+		memset(free_timer_list + (free_timer_list_max - 256), 0, 256 * sizeof(int));
+	}
+	free_timer_list[free_timer_list_pos++] = tid;
+}
+
 /// Starts a new timer that is deleted once it expires (single-use).
 /// Returns the timer's id.
 int add_timer(unsigned int tick, TimerFunc func, int id, intptr_t data)
@@ -302,6 +936,14 @@ int delete_timer(int tid, TimerFunc func)
 	}
 
 	timer_data[tid].func = NULL;
+#ifdef TIMER_WHEEL
+	if( timer_wheel_link[tid].slot != -1 )
+	{// not running, can be released right away
+		pop_timer_heap(tid);
+		release_timer(tid);
+		return 0;
+	}
+#endif
 	timer_data[tid].type = TIMER_ONCE_AUTODEL;
 
 	return 0;
@@ -318,6 +960,25 @@ int addtick_timer(int tid, unsigned int tick)
 /// Returns the new tick value, or -1 if it fails.
 int settick_timer(int tid, unsigned int tick)
 {
+#ifdef TIMER_WHEEL
+	if( timer_wheel_link[tid].slot == -1 )
+	{
+		ShowError("settick_timer: no such timer %d (%p(%s))\n", tid, timer_data[tid].func, search_timer_func_list(timer_data[tid].func));
+		return -1;
+	}
+
+	if( (int)tick == -1 )
+		tick = 0;// add 1ms to avoid the error value -1
+
+	if( timer_data[tid].tick == tick )
+		return (int)tick;// nothing to do, already in propper position
+
+	// move the timer to the slot of the new tick
+	pop_timer_heap(tid);
+	timer_data[tid].tick = tick;
+	push_timer_heap(tid);
+	return (int)tick;
+#else
 	size_t i;
 
 	// search timer position
@@ -339,6 +1000,59 @@ int settick_timer(int tid, unsigned int tick)
 	timer_data[tid].tick = tick;
 	BHEAP_PUSH(timer_heap, tid, DIFFTICK_MINTOPCMP, swap);
 	return (int)tick;
+#endif
+}
+
+/// Executes an expired timer that was removed from the timer_heap.
+static void run_timer(int tid, unsigned int tick)
+{
+	int diff = DIFF_TICK(timer_data[tid].tick, tick);
+
+	timer_data[tid].type |= TIMER_REMOVE_HEAP;
+
+	if( timer_data[tid].func )
+	{
+		TimerFunc func = timer_data[tid].func;
+		bool profile = timer_profile_enabled;// the callback can change it
+		bool stat = tickstat_isenabled();
+		uint64 start = ( profile || stat ) ? gettick_usec() : 0;
+
+		if( diff < -1000 )
+			// timer was delayed for more than 1 second, use current tick instead
+			func(tid, tick, timer_data[tid].id, timer_data[tid].data);
+		else
+			func(tid, timer_data[tid].tick, timer_data[tid].id, timer_data[tid].data);
+
+		if( profile || stat )
+		{
+			uint64 usec = gettick_usec() - start;
+			if( profile )
+				timer_profile_add(func, usec);
+			if( stat )
+				tickstat_entry_add(tickstat_timers, &tickstat_timers_num, (intptr_t)func, usec);
+		}
+	}
+
+	// in the case the function didn't change anything...
+	if( timer_data[tid].type & TIMER_REMOVE_HEAP )
+	{
+		timer_data[tid].type &= ~TIMER_REMOVE_HEAP;
+
+		switch( timer_data[tid].type )
+		{
+		default:
+		case TIMER_ONCE_AUTODEL:
+			release_timer(tid);
+		break;
+		case TIMER_INTERVAL:
+			if( DIFF_TICK(timer_data[tid].tick, tick) < -1000 )
+				timer_data[tid].tick = tick + timer_data[tid].interval;
+			else
+				timer_data[tid].tick += timer_data[tid].interval;
+			push_timer_heap(tid);
+		break;
+		}
+	}
 }
 
 /// Executes all expired timers.
@@ -347,6 +1061,29 @@ int do_timer(unsigned int tick)
 {
 	int diff = TIMER_MAX_INTERVAL; // return value
 
+#ifdef TIMER_WHEEL
+	// process the slots one tick at a time
+	while( DIFF_TICK(tick, timer_wheel_tick) >= 0 )
+	{
+		int slot = timer_wheel_tick & (TIMER_WHEEL_ROOT_SIZE-1);
+		int tid;
+
+		if( slot == 0 )
+		{// the first level turned, bring down the timers of the next slot of each level
+			int lv;
+			for( lv = 1; lv <= TIMER_WHEEL_LEVELS && timer_wheel_cascade(lv) == 0; ++lv );
+		}
+
+		// timers added to this slot by the callbacks are processed too
+		while( (tid = timer_wheel_head[slot]) != -1 )
+		{
+			pop_timer_heap(tid);
+			run_timer(tid, tick);
+		}
+		++timer_wheel_tick;
+	}
+	diff = timer_wheel_next();
+#else
 	// process all timers one by one
 	while( BHEAP_LENGTH(timer_heap) )
 	{
@@ -358,44 +1095,9 @@ int do_timer(unsigned int tick)
 
 		// remove timer
 		BHEAP_POP(timer_heap, DIFFTICK_MINTOPCMP, swap);
-		timer_data[tid].type |= TIMER_REMOVE_HEAP;
-
-		if( timer_data[tid].func )
-		{
-			if( diff < -1000 )
-				// timer was delayed for more than 1 second, use current tick instead
-				timer_data[tid].func(tid, tick, timer_data[tid].id, timer_data[tid].data);
-			else
-				timer_data[tid].func(tid, timer_data[tid].tick, timer_data[tid].id, timer_data[tid].data);
-		}
-
-		// in the case the function didn't change anything...
-		if( timer_data[tid].type & TIMER_REMOVE_HEAP )
-		{
-			timer_data[tid].type &= ~TIMER_REMOVE_HEAP;
-
-			switch( timer_data[tid].type )
-			{
-			default:
-			case TIMER_ONCE_AUTODEL:
-				timer_data[tid].type = 0;
-				if (free_timer_list_pos >= free_timer_list_max) {
-					free_timer_list_max += 256;
-					RECREATE(free_timer_list,int,free_timer_list_max);
-					memset(free_timer_list + (free_timer_list_max - 256), 0, 256 * sizeof(int));
-				}
-				free_timer_list[free_timer_list_pos++] = tid;
-			break;
-			case TIMER_INTERVAL:
-				if( DIFF_TICK(timer_data[tid].tick, tick) < -1000 )
-					timer_data[tid].tick = tick + timer_data[tid].interval;
-				else
-					timer_data[tid].tick += timer_data[tid].interval;
-				push_timer_heap(tid);
-			break;
-			}
-		}
+		run_timer(tid, tick);
 	}
+#endif
 
 	return cap_value(diff, TIMER_MIN_INTERVAL, TIMER_MAX_INTERVAL);
 }
@@ -510,6 +1212,12 @@ void timer_init(void)
 #endif
 
 	time(&start_time);
+
+#ifdef TIMER_WHEEL
+	memset(timer_wheel_head, -1, sizeof(timer_wheel_head));
+	memset(timer_wheel_tail, -1, sizeof(timer_wheel_tail));
+	timer_wheel_tick = gettick_nocache();
+#endif
 }
 
 void timer_final(void)
@@ -524,6 +1232,10 @@ void timer_final(void)
 	}
 
 	if (timer_data) aFree(timer_data);
+#ifdef TIMER_WHEEL
+	if (timer_wheel_link) aFree(timer_wheel_link);
+#else
 	BHEAP_CLEAR(timer_heap);
+#endif
 	if (free_timer_list) aFree(free_timer_list);
 }
@@ -19,6 +19,16 @@ enum {
 	TIMER_REMOVE_HEAP = 0x10,
 };
 
+// main loop phases, see tickstat_phase
+enum tickstat_phase {
+	TICKSTAT_TIMER,
+	TICKSTAT_SEND,
+	TICKSTAT_WAIT,// waiting for network events, not counted as busy time
+	TICKSTAT_RECV,
+	TICKSTAT_PARSE,
+	TICKSTAT_MAX
+};
+
 // Struct declaration
 
 typedef int (*TimerFunc)(int tid, unsigned int tick, int id, intptr_t data);
@@ -38,6 +48,7 @@ struct TimerData {
 
 unsigned int gettick(void);
 unsigned int gettick_nocache(void);
+uint64 gettick_usec(void);
 
 int add_timer(unsigned int tick, TimerFunc func, int id, intptr_t data);
 int add_timer_interval(unsigned int tick, TimerFunc func, int id, intptr_t data, int interval);
@@ -49,6 +60,32 @@ int settick_timer(int tid, unsigned int tick);
 
 int add_timer_func_list(TimerFunc func, char* name);
 
+// timer profiler
+void timer_profile_enable(bool enable);
+bool timer_profile_isenabled(void);
+void timer_profile_reset(void);
+void timer_profile_report(int count, void (*print)(const char* line, void* ctx), void* ctx);
+
+// main loop statistics
+void tickstat_begin(void);
+void tickstat_phase(enum tickstat_phase phase);
+void tickstat_end(void);
+bool tickstat_isenabled(void);
+void tickstat_add_packet(int cmd, uint64 usec);
+void tickstat_set_threshold(int ms);
+void tickstat_set_report_interval(int seconds);
+void tickstat_report(void (*print)(const char* line, void* ctx), void* ctx);
+
+// startup statistics
+void initstat_reset(void);
+void initstat_begin(const char* name);
+void initstat_end(void);
+void initstat_add_file(const char* name, uint64 usec);
+void initstat_report(void);
+
+/// Runs a startup stage named after the call, see initstat_begin.
+#define initstat_stage(call) do{ initstat_begin(#call); call; initstat_end(); }while(0)
+
 unsigned long get_uptime(void);
 
 //transform a timestamp to string
@@ -572,6 +572,8 @@ bool login_config_read(const char* cfgName, bool normal) {
 			safestrncpy(db_path, w2, ARRAYLENGTH(db_path));
 		else if(!strcmpi(w1,"stdout_with_ansisequence"))
 			stdout_with_ansisequence = config_switch(w2);
+		else if(!strcmpi(w1,"console_msg_async"))
+			console_msg_async = config_switch(w2);
 		else if(!strcmpi(w1,"console_silent")) {
 			msg_silent = atoi(w2);
 			if( msg_silent ) /* only bother if we actually have this enabled */
@@ -807,17 +809,20 @@ void set_server_type(void) {
  */
 int do_init(int argc, char** argv) {
 	runflag = LOGINSERVER_ST_STARTING;
+	initstat_begin("do_init");
 
 	// initialize engine
 	accounts = account_db_sql();
 
 	// read login-server configuration
+	initstat_begin("config files");
 	login_set_defaults();
 	logcnslif_get_options(argc,argv);
 
 	login_config_read(login_config.loginconf_name, true);
 	msg_config_read(login_config.msgconf_name);
 	login_lan_config_read(login_config.lanconf_name);
+	initstat_end();
 	//end config
 
 	rnd_init();
@@ -827,10 +832,10 @@ int do_init(int argc, char** argv) {
 
 	// initialize logging
 	if( login_config.log_login )
-		loginlog_init();
+		initstat_stage(loginlog_init());
 
 	// initialize static and dynamic ipban system
-	ipban_init();
+	initstat_stage(ipban_init());
 
 	// Online user database init
 	online_db = idb_alloc(DB_OPT_RELEASE_DATA);
@@ -851,10 +856,12 @@ int do_init(int argc, char** argv) {
 		ShowFatalError("do_init: account engine not found.\n");
 		exit(EXIT_FAILURE);
 	} else {
+		initstat_begin("accounts->init()");
 		if(!accounts->init(accounts)) {
 			ShowFatalError("do_init: Failed to initialize account engine.\n");
 			exit(EXIT_FAILURE);
 		}
+		initstat_end();
 	}
 
 	// server port open & binding
@@ -869,6 +876,8 @@ int do_init(int argc, char** argv) {
 	}
 
 	do_init_logincnslif();
+	initstat_end();
+	initstat_report();
 
 	ShowStatus("The login-server is "CL_GREEN"ready"CL_RESET" (Server is listening on the port %u).\n\n", login_config.login_port);
 	login_log(0, "login server", 100, "login server started");
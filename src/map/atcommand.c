@@ -3819,9 +3819,13 @@ ACMD_FUNC(reload) {
 		mapit_free(iter);
 
 		flush_fifos();
-		map_reloadnpc(true); // reload config files seeking for npcs
-		script_reload();
-		npc_reload();
+		initstat_reset();
+		initstat_begin("reloadscript");
+		initstat_stage(map_reloadnpc(true)); // reload config files seeking for npcs
+		initstat_stage(script_reload());
+		initstat_stage(npc_reload());
+		initstat_end();
+		initstat_report();
 
 		clif_displaymessage(fd, msg_txt(sd,100)); // Scripts have been reloaded.
 	} else if (strstr(command, "msgconf") || strncmp(message, "msgconf", 3) == 0) {
@@ -9704,6 +9708,80 @@ ACMD_FUNC(clonestat) {
 	return 0;
 }
 
+/// Prints a line of a report in the chat of the player.
+static void atcommand_report_print(const char* line, void* ctx)
+{
+	clif_displaymessage(*(const int*)ctx, line);
+}
+
+/*==========================================
+ * @timerprofile {start|stop|reset}
+ * Shows the timer functions that took the most time
+ *------------------------------------------*/
+ACMD_FUNC(timerprofile)
+{
+	char action[16];
+
+	memset(action, '\0', sizeof(action));
+	if( message && *message && sscanf(message, "%15s", action) < 1 ) {
+		clif_displaymessage(fd, msg_txt(sd,1500)); // Usage: @timerprofile {start|stop|reset}
+		return -1;
+	}
+
+	if( strcmpi(action, "start") == 0 ) {
+		timer_profile_enable(true);
+		clif_displaymessage(fd, msg_txt(sd,1497)); // Timer profiler started.
+	} else if( strcmpi(action, "stop") == 0 ) {
+		timer_profile_enable(false);
+		clif_displaymessage(fd, msg_txt(sd,1498)); // Timer profiler stopped.
+	} else if( strcmpi(action, "reset") == 0 ) {
+		timer_profile_reset();
+		clif_displaymessage(fd, msg_txt(sd,1499)); // Timer profiler statistics cleared.
+	} else if( action[0] ) {
+		clif_displaymessage(fd, msg_txt(sd,1500)); // Usage: @timerprofile {start|stop|reset}
+		return -1;
+	} else {
+		if( !timer_profile_isenabled() )
+			clif_displaymessage(fd, msg_txt(sd,1501)); // The timer profiler is stopped, use '@timerprofile start' to start it.
+		timer_profile_report(10, atcommand_report_print, (void*)&fd);
+	}
+	return 0;
+}
+
+/*==========================================
+ * @packetstats {start|stop|reset}
+ * Shows the client packets whose handlers took the most time
+ *------------------------------------------*/
+ACMD_FUNC(packetstats)
+{
+	char action[16];
+
+	memset(action, '\0', sizeof(action));
+	if( message && *message && sscanf(message, "%15s", action) < 1 ) {
+		clif_displaymessage(fd, msg_txt(sd,1505)); // Usage: @packetstats {start|stop|reset}
+		return -1;
+	}
+
+	if( strcmpi(action, "start") == 0 ) {
+		clif_packet_stats_enable(true);
+		clif_displaymessage(fd, msg_txt(sd,1502)); // Packet statistics started.
+	} else if( strcmpi(action, "stop") == 0 ) {
+		clif_packet_stats_enable(false);
+		clif_displaymessage(fd, msg_txt(sd,1503)); // Packet statistics stopped.
+	} else if( strcmpi(action, "reset") == 0 ) {
+		clif_packet_stats_reset();
+		clif_displaymessage(fd, msg_txt(sd,1504)); // Packet statistics cleared.
+	} else if( action[0] ) {
+		clif_displaymessage(fd, msg_txt(sd,1505)); // Usage: @packetstats {start|stop|reset}
+		return -1;
+	} else {
+		if( !clif_packet_stats_isenabled() )
+			clif_displaymessage(fd, msg_txt(sd,1506)); // The packet statistics are stopped, use '@packetstats start' to start them.
+		clif_packet_stats_report(10, atcommand_report_print, (void*)&fd);
+	}
+	return 0;
+}
+
 #include "../custom/atcommand.inc"
 
 /**
@@ -9994,6 +10072,8 @@ void atcommand_basecommands(void) {
 		ACMD_DEF(costume),
 		ACMD_DEF(cloneequip),
 		ACMD_DEF(clonestat),
+		ACMD_DEF(timerprofile),
+		ACMD_DEF(packetstats),
 	};
 	AtCommandInfo* atcommand;
 	int i;
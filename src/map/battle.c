@@ -8176,6 +8176,10 @@ static const struct _battle_data {
 	{ "homunculus_evo_intimacy_need",       &battle_config.homunculus_evo_intimacy_need,    91100,  0,      INT_MAX,        },
 	{ "homunculus_evo_intimacy_reset",      &battle_config.homunculus_evo_intimacy_reset,   1000,   0,      INT_MAX,        },
 	{ "monster_loot_search_type",           &battle_config.monster_loot_search_type,        1,      0,      1,              },
+	{ "fast_pathfinding",                   &battle_config.fast_pathfinding,                1,      0,      1,              },
+	{ "chase_flowfield",                    &battle_config.chase_flowfield,                 0,      0,      1,              },
+	{ "mob_hibernate_time",                 &battle_config.mob_hibernate_time,              0,      0,      INT_MAX,        },
+	{ "mob_hibernate_despawn",              &battle_config.mob_hibernate_despawn,           0,      0,      1,              },
 };
 
 #ifndef STATS_OPT_OUT
@@ -589,6 +589,10 @@ extern struct Battle_Config
 	int homunculus_evo_intimacy_need;
 	int homunculus_evo_intimacy_reset;
 	int monster_loot_search_type;
+	int fast_pathfinding;
+	int chase_flowfield;
+	int mob_hibernate_time;
+	int mob_hibernate_despawn;
 } battle_config;
 
 void do_init_battle(void);
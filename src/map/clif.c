@@ -65,6 +65,15 @@ struct Clif_Config {
 
 struct s_packet_db packet_db[MAX_PACKET_VER + 1][MAX_PACKET_DB + 1];
 int packet_db_ack[MAX_PACKET_VER + 1][MAX_ACK_FUNC + 1];
+
+/// Statistics of a client packet, see clif_packet_stats_enable.
+struct s_packet_stats {
+	unsigned int count;
+	uint64 bytes;
+	uint64 usec;// time spent in the handler
+};
+static struct s_packet_stats (*packet_stats)[MAX_PACKET_DB + 1] = NULL;// [packet_ver][cmd], allocated on first use
+static bool packet_stats_enabled = false;
 #ifdef PACKET_OBFUSCATION
 static struct s_packet_keys *packet_keys[MAX_PACKET_VER + 1];
 static unsigned int clif_cryptKey[3]; // Used keys
@@ -284,6 +293,19 @@ static inline unsigned char clif_bl_type(struct block_list *bl) {
 }
 #endif
 
+/// Queues a packet of clif_send on the write fifo of a client.
+/// The shared packet is used when there is one, the buffer is copied otherwise.
+static void clif_send_fd(int fd, const uint8* buf, int len, struct shared_packet* sp)
+{
+	if( sp ) {
+		shared_packet_send(fd, sp);
+		return;
+	}
+	WFIFOHEAD(fd,len);
+	memcpy(WFIFOP(fd,0), buf, len);
+	WFIFOSET(fd,len);
+}
+
 /*==========================================
  * sub process of clif_send
  * Called from a map_foreachinarea (grabs all players in specific area and subjects them to this function)
@@ -298,6 +320,7 @@ static int clif_send_sub(struct block_list *bl, va_list ap)
 {
 	struct block_list *src_bl;
 	struct map_session_data *sd;
+	struct shared_packet *sp;
 	unsigned char *buf;
 	int len, type, fd;
 
@@ -312,6 +335,7 @@ static int clif_send_sub(struct block_list *bl, va_list ap)
 	len = va_arg(ap,int);
 	nullpo_ret(src_bl = va_arg(ap,struct block_list*));
 	type = va_arg(ap,int);
+	sp = va_arg(ap,struct shared_packet*);
 
 	switch(type) {
 	case AREA_WOS:
@@ -346,7 +370,6 @@ static int clif_send_sub(struct block_list *bl, va_list ap)
 		!sd->sc.data[SC_INTRAVISION] && battle_check_target(src_bl,&sd->bl,BCT_ENEMY) > 0)
 		return 0;
 
-	WFIFOHEAD(fd, len);
 	if (WFIFOP(fd,0) == buf) {
 		ShowError("WARNING: Invalid use of clif_send function\n");
 		ShowError("         Packet x%4x use a WFIFO of a player instead of to use a buffer.\n", WBUFW(buf,0));
@@ -357,10 +380,8 @@ static int clif_send_sub(struct block_list *bl, va_list ap)
 		return 0;
 	}
 
-	if (packet_db[sd->packet_ver][RBUFW(buf,0)].len) { // packet must exist for the client version
-		memcpy(WFIFOP(fd,0), buf, len);
-		WFIFOSET(fd,len);
-	}
+	if (packet_db[sd->packet_ver][RBUFW(buf,0)].len) // packet must exist for the client version
+		clif_send_fd(fd, buf, len, sp);
 
 	return 0;
 }
@@ -378,12 +399,16 @@ int clif_send(const uint8* buf, int len, struct block_list* bl, enum send_target
 	struct battleground_data *bg = NULL;
 	int x0 = 0, x1 = 0, y0 = 0, y1 = 0, fd;
 	struct s_mapiterator* iter;
+	struct shared_packet* sp = NULL;
 
 	if( type != ALL_CLIENT )
 		nullpo_ret(bl);
 
 	sd = BL_CAST(BL_PC, bl);
 
+	if( type != SELF && len >= SHARED_PACKET_MIN_SIZE ) // encoded once, shared by the write fifos of all recipients
+		sp = shared_packet_create(buf, len);
+
 	switch(type) {
 
 	case ALL_CLIENT: //All player clients.
@@ -392,9 +417,7 @@ int clif_send(const uint8* buf, int len, struct block_list* bl, enum send_target
 		{
 			if( packet_db[tsd->packet_ver][RBUFW(buf,0)].len )
 			{ // packet must exist for the client version
-				WFIFOHEAD(tsd->fd, len);
-				memcpy(WFIFOP(tsd->fd,0), buf, len);
-				WFIFOSET(tsd->fd,len);
+				clif_send_fd(tsd->fd, buf, len, sp);
 			}
 		}
 		mapit_free(iter);
@@ -406,9 +429,7 @@ int clif_send(const uint8* buf, int len, struct block_list* bl, enum send_target
 		{
 			if( bl->m == tsd->bl.m && packet_db[tsd->packet_ver][RBUFW(buf,0)].len )
 			{ // packet must exist for the client version
-				WFIFOHEAD(tsd->fd, len);
-				memcpy(WFIFOP(tsd->fd,0), buf, len);
-				WFIFOSET(tsd->fd,len);
+				clif_send_fd(tsd->fd, buf, len, sp);
 			}
 		}
 		mapit_free(iter);
@@ -421,11 +442,11 @@ int clif_send(const uint8* buf, int len, struct block_list* bl, enum send_target
 	case AREA_WOC:
 	case AREA_WOS:
 		map_foreachinarea(clif_send_sub, bl->m, bl->x-AREA_SIZE, bl->y-AREA_SIZE, bl->x+AREA_SIZE, bl->y+AREA_SIZE,
-			BL_PC, buf, len, bl, type);
+			BL_PC, buf, len, bl, type, sp);
 		break;
 	case AREA_CHAT_WOC:
 		map_foreachinarea(clif_send_sub, bl->m, bl->x-(AREA_SIZE-5), bl->y-(AREA_SIZE-5),
-			bl->x+(AREA_SIZE-5), bl->y+(AREA_SIZE-5), BL_PC, buf, len, bl, AREA_WOC);
+			bl->x+(AREA_SIZE-5), bl->y+(AREA_SIZE-5), BL_PC, buf, len, bl, AREA_WOC, sp);
 		break;
 
 	case CHAT:
@@ -445,9 +466,7 @@ int clif_send(const uint8* buf, int len, struct block_list* bl, enum send_target
 				if (packet_db[cd->usersd[i]->packet_ver][RBUFW(buf,0)].len) { // packet must exist for the client version
 					if ((fd=cd->usersd[i]->fd) >0 && session[fd]) // Added check to see if session exists [PoW]
 					{
-						WFIFOHEAD(fd,len);
-						memcpy(WFIFOP(fd,0), buf, len);
-						WFIFOSET(fd,len);
+						clif_send_fd(fd, buf, len, sp);
 					}
 				}
 			}
@@ -486,9 +505,7 @@ int clif_send(const uint8* buf, int len, struct block_list* bl, enum send_target
 
 				if( packet_db[sd->packet_ver][RBUFW(buf,0)].len )
 				{ // packet must exist for the client version
-					WFIFOHEAD(fd,len);
-					memcpy(WFIFOP(fd,0), buf, len);
-					WFIFOSET(fd,len);
+					clif_send_fd(fd, buf, len, sp);
 				}
 			}
 			if (!enable_spy) //Skip unnecessary parsing. [Skotlex]
@@ -499,9 +516,7 @@ int clif_send(const uint8* buf, int len, struct block_list* bl, enum send_target
 			{
 				if( tsd->partyspy == p->party.party_id && packet_db[tsd->packet_ver][RBUFW(buf,0)].len )
 				{ // packet must exist for the client version
-					WFIFOHEAD(tsd->fd, len);
-					memcpy(WFIFOP(tsd->fd,0), buf, len);
-					WFIFOSET(tsd->fd,len);
+					clif_send_fd(tsd->fd, buf, len, sp);
 				}
 			}
 			mapit_free(iter);
@@ -519,9 +534,7 @@ int clif_send(const uint8* buf, int len, struct block_list* bl, enum send_target
 				continue;
 			if( sd->duel_group == tsd->duel_group && packet_db[tsd->packet_ver][RBUFW(buf,0)].len )
 			{ // packet must exist for the client version
-				WFIFOHEAD(tsd->fd, len);
-				memcpy(WFIFOP(tsd->fd,0), buf, len);
-				WFIFOSET(tsd->fd,len);
+				clif_send_fd(tsd->fd, buf, len, sp);
 			}
 		}
 		mapit_free(iter);
@@ -529,9 +542,7 @@ int clif_send(const uint8* buf, int len, struct block_list* bl, enum send_target
 
 	case SELF:
 		if (sd && (fd=sd->fd) && packet_db[sd->packet_ver][RBUFW(buf,0)].len) { // packet must exist for the client version
-			WFIFOHEAD(fd,len);
-			memcpy(WFIFOP(fd,0), buf, len);
-			WFIFOSET(fd,len);
+			clif_send_fd(fd, buf, len, sp);
 		}
 		break;
 
@@ -571,9 +582,7 @@ int clif_send(const uint8* buf, int len, struct block_list* bl, enum send_target
 
 					if( packet_db[sd->packet_ver][RBUFW(buf,0)].len )
 					{ // packet must exist for the client version
-						WFIFOHEAD(fd,len);
-						memcpy(WFIFOP(fd,0), buf, len);
-						WFIFOSET(fd,len);
+						clif_send_fd(fd, buf, len, sp);
 					}
 				}
 			}
@@ -585,9 +594,7 @@ int clif_send(const uint8* buf, int len, struct block_list* bl, enum send_target
 			{
 				if( tsd->guildspy == g->guild_id && packet_db[tsd->packet_ver][RBUFW(buf,0)].len )
 				{ // packet must exist for the client version
-					WFIFOHEAD(tsd->fd, len);
-					memcpy(WFIFOP(tsd->fd,0), buf, len);
-					WFIFOSET(tsd->fd,len);
+					clif_send_fd(tsd->fd, buf, len, sp);
 				}
 			}
 			mapit_free(iter);
@@ -618,9 +625,7 @@ int clif_send(const uint8* buf, int len, struct block_list* bl, enum send_target
 					continue;
 				if( packet_db[sd->packet_ver][RBUFW(buf,0)].len )
 				{ // packet must exist for the client version
-					WFIFOHEAD(fd,len);
-					memcpy(WFIFOP(fd,0), buf, len);
-					WFIFOSET(fd,len);
+					clif_send_fd(fd, buf, len, sp);
 				}
 			}
 		}
@@ -628,9 +633,13 @@ int clif_send(const uint8* buf, int len, struct block_list* bl, enum send_target
 
 	default:
 		ShowError("clif_send: Unrecognized type %d\n",type);
+		if( sp )
+			shared_packet_release(sp);
 		return -1;
 	}
 
+	if( sp )
+		shared_packet_release(sp);
 	return 0;
 }
 
@@ -4071,8 +4080,8 @@ void clif_tradeadditem(struct map_session_data* sd, struct map_session_data* tsd
 	nullpo_retv(tsd);
 
 	fd = tsd->fd;
-	buf = WFIFOP(fd,0);
 	WFIFOHEAD(fd,packet_len(cmd));
+	buf = WFIFOP(fd,0);
 	WBUFW(buf,0) = cmd;
 	if( index == 0 )
 	{
@@ -5843,26 +5852,29 @@ void clif_broadcast2(struct block_list* bl, const char* mes, int len, unsigned l
 void clif_channel_msg(struct Channel *channel, struct map_session_data *sd, char *msg, short color) {
 	DBIterator *iter;
 	struct map_session_data *user;
-	unsigned short msg_len = strlen(msg) + 1;
+	struct shared_packet *sp;
+	unsigned short msg_len = min(strlen(msg) + 1, CHAN_MSG_LENGTH);
+	uint8 buf[CHAN_MSG_LENGTH + 12];
 
-	WFIFOHEAD(sd->fd,msg_len + 12);
-	WFIFOW(sd->fd,0) = 0x2C1;
-	WFIFOW(sd->fd,2) = msg_len + 12;
-	WFIFOL(sd->fd,4) = 0;
-	WFIFOL(sd->fd,8) = channel_config.colors[color];
-	safestrncpy((char*)WFIFOP(sd->fd,12), msg, msg_len);
+	WBUFW(buf,0) = 0x2C1;
+	WBUFW(buf,2) = msg_len + 12;
+	WBUFL(buf,4) = 0;
+	WBUFL(buf,8) = channel_config.colors[color];
+	safestrncpy((char*)WBUFP(buf,12), msg, msg_len);
 
+	// encoded once, shared by the write fifos of all channel users
+	sp = ( msg_len + 12 >= SHARED_PACKET_MIN_SIZE ) ? shared_packet_create(buf, msg_len + 12) : NULL;
 	iter = db_iterator(channel->users);
 	for( user = dbi_first(iter); dbi_exists(iter); user = dbi_next(iter) ) {
 		if( user->fd == sd->fd )
 			continue;
-		WFIFOHEAD(user->fd,msg_len + 12);
-		memcpy(WFIFOP(user->fd,0), WFIFOP(sd->fd,0), msg_len + 12);
-		WFIFOSET(user->fd, msg_len + 12);
+		clif_send_fd(user->fd, buf, msg_len + 12, sp);
 	}
 	dbi_destroy(iter);
 
-	WFIFOSET(sd->fd, msg_len + 12);
+	clif_send_fd(sd->fd, buf, msg_len + 12, sp);
+	if( sp )
+		shared_packet_release(sp);
 }
 
 /// Displays heal effect (ZC_RECOVERY).
@@ -9779,8 +9791,11 @@ void clif_parse_LoadEndAck(int fd,struct map_session_data *sd)
 			pc_setinvincibletimer(sd,battle_config.pc_invincible_time);
 	}
 
-	if( map[sd->bl.m].users++ == 0 && battle_config.dynamic_mobs )
-		map_spawnmobs(sd->bl.m);
+	if( map[sd->bl.m].users++ == 0 ) {
+		mob_thaw(sd->bl.m);
+		if( battle_config.dynamic_mobs )
+			map_spawnmobs(sd->bl.m);
+	}
 	if( !(sd->sc.option&OPTION_INVISIBLE) ) { // increment the number of pvp players on the map
 		map[sd->bl.m].users_pvp++;
 	}
@@ -17842,6 +17857,11 @@ static int clif_parse(int fd)
 		sd->cryptKey = ((sd->cryptKey * clif_cryptKey[1]) + clif_cryptKey[2]) & 0xFFFFFFFF; // Update key for the next packet
 #endif
 
+	if( packet_stats_enabled ) {
+		packet_stats[packet_ver][cmd].count++;
+		packet_stats[packet_ver][cmd].bytes += packet_len;
+	}
+
 	if( packet_db[packet_ver][cmd].func == clif_parse_debug )
 		packet_db[packet_ver][cmd].func(fd, sd);
 	else if( packet_db[packet_ver][cmd].func != NULL ) {
@@ -17850,6 +17870,17 @@ static int clif_parse(int fd)
 		else
 		if( sd && sd->bl.prev == NULL && packet_db[packet_ver][cmd].func != clif_parse_LoadEndAck )
 			; //Only valid packet when player is not on a map
+		else if( tickstat_isenabled() || packet_stats_enabled ) {
+			bool stats = packet_stats_enabled;// the handler can change it
+			uint64 start = gettick_usec(), usec;
+
+			packet_db[packet_ver][cmd].func(fd, sd);
+			usec = gettick_usec() - start;
+			if( tickstat_isenabled() )
+				tickstat_add_packet(cmd, usec);
+			if( stats )
+				packet_stats[packet_ver][cmd].usec += usec;
+		}
 		else
 			packet_db[packet_ver][cmd].func(fd, sd);
 	}
@@ -17862,6 +17893,78 @@ static int clif_parse(int fd)
 	return 0;
 }
 
+/// Starts or stops counting the client packets and the time spent in their handlers.
+void clif_packet_stats_enable(bool enable)
+{
+	if( enable && packet_stats == NULL )
+		packet_stats = aCalloc(MAX_PACKET_VER + 1, sizeof(packet_stats[0]));
+	packet_stats_enabled = enable;
+}
+
+bool clif_packet_stats_isenabled(void)
+{
+	return packet_stats_enabled;
+}
+
+/// Clears the packet statistics.
+void clif_packet_stats_reset(void)
+{
+	if( packet_stats )
+		memset(packet_stats, 0, sizeof(packet_stats[0])*(MAX_PACKET_VER + 1));
+}
+
+/// Packet of the statistics report.
+struct s_packet_stats_entry {
+	int packet_ver;
+	int cmd;
+	struct s_packet_stats* stats;
+};
+
+static int clif_packet_stats_cmp(const void* a, const void* b)
+{
+	const struct s_packet_stats_entry* e1 = (const struct s_packet_stats_entry*)a;
+	const struct s_packet_stats_entry* e2 = (const struct s_packet_stats_entry*)b;
+
+	if( e1->stats->usec != e2->stats->usec )
+		return ( e1->stats->usec < e2->stats->usec ) ? 1 : -1;
+	if( e1->stats->count != e2->stats->count )
+		return ( e1->stats->count < e2->stats->count ) ? 1 : -1;
+	return 0;
+}
+
+/// Reports the 'count' packets whose handlers took the most time, one line at a time.
+void clif_packet_stats_report(int count, void (*print)(const char* line, void* ctx), void* ctx)
+{
+	struct s_packet_stats_entry* list;
+	char line[256];
+	int i, j, n = 0;
+
+	if( packet_stats == NULL )
+		return;
+
+	CREATE(list, struct s_packet_stats_entry, (MAX_PACKET_VER + 1)*(MAX_PACKET_DB + 1));
+	for( i = 0; i <= MAX_PACKET_VER; ++i ) {
+		for( j = 0; j <= MAX_PACKET_DB; ++j ) {
+			if( packet_stats[i][j].count == 0 )
+				continue;
+			list[n].packet_ver = i;
+			list[n].cmd = j;
+			list[n].stats = &packet_stats[i][j];
+			++n;
+		}
+	}
+	qsort(list, n, sizeof(list[0]), clif_packet_stats_cmp);
+
+	print("packet  ver      count        bytes   total ms   avg us", ctx);
+	for( i = 0; i < n && i < count; ++i ) {
+		struct s_packet_stats* stats = list[i].stats;
+		snprintf(line, sizeof(line), "0x%04x %4d %10u %12"PRIu64" %10.1f %8u", list[i].cmd, list[i].packet_ver,
+			stats->count, stats->bytes, stats->usec/1000., (unsigned int)(stats->usec/stats->count));
+		print(line, ctx);
+	}
+	aFree(list);
+}
+
 /*==========================================
  * Reads packet_db.txt and setups its array reference
  *------------------------------------------*/
@@ -18627,4 +18730,6 @@ void do_init_clif(void) {
 
 void do_final_clif(void) {
 	ers_destroy(delay_clearunit_ers);
+	if( packet_stats )
+		aFree(packet_stats);
 }
@@ -775,6 +775,12 @@ int clif_send(const uint8* buf, int len, struct block_list* bl, enum send_target
 void do_init_clif(void);
 void do_final_clif(void);
 
+// client packet statistics
+void clif_packet_stats_enable(bool enable);
+bool clif_packet_stats_isenabled(void);
+void clif_packet_stats_reset(void);
+void clif_packet_stats_report(int count, void (*print)(const char* line, void* ctx), void* ctx);
+
 // MAIL SYSTEM
 void clif_Mail_window(int fd, int flag);
 void clif_Mail_read(struct map_session_data *sd, int mail_id);
@@ -1644,7 +1644,7 @@ void do_final_itemdb(void) {
 * Initializing Item DB
 */
 void do_init_itemdb(void) {
-	itemdb = uidb_alloc(DB_OPT_BASE);
+	itemdb = uidb_alloc(DB_OPT_FLAT);
 	itemdb_combo = uidb_alloc(DB_OPT_BASE);
 	itemdb_group = uidb_alloc(DB_OPT_BASE);
 	itemdb_create_dummy();
@@ -6,6 +6,8 @@
 #include "../common/strlib.h"
 #include "../common/nullpo.h"
 #include "../common/showmsg.h"
+#include "../common/timer.h"
+#include "../common/utils.h"
 #include "map.h"
 #include "battle.h"
 #include "itemdb.h"
@@ -40,6 +42,21 @@ e_log_filter;
 struct Log_Config log_config;
 
 
+/// log tables/files, also the ordering keys of the asynchronous log queries
+enum e_log_target
+{
+	LOG_TARGET_BRANCH,
+	LOG_TARGET_PICK,
+	LOG_TARGET_ZENY,
+	LOG_TARGET_MVPDROP,
+	LOG_TARGET_ATCOMMAND,
+	LOG_TARGET_NPC,
+	LOG_TARGET_CHAT,
+	LOG_TARGET_CASH,
+	LOG_TARGET_MAX
+};
+
+
 #ifdef SQL_INNODB
 // database is using an InnoDB engine so do not use DELAYED
 #define LOG_QUERY "INSERT"
@@ -48,6 +65,144 @@ struct Log_Config log_config;
 #define LOG_QUERY "INSERT DELAYED"
 #endif
 
+#define LOG_SQL_BATCH_MAX_LENGTH (64*1024) // flush a batch before it gets bigger than this
+#define LOG_FILE_BUFFER_SIZE (16*1024)
+
+
+/// Buffer of a log table or file.
+/// Sql logs are sent as multi-row inserts, executed by the worker threads
+/// (logmysql_async). File logs are kept open and flushed periodically.
+static struct log_buffer
+{
+	const char* table; // log_config table (or file) name
+	const char* columns; // sql columns, the first one is the time
+	StringBuf rows; // sql rows of the next insert
+	int count; // number of rows
+	FILE* fp; // open log file
+	char fp_name[64]; // name fp was opened with
+} log_buffers[LOG_TARGET_MAX] = {
+	{ log_config.log_branch, "(`branch_date`, `account_id`, `char_id`, `char_name`, `map`)" },
+	{ log_config.log_pick, "(`time`, `char_id`, `type`, `nameid`, `amount`, `refine`, `card0`, `card1`, `card2`, `card3`, `map`, `unique_id`, `bound`)" },
+	{ log_config.log_zeny, "(`time`, `char_id`, `src_id`, `type`, `amount`, `map`)" },
+	{ log_config.log_mvpdrop, "(`mvp_date`, `kill_char_id`, `monster_id`, `prize`, `mvpexp`, `map`)" },
+	{ log_config.log_gm, "(`atcommand_date`, `account_id`, `char_id`, `char_name`, `map`, `command`)" },
+	{ log_config.log_npc, "(`npc_date`, `account_id`, `char_id`, `char_name`, `map`, `mes`)" },
+	{ log_config.log_chat, "(`time`, `type`, `type_id`, `src_charid`, `src_accountid`, `src_map`, `src_map_x`, `src_map_y`, `dst_charname`, `message`)" },
+	{ log_config.log_cash, "(`time`, `char_id`, `type`, `cash_type`, `amount`, `map`)" },
+};
+
+static unsigned int log_dropped = 0; // rows dropped since the last report
+static bool log_buffers_init = false;
+
+
+/// Sends the buffered rows of a table as one insert.
+static void log_sql_flush(enum e_log_target target)
+{
+	struct log_buffer* buf = &log_buffers[target];
+
+	if( buf->count == 0 )
+		return;
+
+	if( SQL_ERROR == SqlAsync_Query(logmysql_async, target, NULL, NULL, LOG_QUERY " INTO `%s` %s VALUES %s", buf->table, buf->columns, StringBuf_Value(&buf->rows)) )
+		log_dropped += buf->count;
+	StringBuf_Clear(&buf->rows);
+	buf->count = 0;
+}
+
+
+/// Adds a row to the buffer of a table, the time of the row is added in front of the values.
+/// When the database is behind by log_config.sql_max_pending inserts, full batches
+/// are not sent and the new rows are dropped.
+static void log_sql_add(enum e_log_target target, const char* fmt, ...)
+{
+	static time_t last_time = 0;
+	static char timestring[24];
+	struct log_buffer* buf = &log_buffers[target];
+	time_t curtime;
+	va_list ap;
+
+	if( !log_buffers_init || logmysql_async == NULL )
+		return;
+
+	if( buf->count >= log_config.sql_batch_rows || StringBuf_Length(&buf->rows) >= LOG_SQL_BATCH_MAX_LENGTH )
+	{// batch is full
+		if( SqlAsync_Pending(logmysql_async) >= log_config.sql_max_pending )
+		{
+			log_dropped++;
+			return;
+		}
+		log_sql_flush(target);
+	}
+
+	time(&curtime);
+	if( curtime != last_time )
+	{
+		strftime(timestring, sizeof(timestring), "%Y-%m-%d %H:%M:%S", localtime(&curtime));
+		last_time = curtime;
+	}
+
+	StringBuf_Printf(&buf->rows, "%s('%s', ", buf->count ? "," : "", timestring);
+	va_start(ap, fmt);
+	StringBuf_Vprintf(&buf->rows, fmt, ap);
+	va_end(ap);
+	StringBuf_AppendStr(&buf->rows, ")");
+	buf->count++;
+}
+
+
+/// Returns the open log file of a target, (re)opening it if needed.
+static FILE* log_file(enum e_log_target target, const char* name)
+{
+	struct log_buffer* buf = &log_buffers[target];
+
+	if( buf->fp != NULL && strcmp(buf->fp_name, name) != 0 )
+	{// file name changed
+		fclose(buf->fp);
+		buf->fp = NULL;
+	}
+	if( buf->fp == NULL )
+	{
+		if( ( buf->fp = fopen(name, "a") ) == NULL )
+			return NULL;
+		setvbuf(buf->fp, NULL, _IOFBF, LOG_FILE_BUFFER_SIZE);
+		safestrncpy(buf->fp_name, name, sizeof(buf->fp_name));
+	}
+	return buf->fp;
+}
+
+
+/// Sends the buffered sql rows and flushes the log files.
+static void log_flush(void)
+{
+	int i;
+
+	for( i = 0; i < LOG_TARGET_MAX; i++ )
+	{
+		struct log_buffer* buf = &log_buffers[i];
+
+		if( buf->count > 0 && logmysql_async != NULL )
+		{
+			if( SqlAsync_Pending(logmysql_async) < log_config.sql_max_pending )
+				log_sql_flush((enum e_log_target)i);
+		}
+		if( buf->fp != NULL )
+			fflush(buf->fp);
+	}
+
+	if( log_dropped > 0 )
+	{
+		ShowWarning("log_flush: The log database is too slow, %u log entries were dropped.\n", log_dropped);
+		log_dropped = 0;
+	}
+}
+
+
+static int log_flush_timer(int tid, unsigned int tick, int id, intptr_t data)
+{
+	log_flush();
+	return 0;
+}
+
 
 /// obtain log type character for item/zeny logs
 static char log_picktype2char(e_log_pick_type type)
@@ -155,17 +310,10 @@ void log_branch(struct map_session_data* sd)
 		e_length = sprintf(entry, LOG_QUERY " INTO `%s` (`branch_date`, `account_id`, `char_id`, `char_name`, `map`) VALUES (NOW(), '%d', '%d', '%s', '%s')", log_config.log_branch, sd->status.account_id, sd->status.char_id, sd->status.name, mapindex_id2name(sd->mapindex));
 		queryThread_log(entry,e_length);
 #else
-		SqlStmt* stmt;
-		stmt = SqlStmt_Malloc(logmysql_handle);
-		if( SQL_SUCCESS != SqlStmt_Prepare(stmt, LOG_QUERY " INTO `%s` (`branch_date`, `account_id`, `char_id`, `char_name`, `map`) VALUES (NOW(), '%d', '%d', ?, '%s')", log_config.log_branch, sd->status.account_id, sd->status.char_id, mapindex_id2name(sd->mapindex) )
-		||  SQL_SUCCESS != SqlStmt_BindParam(stmt, 0, SQLDT_STRING, sd->status.name, strnlen(sd->status.name, NAME_LENGTH))
-		||  SQL_SUCCESS != SqlStmt_Execute(stmt) )
-		{
-			SqlStmt_ShowDebug(stmt);
-			SqlStmt_Free(stmt);
-			return;
-		}
-		SqlStmt_Free(stmt);
+		char esc_name[NAME_LENGTH*2+1];
+
+		Sql_EscapeStringLen(logmysql_handle, esc_name, sd->status.name, strnlen(sd->status.name, NAME_LENGTH));
+		log_sql_add(LOG_TARGET_BRANCH, "'%d', '%d', '%s', '%s'", sd->status.account_id, sd->status.char_id, esc_name, mapindex_id2name(sd->mapindex));
 #endif
 	}
 	else
@@ -174,12 +322,11 @@ void log_branch(struct map_session_data* sd)
 		time_t curtime;
 		FILE* logfp;
 
-		if( ( logfp = fopen(log_config.log_branch, "a") ) == NULL )
+		if( ( logfp = log_file(LOG_TARGET_BRANCH, log_config.log_branch) ) == NULL )
 			return;
 		time(&curtime);
 		strftime(timestring, sizeof(timestring), "%m/%d/%Y %H:%M:%S", localtime(&curtime));
 		fprintf(logfp,"%s - %s[%d:%d]\t%s\n", timestring, sd->status.name, sd->status.account_id, sd->status.char_id, mapindex_id2name(sd->mapindex));
-		fclose(logfp);
 	}
 }
 
@@ -204,12 +351,8 @@ void log_pick(int id, int16 m, e_log_pick_type type, int amount, struct item* it
 				log_config.log_pick, id, log_picktype2char(type), itm->nameid, amount, itm->refine, itm->card[0], itm->card[1], itm->card[2], itm->card[3], map[m].name?map[m].name:"", itm->unique_id, itm->bound);
 		queryThread_log(entry,e_length);
 #else
-		if( SQL_ERROR == Sql_Query(logmysql_handle, LOG_QUERY " INTO `%s` (`time`, `char_id`, `type`, `nameid`, `amount`, `refine`, `card0`, `card1`, `card2`, `card3`, `map`, `unique_id`, `bound`) VALUES (NOW(), '%d', '%c', '%hu', '%d', '%d', '%hu', '%hu', '%hu', '%hu', '%s', '%"PRIu64"', '%d')",
-			log_config.log_pick, id, log_picktype2char(type), itm->nameid, amount, itm->refine, itm->card[0], itm->card[1], itm->card[2], itm->card[3], map[m].name?map[m].name:"", itm->unique_id, itm->bound) )
-		{
-			Sql_ShowDebug(logmysql_handle);
-			return;
-		}
+		log_sql_add(LOG_TARGET_PICK, "'%d', '%c', '%hu', '%d', '%d', '%hu', '%hu', '%hu', '%hu', '%s', '%"PRIu64"', '%d'",
+			id, log_picktype2char(type), itm->nameid, amount, itm->refine, itm->card[0], itm->card[1], itm->card[2], itm->card[3], map[m].name?map[m].name:"", itm->unique_id, itm->bound);
 #endif
 	}
 	else
@@ -218,12 +361,11 @@ void log_pick(int id, int16 m, e_log_pick_type type, int amount, struct item* it
 		time_t curtime;
 		FILE* logfp;
 
-		if( ( logfp = fopen(log_config.log_pick, "a") ) == NULL )
+		if( ( logfp = log_file(LOG_TARGET_PICK, log_config.log_pick) ) == NULL )
 			return;
 		time(&curtime);
 		strftime(timestring, sizeof(timestring), "%m/%d/%Y %H:%M:%S", localtime(&curtime));
 		fprintf(logfp,"%s - %d\t%c\t%hu,%d,%d,%hu,%hu,%hu,%hu,%s,'%"PRIu64"',%d\n", timestring, id, log_picktype2char(type), itm->nameid, amount, itm->refine, itm->card[0], itm->card[1], itm->card[2], itm->card[3], map[m].name?map[m].name:"", itm->unique_id, itm->bound);
-		fclose(logfp);
 	}
 }
 
@@ -259,12 +401,8 @@ void log_zeny(struct map_session_data* sd, e_log_pick_type type, struct map_sess
 				log_config.log_zeny, sd->status.char_id, src_sd->status.char_id, log_picktype2char(type), amount, mapindex_id2name(sd->mapindex));
 		queryThread_log(entry,e_length);
 #else
-		if( SQL_ERROR == Sql_Query(logmysql_handle, LOG_QUERY " INTO `%s` (`time`, `char_id`, `src_id`, `type`, `amount`, `map`) VALUES (NOW(), '%d', '%d', '%c', '%d', '%s')",
-			log_config.log_zeny, sd->status.char_id, src_sd->status.char_id, log_picktype2char(type), amount, mapindex_id2name(sd->mapindex)) )
-		{
-			Sql_ShowDebug(logmysql_handle);
-			return;
-		}
+		log_sql_add(LOG_TARGET_ZENY, "'%d', '%d', '%c', '%d', '%s'",
+			sd->status.char_id, src_sd->status.char_id, log_picktype2char(type), amount, mapindex_id2name(sd->mapindex));
 #endif
 	}
 	else
@@ -273,12 +411,11 @@ void log_zeny(struct map_session_data* sd, e_log_pick_type type, struct map_sess
 		time_t curtime;
 		FILE* logfp;
 
-		if( ( logfp = fopen(log_config.log_zeny, "a") ) == NULL )
+		if( ( logfp = log_file(LOG_TARGET_ZENY, log_config.log_zeny) ) == NULL )
 			return;
 		time(&curtime);
 		strftime(timestring, sizeof(timestring), "%m/%d/%Y %H:%M:%S", localtime(&curtime));
 		fprintf(logfp, "%s - %s[%d]\t%s[%d]\t%d\t\n", timestring, src_sd->status.name, src_sd->status.account_id, sd->status.name, sd->status.account_id, amount);
-		fclose(logfp);
 	}
 }
 
@@ -300,12 +437,8 @@ void log_mvpdrop(struct map_session_data* sd, int monster_id, unsigned int* log_
 						   log_config.log_mvpdrop, sd->status.char_id, monster_id, (unsigned short)log_mvp[0], log_mvp[1], mapindex_id2name(sd->mapindex));
 		queryThread_log(entry,e_length);
 #else
-		if( SQL_ERROR == Sql_Query(logmysql_handle, LOG_QUERY " INTO `%s` (`mvp_date`, `kill_char_id`, `monster_id`, `prize`, `mvpexp`, `map`) VALUES (NOW(), '%d', '%d', '%hu', '%u', '%s') ",
-			log_config.log_mvpdrop, sd->status.char_id, monster_id, (unsigned short)log_mvp[0], log_mvp[1], mapindex_id2name(sd->mapindex)) )
-		{
-			Sql_ShowDebug(logmysql_handle);
-			return;
-		}
+		log_sql_add(LOG_TARGET_MVPDROP, "'%d', '%d', '%hu', '%u', '%s'",
+			sd->status.char_id, monster_id, (unsigned short)log_mvp[0], log_mvp[1], mapindex_id2name(sd->mapindex));
 #endif
 	}
 	else
@@ -314,12 +447,11 @@ void log_mvpdrop(struct map_session_data* sd, int monster_id, unsigned int* log_
 		time_t curtime;
 		FILE* logfp;
 
-		if( ( logfp = fopen(log_config.log_mvpdrop,"a") ) == NULL )
+		if( ( logfp = log_file(LOG_TARGET_MVPDROP, log_config.log_mvpdrop) ) == NULL )
 			return;
 		time(&curtime);
 		strftime(timestring, sizeof(timestring), "%m/%d/%Y %H:%M:%S", localtime(&curtime));
 		fprintf(logfp,"%s - %s[%d:%d]\t%d\t%hu,%u\n", timestring, sd->status.name, sd->status.account_id, sd->status.char_id, monster_id, (unsigned short)log_mvp[0], log_mvp[1]);
-		fclose(logfp);
 	}
 }
 
@@ -341,19 +473,12 @@ void log_atcommand(struct map_session_data* sd, const char* message)
 		e_length = sprintf(entry,  LOG_QUERY " INTO `%s` (`atcommand_date`, `account_id`, `char_id`, `char_name`, `map`, `command`) VALUES (NOW(), '%d', '%d', '%s', '%s', '%s')", log_config.log_gm, sd->status.account_id, sd->status.char_id, sd->status.name ,mapindex_id2name(sd->mapindex), message);
 		queryThread_log(entry,e_length);
 #else
-		SqlStmt* stmt;
+		char esc_name[NAME_LENGTH*2+1];
+		char esc_message[255*2+1];
 
-		stmt = SqlStmt_Malloc(logmysql_handle);
-		if( SQL_SUCCESS != SqlStmt_Prepare(stmt, LOG_QUERY " INTO `%s` (`atcommand_date`, `account_id`, `char_id`, `char_name`, `map`, `command`) VALUES (NOW(), '%d', '%d', ?, '%s', ?)", log_config.log_gm, sd->status.account_id, sd->status.char_id, mapindex_id2name(sd->mapindex) )
-		||  SQL_SUCCESS != SqlStmt_BindParam(stmt, 0, SQLDT_STRING, sd->status.name, strnlen(sd->status.name, NAME_LENGTH))
-		||  SQL_SUCCESS != SqlStmt_BindParam(stmt, 1, SQLDT_STRING, (char*)message, safestrnlen(message, 255))
-		||  SQL_SUCCESS != SqlStmt_Execute(stmt) )
-		{
-			SqlStmt_ShowDebug(stmt);
-			SqlStmt_Free(stmt);
-			return;
-		}
-		SqlStmt_Free(stmt);
+		Sql_EscapeStringLen(logmysql_handle, esc_name, sd->status.name, strnlen(sd->status.name, NAME_LENGTH));
+		Sql_EscapeStringLen(logmysql_handle, esc_message, message, safestrnlen(message, 255));
+		log_sql_add(LOG_TARGET_ATCOMMAND, "'%d', '%d', '%s', '%s', '%s'", sd->status.account_id, sd->status.char_id, esc_name, mapindex_id2name(sd->mapindex), esc_message);
 #endif
 	}
 	else
@@ -362,12 +487,11 @@ void log_atcommand(struct map_session_data* sd, const char* message)
 		time_t curtime;
 		FILE* logfp;
 
-		if( ( logfp = fopen(log_config.log_gm, "a") ) == NULL )
+		if( ( logfp = log_file(LOG_TARGET_ATCOMMAND, log_config.log_gm) ) == NULL )
 			return;
 		time(&curtime);
 		strftime(timestring, sizeof(timestring), "%m/%d/%Y %H:%M:%S", localtime(&curtime));
 		fprintf(logfp, "%s - %s[%d]: %s\n", timestring, sd->status.name, sd->status.account_id, message);
-		fclose(logfp);
 	}
 }
 
@@ -388,18 +512,12 @@ void log_npc(struct map_session_data* sd, const char* message)
 		e_length = sprintf(entry, LOG_QUERY " INTO `%s` (`npc_date`, `account_id`, `char_id`, `char_name`, `map`, `mes`) VALUES (NOW(), '%d', '%d', '%s', '%s', '%s')", log_config.log_npc, sd->status.account_id, sd->status.char_id, sd->status.name, mapindex_id2name(sd->mapindex), message );
 		queryThread_log(entry,e_length);
 #else
-		SqlStmt* stmt;
-		stmt = SqlStmt_Malloc(logmysql_handle);
-		if( SQL_SUCCESS != SqlStmt_Prepare(stmt, LOG_QUERY " INTO `%s` (`npc_date`, `account_id`, `char_id`, `char_name`, `map`, `mes`) VALUES (NOW(), '%d', '%d', ?, '%s', ?)", log_config.log_npc, sd->status.account_id, sd->status.char_id, mapindex_id2name(sd->mapindex) )
-		||  SQL_SUCCESS != SqlStmt_BindParam(stmt, 0, SQLDT_STRING, sd->status.name, strnlen(sd->status.name, NAME_LENGTH))
-		||  SQL_SUCCESS != SqlStmt_BindParam(stmt, 1, SQLDT_STRING, (char*)message, safestrnlen(message, 255))
-		||  SQL_SUCCESS != SqlStmt_Execute(stmt) )
-		{
-			SqlStmt_ShowDebug(stmt);
-			SqlStmt_Free(stmt);
-			return;
-		}
-		SqlStmt_Free(stmt);
+		char esc_name[NAME_LENGTH*2+1];
+		char esc_message[255*2+1];
+
+		Sql_EscapeStringLen(logmysql_handle, esc_name, sd->status.name, strnlen(sd->status.name, NAME_LENGTH));
+		Sql_EscapeStringLen(logmysql_handle, esc_message, message, safestrnlen(message, 255));
+		log_sql_add(LOG_TARGET_NPC, "'%d', '%d', '%s', '%s', '%s'", sd->status.account_id, sd->status.char_id, esc_name, mapindex_id2name(sd->mapindex), esc_message);
 #endif
 	}
 	else
@@ -408,12 +526,11 @@ void log_npc(struct map_session_data* sd, const char* message)
 		time_t curtime;
 		FILE* logfp;
 
-		if( ( logfp = fopen(log_config.log_npc, "a") ) == NULL )
+		if( ( logfp = log_file(LOG_TARGET_NPC, log_config.log_npc) ) == NULL )
 			return;
 		time(&curtime);
 		strftime(timestring, sizeof(timestring), "%m/%d/%Y %H:%M:%S", localtime(&curtime));
 		fprintf(logfp, "%s - %s[%d]: %s\n", timestring, sd->status.name, sd->status.account_id, message);
-		fclose(logfp);
 	}
 }
 
@@ -438,19 +555,12 @@ void log_chat(e_log_chat_type type, int type_id, int src_charid, int src_accid,
 		e_length = sprintf(entry, LOG_QUERY " INTO `%s` (`time`, `type`, `type_id`, `src_charid`, `src_accountid`, `src_map`, `src_map_x`, `src_map_y`, `dst_charname`, `message`) VALUES (NOW(), '%c', '%d', '%d', '%d', '%s', '%d', '%d', '%s', '%s')", log_config.log_chat, log_chattype2char(type), type_id, src_charid, src_accid, mapname, x, y, dst_charname, message );
 		queryThread_log(entry,e_length);
 #else
-		SqlStmt* stmt;
+		char esc_name[NAME_LENGTH*2+1];
+		char esc_message[CHAT_SIZE_MAX*2+1];
 
-		stmt = SqlStmt_Malloc(logmysql_handle);
-		if( SQL_SUCCESS != SqlStmt_Prepare(stmt, LOG_QUERY " INTO `%s` (`time`, `type`, `type_id`, `src_charid`, `src_accountid`, `src_map`, `src_map_x`, `src_map_y`, `dst_charname`, `message`) VALUES (NOW(), '%c', '%d', '%d', '%d', '%s', '%d', '%d', ?, ?)", log_config.log_chat, log_chattype2char(type), type_id, src_charid, src_accid, mapname, x, y)
-		||  SQL_SUCCESS != SqlStmt_BindParam(stmt, 0, SQLDT_STRING, (char*)dst_charname, safestrnlen(dst_charname, NAME_LENGTH))
-		||  SQL_SUCCESS != SqlStmt_BindParam(stmt, 1, SQLDT_STRING, (char*)message, safestrnlen(message, CHAT_SIZE_MAX))
-		||  SQL_SUCCESS != SqlStmt_Execute(stmt) )
-		{
-			SqlStmt_ShowDebug(stmt);
-			SqlStmt_Free(stmt);
-			return;
-		}
-		SqlStmt_Free(stmt);
+		Sql_EscapeStringLen(logmysql_handle, esc_name, dst_charname ? dst_charname : "", safestrnlen(dst_charname, NAME_LENGTH));
+		Sql_EscapeStringLen(logmysql_handle, esc_message, message ? message : "", safestrnlen(message, CHAT_SIZE_MAX));
+		log_sql_add(LOG_TARGET_CHAT, "'%c', '%d', '%d', '%d', '%s', '%d', '%d', '%s', '%s'", log_chattype2char(type), type_id, src_charid, src_accid, mapname, x, y, esc_name, esc_message);
 #endif
 	}
 	else
@@ -459,12 +569,11 @@ void log_chat(e_log_chat_type type, int type_id, int src_charid, int src_accid,
 		time_t curtime;
 		FILE* logfp;
 
-		if( ( logfp = fopen(log_config.log_chat, "a") ) == NULL )
+		if( ( logfp = log_file(LOG_TARGET_CHAT, log_config.log_chat) ) == NULL )
 			return;
 		time(&curtime);
 		strftime(timestring, sizeof(timestring), "%m/%d/%Y %H:%M:%S", localtime(&curtime));
 		fprintf(logfp, "%s - %c,%d,%d,%d,%s,%d,%d,%s,%s\n", timestring, log_chattype2char(type), type_id, src_charid, src_accid, mapname, x, y, dst_charname, message);
-		fclose(logfp);
 	}
 }
 
@@ -483,24 +592,19 @@ void log_cash( struct map_session_data* sd, e_log_pick_type type, e_log_cash_typ
 			log_config.log_cash, sd->status.char_id, log_picktype2char( type ), log_cashtype2char( cash_type ), amount, mapindex_id2name( sd->mapindex ) );
 		queryThread_log( entry, e_length );
 #else
-		if( SQL_ERROR == Sql_Query( logmysql_handle, LOG_QUERY " INTO `%s` ( `time`, `char_id`, `type`, `cash_type`, `amount`, `map` ) VALUES ( NOW(), '%d', '%c', '%c', '%d', '%s' )",
-			log_config.log_cash, sd->status.char_id, log_picktype2char( type ), log_cashtype2char( cash_type ), amount, mapindex_id2name( sd->mapindex ) ) )
-		{
-			Sql_ShowDebug( logmysql_handle );
-			return;
-		}
+		log_sql_add( LOG_TARGET_CASH, "'%d', '%c', '%c', '%d', '%s'",
+			sd->status.char_id, log_picktype2char( type ), log_cashtype2char( cash_type ), amount, mapindex_id2name( sd->mapindex ) );
 #endif
 	}else{
 		char timestring[255];
 		time_t curtime;
 		FILE* logfp;
 
-		if( ( logfp = fopen( log_config.log_cash, "a" ) ) == NULL )
+		if( ( logfp = log_file( LOG_TARGET_CASH, log_config.log_cash ) ) == NULL )
 			return;
 		time( &curtime );
 		strftime( timestring, sizeof( timestring ), "%m/%d/%Y %H:%M:%S", localtime( &curtime ) );
 		fprintf( logfp, "%s - %s[%d]\t%d(%c)\t\n", timestring, sd->status.name, sd->status.account_id, amount, log_cashtype2char( cash_type ) );
-		fclose( logfp );
 	}
 }
 
@@ -513,6 +617,53 @@ void log_set_defaults(void)
 	log_config.rare_items_log   = 100;  // log rare items. drop chance <= 1%
 	log_config.price_items_log  = 1000; // 1000z
 	log_config.amount_items_log = 100;
+
+	log_config.sql_batch_rows = 100;
+	log_config.sql_max_pending = 64;
+	log_config.flush_interval = 1000;
+}
+
+
+void do_init_log(void)
+{
+	int i;
+
+	for( i = 0; i < LOG_TARGET_MAX; i++ )
+		StringBuf_Init(&log_buffers[i].rows);
+	log_buffers_init = true;
+
+	add_timer_func_list(log_flush_timer, "log_flush_timer");
+	add_timer_interval(gettick() + log_config.flush_interval, log_flush_timer, 0, 0, log_config.flush_interval);
+}
+
+
+/// Sends every buffered row and closes the log files.
+void do_final_log(void)
+{
+	int i;
+
+	for( i = 0; i < LOG_TARGET_MAX; i++ )
+	{
+		struct log_buffer* buf = &log_buffers[i];
+
+		if( logmysql_async != NULL )
+			log_sql_flush((enum e_log_target)i);
+		if( buf->fp != NULL )
+		{
+			fclose(buf->fp);
+			buf->fp = NULL;
+		}
+		if( log_buffers_init )
+			StringBuf_Destroy(&buf->rows);
+		buf->count = 0;
+	}
+	log_buffers_init = false;
+
+	if( log_dropped > 0 )
+	{
+		ShowWarning("do_final_log: %u log entries were dropped.\n", log_dropped);
+		log_dropped = 0;
+	}
 }
 
 
@@ -542,6 +693,12 @@ int log_config_read(const char* cfgName)
 				log_config.enable_logs = (e_log_pick_type)config_switch(w2);
 			else if( strcmpi(w1, "sql_logs") == 0 )
 				log_config.sql_logs = (bool)config_switch(w2);
+			else if( strcmpi(w1, "log_sql_batch_rows") == 0 )
+				log_config.sql_batch_rows = cap_value(atoi(w2), 1, 1000);
+			else if( strcmpi(w1, "log_sql_max_pending") == 0 )
+				log_config.sql_max_pending = max(1, atoi(w2));
+			else if( strcmpi(w1, "log_flush_interval") == 0 )
+				log_config.flush_interval = cap_value(atoi(w2), 100, 60000);
 //start of common filter settings
 			else if( strcmpi(w1, "rare_items_log") == 0 )
 				log_config.rare_items_log = atoi(w2);
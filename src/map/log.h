@@ -71,11 +71,15 @@ void log_mvpdrop(struct map_session_data* sd, int monster_id, unsigned int* log_
 
 int log_config_read(const char* cfgName);
 
+void do_init_log(void);
+void do_final_log(void);
+
 extern struct Log_Config
 {
 	e_log_pick_type enable_logs;
 	int filter;
 	bool sql_logs;
+	int sql_batch_rows, sql_max_pending, flush_interval;
 	bool log_chat_woe_disable;
 	bool cash;
 	int rare_items_log,refine_items_log,price_items_log,amount_items_log; //for filter
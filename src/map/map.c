@@ -41,6 +41,10 @@
 #include <stdlib.h>
 #include <math.h>
 #ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #endif
 
 char default_codepage[32] = "";
@@ -78,6 +82,7 @@ char log_db_id[32] = "ragnarok";
 char log_db_pw[32] = "ragnarok";
 char log_db_db[32] = "log";
 Sql* logmysql_handle;
+SqlAsync* logmysql_async; // fire-and-forget log inserts
 
 // DBMap declaration
 static DBMap* id_db=NULL; /// int id -> struct block_list*
@@ -92,7 +97,6 @@ static DBMap* map_msg_db=NULL;
 
 static int map_users=0;
 
-#define BLOCK_SIZE 8
 #define block_free_max 1048576
 struct block_list *block_free[block_free_max];
 static int block_free_count = 0, block_free_lock = 0;
@@ -101,7 +105,7 @@ static int block_free_count = 0, block_free_lock = 0;
 static struct block_list *bl_list[BL_LIST_MAX];
 static int bl_list_count = 0;
 
-#define MAP_MAX_MSG 1500
+#define MAP_MAX_MSG 1550
 
 struct map_data map[MAX_MAP_PER_SERVER];
 int map_num = 0;
@@ -153,6 +157,18 @@ struct s_map_default map_default;
 int console = 0;
 int enable_spy = 0; //To enable/disable @spy commands, which consume too much cpu time when sending packets. [Skotlex]
 int enable_grf = 0;	//To enable/disable reading maps from GRF files, bypassing mapcache [blackhole89]
+int lazy_map_loading = 1; // Decompress the map cells from the mapcache when the map is used first
+int idle_map_unload = 0; // Minutes without users after which the cells of a lazily loaded map are freed (0 = never)
+
+// Map cache files, kept while lazily loaded maps still have to be decompressed
+static char *map_cache_buffer[2] = { NULL, NULL };
+static size_t map_cache_size[2] = { 0, 0 };
+static bool map_cache_mapped[2] = { false, false };
+
+// Cell array of the maps whose cells are not decompressed yet
+static struct mapcell map_cell_unloaded[1];
+static int map_cell_loaded_count = 0;
+static void map_cell_free(struct map_data *m);
 
 /*==========================================
  * server player count (of all mapservers)
@@ -253,6 +269,8 @@ static void map_addblcell(struct block_list *bl)
 {
 	if( bl->m<0 || bl->x<0 || bl->x>=map[bl->m].xs || bl->y<0 || bl->y>=map[bl->m].ys || !(bl->type&BL_CHAR) )
 		return;
+	if( map[bl->m].cell == map_cell_unloaded )
+		return;// counted when the cells are loaded
 	map[bl->m].cell[bl->x+bl->y*map[bl->m].xs].cell_bl++;
 	return;
 }
@@ -261,6 +279,8 @@ static void map_delblcell(struct block_list *bl)
 {
 	if( bl->m <0 || bl->x<0 || bl->x>=map[bl->m].xs || bl->y<0 || bl->y>=map[bl->m].ys || !(bl->type&BL_CHAR) )
 		return;
+	if( map[bl->m].cell == map_cell_unloaded )
+		return;
 	map[bl->m].cell[bl->x+bl->y*map[bl->m].xs].cell_bl--;
 }
 #endif
@@ -298,10 +318,17 @@ int map_addblock(struct block_list* bl)
 	pos = x/BLOCK_SIZE+(y/BLOCK_SIZE)*map[m].bxs;
 
 	if (bl->type == BL_MOB) {
+		struct mob_data *md = (TBL_MOB*)bl;
+
 		bl->next = map[m].block_mob[pos];
 		bl->prev = &bl_head;
 		if (bl->next) bl->next->prev = bl;
 		map[m].block_mob[pos] = bl;
+
+		md->map_prev = NULL;
+		md->map_next = map[m].mobs;
+		if (md->map_next) md->map_next->map_prev = md;
+		map[m].mobs = md;
 	} else {
 		bl->next = map[m].block[pos];
 		bl->prev = &bl_head;
@@ -354,6 +381,18 @@ int map_delblock(struct block_list* bl)
 	bl->next = NULL;
 	bl->prev = NULL;
 
+	if (bl->type == BL_MOB) {
+		struct mob_data *md = (TBL_MOB*)bl;
+
+		if (md->map_next)
+			md->map_next->map_prev = md->map_prev;
+		if (md->map_prev)
+			md->map_prev->map_next = md->map_next;
+		else
+			map[bl->m].mobs = md->map_next;
+		md->map_next = md->map_prev = NULL;
+	}
+
 	return 0;
 }
 
@@ -2348,6 +2387,7 @@ int map_addinstancemap(const char *name, int id)
 	}
 
 	// Copy the map
+	map_cell_load(&map[src_m]);
 	memcpy(&map[dst_m], &map[src_m], sizeof(struct map_data));
 
 	strcpy(iname,name);
@@ -2373,6 +2413,11 @@ int map_addinstancemap(const char *name, int id)
 	map[dst_m].instance_id = id;
 	map[dst_m].instance_src_map = src_m;
 	map[dst_m].users = 0;
+	map[dst_m].mobs = NULL;
+	map[dst_m].mob_idle = 0;
+	map[dst_m].mob_hibernate = 0;
+	map[dst_m].mob_parked = NULL;
+	map[dst_m].mob_parked_count = map[dst_m].mob_parked_max = 0;
 
 	memset(map[dst_m].npc, 0, sizeof(map[dst_m].npc));
 	map[dst_m].npc_num = 0;
@@ -2381,6 +2426,13 @@ int map_addinstancemap(const char *name, int id)
 	num_cell = map[dst_m].xs * map[dst_m].ys;
 	CREATE( map[dst_m].cell, struct mapcell, num_cell );
 	memcpy( map[dst_m].cell, map[src_m].cell, num_cell * sizeof(struct mapcell) );
+	for( i = 0; i < CELLBITS_MAX; i++ ) {
+		CREATE( map[dst_m].cellbits[i], uint32, map[dst_m].cellbits_stride * map[dst_m].ys );
+		memcpy( map[dst_m].cellbits[i], map[src_m].cellbits[i], map[dst_m].cellbits_stride * map[dst_m].ys * sizeof(uint32) );
+	}
+	map[dst_m].cell_zip = NULL;
+	map[dst_m].cell_idle = 0;
+	map[dst_m].cellcomp = NULL; // built by the first path search
 
 	size = map[dst_m].bxs * map[dst_m].bys * sizeof(struct block_list*);
 	map[dst_m].block = (struct block_list **)aCalloc(1,size);
@@ -2459,9 +2511,11 @@ int map_delinstancemap(int m)
 	mapindex_removemap( map[m].index );
 
 	// Free memory
-	aFree(map[m].cell);
+	map_cell_free(&map[m]);
 	aFree(map[m].block);
 	aFree(map[m].block_mob);
+	if( map[m].mob_parked )
+		aFree(map[m].mob_parked);
 
 	map_removemapdb(&map[m]);
 	memset(&map[m], 0x00, sizeof(map[0]));
@@ -2784,6 +2838,294 @@ static int map_cell2gat(struct mapcell cell)
 	return 1; // default to 'wall'
 }
 
+/*==========================================
+ * Collision bitplanes
+ * Keep CELL_CHKWALL and CELL_CHKNOPASS of every cell as bits, so line of
+ * sight and area checks can test 32 cells at once.
+ *------------------------------------------*/
+
+/// Updates the bits of cell (x,y) after it was changed.
+static void map_cellbits_update(struct map_data *m, int16 x, int16 y)
+{
+	int i;
+	uint32 bit;
+	struct mapcell cell;
+
+	if( m->cellbits[CELLBITS_WALL] == NULL || x >= m->xs-1 || y >= m->ys-1 )
+		return;// not built yet, or an edge cell (always 'no wall' and 'no pass')
+
+	i = y*m->cellbits_stride + (x>>5);
+	bit = 1u<<(x&31);
+	cell = m->cell[x + y*m->xs];
+
+	if( !cell.walkable && !cell.shootable )
+		m->cellbits[CELLBITS_WALL][i] |= bit;
+	else
+		m->cellbits[CELLBITS_WALL][i] &= ~bit;
+
+	if( !cell.walkable )
+		m->cellbits[CELLBITS_NOPASS][i] |= bit;
+	else
+		m->cellbits[CELLBITS_NOPASS][i] &= ~bit;
+}
+
+/// Builds the bitplanes from the cells of the map.
+static void map_cellbits_build(struct map_data *m)
+{
+	int16 x, y;
+	int i;
+
+	m->cellbits_stride = (m->xs + 31) / 32;
+	for( i = 0; i < CELLBITS_MAX; i++ )
+		CREATE(m->cellbits[i], uint32, m->cellbits_stride * m->ys);
+
+	for( y = 0; y < m->ys; y++ ) {
+		for( x = 0; x < m->xs; x++ ) {
+			if( x >= m->xs-1 || y >= m->ys-1 )
+				m->cellbits[CELLBITS_NOPASS][y*m->cellbits_stride + (x>>5)] |= 1u<<(x&31);
+			else
+				map_cellbits_update(m, x, y);
+		}
+	}
+}
+
+/// Frees the cells of a map and their bitplanes.
+static void map_cell_free(struct map_data *m)
+{
+	int i;
+
+	if( m->cell != NULL && m->cell != map_cell_unloaded )
+		aFree(m->cell);
+	m->cell = NULL;
+	for( i = 0; i < CELLBITS_MAX; i++ ) {
+		if( m->cellbits[i] != NULL )
+			aFree(m->cellbits[i]);
+		m->cellbits[i] = NULL;
+	}
+	if( m->cellcomp != NULL )
+		aFree(m->cellcomp);
+	m->cellcomp = NULL;
+}
+
+/// Returns true if a cell of the rectangle (x0,y0)-(x1,y1) has its bit set.
+/// The cells of the map must be loaded.
+bool map_cellbits_rect(struct map_data *m, enum e_cellbits plane, int16 x0, int16 y0, int16 x1, int16 y1)
+{
+	const uint32 *row;
+	uint32 mask0, mask1;
+	int w0, w1, w;
+	int16 y;
+
+	if( x0 > x1 ) swap(x0, x1);
+	if( y0 > y1 ) swap(y0, y1);
+	x0 = max(x0, 0); x1 = min(x1, m->xs-1);
+	y0 = max(y0, 0); y1 = min(y1, m->ys-1);
+	if( x0 > x1 || y0 > y1 )
+		return false;
+
+	w0 = x0>>5;
+	w1 = x1>>5;
+	mask0 = 0xFFFFFFFFu<<(x0&31);
+	mask1 = 0xFFFFFFFFu>>(31-(x1&31));
+	if( w0 == w1 )
+		mask0 &= mask1;
+
+	for( y = y0, row = m->cellbits[plane] + y0*m->cellbits_stride; y <= y1; y++, row += m->cellbits_stride ) {
+		if( row[w0]&mask0 )
+			return true;
+		if( w0 == w1 )
+			continue;
+		for( w = w0+1; w < w1; w++ )
+			if( row[w] )
+				return true;
+		if( row[w1]&mask1 )
+			return true;
+	}
+
+	return false;
+}
+
+/// Cells of the connected components: walkable cells, and the last row and
+/// column since CELL_CHKNOREACH treats them as walkable.
+#define map_cellcomp_passable(m, x, y) ( (m)->cell[(x) + (y)*(m)->xs].walkable || (x) >= (m)->xs-1 || (y) >= (m)->ys-1 )
+
+static int *cellcomp_queue = NULL; // flood fill queue, reused by every map
+static int cellcomp_queue_max = 0;
+
+/// Labels the cells of the component of xy with 'label'.
+/// The cells of the component are the passable ones (from == 0) of a map
+/// being built, or the ones labelled 'from'.
+static void map_cellcomp_flood(struct map_data *m, int xy, uint16 from, uint16 label)
+{
+	int head = 0, tail = 1;
+
+	if( cellcomp_queue_max < m->xs * m->ys ) {
+		cellcomp_queue_max = m->xs * m->ys;
+		RECREATE(cellcomp_queue, int, cellcomp_queue_max);
+	}
+
+	m->cellcomp[xy] = label;
+	cellcomp_queue[0] = xy;
+	while( head < tail ) {
+		int16 x = cellcomp_queue[head] % m->xs;
+		int16 y = cellcomp_queue[head] / m->xs;
+		int16 nx, ny;
+
+		head++;
+		for( ny = max(y-1, 0); ny <= min(y+1, m->ys-1); ny++ ) {
+			for( nx = max(x-1, 0); nx <= min(x+1, m->xs-1); nx++ ) {
+				int n = nx + ny*m->xs;
+				if( m->cellcomp[n] != from || (from == 0 && !map_cellcomp_passable(m, nx, ny)) )
+					continue;
+				m->cellcomp[n] = label;
+				cellcomp_queue[tail++] = n;
+			}
+		}
+	}
+}
+
+/// Labels the connected components of the walkable cells of a map.
+/// Neighbours are linked in 8 directions, so every walk path (A* or easy
+/// path, CELL_CHKNOPASS or CELL_CHKNOREACH) stays in one component.
+/// Past 65535 components the remaining cells are left unknown (0).
+static void map_cellcomp_build(struct map_data *m)
+{
+	int size = m->xs * m->ys;
+	int xy;
+	uint16 label = 0;
+
+	if( m->cellcomp == NULL )
+		CREATE(m->cellcomp, uint16, size);
+	else
+		memset(m->cellcomp, 0, size * sizeof(uint16));
+	m->cellcomp_dirty = 0;
+
+	for( xy = 0; xy < size && label < 0xFFFF; xy++ ) {
+		if( m->cellcomp[xy] != 0 || !map_cellcomp_passable(m, xy % m->xs, xy / m->xs) )
+			continue;
+		map_cellcomp_flood(m, xy, 0, ++label);
+	}
+
+	m->cellcomp_labels = label;
+}
+
+/// Returns a label that isn't used yet, 0 if they ran out.
+static uint16 map_cellcomp_newlabel(struct map_data *m)
+{
+	if( m->cellcomp_labels >= 0xFFFE ) {
+		m->cellcomp_labels = 0xFFFF;
+		return 0;
+	}
+	return ++m->cellcomp_labels;
+}
+
+/// Updates the components after the walkability of (x,y) changed.
+/// A cell that becomes passable joins the components around it. A cell that
+/// becomes blocked can only split its component if the passable cells around
+/// it aren't linked to each other, only then the parts are labelled again.
+/// When the labels run out, the components are built again by the next path
+/// search, which starts the labels over (at most once per 65534 labels).
+static void map_cellcomp_update(struct map_data *m, int16 x, int16 y)
+{
+	static const int8 ring_x[8] = { -1, 0, 1, 1, 1, 0,-1,-1 };
+	static const int8 ring_y[8] = { -1,-1,-1, 0, 1, 1, 1, 0 };
+	int ring[8]; // passable cells around (x,y), -1 otherwise
+	int xy = x + y*m->xs;
+	int i, j;
+
+	if( m->cellcomp == NULL || m->cellcomp_dirty )
+		return; // built from scratch by the next path search
+	if( m->cellcomp_labels == 0xFFFF ) {
+		m->cellcomp_dirty = 1; // some cells aren't labelled
+		return;
+	}
+	if( map_cellcomp_passable(m, x, y) == (m->cellcomp[xy] != 0) )
+		return; // same component
+
+	for( i = 0; i < 8; i++ ) {
+		int16 nx = x + ring_x[i], ny = y + ring_y[i];
+		ring[i] = ( nx >= 0 && nx < m->xs && ny >= 0 && ny < m->ys && m->cellcomp[nx + ny*m->xs] != 0 ) ? nx + ny*m->xs : -1;
+	}
+
+	if( map_cellcomp_passable(m, x, y) ) {
+		// joins the components around it, the first one takes the others
+		uint16 label = 0;
+
+		for( i = 0; i < 8; i++ ) {
+			if( ring[i] < 0 )
+				continue;
+			if( label == 0 )
+				label = m->cellcomp[ring[i]];
+			else if( m->cellcomp[ring[i]] != label )
+				map_cellcomp_flood(m, ring[i], m->cellcomp[ring[i]], label);
+		}
+		if( label == 0 && (label = map_cellcomp_newlabel(m)) == 0 ) {
+			m->cellcomp_dirty = 1;
+			return;
+		}
+		m->cellcomp[xy] = label;
+	} else {
+		// splits its component when the cells around it aren't linked by themselves
+		uint16 label = m->cellcomp[xy];
+		int group[8]; // linked groups of the ring, numbered from 1
+		int groups = 0;
+
+		m->cellcomp[xy] = 0;
+		memset(group, 0, sizeof(group));
+		for( i = 0; i < 8; i++ ) {
+			bool linked = true;
+
+			if( ring[i] < 0 || group[i] != 0 )
+				continue;
+			group[i] = ++groups;
+			while( linked ) { // spread the group to the ring cells next to it
+				linked = false;
+				for( j = 0; j < 8; j++ ) {
+					int k;
+					if( ring[j] < 0 || group[j] != 0 )
+						continue;
+					ARR_FIND(0, 8, k, group[k] == groups && abs(ring_x[k] - ring_x[j]) <= 1 && abs(ring_y[k] - ring_y[j]) <= 1);
+					if( k < 8 ) {
+						group[j] = groups;
+						linked = true;
+					}
+				}
+			}
+		}
+
+		// every other group still holding the old label is labelled again with
+		// what it reaches, the first group keeps what remains
+		for( i = 0; i < 8 && groups > 1; i++ ) {
+			uint16 newlabel;
+
+			if( ring[i] < 0 || group[i] == 1 || m->cellcomp[ring[i]] != label )
+				continue; // first group or already labelled again
+			if( (newlabel = map_cellcomp_newlabel(m)) == 0 ) {
+				m->cellcomp_dirty = 1;
+				return;
+			}
+			map_cellcomp_flood(m, ring[i], label, newlabel);
+		}
+	}
+}
+
+/// Returns false if (x0,y0) and (x1,y1) are in different connected components,
+/// no walk path can link them then. True means they may be connected.
+/// The components are built by the first search and kept up to date by map_setcell.
+bool map_cell_reachable(struct map_data *m, int16 x0, int16 y0, int16 x1, int16 y1)
+{
+	uint16 c0, c1;
+
+	if( m->cell == map_cell_unloaded )
+		map_cell_load(m);
+	if( m->cellcomp == NULL || m->cellcomp_dirty )
+		map_cellcomp_build(m);
+
+	c0 = m->cellcomp[x0 + y0*m->xs];
+	c1 = m->cellcomp[x1 + y1*m->xs];
+	return ( c0 == 0 || c1 == 0 || c0 == c1 );
+}
+
 /*==========================================
  * Confirm if celltype in (m,x,y) match the one given in cellchk
  *------------------------------------------*/
@@ -2802,6 +3144,8 @@ int map_getcellp(struct map_data* m,int16 x,int16 y,cell_chk cellchk)
 	if(x<0 || x>=m->xs-1 || y<0 || y>=m->ys-1)
 		return( cellchk == CELL_CHKNOPASS );
 
+	if( m->cell == map_cell_unloaded )
+		map_cell_load(m);
 	cell = m->cell[x + y*m->xs];
 
 	switch(cellchk)
@@ -2878,6 +3222,11 @@ void map_setcell(int16 m, int16 x, int16 y, cell_t cell, bool flag)
 
 	j = x + y*map[m].xs;
 
+	if( map[m].cell == map_cell_unloaded )
+		map_cell_load(&map[m]);
+	if( cell != CELL_NPC ) // npc cells are marked again when the map is loaded
+		map[m].cell_dirty = 1;
+
 	switch( cell ) {
 		case CELL_WALKABLE:      map[m].cell[j].walkable = flag;      break;
 		case CELL_SHOOTABLE:     map[m].cell[j].shootable = flag;     break;
@@ -2894,6 +3243,11 @@ void map_setcell(int16 m, int16 x, int16 y, cell_t cell, bool flag)
 			ShowWarning("map_setcell: invalid cell type '%d'\n", (int)cell);
 			break;
 	}
+
+	if( cell == CELL_WALKABLE || cell == CELL_SHOOTABLE )
+		map_cellbits_update(&map[m], x, y);
+	if( cell == CELL_WALKABLE )
+		map_cellcomp_update(&map[m], x, y);
 }
 
 void map_setgatcell(int16 m, int16 x, int16 y, int gat)
@@ -2906,10 +3260,16 @@ void map_setgatcell(int16 m, int16 x, int16 y, int gat)
 
 	j = x + y*map[m].xs;
 
+	if( map[m].cell == map_cell_unloaded )
+		map_cell_load(&map[m]);
+	map[m].cell_dirty = 1;
+
 	cell = map_gat2cell(gat);
 	map[m].cell[j].walkable = cell.walkable;
 	map[m].cell[j].shootable = cell.shootable;
 	map[m].cell[j].water = cell.water;
+	map_cellbits_update(&map[m], x, y);
+	map_cellcomp_update(&map[m], x, y);
 }
 
 /*==========================================
@@ -3097,14 +3457,37 @@ int map_eraseipport(unsigned short mapindex, uint32 ip, uint16 port)
 
 /*==========================================
  * [Shinryo]: Init the mapcache
+ * The file is memory mapped when possible, so only the pages of the maps
+ * that get decompressed are read.
  *------------------------------------------*/
-static char *map_init_mapcache(FILE *fp)
+static char *map_init_mapcache(const char *path, size_t *out_size, bool *out_mapped)
 {
+	FILE *fp;
 	size_t size = 0;
 	char *buffer;
 
-	// No file open? Return..
-	nullpo_ret(fp);
+	*out_mapped = false;
+#ifndef _WIN32
+	{
+		struct stat st;
+		int fd = open(path, O_RDONLY);
+		if( fd == -1 )
+			return NULL;
+		if( fstat(fd, &st) == 0 && st.st_size > 0 ) {
+			buffer = (char *)mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if( buffer != MAP_FAILED ) {
+				close(fd);
+				*out_size = (size_t)st.st_size;
+				*out_mapped = true;
+				return buffer;
+			}
+		}
+		close(fd);
+	}
+#endif
+
+	if( ( fp = fopen(path, "rb") ) == NULL )
+		return NULL;
 
 	// Get file size
 	fseek(fp, 0, SEEK_END);
@@ -3114,67 +3497,188 @@ static char *map_init_mapcache(FILE *fp)
 	// Allocate enough space
 	CREATE(buffer, char, size);
 
-	// No memory? Return..
-	nullpo_ret(buffer);
-
 	// Read file into buffer..
 	if(fread(buffer, 1, size, fp) != size) {
 		ShowError("map_init_mapcache: Could not read entire mapcache file\n");
+		aFree(buffer);
+		fclose(fp);
 		return NULL;
 	}
+	fclose(fp);
 
+	*out_size = size;
 	return buffer;
 }
 
-/*==========================================
- * Map cache reading
- * [Shinryo]: Optimized some behaviour to speed this up
- *==========================================*/
-int map_readfromcache(struct map_data *m, char *buffer, char *decode_buffer)
+/// Releases a map cache file loaded by map_init_mapcache.
+static void map_final_mapcache(int i)
+{
+	if( map_cache_buffer[i] == NULL )
+		return;
+#ifndef _WIN32
+	if( map_cache_mapped[i] )
+		munmap(map_cache_buffer[i], map_cache_size[i]);
+	else
+#endif
+		aFree(map_cache_buffer[i]);
+	map_cache_buffer[i] = NULL;
+	map_cache_size[i] = 0;
+	map_cache_mapped[i] = false;
+}
+
+/// Adds the maps of a map cache file to index (map name -> struct map_cache_map_info*).
+/// Maps already in the index are replaced.
+static void map_index_mapcache(DBMap *index, char *buffer, size_t size)
 {
-	int i;
 	struct map_cache_main_header *header = (struct map_cache_main_header *)buffer;
-	struct map_cache_map_info *info = NULL;
 	char *p = buffer + sizeof(struct map_cache_main_header);
+	char *end = buffer + size;
+	int i;
 
-	for(i = 0; i < header->map_count; i++) {
-		info = (struct map_cache_map_info *)p;
+	if( size < sizeof(struct map_cache_main_header) )
+		return;
 
-		if( strcmp(m->name, info->name) == 0 )
-			break; // Map found
+	for( i = 0; i < header->map_count; i++ ) {
+		struct map_cache_map_info *info = (struct map_cache_map_info *)p;
+		char name[MAP_NAME_LENGTH];
+
+		if( p + sizeof(struct map_cache_map_info) > end || info->len < 0 || p + sizeof(struct map_cache_map_info) + info->len > end ) {
+			ShowWarning("map_index_mapcache: The map cache is truncated after %d maps.\n", i);
+			break;
+		}
+		safestrncpy(name, info->name, sizeof(name));
+		strdb_put(index, name, info);
 
 		// Jump to next entry..
 		p += sizeof(struct map_cache_map_info) + info->len;
 	}
+}
 
-	if( info && i < header->map_count ) {
-		unsigned long size, xy;
+/*==========================================
+ * Map cache reading
+ * [Shinryo]: Optimized some behaviour to speed this up
+ * Only the size is read here, the cells are decompressed by map_cell_load.
+ *==========================================*/
+int map_readfromcache(struct map_data *m, struct map_cache_map_info *info)
+{
+	unsigned long size;
 
-		if( info->xs <= 0 || info->ys <= 0 )
-			return 0;// Invalid
+	if( info == NULL )
+		return 0; // Not found
 
-		m->xs = info->xs;
-		m->ys = info->ys;
-		size = (unsigned long)info->xs*(unsigned long)info->ys;
+	if( info->xs <= 0 || info->ys <= 0 )
+		return 0;// Invalid
 
-		if(size > MAX_MAP_SIZE) {
-			ShowWarning("map_readfromcache: %s exceeded MAX_MAP_SIZE of %d\n", info->name, MAX_MAP_SIZE);
-			return 0; // Say not found to remove it from list.. [Shinryo]
-		}
+	m->xs = info->xs;
+	m->ys = info->ys;
+	size = (unsigned long)info->xs*(unsigned long)info->ys;
 
-		// TO-DO: Maybe handle the scenario, if the decoded buffer isn't the same size as expected? [Shinryo]
-		decode_zip(decode_buffer, &size, p+sizeof(struct map_cache_map_info), info->len);
+	if(size > MAX_MAP_SIZE) {
+		ShowWarning("map_readfromcache: %s exceeded MAX_MAP_SIZE of %d\n", info->name, MAX_MAP_SIZE);
+		return 0; // Say not found to remove it from list.. [Shinryo]
+	}
 
-		CREATE(m->cell, struct mapcell, size);
+	m->cell = map_cell_unloaded;
+	m->cell_zip = (const char *)info + sizeof(struct map_cache_map_info);
+	m->cell_ziplen = info->len;
+	m->cell_idle = 0;
+	m->cell_dirty = 0;
 
+	return 1;
+}
 
-		for( xy = 0; xy < size; ++xy )
-			m->cell[xy] = map_gat2cell(decode_buffer[xy]);
+static int map_cell_setnpc_sub(struct block_list *bl, va_list ap)
+{
+	npc_setcells((struct npc_data *)bl);
+	return 0;
+}
 
-		return 1;
+#ifdef CELL_NOSTACK
+static int map_cell_setbl_sub(struct block_list *bl, va_list ap)
+{
+	map_addblcell(bl);
+	return 0;
+}
+#endif
+
+/*==========================================
+ * Decompresses the cells of a map from the map cache, if it wasn't done yet.
+ *------------------------------------------*/
+bool map_cell_load(struct map_data *m)
+{
+	static char decode_buffer[MAX_MAP_SIZE];
+	unsigned long size, xy;
+
+	if( m->cell != map_cell_unloaded )
+		return true;
+
+	size = (unsigned long)m->xs*(unsigned long)m->ys;
+	// TO-DO: Maybe handle the scenario, if the decoded buffer isn't the same size as expected? [Shinryo]
+	decode_zip(decode_buffer, &size, m->cell_zip, m->cell_ziplen);
+
+	CREATE(m->cell, struct mapcell, m->xs*m->ys);
+	for( xy = 0; xy < size; ++xy )
+		m->cell[xy] = map_gat2cell(decode_buffer[xy]);
+	map_cellbits_build(m);
+
+	m->cell_idle = 0;
+	m->cell_dirty = 0;
+	map_cell_loaded_count++;
+
+	if( m->block != NULL ) {// restore the cells that depend on the objects already on the map
+		map_foreachinmap(map_cell_setnpc_sub, m->m, BL_NPC);
+#ifdef CELL_NOSTACK
+		map_foreachinmap(map_cell_setbl_sub, m->m, BL_CHAR);
+#endif
 	}
 
-	return 0; // Not found
+	return true;
+}
+
+/// Returns true if the cells of the map are in memory.
+bool map_cell_isloaded(int16 m)
+{
+	return ( m >= 0 && m < map_num && map[m].cell != map_cell_unloaded );
+}
+
+/*==========================================
+ * Frees the cells of the maps that had no users for idle_map_unload minutes.
+ * Only maps read from the map cache whose terrain was not changed and that
+ * only have npcs on them are unloaded, the npc cells are marked again by
+ * map_cell_load.
+ *------------------------------------------*/
+static int map_cell_unload_timer(int tid, unsigned int tick, int id, intptr_t data)
+{
+	int i, count = 0;
+
+	for( i = 0; i < map_num; i++ ) {
+		struct map_data *m = &map[i];
+
+		if( m->cell == map_cell_unloaded || m->cell_zip == NULL || m->instance_id )
+			continue;
+		if( m->users > 0 || m->cell_dirty || m->iwall_num > 0 ) {
+			m->cell_idle = 0;
+			continue;
+		}
+		if( m->cell_idle == 0 ) {
+			m->cell_idle = tick;
+			continue;
+		}
+		if( DIFF_TICK(tick, m->cell_idle) < idle_map_unload*60*1000 )
+			continue;
+		if( map_foreachinmap(map_count_sub, i, BL_ALL&~BL_NPC) > 0 )
+			continue;
+
+		map_cell_free(m);
+		m->cell = map_cell_unloaded;
+		m->cell_idle = 0;
+		map_cell_loaded_count--;
+		count++;
+	}
+
+	if( count > 0 )
+		ShowInfo("Unloaded the cells of '"CL_WHITE"%d"CL_RESET"' idle maps ('"CL_WHITE"%d"CL_RESET"' maps loaded).\n", count, map_cell_loaded_count);
+	return 0;
 }
 
 int map_addmap(char* mapname)
@@ -3328,6 +3832,7 @@ int map_readgat (struct map_data* m)
 
 		m->cell[xy] = map_gat2cell(type);
 	}
+	map_cellbits_build(m);
 
 	aFree(gat);
 
@@ -3353,14 +3858,8 @@ void map_removemapdb(struct map_data *m)
 int map_readallmaps (void)
 {
 	int i;
-	FILE* fp=NULL;
 	int maps_removed = 0;
-	// Has the uncompressed gat data of all maps, so just one allocation has to be made
-	char *map_cache_buffer[2] = {
-		NULL,
-		NULL
-	};
-	char map_cache_decode_buffer[MAX_MAP_SIZE];
+	DBMap* map_cache_index = NULL; // map name -> struct map_cache_map_info*
 
 	if( enable_grf )
 		ShowStatus("Loading maps (using GRF files)...\n");
@@ -3373,7 +3872,10 @@ int map_readallmaps (void)
 		for( i = 0; i < 2; i++ ){
 			ShowStatus( "Loading maps (using %s as map cache)...\n", mapcachefilepath[i] );
 
-			if( ( fp = fopen(mapcachefilepath[i], "rb") ) == NULL ){
+			// Init mapcache data. [Shinryo]
+			map_cache_buffer[i] = map_init_mapcache(mapcachefilepath[i], &map_cache_size[i], &map_cache_mapped[i]);
+
+			if( !map_cache_buffer[i] ){
 				if( i == 0 ){
 					ShowFatalError( "Unable to open map cache file "CL_WHITE"%s"CL_RESET"\n", mapcachefilepath[i] );
 					exit(EXIT_FAILURE); //No use launching server if maps can't be read.
@@ -3382,17 +3884,13 @@ int map_readallmaps (void)
 					break;
 				}
 			}
-
-			// Init mapcache data. [Shinryo]
-			map_cache_buffer[i] = map_init_mapcache(fp);
-
-			if( !map_cache_buffer[i] ) {
-				ShowFatalError( "Failed to initialize mapcache data (%s)..\n", mapcachefilepath );
-				exit(EXIT_FAILURE);
-			}
-
-			fclose(fp);
 		}
+
+		// Read from import first, in case of override
+		map_cache_index = strdb_alloc(DB_OPT_DUP_KEY, MAP_NAME_LENGTH);
+		for( i = 0; i < 2; i++ )
+			if( map_cache_buffer[i] != NULL )
+				map_index_mapcache(map_cache_index, map_cache_buffer[i], map_cache_size[i]);
 	}
 
 	for(i = 0; i < map_num; i++) {
@@ -3408,15 +3906,7 @@ int map_readallmaps (void)
 			success = map_readgat(&map[i]) != 0;
 		}else{
 			// try to load the map
-			// Read from import first, in case of override
-			if( map_cache_buffer[1] != NULL ){
-				success = map_readfromcache( &map[i], map_cache_buffer[1], map_cache_decode_buffer ) != 0;
-			}
-
-			// Nothing was found in import - try to find it in the main file
-			if( !success ){
-				success = map_readfromcache( &map[i], map_cache_buffer[0], map_cache_decode_buffer ) != 0;
-			}
+			success = map_readfromcache( &map[i], (struct map_cache_map_info *)strdb_get(map_cache_index, map[i].name) ) != 0;
 		}
 
 		// The map was not found - remove it
@@ -3432,10 +3922,7 @@ int map_readallmaps (void)
 		if (uidb_get(map_db,(unsigned int)map[i].index) != NULL)
 		{
 			ShowWarning("Map %s already loaded!"CL_CLL"\n", map[i].name);
-			if (map[i].cell) {
-				aFree(map[i].cell);
-				map[i].cell = NULL;
-			}
+			map_cell_free(&map[i]);
 			map_delmapid(i);
 			maps_removed++;
 			i--;
@@ -3454,21 +3941,32 @@ int map_readallmaps (void)
 		size = map[i].bxs * map[i].bys * sizeof(struct block_list*);
 		map[i].block = (struct block_list**)aCalloc(size, 1);
 		map[i].block_mob = (struct block_list**)aCalloc(size, 1);
+
+		if( enable_grf )
+			map_cell_loaded_count++;
+		else if( !lazy_map_loading )
+			map_cell_load(&map[i]);
 	}
 
 	// intialization and configuration-dependent adjustments of mapflags
 	map_flags_init();
 
 	if( !enable_grf ) {
-		// The cache isn't needed anymore, so free it. [Shinryo]
-		if( map_cache_buffer[1] != NULL ){
-			aFree(map_cache_buffer[1]);
+		db_destroy(map_cache_index);
+		if( !lazy_map_loading ) {
+			// The cache isn't needed anymore, so free it. [Shinryo]
+			for( i = 0; i < map_num; i++ )
+				map[i].cell_zip = NULL;
+			map_final_mapcache(1);
+			map_final_mapcache(0);
 		}
-		aFree(map_cache_buffer[0]);
 	}
 
 	// finished map loading
-	ShowInfo("Successfully loaded '"CL_WHITE"%d"CL_RESET"' maps."CL_CLL"\n",map_num);
+	if( enable_grf || !lazy_map_loading )
+		ShowInfo("Successfully loaded '"CL_WHITE"%d"CL_RESET"' maps."CL_CLL"\n",map_num);
+	else
+		ShowInfo("Successfully loaded '"CL_WHITE"%d"CL_RESET"' maps, their cells are decompressed when they are used."CL_CLL"\n",map_num);
 	instance_start = map_num; // Next Map Index will be instances
 
 	if (maps_removed)
@@ -3484,6 +3982,12 @@ static int char_ip_set = 0;
 /*==========================================
  * Console Command Parser [Wizputer]
  *------------------------------------------*/
+/// Prints a line of a report on the console.
+static void map_console_print(const char* line, void* ctx)
+{
+	ShowInfo("%s\n", line);
+}
+
 int parse_console(const char* buf){
 	char type[64];
 	char command[64];
@@ -3543,12 +4047,54 @@ int parse_console(const char* buf){
 	else if( strcmpi("ers_report", type) == 0 ){
 		ers_report();
 	}
+	else if( strcmpi("timer_profile", type) == 0 ){
+		if( strcmpi("start", command) == 0 ){
+			timer_profile_enable(true);
+			ShowInfo("Timer profiler started.\n");
+		}
+		else if( strcmpi("stop", command) == 0 ){
+			timer_profile_enable(false);
+			ShowInfo("Timer profiler stopped.\n");
+		}
+		else if( strcmpi("reset", command) == 0 ){
+			timer_profile_reset();
+			ShowInfo("Timer profiler statistics cleared.\n");
+		}
+		else
+			timer_profile_report(20, map_console_print, NULL);
+	}
+	else if( strcmpi("tick_report", type) == 0 ){
+		tickstat_report(map_console_print, NULL);
+	}
+	else if( strcmpi("mob_ai_report", type) == 0 ){
+		mob_ai_report(map_console_print, NULL);
+	}
+	else if( strcmpi("packet_stats", type) == 0 ){
+		if( strcmpi("start", command) == 0 ){
+			clif_packet_stats_enable(true);
+			ShowInfo("Packet statistics started.\n");
+		}
+		else if( strcmpi("stop", command) == 0 ){
+			clif_packet_stats_enable(false);
+			ShowInfo("Packet statistics stopped.\n");
+		}
+		else if( strcmpi("reset", command) == 0 ){
+			clif_packet_stats_reset();
+			ShowInfo("Packet statistics cleared.\n");
+		}
+		else
+			clif_packet_stats_report(20, map_console_print, NULL);
+	}
 	else if( strcmpi("help", type) == 0 ) {
 		ShowInfo("Available commands:\n");
 		ShowInfo("\t admin:@<atcommand> => Uses an atcommand. Do NOT use commands requiring an attached player.\n");
 		ShowInfo("\t admin:map:<map> <x> <y> => Changes the map from which console commands are executed.\n");
 		ShowInfo("\t server:shutdown => Stops the server.\n");
 		ShowInfo("\t ers_report => Displays database usage.\n");
+		ShowInfo("\t timer_profile{:start|:stop|:reset} => Displays, starts, stops or clears the timer function statistics.\n");
+		ShowInfo("\t tick_report => Displays the p50/p99/max time of the server loop phases.\n");
+		ShowInfo("\t mob_ai_report => Displays how many mobs the hard AI activated, and the redundant visits it skipped, and the hibernating maps.\n");
+		ShowInfo("\t packet_stats{:start|:stop|:reset} => Displays, starts, stops or clears the client packet statistics.\n");
 	}
 
 	return 0;
@@ -3590,6 +4136,8 @@ int map_config_read(char *cfgName)
 			safestrncpy(timestamp_format, w2, 20);
 		else if(strcmpi(w1,"stdout_with_ansisequence")==0)
 			stdout_with_ansisequence = config_switch(w2);
+		else if(strcmpi(w1,"console_msg_async")==0)
+			console_msg_async = config_switch(w2);
 		else if(strcmpi(w1,"console_silent")==0) {
 			msg_silent = atoi(w2);
 			if( msg_silent ) // only bother if its actually enabled
@@ -3647,6 +4195,10 @@ int map_config_read(char *cfgName)
 			enable_spy = config_switch(w2);
 		else if (strcmpi(w1, "use_grf") == 0)
 			enable_grf = config_switch(w2);
+		else if (strcmpi(w1, "lazy_map_loading") == 0)
+			lazy_map_loading = config_switch(w2);
+		else if (strcmpi(w1, "idle_map_unload") == 0)
+			idle_map_unload = max(0, config_switch(w2));
 		else if (strcmpi(w1, "console_msg_log") == 0)
 			console_msg_log = atoi(w2);//[Ind]
 		else if (strcmpi(w1, "import") == 0)
@@ -3858,6 +4410,8 @@ int map_sql_close(void)
 		ShowStatus("Close Log DB Connection....\n");
 		Sql_Free(logmysql_handle);
 		logmysql_handle = NULL;
+		SqlAsync_Free(logmysql_async);
+		logmysql_async = NULL;
 	}
 #endif
 	return 0;
@@ -3882,6 +4436,9 @@ int log_sql_init(void)
 	if( strlen(default_codepage) > 0 )
 		if ( SQL_ERROR == Sql_SetEncoding(logmysql_handle, default_codepage) )
 			Sql_ShowDebug(logmysql_handle);
+
+	// the log inserts run on the worker threads, each with its own connection
+	logmysql_async = SqlAsync_Create(log_db_id, log_db_pw, log_db_ip, log_db_port, log_db_db, default_codepage);
 #endif
 	return 0;
 }
@@ -4110,9 +4667,10 @@ void do_final(void)
 	map_db->destroy(map_db, map_db_final);
 
 	for (i=0; i<map_num; i++) {
-		if(map[i].cell) aFree(map[i].cell);
+		map_cell_free(&map[i]);
 		if(map[i].block) aFree(map[i].block);
 		if(map[i].block_mob) aFree(map[i].block_mob);
+		if(map[i].mob_parked) aFree(map[i].mob_parked);
 		if(map[i].qi_data) aFree(map[i].qi_data);
 		if(battle_config.dynamic_mobs) { //Dynamic mobs flag by [random]
 			if(map[i].mob_delete_timer != INVALID_TIMER)
@@ -4125,10 +4683,15 @@ void do_final(void)
 			map_skill_damage_free(&map[i]);
 #endif
 	}
+	if (cellcomp_queue) aFree(cellcomp_queue);
+	cellcomp_queue = NULL;
+	cellcomp_queue_max = 0;
 
 	mapindex_final();
 	if(enable_grf)
 		grfio_final();
+	map_final_mapcache(1);
+	map_final_mapcache(0);
 
 	id_db->destroy(id_db, NULL);
 	pc_db->destroy(pc_db, NULL);
@@ -4143,6 +4706,7 @@ void do_final(void)
 	ers_destroy(map_skill_damage_ers);
 #endif
 
+	do_final_log();
 	map_sql_close();
 
 	ShowStatus("Finished.\n");
@@ -4313,6 +4877,7 @@ void do_shutdown(void)
 int do_init(int argc, char *argv[])
 {
 	runflag = MAPSERVER_ST_STARTING;
+	initstat_begin("do_init");
 #ifdef GCOLLECT
 	GC_enable_incremental();
 #endif
@@ -4346,6 +4911,7 @@ int do_init(int argc, char *argv[])
 	cli_get_options(argc,argv);
 
 	rnd_init();
+	initstat_begin("config files");
 	map_config_read(MAP_CONF_NAME);
 
 	// loads npcs
@@ -4376,14 +4942,15 @@ int do_init(int argc, char *argv[])
 	script_config_read(SCRIPT_CONF_NAME);
 	inter_config_read(INTER_CONF_NAME);
 	log_config_read(LOG_CONF_NAME);
+	initstat_end();
 
-	id_db = idb_alloc(DB_OPT_BASE);
-	pc_db = idb_alloc(DB_OPT_BASE);	//Added for reliable map_id2sd() use. [Skotlex]
-	mobid_db = idb_alloc(DB_OPT_BASE);	//Added to lower the load of the lazy mob ai. [Skotlex]
+	id_db = idb_alloc(DB_OPT_FLAT);
+	pc_db = idb_alloc(DB_OPT_FLAT);	//Added for reliable map_id2sd() use. [Skotlex]
+	mobid_db = idb_alloc(DB_OPT_FLAT);	//Added to lower the load of the lazy mob ai. [Skotlex]
 	bossid_db = idb_alloc(DB_OPT_BASE); // Used for Convex Mirror quick MVP search
 	map_db = uidb_alloc(DB_OPT_BASE);
 	nick_db = idb_alloc(DB_OPT_BASE);
-	charid_db = idb_alloc(DB_OPT_BASE);
+	charid_db = idb_alloc(DB_OPT_FLAT);
 	regen_db = idb_alloc(DB_OPT_BASE); // efficient status_natural_heal processing
 	iwall_db = strdb_alloc(DB_OPT_RELEASE_DATA,2*NAME_LENGTH+2+1); // [Zephyrus] Invisible Walls
 
@@ -4391,51 +4958,60 @@ int do_init(int argc, char *argv[])
 	map_skill_damage_ers = ers_new(sizeof(struct s_skill_damage), "map.c:map_skill_damage_ers", ERS_OPT_NONE);
 #endif
 
+	initstat_begin("sql connections");
 	map_sql_init();
 	if (log_config.sql_logs)
 		log_sql_init();
+	initstat_end();
 
-	mapindex_init();
+	initstat_stage(mapindex_init());
 	if(enable_grf)
-		grfio_init(GRF_PATH_FILENAME);
+		initstat_stage(grfio_init(GRF_PATH_FILENAME));
 
-	map_readallmaps();
+	initstat_stage(map_readallmaps());
 
 	add_timer_func_list(map_freeblock_timer, "map_freeblock_timer");
 	add_timer_func_list(map_clearflooritem_timer, "map_clearflooritem_timer");
 	add_timer_func_list(map_removemobs_timer, "map_removemobs_timer");
 	add_timer_interval(gettick()+1000, map_freeblock_timer, 0, 0, 60*1000);
+	if( !enable_grf && lazy_map_loading && idle_map_unload > 0 ) {
+		add_timer_func_list(map_cell_unload_timer, "map_cell_unload_timer");
+		add_timer_interval(gettick()+60*1000, map_cell_unload_timer, 0, 0, 60*1000);
+	}
 	
-	map_do_init_msg();
-	do_init_atcommand();
-	do_init_battle();
-	do_init_instance();
-	do_init_channel();
-	do_init_chrif();
-	do_init_clif();
-	do_init_script();
-	do_init_itemdb();
-	do_init_cashshop();
-	do_init_skill();
-	do_init_mob();
-	do_init_pc();
-	do_init_status();
-	do_init_party();
-	do_init_guild();
-	do_init_storage();
-	do_init_pet();
-	do_init_homunculus();
-	do_init_mercenary();
-	do_init_elemental();
-	do_init_quest();
-	do_init_npc();
-	do_init_unit();
-	do_init_battleground();
-	do_init_duel();
-	do_init_vending();
-	do_init_buyingstore();
-
-	npc_event_do_oninit();	// Init npcs (OnInit)
+	initstat_stage(map_do_init_msg());
+	initstat_stage(do_init_atcommand());
+	initstat_stage(do_init_battle());
+	initstat_stage(do_init_instance());
+	initstat_stage(do_init_channel());
+	initstat_stage(do_init_chrif());
+	initstat_stage(do_init_clif());
+	initstat_stage(do_init_script());
+	initstat_stage(do_init_itemdb());
+	initstat_stage(do_init_cashshop());
+	initstat_stage(do_init_skill());
+	initstat_stage(do_init_mob());
+	initstat_stage(do_init_pc());
+	initstat_stage(do_init_status());
+	initstat_stage(do_init_party());
+	initstat_stage(do_init_guild());
+	initstat_stage(do_init_storage());
+	initstat_stage(do_init_pet());
+	initstat_stage(do_init_homunculus());
+	initstat_stage(do_init_mercenary());
+	initstat_stage(do_init_elemental());
+	initstat_stage(do_init_quest());
+	initstat_stage(do_init_npc());
+	initstat_stage(do_init_unit());
+	initstat_stage(do_init_battleground());
+	initstat_stage(do_init_duel());
+	initstat_stage(do_init_vending());
+	initstat_stage(do_init_buyingstore());
+	initstat_stage(do_init_log());
+
+	initstat_stage(npc_event_do_oninit());	// Init npcs (OnInit)
+	initstat_end();
+	initstat_report();
 
 	if (battle_config.pk_mode)
 		ShowNotice("Server is running on '"CL_WHITE"PK Mode"CL_RESET"'.\n");
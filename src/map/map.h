@@ -50,6 +50,7 @@ void map_msg_reload(void);
 #define MAX_IGNORE_LIST 20 	// official is 14
 #define MAX_VENDING 12
 #define MAX_MAP_SIZE 512*512 	// Wasn't there something like this already? Can't find it.. [Shinryo]
+#define BLOCK_SIZE 8 // Side of the map blocks, in cells
 
 /** Added definitions for WoESE objects and other [L0ne_W0lf], [aleos] */
 enum MOBID {
@@ -584,6 +585,14 @@ struct mapcell
 #endif
 };
 
+/// Collision bitplanes derived from the cells of a map, one bit per cell.
+/// The last row and column follow map_getcellp, which treats them as out of the map.
+enum e_cellbits {
+	CELLBITS_WALL = 0, ///< CELL_CHKWALL (blocks ranged attacks)
+	CELLBITS_NOPASS,   ///< CELL_CHKNOPASS, without the CELL_NOSTACK limit
+	CELLBITS_MAX
+};
+
 struct iwall_data {
 	char wall_name[50];
 	short m, x, y, size;
@@ -619,6 +628,15 @@ struct map_data {
 	char name[MAP_NAME_LENGTH];
 	uint16 index; // The map index used by the mapindex* functions.
 	struct mapcell* cell; // Holds the information of each map cell (NULL if the map is not on this map-server).
+	const char* cell_zip; // Compressed cells in the map cache, NULL if the cells can't be unloaded
+	int32 cell_ziplen;
+	unsigned int cell_idle; // Tick since which the map has no users, 0 if it's in use
+	unsigned cell_dirty : 1; // The terrain was changed at runtime, the cells can't be unloaded
+	unsigned cellcomp_dirty : 1; // cellcomp must be built again (labels exhausted)
+	uint32* cellbits[CELLBITS_MAX]; // Collision bitplanes, rows of cellbits_stride words (NULL while the cells are not loaded)
+	int cellbits_stride;
+	uint16* cellcomp; // Connected component of each cell, 0 if blocked or unknown (NULL until a path search needs it)
+	uint16 cellcomp_labels; // Last label used in cellcomp, 0xFFFF when they ran out
 	struct block_list **block;
 	struct block_list **block_mob;
 	int16 m;
@@ -628,6 +646,11 @@ struct map_data {
 	int npc_num;
 	int users;
 	int users_pvp;
+	struct mob_data *mobs; // Mobs on the map, linked by mob_data::map_next (see mob_ai_lazy)
+	unsigned int mob_idle; // Tick since which the map has no users, 0 if it's in use (see mob_hibernate_time)
+	unsigned mob_hibernate : 1; // The lazy AI and the respawns are frozen until a player enters (see mob_thaw)
+	int *mob_parked; // Ids of the mobs to spawn when the map thaws
+	int mob_parked_count, mob_parked_max;
 	int iwall_num; // Total of invisible walls in this map
 	struct map_flag {
 		unsigned town : 1; // [Suggestion to protect Mail System]
@@ -740,6 +763,13 @@ struct map_data_other_server {
 
 int map_getcell(int16 m,int16 x,int16 y,cell_chk cellchk);
 int map_getcellp(struct map_data* m,int16 x,int16 y,cell_chk cellchk);
+bool map_cell_load(struct map_data* m);
+bool map_cell_isloaded(int16 m);
+bool map_cellbits_rect(struct map_data* m, enum e_cellbits plane, int16 x0, int16 y0, int16 x1, int16 y1);
+bool map_cell_reachable(struct map_data* m, int16 x0, int16 y0, int16 x1, int16 y1);
+
+/// Returns the bit of cell (x,y) in a collision bitplane. The cells must be loaded.
+#define map_cellbits_get(m, plane, x, y) ( ((m)->cellbits[plane][(y)*(m)->cellbits_stride + ((x)>>5)] >> ((x)&31)) & 1 )
 void map_setcell(int16 m, int16 x, int16 y, cell_t cell, bool flag);
 void map_setgatcell(int16 m, int16 x, int16 y, int gat);
 
@@ -981,6 +1011,7 @@ extern int db_use_sqldbs;
 extern Sql* mmysql_handle;
 extern Sql* qsmysql_handle;
 extern Sql* logmysql_handle;
+extern SqlAsync* logmysql_async;
 
 extern char buyingstores_db[32];
 extern char buyingstore_items_db[32];
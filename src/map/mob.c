@@ -829,6 +829,8 @@ int mob_linksearch(struct block_list *bl,va_list ap)
 	return 0;
 }
 
+static void mob_park(struct mob_data *md);
+
 /*==========================================
  * mob spawn with delay (timer function)
  *------------------------------------------*/
@@ -845,6 +847,11 @@ int mob_delayspawn(int tid, unsigned int tick, int id, intptr_t data)
 			return 0;
 		}
 		md->spawn_timer = INVALID_TIMER;
+		if( map[md->bl.m].mob_hibernate )
+		{	// spawns when the map thaws
+			mob_park(md);
+			return 0;
+		}
 		mob_spawn(md);
 	}
 	return 0;
@@ -1719,45 +1726,292 @@ static bool mob_ai_sub_hard(struct mob_data *md, unsigned int tick)
 	return true;
 }
 
-static int mob_ai_sub_hard_timer(struct block_list *bl,va_list ap)
+static void mob_ai_sub_hard_timer(struct mob_data *md, unsigned int tick)
 {
-	struct mob_data *md = (struct mob_data*)bl;
-	unsigned int tick = va_arg(ap, unsigned int);
 	if (mob_ai_sub_hard(md, tick))
 	{	//Hard AI triggered.
 		if(!md->state.spotted)
 			md->state.spotted = 1;
 		md->last_pcneartime = tick;
 	}
+}
+
+/*==========================================
+ * Hard AI activation set
+ * Every pass collects the mobs in range of the players once, map by map, then
+ * runs their hard AI. Visiting the mobs around each player reached a mob once
+ * per player in range, only last_thinktime stopped the duplicates.
+ * A block fully in range of a player is collected as a whole and skipped for
+ * the next players of the map.
+ *------------------------------------------*/
+static unsigned int mob_ai_pass = 0;
+static struct map_session_data **mob_ai_pc = NULL; // players of the pass
+static int mob_ai_pc_count = 0, mob_ai_pc_max = 0;
+static struct mob_data **mob_ai_md = NULL; // mobs of the pass
+static int mob_ai_md_count = 0, mob_ai_md_max = 0;
+static int *mob_ai_block = NULL; // blocks of the current map collected as a whole: number of mobs, -1 if not
+static int mob_ai_block_max = 0;
+
+// totals since the server started
+static struct {
+	uint64 passes;
+	uint64 players;
+	uint64 visits; // mobs in range of each player, what visiting them per player cost
+	uint64 mobs; // mobs of the activation sets
+} mob_ai_stat;
+
+static int mob_ai_pc_collect(struct map_session_data *sd, va_list ap)
+{
+	if( mob_ai_pc_count == mob_ai_pc_max ) {
+		mob_ai_pc_max += 256;
+		RECREATE(mob_ai_pc, struct map_session_data*, mob_ai_pc_max);
+	}
+	mob_ai_pc[mob_ai_pc_count++] = sd;
 	return 0;
 }
 
+static int mob_ai_pc_cmp(const void *a, const void *b)
+{
+	return (*(struct map_session_data**)a)->bl.m - (*(struct map_session_data**)b)->bl.m;
+}
+
+/// Adds the mobs in range of sd that aren't in the set yet.
+static void mob_ai_md_collect(struct map_session_data *sd)
+{
+	struct map_data *mapdata = &map[sd->bl.m];
+	int range = AREA_SIZE+ACTIVE_AI_RANGE;
+	int x0, x1, y0, y1, bx, by;
+
+	// same area as map_foreachinrange
+	x0 = max(sd->bl.x - range, 0);
+	y0 = max(sd->bl.y - range, 0);
+	x1 = min(sd->bl.x + range, mapdata->xs - 1);
+	y1 = min(sd->bl.y + range, mapdata->ys - 1);
+
+	for( by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++ ) {
+		for( bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++ ) {
+			int b = bx + by * mapdata->bxs;
+			int count = 0;
+			bool full = false;
+			struct block_list *bl;
+
+			if( mob_ai_block[b] >= 0 ) { // every mob of the block is in the set
+				mob_ai_stat.visits += mob_ai_block[b];
+				continue;
+			}
+#ifndef CIRCULAR_AREA
+			full = ( bx*BLOCK_SIZE >= x0 && min(bx*BLOCK_SIZE + BLOCK_SIZE-1, mapdata->xs-1) <= x1
+				&& by*BLOCK_SIZE >= y0 && min(by*BLOCK_SIZE + BLOCK_SIZE-1, mapdata->ys-1) <= y1 );
+#endif
+
+			for( bl = mapdata->block_mob[b]; bl != NULL; bl = bl->next ) {
+				struct mob_data *md = (TBL_MOB*)bl;
+
+				if( !full && !(bl->x >= x0 && bl->x <= x1 && bl->y >= y0 && bl->y <= y1
+#ifdef CIRCULAR_AREA
+					&& check_distance_bl(&sd->bl, bl, range)
+#endif
+					) )
+					continue;
+				count++;
+				if( md->ai_pass == mob_ai_pass )
+					continue; // already in range of another player
+				md->ai_pass = mob_ai_pass;
+				if( mob_ai_md_count == mob_ai_md_max ) {
+					mob_ai_md_max += 1024;
+					RECREATE(mob_ai_md, struct mob_data*, mob_ai_md_max);
+				}
+				mob_ai_md[mob_ai_md_count++] = md;
+			}
+
+			mob_ai_stat.visits += count;
+			if( full )
+				mob_ai_block[b] = count;
+		}
+	}
+}
+
+/// Builds the activation set of the pass.
+static void mob_ai_hard_collect(void)
+{
+	int i, j;
+
+	mob_ai_pass++;
+	mob_ai_pc_count = 0;
+	mob_ai_md_count = 0;
+	map_foreachpc(mob_ai_pc_collect);
+	qsort(mob_ai_pc, mob_ai_pc_count, sizeof(mob_ai_pc[0]), mob_ai_pc_cmp);
+
+	for( i = 0; i < mob_ai_pc_count; i = j ) {
+		struct map_data *mapdata = &map[mob_ai_pc[i]->bl.m];
+		int blocks = mapdata->bxs * mapdata->bys;
+
+		if( blocks > mob_ai_block_max ) {
+			mob_ai_block_max = blocks;
+			RECREATE(mob_ai_block, int, mob_ai_block_max);
+		}
+		memset(mob_ai_block, 0xFF, blocks * sizeof(int)); // -1
+
+		for( j = i; j < mob_ai_pc_count && mob_ai_pc[j]->bl.m == mob_ai_pc[i]->bl.m; j++ )
+			mob_ai_md_collect(mob_ai_pc[j]);
+	}
+
+	mob_ai_stat.passes++;
+	mob_ai_stat.players += mob_ai_pc_count;
+	mob_ai_stat.mobs += mob_ai_md_count;
+}
+
 /*==========================================
- * Serious processing for mob in PC field of view (foreachclient)
+ * Map hibernation
+ * A map without players for mob_hibernate_time stops the lazy AI of its mobs
+ * and defers their respawns. With mob_hibernate_despawn the mobs that respawn
+ * are also taken off the map: the cached spawns of the dynamic mobs are freed
+ * like map_removemobs does, the others are parked. The first player entering
+ * the map thaws it: the parked mobs spawn in id order, before the player gets
+ * the area, and map_spawnmobs brings the cached spawns back.
+ * Instance maps never hibernate, their scripts count and kill their mobs.
  *------------------------------------------*/
-static int mob_ai_sub_foreachclient(struct map_session_data *sd,va_list ap)
+static struct {
+	uint64 hibernations;
+	uint64 despawned;
+	uint64 thawed; // parked mobs spawned by the thaws
+} mob_hibernate_stat;
+
+/// Adds md to the mobs that spawn when its map thaws.
+static void mob_park(struct mob_data *md)
 {
-	unsigned int tick;
-	tick=va_arg(ap,unsigned int);
-	map_foreachinrange(mob_ai_sub_hard_timer,&sd->bl, AREA_SIZE+ACTIVE_AI_RANGE, BL_MOB,tick);
+	struct map_data *mapdata = &map[md->bl.m];
 
-	return 0;
+	if( mapdata->mob_parked_count == mapdata->mob_parked_max ) {
+		mapdata->mob_parked_max += 64;
+		RECREATE(mapdata->mob_parked, int, mapdata->mob_parked_max);
+	}
+	mapdata->mob_parked[mapdata->mob_parked_count++] = md->bl.id;
+}
+
+/// Takes a mob off its hibernating map, the same mobs as map_removemobs_sub.
+static int mob_hibernate_sub(struct block_list *bl, va_list ap)
+{
+	struct mob_data *md = (struct mob_data *)bl;
+
+	// doesn't respawn and is not a slave
+	if( !md->spawn && !md->master_id )
+		return 0;
+	// is damaged and mob_remove_damaged is off
+	if( !battle_config.mob_remove_damaged && md->status.hp < md->status.max_hp )
+		return 0;
+	// is a boss or a mvp
+	if( (md->status.mode&MD_BOSS) || md->db->mexp > 0 )
+		return 0;
+
+	if( !md->spawn || md->spawn->state.dynamic ) {
+		// slaves are summoned again by their master, cached spawns by map_spawnmobs
+		unit_free(&md->bl, CLR_OUTSIGHT);
+		return 1;
+	}
+	unit_remove_map(&md->bl, CLR_OUTSIGHT);
+	mob_park(md);
+	return 1;
+}
+
+static void mob_hibernate(int16 m)
+{
+	map[m].mob_hibernate = 1;
+	mob_hibernate_stat.hibernations++;
+	if( !battle_config.mob_hibernate_despawn )
+		return;
+	if( map[m].mob_delete_timer != INVALID_TIMER ) {
+		// removed now, map_spawnmobs only spawns the cached mobs when the timer isn't pending
+		delete_timer(map[m].mob_delete_timer, map_removemobs_timer);
+		map[m].mob_delete_timer = INVALID_TIMER;
+	}
+	mob_hibernate_stat.despawned += map_foreachinmap(mob_hibernate_sub, m, BL_MOB);
+}
+
+static int mob_parked_cmp(const void *a, const void *b)
+{
+	return *(const int*)a - *(const int*)b;
+}
+
+/// Thaws map m, called when the first player enters it.
+void mob_thaw(int16 m)
+{
+	struct map_data *mapdata = &map[m];
+	int i;
+
+	mapdata->mob_idle = 0;
+	if( !mapdata->mob_hibernate )
+		return;
+	mapdata->mob_hibernate = 0;
+
+	// spawned in the same order whatever the order they were parked in
+	qsort(mapdata->mob_parked, mapdata->mob_parked_count, sizeof(int), mob_parked_cmp);
+	for( i = 0; i < mapdata->mob_parked_count; i++ ) {
+		struct mob_data *md = map_id2md(mapdata->mob_parked[i]);
+
+		if( md == NULL || md->bl.prev != NULL || md->bl.m != m || md->spawn_timer != INVALID_TIMER )
+			continue; // freed, spawned again or waiting for its respawn
+		mob_spawn(md);
+		mob_hibernate_stat.thawed++;
+	}
+	mapdata->mob_parked_count = 0;
+}
+
+/// Hibernates the maps that have been empty for mob_hibernate_time.
+static void mob_hibernate_check(unsigned int tick)
+{
+	int16 m;
+
+	for( m = 0; m < map_num; m++ ) {
+		struct map_data *mapdata = &map[m];
+
+		if( mapdata->users > 0 || !battle_config.mob_hibernate_time || mapdata->instance_id ) {
+			if( mapdata->mob_hibernate )
+				mob_thaw(m); // the setting was turned off
+			mapdata->mob_idle = 0;
+		} else if( !mapdata->mob_hibernate ) {
+			if( !mapdata->mob_idle )
+				mapdata->mob_idle = tick;
+			else if( DIFF_TICK(tick, mapdata->mob_idle) >= battle_config.mob_hibernate_time )
+				mob_hibernate(m);
+		}
+	}
+}
+
+/// Displays the totals of the hard AI activation sets and of the hibernation.
+void mob_ai_report(void (*print)(const char* line, void* ctx), void* ctx)
+{
+	char line[256];
+	int16 m;
+	int maps = 0, parked = 0;
+
+	snprintf(line, sizeof(line), "Hard AI, %"PRIu64" passes: %"PRIu64" players, %"PRIu64" mobs activated, %"PRIu64" redundant visits skipped (%.1f%%)",
+		mob_ai_stat.passes, mob_ai_stat.players, mob_ai_stat.mobs,
+		mob_ai_stat.visits - mob_ai_stat.mobs,
+		mob_ai_stat.visits ? 100. * (mob_ai_stat.visits - mob_ai_stat.mobs) / mob_ai_stat.visits : 0.);
+	print(line, ctx);
+
+	for( m = 0; m < map_num; m++ ) {
+		if( map[m].mob_hibernate ) {
+			maps++;
+			parked += map[m].mob_parked_count;
+		}
+	}
+	snprintf(line, sizeof(line), "Hibernation: %d maps hibernating with %d parked mobs, %"PRIu64" hibernations, %"PRIu64" mobs despawned, %"PRIu64" parked mobs spawned by the thaws",
+		maps, parked, mob_hibernate_stat.hibernations, mob_hibernate_stat.despawned, mob_hibernate_stat.thawed);
+	print(line, ctx);
 }
 
 /*==========================================
  * Negligent mode MOB AI (PC is not in near)
  *------------------------------------------*/
-static int mob_ai_sub_lazy(struct mob_data *md, va_list args)
+static int mob_ai_sub_lazy(struct mob_data *md, unsigned int tick)
 {
-	unsigned int tick;
-
 	nullpo_ret(md);
 
 	if(md->bl.prev == NULL)
 		return 0;
 
-	tick = va_arg(args,unsigned int);
-
 	if (battle_config.mob_ai&0x20 && map[md->bl.m].users>0)
 		return (int)mob_ai_sub_hard(md, tick);
 
@@ -1810,12 +2064,43 @@ static int mob_ai_sub_lazy(struct mob_data *md, va_list args)
 	return 0;
 }
 
+static struct mob_data **mob_ai_lazy_md = NULL; // mobs of the lazy AI pass
+static int mob_ai_lazy_md_max = 0;
+
+/// Runs the lazy AI of the mobs on the maps that don't hibernate.
+static void mob_ai_lazy_maps(unsigned int tick)
+{
+	int16 m;
+	int i, count = 0;
+
+	// collected first, the AI moves mobs between the lists
+	for( m = 0; m < map_num; m++ ) {
+		struct mob_data *md;
+
+		if( map[m].mob_hibernate )
+			continue;
+		for( md = map[m].mobs; md != NULL; md = md->map_next ) {
+			if( count == mob_ai_lazy_md_max ) {
+				mob_ai_lazy_md_max += 1024;
+				RECREATE(mob_ai_lazy_md, struct mob_data*, mob_ai_lazy_md_max);
+			}
+			mob_ai_lazy_md[count++] = md;
+		}
+	}
+
+	map_freeblock_lock();
+	for( i = 0; i < count; i++ )
+		mob_ai_sub_lazy(mob_ai_lazy_md[i], tick);
+	map_freeblock_unlock();
+}
+
 /*==========================================
  * Negligent processing for mob outside PC field of view   (interval timer function)
  *------------------------------------------*/
 static int mob_ai_lazy(int tid, unsigned int tick, int id, intptr_t data)
 {
-	map_foreachmob(mob_ai_sub_lazy,tick);
+	mob_hibernate_check(tick);
+	mob_ai_lazy_maps(tick);
 	return 0;
 }
 
@@ -1825,10 +2110,20 @@ static int mob_ai_lazy(int tid, unsigned int tick, int id, intptr_t data)
 static int mob_ai_hard(int tid, unsigned int tick, int id, intptr_t data)
 {
 
-	if (battle_config.mob_ai&0x20)
-		map_foreachmob(mob_ai_sub_lazy,tick);
-	else
-		map_foreachpc(mob_ai_sub_foreachclient,tick);
+	int i;
+
+	if (battle_config.mob_ai&0x20) {
+		mob_ai_lazy_maps(tick);
+		return 0;
+	}
+
+	mob_ai_hard_collect();
+
+	map_freeblock_lock();
+	for( i = 0; i < mob_ai_md_count; i++ )
+		if( mob_ai_md[i]->bl.prev != NULL ) // removed by the AI of another mob
+			mob_ai_sub_hard_timer(mob_ai_md[i], tick);
+	map_freeblock_unlock();
 
 	return 0;
 }
@@ -4933,4 +5228,13 @@ void do_final_mob(void){
 	mob_skill_db->destroy(mob_skill_db, mob_skill_db_free);
 	ers_destroy(item_drop_ers);
 	ers_destroy(item_drop_list_ers);
+	if (mob_ai_pc) aFree(mob_ai_pc);
+	if (mob_ai_md) aFree(mob_ai_md);
+	if (mob_ai_block) aFree(mob_ai_block);
+	if (mob_ai_lazy_md) aFree(mob_ai_lazy_md);
+	mob_ai_pc = NULL;
+	mob_ai_md = NULL;
+	mob_ai_block = NULL;
+	mob_ai_lazy_md = NULL;
+	mob_ai_pc_max = mob_ai_md_max = mob_ai_block_max = mob_ai_lazy_md_max = 0;
 }
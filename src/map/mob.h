@@ -166,6 +166,8 @@ struct mob_data {
 	unsigned int bg_id; // BattleGround System
 
 	unsigned int next_walktime,last_thinktime,last_linktime,last_pcneartime,dmgtick;
+	unsigned int ai_pass; //Hard AI pass that last collected this mob (see mob_ai_hard)
+	struct mob_data *map_prev, *map_next; //Mobs on the same map (see map_data::mobs)
 	short move_fail_count;
 	short lootitem_count;
 	short min_chase;
@@ -291,6 +293,9 @@ void mob_clear_spawninfo();
 void do_init_mob(void);
 void do_final_mob(void);
 
+void mob_ai_report(void (*print)(const char* line, void* ctx), void* ctx);
+void mob_thaw(int16 m);
+
 int mob_timer_delete(int tid, unsigned int tick, int id, intptr_t data);
 int mob_deleteslave(struct mob_data *md);
 
@@ -3352,6 +3352,8 @@ void npc_setcells(struct npc_data* nd)
 
 	if (m < 0 || xs < 0 || ys < 0) //invalid range or map
 		return;
+	if (!map_cell_isloaded(m)) // marked when the map is loaded
+		return;
 
 	for (i = y-ys; i <= y+ys; i++) {
 		for (j = x-xs; j <= x+xs; j++) {
@@ -3384,7 +3386,7 @@ void npc_unsetcells(struct npc_data* nd)
 		ys = nd->u.scr.ys;
 	}
 
-	if (m < 0 || xs < 0 || ys < 0)
+	if (m < 0 || xs < 0 || ys < 0 || !map_cell_isloaded(m))
 		return;
 
 	//Locate max range on which we can locate npc cells
@@ -4101,6 +4103,8 @@ int npc_parsesrcfile(const char* filepath, bool runOnInit)
 		return 0;
 	}
 
+	script_cache_begin(filepath, buffer, len);
+
 	// parse buffer
 	for( p = skip_space(buffer); p && *p ; p = skip_space(p) )
 	{
@@ -4218,6 +4222,7 @@ int npc_parsesrcfile(const char* filepath, bool runOnInit)
 			p = strchr(p,'\n');// skip and continue
 		}
 	}
+	script_cache_end();
 	aFree(buffer);
 
 	return 1;
@@ -4377,9 +4382,12 @@ int npc_reload(void) {
 	//TODO: the following code is copy-pasted from do_init_npc(); clean it up
 	// Reloading npcs now
 	for (nsl = npc_src_files; nsl; nsl = nsl->next) {
+		uint64 start = gettick_usec();
 		ShowStatus("Loading NPC file: %s"CL_CLL"\r", nsl->name);
 		npc_parsesrcfile(nsl->name,false);
+		initstat_add_file(nsl->name, gettick_usec() - start);
 	}
+	script_cache_save();
 	ShowInfo ("Done loading '"CL_WHITE"%d"CL_RESET"' NPCs:"CL_CLL"\n"
 		"\t-'"CL_WHITE"%d"CL_RESET"' Warps\n"
 		"\t-'"CL_WHITE"%d"CL_RESET"' Shops\n"
@@ -4518,9 +4526,12 @@ void do_init_npc(void){
 	// process all npc files
 	ShowStatus("Loading NPCs...\r");
 	for( file = npc_src_files; file != NULL; file = file->next ) {
+		uint64 start = gettick_usec();
 		ShowStatus("Loading NPC file: %s"CL_CLL"\r", file->name);
 		npc_parsesrcfile(file->name,false);
+		initstat_add_file(file->name, gettick_usec() - start);
 	}
+	script_cache_save();
 	ShowInfo ("Done loading '"CL_WHITE"%d"CL_RESET"' NPCs:"CL_CLL"\n"
 		"\t-'"CL_WHITE"%d"CL_RESET"' Warps\n"
 		"\t-'"CL_WHITE"%d"CL_RESET"' Shops\n"
@@ -7,6 +7,7 @@
 #include "../common/nullpo.h"
 #include "../common/random.h"
 #include "../common/showmsg.h"
+#include "../common/timer.h"
 #include "map.h"
 #include "battle.h"
 #include "path.h"
@@ -120,16 +121,34 @@ bool path_search_long(struct shootpath_data *spd,int16 m,int16 x0,int16 y0,int16
 	int dx, dy;
 	int wx = 0, wy = 0;
 	int weight;
+	int plane = -1;
 	struct map_data *md;
 	struct shootpath_data s_spd;
 
-	if( spd == NULL )
-		spd = &s_spd; // use dummy output variable
-
 	if (!map[m].cell)
 		return false;
 	md = &map[m];
 
+	// use the collision bitplanes when they hold the same answer as map_getcellp
+	if (x0 >= 0 && y0 >= 0 && x1 >= 0 && y1 >= 0 && x0 < md->xs && y0 < md->ys && x1 < md->xs && y1 < md->ys) {
+		if (cell == CELL_CHKWALL)
+			plane = CELLBITS_WALL;
+#ifndef CELL_NOSTACK
+		else if (cell == CELL_CHKNOPASS || cell == CELL_CHKNOREACH)
+			plane = CELLBITS_NOPASS;
+#endif
+	}
+	if (cell == CELL_CHKNOREACH && plane >= 0 && (max(x0,x1) >= md->xs-1 || max(y0,y1) >= md->ys-1))
+		plane = -1; // edge cells are 'no pass' but not 'no reach'
+	if (plane >= 0) {
+		map_cell_load(md);
+		if (spd == NULL && !map_cellbits_rect(md, (enum e_cellbits)plane, x0, y0, x1, y1))
+			return true; // nothing blocks the whole rectangle around the line
+	}
+
+	if( spd == NULL )
+		spd = &s_spd; // use dummy output variable
+
 	dx = (x1 - x0);
 	if (dx < 0) {
 		swap(x0, x1);
@@ -172,7 +191,7 @@ bool path_search_long(struct shootpath_data *spd,int16 m,int16 x0,int16 y0,int16
 			spd->y[spd->len] = y0;
 			spd->len++;
 		}
-		if (map_getcellp(md,x0,y0,cell))
+		if (plane >= 0 ? map_cellbits_get(md,plane,x0,y0) : map_getcellp(md,x0,y0,cell))
 			return false;
 	}
 
@@ -243,6 +262,253 @@ static int add_path(struct node_heap *heap, struct path_node *tp, int16 x, int16
 }
 ///@}
 
+/// @name Fast A* pathfinding
+/// Runs the same search as the A* of path_search: same expansion order,
+/// same heap layout and same node index collisions, so it finds the same
+/// paths. It is only faster:
+/// - the node table is cleared lazily with a search id instead of memset,
+/// - heap entries know their position, so updates don't scan the heap,
+/// - the cells are read from the collision bitplanes when possible.
+/// The tables are static, path_search must only be called from the main thread.
+/// @{
+
+/// Path node of the fast search
+struct path_fast_node {
+	struct path_fast_node *parent; ///< pointer to parent (for path reconstruction)
+	short x; ///< X-coordinate
+	short y; ///< Y-coordinate
+	short g_cost; ///< Actual cost from start to this node
+	short f_cost; ///< g_cost + heuristic(this, goal)
+	short flag; ///< SET_OPEN / SET_CLOSED
+	int heap_index; ///< position in the open set
+	unsigned int search; ///< search that last used this node
+};
+
+static struct path_fast_node fast_nodes[MAX_WALKPATH * MAX_WALKPATH];
+static struct path_fast_node *fast_heap[MAX_WALKPATH * MAX_WALKPATH]; ///< 'open' set, a node is at most once in it
+static int fast_heap_len = 0;
+static unsigned int fast_search = 0;
+
+/// Returns node i, cleared if it wasn't used by the current search.
+static struct path_fast_node *fast_node(int i)
+{
+	struct path_fast_node *node = &fast_nodes[i];
+
+	if (node->search != fast_search) {
+		node->parent = NULL;
+		node->x = node->y = 0;
+		node->g_cost = node->f_cost = 0;
+		node->flag = SET_OPEN;
+		node->search = fast_search;
+	}
+	return node;
+}
+
+static void fast_heap_swap(int i, int j)
+{
+	struct path_fast_node *tmp = fast_heap[i];
+
+	fast_heap[i] = fast_heap[j];
+	fast_heap[j] = tmp;
+	fast_heap[i]->heap_index = i;
+	fast_heap[j]->heap_index = j;
+}
+
+/// Same as BHEAP_SIFTDOWN.
+static void fast_heap_siftdown(int start, int i)
+{
+	while (i > start) {
+		int parent = (i-1)/2;
+		if (NODE_MINTOPCMP(fast_heap[parent], fast_heap[i]) <= 0)
+			break;
+		fast_heap_swap(parent, i);
+		i = parent;
+	}
+}
+
+/// Same as BHEAP_SIFTUP.
+static void fast_heap_siftup(int idx)
+{
+	int i = idx;
+	int lchild = i*2 + 1;
+
+	while (lchild < fast_heap_len) {
+		int rchild = i*2 + 2;
+		if (rchild >= fast_heap_len || NODE_MINTOPCMP(fast_heap[lchild], fast_heap[rchild]) < 0) {
+			fast_heap_swap(i, lchild);
+			i = lchild;
+		} else {
+			fast_heap_swap(i, rchild);
+			i = rchild;
+		}
+		lchild = i*2 + 1;
+	}
+	fast_heap_siftdown(idx, i);
+}
+
+/// Same as BHEAP_PUSH2.
+static void fast_heap_push(struct path_fast_node *node)
+{
+	fast_heap[fast_heap_len] = node;
+	node->heap_index = fast_heap_len;
+	fast_heap_len++;
+	fast_heap_siftdown(0, fast_heap_len-1);
+}
+
+/// Same as BHEAP_POP2, returns the top node.
+static struct path_fast_node *fast_heap_pop(void)
+{
+	struct path_fast_node *top = fast_heap[0];
+
+	fast_heap_len--;
+	fast_heap[0] = fast_heap[fast_heap_len];
+	fast_heap[0]->heap_index = 0;
+	if (fast_heap_len > 0)
+		fast_heap_siftup(0);
+	return top;
+}
+
+/// Same as add_path.
+static int fast_add_path(int16 x, int16 y, int g_cost, struct path_fast_node *parent, int h_cost)
+{
+	struct path_fast_node *node = fast_node(calc_index(x, y));
+
+	if (node->x == x && node->y == y) { // We processed this node before
+		if (g_cost < node->g_cost) { // New path to this node is better than old one
+			// Update costs and parent
+			node->g_cost = g_cost;
+			node->parent = parent;
+			node->f_cost = g_cost + h_cost;
+			if (node->flag == SET_CLOSED)
+				fast_heap_push(node); // Put it in open set again
+			else { // BHEAP_UPDATE, the sift up starts where the node was
+				int idx = node->heap_index;
+				fast_heap_siftdown(0, idx);
+				fast_heap_siftup(idx);
+			}
+			node->flag = SET_OPEN;
+		}
+		return 0;
+	}
+
+	if (node->x || node->y) // Index is already taken; see `tp` array FIXME in path_search
+		return 1;
+
+	// New node
+	node->x = x;
+	node->y = y;
+	node->g_cost = g_cost;
+	node->parent = parent;
+	node->f_cost = g_cost + h_cost;
+	node->flag = SET_OPEN;
+	fast_heap_push(node);
+	return 0;
+}
+
+/// A* search from (x0,y0) to (x1,y1), see path_search.
+static bool path_search_fast(struct walkpath_data *wpd, struct map_data *md, int16 x0, int16 y0, int16 x1, int16 y1, cell_chk cell)
+{
+	struct path_fast_node *current, *it;
+	int xs = md->xs - 1;
+	int ys = md->ys - 1;
+	int plane = -1;
+	int len = 0;
+	int j;
+
+	// the bitplanes cover the whole map with the same answers as map_getcellp
+	if (cell == CELL_CHKWALL)
+		plane = CELLBITS_WALL;
+#ifndef CELL_NOSTACK
+	else if (cell == CELL_CHKNOPASS)
+		plane = CELLBITS_NOPASS;
+#endif
+	if (plane >= 0)
+		map_cell_load(md);
+#define fast_chk(x,y) ( plane >= 0 ? map_cellbits_get(md,plane,x,y) : map_getcellp(md,x,y,cell) )
+
+	if (++fast_search == 0) { // wrapped, the ids of old searches could match again
+		memset(fast_nodes, 0, sizeof(fast_nodes));
+		fast_search = 1;
+	}
+	fast_heap_len = 0;
+
+	// Start node
+	current = fast_node(calc_index(x0, y0));
+	current->parent = NULL;
+	current->x      = x0;
+	current->y      = y0;
+	current->g_cost = 0;
+	current->f_cost = heuristic(x0, y0, x1, y1);
+	current->flag   = SET_OPEN;
+
+	fast_heap_push(current); // Put start node to 'open' set
+
+	for(;;) {
+		int e = 0; // error flag
+		int allowed_dirs = 0; // see path_search
+		int g_cost, x, y;
+
+		if (fast_heap_len == 0)
+			return false;
+
+		current = fast_heap_pop(); // Remove the lowest f_cost node from 'open' set
+
+		x      = current->x;
+		y      = current->y;
+		g_cost = current->g_cost;
+
+		current->flag = SET_CLOSED; // Add current node to 'closed' set
+
+		if (x == x1 && y == y1)
+			break;
+
+		if (y < ys && !fast_chk(x, y+1)) allowed_dirs |= DIR_NORTH;
+		if (y >  0 && !fast_chk(x, y-1)) allowed_dirs |= DIR_SOUTH;
+		if (x < xs && !fast_chk(x+1, y)) allowed_dirs |= DIR_EAST;
+		if (x >  0 && !fast_chk(x-1, y)) allowed_dirs |= DIR_WEST;
+
+#define chk_dir(d) ((allowed_dirs & (d)) == (d))
+		// Process neighbors of current node
+		if (chk_dir(DIR_SOUTH|DIR_EAST) && !fast_chk(x+1, y-1))
+			e += fast_add_path(x+1, y-1, g_cost + MOVE_DIAGONAL_COST, current, heuristic(x+1, y-1, x1, y1)); // (x+1, y-1) 5
+		if (chk_dir(DIR_EAST))
+			e += fast_add_path(x+1, y, g_cost + MOVE_COST, current, heuristic(x+1, y, x1, y1)); // (x+1, y) 6
+		if (chk_dir(DIR_NORTH|DIR_EAST) && !fast_chk(x+1, y+1))
+			e += fast_add_path(x+1, y+1, g_cost + MOVE_DIAGONAL_COST, current, heuristic(x+1, y+1, x1, y1)); // (x+1, y+1) 7
+		if (chk_dir(DIR_NORTH))
+			e += fast_add_path(x, y+1, g_cost + MOVE_COST, current, heuristic(x, y+1, x1, y1)); // (x, y+1) 0
+		if (chk_dir(DIR_NORTH|DIR_WEST) && !fast_chk(x-1, y+1))
+			e += fast_add_path(x-1, y+1, g_cost + MOVE_DIAGONAL_COST, current, heuristic(x-1, y+1, x1, y1)); // (x-1, y+1) 1
+		if (chk_dir(DIR_WEST))
+			e += fast_add_path(x-1, y, g_cost + MOVE_COST, current, heuristic(x-1, y, x1, y1)); // (x-1, y) 2
+		if (chk_dir(DIR_SOUTH|DIR_WEST) && !fast_chk(x-1, y-1))
+			e += fast_add_path(x-1, y-1, g_cost + MOVE_DIAGONAL_COST, current, heuristic(x-1, y-1, x1, y1)); // (x-1, y-1) 3
+		if (chk_dir(DIR_SOUTH))
+			e += fast_add_path(x, y-1, g_cost + MOVE_COST, current, heuristic(x, y-1, x1, y1)); // (x, y-1) 4
+#undef chk_dir
+		if (e)
+			return false;
+	}
+#undef fast_chk
+
+	for (it = current; it->parent != NULL; it = it->parent, len++);
+	if (len > sizeof(wpd->path))
+		return false;
+
+	// Recreate path
+	wpd->path_len = len;
+	wpd->path_pos = 0;
+
+	for (it = current, j = len-1; j >= 0; it = it->parent, j--) {
+		int dx = it->x - it->parent->x;
+		int dy = it->y - it->parent->y;
+		wpd->path[j] = walk_choices[-dy + 1][dx + 1];
+	}
+
+	return true;
+}
+///@}
+
 /*==========================================
  * path search (x0,y0)->(x1,y1)
  * wpd: path info will be written here
@@ -271,6 +537,10 @@ bool path_search(struct walkpath_data *wpd, int16 m, int16 x0, int16 y0, int16 x
 	if (x1 < 0 || x1 >= md->xs || y1 < 0 || y1 >= md->ys || map_getcellp(md,x1,y1,cell))
 		return false;
 
+	// The A* would explore everything it can reach before failing
+	if (!(flag&1) && (cell == CELL_CHKNOPASS || cell == CELL_CHKNOREACH) && !map_cell_reachable(md, x0, y0, x1, y1))
+		return false;
+
 	if (flag&1) {
 		// Try finding direct path to target
 		// Direct path goes diagonally first, then in straight line.
@@ -305,6 +575,8 @@ bool path_search(struct walkpath_data *wpd, int16 m, int16 x0, int16 y0, int16 x
 		}
 
 		return false; // easy path unsuccessful
+	} else if (battle_config.fast_pathfinding) { // !(flag&1)
+		return path_search_fast(wpd, md, x0, y0, x1, y1, cell);
 	} else { // !(flag&1)
 		// A* (A-star) pathfinding
 		// We always use A* for finding walkpaths because it is what game client uses.
@@ -417,6 +689,141 @@ bool path_search(struct walkpath_data *wpd, int16 m, int16 x0, int16 y0, int16 x
 	return false;
 }
 
+/// @name Flow fields
+/// Walk distance maps around chased targets. The units asking if they can
+/// reach the same target share one breadth first search around it instead
+/// of running an A* each.
+/// @{
+
+#define FLOWFIELD_RANGE (MAX_WALKPATH+4) ///< Max walk cells to the target (a little more than a walk path, see path_flowfield_reach)
+#define FLOWFIELD_SIZE (FLOWFIELD_RANGE*2 + 1) ///< Side of the square around the target
+#define FLOWFIELD_LIFETIME 100 ///< How long a field is used, in ms (one mob think interval)
+#define FLOWFIELD_CACHE 64 ///< Number of fields kept, indexed by target id
+#define FLOWFIELD_UNREACHABLE 0xFF
+#define FLOWFIELD_SURE_WALK (MAX_WALKPATH/2) ///< Longest walk trusted without a path search, the A* can fail on longer ones (node collisions in path_search)
+
+/// Flow field of a target
+struct path_flowfield {
+	int id; ///< Target id, 0 if unused
+	int16 m, x, y; ///< Cell of the target
+	unsigned int tick; ///< When the field was built
+	uint8 dist[FLOWFIELD_SIZE*FLOWFIELD_SIZE]; ///< Walk cells to the target, FLOWFIELD_UNREACHABLE past FLOWFIELD_RANGE
+};
+
+static struct path_flowfield flowfields[FLOWFIELD_CACHE];
+
+/// Builds the distance map around the target cell of ff.
+/// The moves are the ones of the A* (diagonals need both side cells free),
+/// which work both ways, so the distances to the target are the ones from it.
+/// The cells are read from the CELLBITS_NOPASS bitplane, which only differs
+/// from CELL_CHKNOREACH on the last row and column (passable for NOREACH).
+static void path_flowfield_build(struct path_flowfield *ff, struct map_data *md)
+{
+	static int16 queue[FLOWFIELD_SIZE*FLOWFIELD_SIZE][2];
+	int head = 0, tail = 0;
+	int16 xs = md->xs - 1;
+	int16 ys = md->ys - 1;
+	int16 ox = ff->x - FLOWFIELD_RANGE; // origin of the square
+	int16 oy = ff->y - FLOWFIELD_RANGE;
+
+#define ff_dist(x,y) ( ff->dist[((x)-ox) + ((y)-oy)*FLOWFIELD_SIZE] )
+#define ff_noreach(x,y) ( (x) < xs && (y) < ys && map_cellbits_get(md, CELLBITS_NOPASS, x, y) )
+#define ff_visit(x,y) \
+	if (ff_dist(x,y) == FLOWFIELD_UNREACHABLE) { \
+		ff_dist(x,y) = d + 1; \
+		queue[tail][0] = (x); \
+		queue[tail][1] = (y); \
+		tail++; \
+	}
+
+	memset(ff->dist, FLOWFIELD_UNREACHABLE, sizeof(ff->dist));
+	ff_dist(ff->x, ff->y) = 0;
+	queue[tail][0] = ff->x;
+	queue[tail][1] = ff->y;
+	tail++;
+
+	while (head < tail) {
+		int16 x = queue[head][0];
+		int16 y = queue[head][1];
+		uint8 d = ff_dist(x, y);
+		int allowed_dirs = 0;
+
+		head++;
+		if (d >= FLOWFIELD_RANGE)
+			continue;
+
+		if (y < ys && !ff_noreach(x, y+1)) allowed_dirs |= DIR_NORTH;
+		if (y >  0 && !ff_noreach(x, y-1)) allowed_dirs |= DIR_SOUTH;
+		if (x < xs && !ff_noreach(x+1, y)) allowed_dirs |= DIR_EAST;
+		if (x >  0 && !ff_noreach(x-1, y)) allowed_dirs |= DIR_WEST;
+
+#define chk_dir(d) ((allowed_dirs & (d)) == (d))
+		if (chk_dir(DIR_NORTH)) { ff_visit(x, y+1); }
+		if (chk_dir(DIR_SOUTH)) { ff_visit(x, y-1); }
+		if (chk_dir(DIR_EAST)) { ff_visit(x+1, y); }
+		if (chk_dir(DIR_WEST)) { ff_visit(x-1, y); }
+		if (chk_dir(DIR_NORTH|DIR_EAST) && !ff_noreach(x+1, y+1)) { ff_visit(x+1, y+1); }
+		if (chk_dir(DIR_NORTH|DIR_WEST) && !ff_noreach(x-1, y+1)) { ff_visit(x-1, y+1); }
+		if (chk_dir(DIR_SOUTH|DIR_EAST) && !ff_noreach(x+1, y-1)) { ff_visit(x+1, y-1); }
+		if (chk_dir(DIR_SOUTH|DIR_WEST) && !ff_noreach(x-1, y-1)) { ff_visit(x-1, y-1); }
+#undef chk_dir
+	}
+#undef ff_visit
+#undef ff_noreach
+#undef ff_dist
+}
+
+/*==========================================
+ * Tells if (x0,y0) can walk to (x1,y1), a cell next to target tbl, with the
+ * rules of the CELL_CHKNOREACH path search of unit_can_reach_bl.
+ * The answer comes from the flow field of tbl, built by the first unit that
+ * asks and kept while tbl stays on its cell. It only answers when it is sure,
+ * and falls back to path_search otherwise (a unit or target on a blocked
+ * cell, too far away, or a walk that may be longer than a walk path).
+ *------------------------------------------*/
+bool path_flowfield_reach(struct block_list *tbl, int16 x0, int16 y0, int16 x1, int16 y1)
+{
+	struct path_flowfield *ff;
+	struct map_data *md;
+	unsigned int tick = gettick();
+	int i0, i1;
+
+	nullpo_retr(false, tbl);
+
+	if (!map[tbl->m].cell)
+		return false;
+
+	md = &map[tbl->m];
+
+	i0 = (x0 - tbl->x + FLOWFIELD_RANGE) + (y0 - tbl->y + FLOWFIELD_RANGE)*FLOWFIELD_SIZE;
+	i1 = (x1 - tbl->x + FLOWFIELD_RANGE) + (y1 - tbl->y + FLOWFIELD_RANGE)*FLOWFIELD_SIZE;
+	if (abs(x0 - tbl->x) > FLOWFIELD_RANGE || abs(y0 - tbl->y) > FLOWFIELD_RANGE
+	||  abs(x1 - tbl->x) > FLOWFIELD_RANGE || abs(y1 - tbl->y) > FLOWFIELD_RANGE
+	||  map_getcellp(md, tbl->x, tbl->y, CELL_CHKNOREACH) || map_getcellp(md, x0, y0, CELL_CHKNOREACH))
+		return path_search(NULL, tbl->m, x0, y0, x1, y1, 0, CELL_CHKNOREACH);
+
+	ff = &flowfields[tbl->id % FLOWFIELD_CACHE];
+	if (ff->id != tbl->id || ff->m != tbl->m || ff->x != tbl->x || ff->y != tbl->y || DIFF_TICK(tick, ff->tick) >= FLOWFIELD_LIFETIME) {
+		ff->id = tbl->id;
+		ff->m = tbl->m;
+		ff->x = tbl->x;
+		ff->y = tbl->y;
+		ff->tick = tick;
+		map_cell_load(md);
+		path_flowfield_build(ff, md);
+	}
+
+	// (x1,y1) is next to the target, a walk to it that fits in a walk path
+	// stays within FLOWFIELD_RANGE of the target
+	if (ff->dist[i0] == FLOWFIELD_UNREACHABLE || ff->dist[i1] == FLOWFIELD_UNREACHABLE)
+		return false;
+	// the walk through the target cell exists and is short enough for the A*
+	if (ff->dist[i0] + ff->dist[i1] <= FLOWFIELD_SURE_WALK)
+		return true;
+	return path_search(NULL, tbl->m, x0, y0, x1, y1, 0, CELL_CHKNOREACH);
+}
+///@}
+
 
 //Distance functions, taken from http://www.flipcode.com/articles/article_fastdistance.shtml
 bool check_distance(int dx, int dy, int distance)
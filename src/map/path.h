@@ -44,6 +44,9 @@ int path_blownpos(int16 m,int16 x0,int16 y0,int16 dx,int16 dy,int count);
 // tries to find a walkable path
 bool path_search(struct walkpath_data *wpd,int16 m,int16 x0,int16 y0,int16 x1,int16 y1,int flag,cell_chk cell);
 
+// tells if a unit can walk next to a chased target, sharing one search among the units chasing it
+bool path_flowfield_reach(struct block_list *tbl,int16 x0,int16 y0,int16 x1,int16 y1);
+
 // tries to find a shootable path
 bool path_search_long(struct shootpath_data *spd,int16 m,int16 x0,int16 y0,int16 x1,int16 y1,cell_chk cell);
 
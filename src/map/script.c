@@ -305,6 +305,7 @@ struct Script_Config script_config = {
 	"OnPCStatCalcEvent", //stat_calc_event_name
 	"OnTouch_",	//ontouch_name (runs on first visible char to enter area, picks another char if the first char leaves)
 	"OnTouch",	//ontouch2_name (run whenever a char walks into the OnTouch area)
+	"", //cache_file
 };
 
 static jmp_buf     error_jump;
@@ -2495,6 +2496,22 @@ void script_warning(const char* src, const char* file, int start_line, const cha
 	StringBuf_Destroy(&buf);
 }
 
+/// Registers the buildin functions and the constants before the first script is parsed.
+static void parse_script_init(void)
+{
+	static bool first = true;
+
+	if( !first )
+		return;
+	add_buildin_func();
+	read_constdb();
+	script_hardcoded_constants();
+	first = false;
+}
+
+static struct script_code* script_cache_get(const char* src, int options);
+static void script_cache_record(const char* src, int options);
+
 /*==========================================
  * Analysis of the script
  *------------------------------------------*/
@@ -2503,7 +2520,6 @@ struct script_code* parse_script(const char *src,const char *file,int line,int o
 	const char *p,*tmpp;
 	int i;
 	struct script_code* code = NULL;
-	static int first=1;
 	char end;
 	bool unresolved_names = false;
 
@@ -2515,12 +2531,10 @@ struct script_code* parse_script(const char *src,const char *file,int line,int o
 		return NULL;// empty script
 
 	memset(&syntax,0,sizeof(syntax));
-	if(first){
-		add_buildin_func();
-		read_constdb();
-		script_hardcoded_constants();
-		first=0;
-	}
+	parse_script_init();
+
+	if( (code = script_cache_get(src, options)) != NULL )
+		return code;// unchanged since it was compiled
 
 	script_buf=(unsigned char *)aMalloc(SCRIPT_BLOCK_SIZE*sizeof(unsigned char));
 	script_pos=0;
@@ -2646,6 +2660,8 @@ struct script_code* parse_script(const char *src,const char *file,int line,int o
 		disp_error_message("parse_script: unresolved function references", p);
 	}
 
+	script_cache_record(src, options);
+
 #ifdef DEBUG_DISP
 	for(i=0;i<script_pos;i++){
 		if((i&15)==0) ShowMessage("%04x : ",i);
@@ -2693,6 +2709,625 @@ struct script_code* parse_script(const char *src,const char *file,int line,int o
 	return code;
 }
 
+/*==========================================
+ * Compiled script cache
+ * Keeps the bytecode of the npc scripts, so unchanged npc files don't have
+ * to be parsed again. The scripts are stored by source file and by position
+ * in the file, the file is only used when its content hash didn't change.
+ * The str_data ids in the bytecode are replaced by indexes in a name table
+ * of the script, since the ids depend on the loading order.
+ *------------------------------------------*/
+#define SCRIPT_CACHE_MAGIC "rASC"
+#define SCRIPT_CACHE_VERSION 1
+#define SCRIPT_CACHE_HASH_INIT 14695981039346656037ULL
+
+struct script_cache_label {
+	int name; // index in the name table
+	int pos;
+};
+
+struct script_cache_entry {
+	uint32 offset; // position of the script in the source file
+	int options;
+	int code_size;
+	unsigned char* code; // C_NAME operands are indexes in the name table
+	int name_count;
+	int names_size;
+	char* names; // name table, name_count NUL-terminated strings
+	int label_count;
+	struct script_cache_label* labels; // SCRIPT_USE_LABEL_DB labels
+};
+
+struct script_cache_file {
+	uint64 hash; // content hash of the source file
+	bool visited; // loaded since the last save
+	int entry_count;
+	int entry_max;
+	struct script_cache_entry* entries; // sorted by offset
+};
+
+static DBMap* script_cache_db = NULL; // const char* filepath -> struct script_cache_file*
+static struct script_cache_file* script_cache_current = NULL;
+static const char* script_cache_buffer = NULL;
+static size_t script_cache_len = 0;
+static uint64 script_cache_fingerprint = 0;
+static bool script_cache_dirty = false;
+static int* script_cache_ids = NULL; // name index -> str_data id
+static int script_cache_ids_size = 0;
+static int* script_cache_remap = NULL; // str_data id -> name index
+static int script_cache_remap_size = 0;
+
+/// FNV-1a hash.
+static uint64 script_cache_hash(uint64 hash, const void* data, size_t len)
+{
+	const unsigned char* p = (const unsigned char*)data;
+
+	while( len-- ) {
+		hash ^= *p++;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+/// Identifies the parser build and the functions/constants the bytecode depends on.
+static uint64 script_cache_build_fingerprint(void)
+{
+	static const char build[] = __DATE__ " " __TIME__;
+	uint64 hash = script_cache_hash(SCRIPT_CACHE_HASH_INIT, build, sizeof(build));
+	int i;
+
+	for( i = LABEL_START; i < str_num; i++ ) {
+		const char* name;
+
+		if( str_data[i].type != C_FUNC && str_data[i].type != C_INT && str_data[i].type != C_PARAM )
+			continue;
+		name = get_str(i);
+		hash = script_cache_hash(hash, name, strlen(name)+1);
+		hash = script_cache_hash(hash, &str_data[i].type, sizeof(str_data[i].type));
+		hash = script_cache_hash(hash, &str_data[i].val, sizeof(str_data[i].val));
+		if( str_data[i].type == C_FUNC )
+			hash = script_cache_hash(hash, buildin_func[str_data[i].val].arg, strlen(buildin_func[str_data[i].val].arg)+1);
+	}
+	return hash;
+}
+
+/// Returns the position of the next C_NAME operand, -1 at the end of the code.
+/// The code must end with C_NOP.
+static int script_cache_nextname(unsigned char* code, int size, int* pos)
+{
+	while( *pos < size ) {
+		switch( get_com(code, pos) ) {
+		case C_INT:
+			get_num(code, pos);
+			break;
+		case C_POS:
+			*pos += 3;
+			break;
+		case C_NAME:
+			*pos += 3;
+			if( *pos > size )
+				return -1;
+			return *pos - 3;
+		case C_STR:
+		{
+			const unsigned char* eos = (const unsigned char*)memchr(code + *pos, '\0', size - *pos);
+			*pos = ( eos ? (int)(eos - code) : size ) + 1;
+			break;
+		}
+		default:
+			break;
+		}
+	}
+	return -1;
+}
+
+static void script_cache_entry_free(struct script_cache_entry* e)
+{
+	if( e->code )
+		aFree(e->code);
+	if( e->names )
+		aFree(e->names);
+	if( e->labels )
+		aFree(e->labels);
+	memset(e, 0, sizeof(*e));
+}
+
+static void script_cache_file_clear(struct script_cache_file* cf)
+{
+	int i;
+
+	for( i = 0; i < cf->entry_count; i++ )
+		script_cache_entry_free(&cf->entries[i]);
+	cf->entry_count = 0;
+}
+
+static void script_cache_file_free(struct script_cache_file* cf)
+{
+	script_cache_file_clear(cf);
+	if( cf->entries )
+		aFree(cf->entries);
+	aFree(cf);
+}
+
+static int script_cache_file_free_sub(DBKey key, DBData* data, va_list ap)
+{
+	script_cache_file_free((struct script_cache_file*)db_data2ptr(data));
+	return 0;
+}
+
+/// Returns the index of the first entry at or after offset.
+static int script_cache_file_find(struct script_cache_file* cf, uint32 offset)
+{
+	int lo = 0, hi = cf->entry_count;
+
+	while( lo < hi ) {
+		int mid = (lo + hi) / 2;
+		if( cf->entries[mid].offset < offset )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/// Appends a name to the name table of the entry.
+static int script_cache_addname(struct script_cache_entry* e, const char* name)
+{
+	int len = (int)strlen(name) + 1;
+
+	RECREATE(e->names, char, e->names_size + len);
+	memcpy(e->names + e->names_size, name, len);
+	e->names_size += len;
+	return e->name_count++;
+}
+
+static void script_cache_reserve_ids(int count)
+{
+	if( script_cache_ids_size < count ) {
+		script_cache_ids_size = count + 64;
+		RECREATE(script_cache_ids, int, script_cache_ids_size);
+	}
+}
+
+/// Rebuilds a script of the current file from the cache.
+/// Returns NULL if it isn't cached.
+static struct script_code* script_cache_get(const char* src, int options)
+{
+	struct script_cache_file* cf = script_cache_current;
+	struct script_cache_entry* e;
+	struct script_code* code;
+	unsigned char* buf;
+	const char* name;
+	int i, pos;
+
+	if( cf == NULL || src < script_cache_buffer || src >= script_cache_buffer + script_cache_len )
+		return NULL;
+	i = script_cache_file_find(cf, (uint32)(src - script_cache_buffer));
+	if( i == cf->entry_count || cf->entries[i].offset != (uint32)(src - script_cache_buffer) || cf->entries[i].options != options )
+		return NULL;
+	e = &cf->entries[i];
+
+	script_cache_reserve_ids(e->name_count);
+	for( i = 0, name = e->names; i < e->name_count; i++, name += strlen(name)+1 ) {
+		int id = add_str(name);
+		if( str_data[id].type == C_NOP ) {// same as an unresolved name after parsing
+			str_data[id].type = C_NAME;
+			str_data[id].label = id;
+		}
+		script_cache_ids[i] = id;
+	}
+
+	buf = (unsigned char*)aMalloc(e->code_size);
+	memcpy(buf, e->code, e->code_size);
+	for( pos = 0; (i = script_cache_nextname(buf, e->code_size, &pos)) >= 0; ) {
+		int n = GETVALUE(buf, i);
+		if( n >= e->name_count ) {// broken entry, parse it again
+			aFree(buf);
+			return NULL;
+		}
+		SETVALUE(buf, i, script_cache_ids[n]);
+	}
+
+	if( options&SCRIPT_USE_LABEL_DB ) {
+		db_clear(scriptlabel_db);
+		for( i = 0; i < e->label_count; i++ )
+			strdb_iput(scriptlabel_db, get_str(script_cache_ids[e->labels[i].name]), e->labels[i].pos);
+	}
+
+	CREATE(code,struct script_code,1);
+	code->script_buf  = buf;
+	code->script_size = e->code_size;
+	code->script_vars = idb_alloc(DB_OPT_RELEASE_DATA);
+	return code;
+}
+
+/// Stores the script that was just parsed in the cache of the current file.
+static void script_cache_record(const char* src, int options)
+{
+	struct script_cache_file* cf = script_cache_current;
+	struct script_cache_entry entry;
+	int i, pos;
+
+	if( cf == NULL || src < script_cache_buffer || src >= script_cache_buffer + script_cache_len )
+		return;
+
+	memset(&entry, 0, sizeof(entry));
+	entry.offset = (uint32)(src - script_cache_buffer);
+	entry.options = options;
+	entry.code_size = script_size;
+	entry.code = (unsigned char*)aMalloc(script_size);
+	memcpy(entry.code, script_buf, script_size);
+
+	if( script_cache_remap_size < str_num ) {
+		RECREATE(script_cache_remap, int, str_num);
+		for( i = script_cache_remap_size; i < str_num; i++ )
+			script_cache_remap[i] = -1;
+		script_cache_remap_size = str_num;
+	}
+	for( pos = 0; (i = script_cache_nextname(entry.code, entry.code_size, &pos)) >= 0; ) {
+		int id = GETVALUE(entry.code, i);
+		if( script_cache_remap[id] < 0 ) {
+			script_cache_reserve_ids(entry.name_count + 1);
+			script_cache_ids[entry.name_count] = id;
+			script_cache_remap[id] = script_cache_addname(&entry, get_str(id));
+		}
+		SETVALUE(entry.code, i, script_cache_remap[id]);
+	}
+	for( i = 0; i < entry.name_count; i++ )
+		script_cache_remap[script_cache_ids[i]] = -1;
+
+	if( options&SCRIPT_USE_LABEL_DB ) {
+		DBIterator* iter = db_iterator(scriptlabel_db);
+		DBData* data;
+		DBKey key;
+
+		for( data = iter->first(iter,&key); iter->exists(iter); data = iter->next(iter,&key) ) {
+			RECREATE(entry.labels, struct script_cache_label, entry.label_count + 1);
+			entry.labels[entry.label_count].name = script_cache_addname(&entry, key.str);
+			entry.labels[entry.label_count].pos = db_data2i(data);
+			entry.label_count++;
+		}
+		dbi_destroy(iter);
+	}
+
+	i = script_cache_file_find(cf, entry.offset);
+	if( i < cf->entry_count && cf->entries[i].offset == entry.offset )
+		script_cache_entry_free(&cf->entries[i]);
+	else {
+		if( cf->entry_count == cf->entry_max ) {
+			cf->entry_max += 32;
+			RECREATE(cf->entries, struct script_cache_entry, cf->entry_max);
+		}
+		memmove(&cf->entries[i+1], &cf->entries[i], (cf->entry_count - i) * sizeof(struct script_cache_entry));
+		cf->entry_count++;
+	}
+	cf->entries[i] = entry;
+	script_cache_dirty = true;
+}
+
+/// Bounds checked reading of the cache file.
+struct script_cache_reader {
+	const unsigned char* p;
+	const unsigned char* end;
+	bool error;
+};
+
+static void script_cache_read_data(struct script_cache_reader* r, void* out, size_t len)
+{
+	if( r->error || (size_t)(r->end - r->p) < len ) {
+		r->error = true;
+		memset(out, 0, len);
+		return;
+	}
+	memcpy(out, r->p, len);
+	r->p += len;
+}
+
+static uint32 script_cache_read_uint32(struct script_cache_reader* r)
+{
+	uint32 v;
+	script_cache_read_data(r, &v, sizeof(v));
+	return v;
+}
+
+static void* script_cache_read_blob(struct script_cache_reader* r, size_t len)
+{
+	void* blob;
+
+	if( r->error || (size_t)(r->end - r->p) < len ) {
+		r->error = true;
+		return NULL;
+	}
+	blob = aMalloc(len > 0 ? len : 1);
+	memcpy(blob, r->p, len);
+	r->p += len;
+	return blob;
+}
+
+/// Reads one script of a cached file.
+static bool script_cache_read_entry(struct script_cache_reader* r, struct script_cache_entry* e)
+{
+	int i, count;
+
+	memset(e, 0, sizeof(*e));
+	e->offset = script_cache_read_uint32(r);
+	e->options = (int)script_cache_read_uint32(r);
+	e->code_size = (int)script_cache_read_uint32(r);
+	if( r->error || e->code_size <= 0 )
+		return false;
+	e->code = (unsigned char*)script_cache_read_blob(r, e->code_size);
+	e->name_count = (int)script_cache_read_uint32(r);
+	e->names_size = (int)script_cache_read_uint32(r);
+	if( r->error || e->name_count < 0 || e->names_size < 0 )
+		return false;
+	if( e->names_size > 0 )
+		e->names = (char*)script_cache_read_blob(r, e->names_size);
+	e->label_count = (int)script_cache_read_uint32(r);
+	if( r->error || e->label_count < 0 || e->label_count > (int)((r->end - r->p) / sizeof(struct script_cache_label)) )
+		return false;
+	if( e->label_count > 0 )
+		e->labels = (struct script_cache_label*)script_cache_read_blob(r, e->label_count * sizeof(struct script_cache_label));
+	if( r->error )
+		return false;
+
+	// the code must end with C_NOP and the name table must hold name_count names
+	if( e->code[e->code_size-1] != C_NOP )
+		return false;
+	for( i = 0, count = 0; i < e->names_size; i++ )
+		if( e->names[i] == '\0' )
+			count++;
+	if( count != e->name_count || (e->names_size > 0 && e->names[e->names_size-1] != '\0') )
+		return false;
+	for( i = 0; i < e->label_count; i++ )
+		if( e->labels[i].name < 0 || e->labels[i].name >= e->name_count )
+			return false;
+	return true;
+}
+
+/// Loads the cache file.
+static void script_cache_read(void)
+{
+	struct script_cache_reader r;
+	unsigned char* data;
+	FILE* fp;
+	long size;
+	char magic[4];
+	uint64 fingerprint;
+	uint32 i, j, count;
+
+	parse_script_init();
+	script_cache_fingerprint = script_cache_build_fingerprint();
+	script_cache_db = strdb_alloc(DB_OPT_DUP_KEY, 0);
+
+	if( (fp = fopen(script_config.cache_file, "rb")) == NULL )
+		return;// first run
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	if( size <= 0 ) {
+		fclose(fp);
+		return;
+	}
+	data = (unsigned char*)aMalloc(size);
+	if( fread(data, 1, size, fp) != (size_t)size ) {
+		ShowWarning("script_cache_read: Failed to read '%s', the scripts will be parsed.\n", script_config.cache_file);
+		aFree(data);
+		fclose(fp);
+		return;
+	}
+	fclose(fp);
+
+	r.p = data;
+	r.end = data + size;
+	r.error = false;
+	script_cache_read_data(&r, magic, sizeof(magic));
+	if( memcmp(magic, SCRIPT_CACHE_MAGIC, sizeof(magic)) != 0 || script_cache_read_uint32(&r) != SCRIPT_CACHE_VERSION ) {
+		ShowWarning("script_cache_read: '%s' is not a script cache file, ignoring it.\n", script_config.cache_file);
+		aFree(data);
+		return;
+	}
+	script_cache_read_data(&r, &fingerprint, sizeof(fingerprint));
+	if( fingerprint != script_cache_fingerprint ) {
+		ShowInfo("Script cache '"CL_WHITE"%s"CL_RESET"' was made by another build, the scripts will be parsed.\n", script_config.cache_file);
+		aFree(data);
+		return;
+	}
+
+	count = script_cache_read_uint32(&r);
+	for( i = 0; i < count && !r.error; i++ ) {
+		struct script_cache_file* cf;
+		char path[1024];
+		uint32 len = script_cache_read_uint32(&r);
+
+		if( len >= sizeof(path) ) {
+			r.error = true;
+			break;
+		}
+		script_cache_read_data(&r, path, len);
+		path[len] = '\0';
+		CREATE(cf, struct script_cache_file, 1);
+		script_cache_read_data(&r, &cf->hash, sizeof(cf->hash));
+		cf->entry_max = (int)script_cache_read_uint32(&r);
+		if( r.error || cf->entry_max < 0 || cf->entry_max > r.end - r.p ) {
+			r.error = true;
+			aFree(cf);
+			break;
+		}
+		if( cf->entry_max > 0 )
+			CREATE(cf->entries, struct script_cache_entry, cf->entry_max);
+		strdb_put(script_cache_db, path, cf);
+		for( j = 0; j < (uint32)cf->entry_max; j++ ) {
+			bool ok = script_cache_read_entry(&r, &cf->entries[j]);
+			cf->entry_count++;
+			if( !ok || (j > 0 && cf->entries[j].offset <= cf->entries[j-1].offset) ) {
+				r.error = true;
+				break;
+			}
+		}
+	}
+	aFree(data);
+
+	if( r.error ) {
+		ShowWarning("script_cache_read: '%s' is damaged, the scripts will be parsed.\n", script_config.cache_file);
+		script_cache_db->clear(script_cache_db, script_cache_file_free_sub);
+		return;
+	}
+	ShowStatus("Done reading '"CL_WHITE"%u"CL_RESET"' files from the script cache '"CL_WHITE"%s"CL_RESET"'.\n", count, script_config.cache_file);
+}
+
+/// Starts using the cache for the scripts of a npc file.
+/// @param filepath Path of the npc file
+/// @param buffer Content of the file, the scripts are parsed from this buffer
+/// @param len Length of the content
+void script_cache_begin(const char* filepath, const char* buffer, size_t len)
+{
+	struct script_cache_file* cf;
+	uint64 hash;
+
+	script_cache_current = NULL;
+	if( script_config.cache_file[0] == '\0' )
+		return;// disabled
+	if( script_cache_db == NULL )
+		script_cache_read();
+
+	hash = script_cache_hash(SCRIPT_CACHE_HASH_INIT, buffer, len);
+	cf = (struct script_cache_file*)strdb_get(script_cache_db, filepath);
+	if( cf == NULL ) {
+		CREATE(cf, struct script_cache_file, 1);
+		cf->hash = hash;
+		strdb_put(script_cache_db, filepath, cf);
+		script_cache_dirty = true;
+	} else if( cf->hash != hash ) {// changed, parse everything again
+		script_cache_file_clear(cf);
+		cf->hash = hash;
+		script_cache_dirty = true;
+	}
+	cf->visited = true;
+
+	script_cache_current = cf;
+	script_cache_buffer = buffer;
+	script_cache_len = len;
+}
+
+/// Stops using the cache for the current npc file.
+void script_cache_end(void)
+{
+	script_cache_current = NULL;
+	script_cache_buffer = NULL;
+	script_cache_len = 0;
+}
+
+/// Writes the cache file if it changed.
+/// Files that weren't loaded since the last save are removed from the cache.
+void script_cache_save(void)
+{
+	DBIterator* iter;
+	DBData* data;
+	DBKey key;
+	FILE* fp;
+	char tmpfile[1024];
+	uint32 v;
+	int i;
+
+	if( script_cache_db == NULL )
+		return;
+
+	iter = db_iterator(script_cache_db);
+	for( data = iter->first(iter,&key); iter->exists(iter); data = iter->next(iter,&key) ) {
+		struct script_cache_file* cf = (struct script_cache_file*)db_data2ptr(data);
+		if( !cf->visited ) {
+			DBData removed;
+			iter->remove(iter, &removed);
+			script_cache_file_free((struct script_cache_file*)db_data2ptr(&removed));
+			script_cache_dirty = true;
+		}
+	}
+	dbi_destroy(iter);
+
+	if( !script_cache_dirty )
+		return;
+
+	safesnprintf(tmpfile, sizeof(tmpfile), "%s.tmp", script_config.cache_file);
+	if( (fp = fopen(tmpfile, "wb")) == NULL ) {
+		ShowError("script_cache_save: Can't write '%s' - %s\n", tmpfile, strerror(errno));
+		return;
+	}
+
+	fwrite(SCRIPT_CACHE_MAGIC, 1, 4, fp);
+	v = SCRIPT_CACHE_VERSION;
+	fwrite(&v, sizeof(v), 1, fp);
+	fwrite(&script_cache_fingerprint, sizeof(script_cache_fingerprint), 1, fp);
+	v = db_size(script_cache_db);
+	fwrite(&v, sizeof(v), 1, fp);
+
+	iter = db_iterator(script_cache_db);
+	for( data = iter->first(iter,&key); iter->exists(iter); data = iter->next(iter,&key) ) {
+		struct script_cache_file* cf = (struct script_cache_file*)db_data2ptr(data);
+
+		v = (uint32)strlen(key.str);
+		fwrite(&v, sizeof(v), 1, fp);
+		fwrite(key.str, 1, v, fp);
+		fwrite(&cf->hash, sizeof(cf->hash), 1, fp);
+		v = cf->entry_count;
+		fwrite(&v, sizeof(v), 1, fp);
+		for( i = 0; i < cf->entry_count; i++ ) {
+			struct script_cache_entry* e = &cf->entries[i];
+			uint32 head[3];
+
+			head[0] = e->offset;
+			head[1] = (uint32)e->options;
+			head[2] = (uint32)e->code_size;
+			fwrite(head, sizeof(head), 1, fp);
+			fwrite(e->code, 1, e->code_size, fp);
+			head[0] = (uint32)e->name_count;
+			head[1] = (uint32)e->names_size;
+			fwrite(head, sizeof(uint32), 2, fp);
+			fwrite(e->names, 1, e->names_size, fp);
+			v = (uint32)e->label_count;
+			fwrite(&v, sizeof(v), 1, fp);
+			fwrite(e->labels, sizeof(struct script_cache_label), e->label_count, fp);
+		}
+		cf->visited = false;
+	}
+	dbi_destroy(iter);
+
+	if( ferror(fp) ) {
+		ShowError("script_cache_save: Failed to write '%s'.\n", tmpfile);
+		fclose(fp);
+		remove(tmpfile);
+		return;
+	}
+	fclose(fp);
+#ifdef WIN32
+	remove(script_config.cache_file);
+#endif
+	if( rename(tmpfile, script_config.cache_file) != 0 ) {
+		ShowError("script_cache_save: Can't replace '%s' - %s\n", script_config.cache_file, strerror(errno));
+		remove(tmpfile);
+		return;
+	}
+	script_cache_dirty = false;
+}
+
+/// Frees the cache.
+static void script_cache_final(void)
+{
+	if( script_cache_db != NULL ) {
+		script_cache_db->destroy(script_cache_db, script_cache_file_free_sub);
+		script_cache_db = NULL;
+	}
+	if( script_cache_ids != NULL ) {
+		aFree(script_cache_ids);
+		script_cache_ids = NULL;
+	}
+	if( script_cache_remap != NULL ) {
+		aFree(script_cache_remap);
+		script_cache_remap = NULL;
+	}
+	script_cache_ids_size = script_cache_remap_size = 0;
+	script_cache_end();
+}
+
 /// Returns the player attached to this script, identified by the rid.
 /// If there is no player attached, the script is terminated.
 TBL_PC *script_rid2sd(struct script_state *st)
@@ -4093,6 +4728,9 @@ int script_config_read(char *cfgName)
 		else if(strcmpi(w1,"warn_func_mismatch_argtypes")==0) {
 			script_config.warn_func_mismatch_argtypes = config_switch(w2);
 		}
+		else if(strcmpi(w1,"script_cache_file")==0) {
+			safestrncpy(script_config.cache_file, w2, sizeof(script_config.cache_file));
+		}
 		else if(strcmpi(w1,"import")==0){
 			script_config_read(w2);
 		}
@@ -4454,6 +5092,7 @@ void do_final_script() {
 #endif
 
 	mapreg_final();
+	script_cache_final();
 
 	db_destroy(scriptlabel_db);
 	userfunc_db->destroy(userfunc_db, db_script_free_code_sub);
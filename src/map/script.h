@@ -32,6 +32,8 @@ extern struct Script_Config {
 
 	const char* ontouch_name;
 	const char* ontouch2_name;
+
+	char cache_file[256]; // compiled npc scripts, disabled when empty
 } script_config;
 
 typedef enum c_op {
@@ -158,6 +160,9 @@ void script_error(const char* src, const char* file, int start_line, const char*
 void script_warning(const char* src, const char* file, int start_line, const char* error_msg, const char* error_pos);
 
 struct script_code* parse_script(const char* src,const char* file,int line,int options);
+void script_cache_begin(const char* filepath, const char* buffer, size_t len);
+void script_cache_end(void);
+void script_cache_save(void);
 void run_script_sub(struct script_code *rootscript,int pos,int rid,int oid, char* file, int lineno);
 void run_script(struct script_code *rootscript,int pos,int rid,int oid);
 
@@ -2362,6 +2362,9 @@ bool unit_can_reach_bl(struct block_list *bl,struct block_list *tbl, int range,
 	if (y)
 		*y = tbl->y-dy;
 
+	if (!easy && battle_config.chase_flowfield)
+		return path_flowfield_reach(tbl,bl->x,bl->y,tbl->x-dx,tbl->y-dy);
+
 	return path_search(NULL,bl->m,bl->x,bl->y,tbl->x-dx,tbl->y-dy,easy,CELL_CHKNOREACH);
 }
 
@@ -0,0 +1,395 @@
+// Copyright (c) Athena Dev Teams - Licensed under GNU GPL
+// For more information, see LICENCE in the main folder
+
+// Microbenchmarks of the common code (db, ers, timer, strlib).
+// Every result is written as JSON so runs can be compared by a script:
+//   benchmarks [-keys 10000,100000,1000000] [-only db|ers|timer|strlib] [-out benchmarks.json]
+//              [-max_timers 100000]
+// The output file is relative to the directory of the executable.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../common/cbasetypes.h"
+#include "../common/db.h"
+#include "../common/ers.h"
+#include "../common/malloc.h"
+#include "../common/showmsg.h"
+#include "../common/strlib.h"
+#include "../common/timer.h"
+#include "../common/utils.h"
+
+#ifdef TIMER_WHEEL
+#define TIMER_ENGINE "wheel"
+#else
+#define TIMER_ENGINE "heap"
+#endif
+
+#define MAX_KEY_COUNTS 8
+
+int key_counts[MAX_KEY_COUNTS] = { 10000, 100000, 1000000 };
+int key_count_num = 3;
+int max_timers = 100000; // settick/delete of the heap engine are linear, 1M timers take minutes
+const char* only_group = NULL;
+const char* out_file = "benchmarks.json";
+
+StringBuf results; // JSON objects of the results, comma separated
+int result_count = 0;
+uint64 bench_start; // start of the operation being measured
+volatile int64 bench_sink; // keeps the results of lookups alive
+
+/// Small deterministic generator, rand() is too slow and too short for 10M keys.
+static uint32 bench_seed = 1;
+static uint32 bench_rand(void)
+{
+	bench_seed ^= bench_seed << 13;
+	bench_seed ^= bench_seed >> 17;
+	bench_seed ^= bench_seed << 5;
+	return bench_seed;
+}
+
+/// Distinct key of index i, spread over the whole int range.
+static int bench_key(int i)
+{
+	return (int)((uint32)i * 2654435761U);
+}
+
+/// Stride that visits the n first indexes in a scattered order.
+static int bench_stride(int n)
+{
+	static const int primes[] = { 1000003, 7919, 101 };
+	int i;
+
+	for( i = 0; i < ARRAYLENGTH(primes); ++i )
+		if( n%primes[i] != 0 )
+			return primes[i]%n;
+	return 1;
+}
+
+/// Records the time since bench_start for 'ops' operations.
+static void bench_result(const char* group, const char* name, const char* variant, int keys, int ops)
+{
+	unsigned int usec = (unsigned int)(gettick_usec() - bench_start);
+	double ns = ( ops > 0 ) ? (double)usec*1000./(double)ops : 0.;
+
+	ShowInfo("%-6s %-14s %-6s %8d keys: %8u us (%.1f ns/op)\n", group, name, variant, keys, usec, ns);
+	StringBuf_Printf(&results, "%s\n\t\t{\"group\":\"%s\",\"name\":\"%s\",\"variant\":\"%s\",\"keys\":%d,\"ops\":%d,\"usec\":%u,\"ns_per_op\":%.2f}",
+		( result_count ? "," : "" ), group, name, variant, keys, ops, usec, ns);
+	++result_count;
+	bench_start = gettick_usec();
+}
+
+static bool bench_enabled(const char* group)
+{
+	return ( only_group == NULL || strcmp(only_group, group) == 0 );
+}
+
+/*==========================================
+ * db
+ *------------------------------------------*/
+static int bench_db_count(DBKey key, DBData* data, va_list ap)
+{
+	return 1;
+}
+
+/// put/get/iterate/remove on one database of n keys.
+/// strkeys holds the string keys of string databases, NULL for numeric ones.
+static void bench_db(const char* name, const char* variant, DBMap* db, int n, char* strkeys)
+{
+	DBType type = db->type(db);
+	DBIterator* iter;
+	DBKey key;
+	int i, j, stride = bench_stride(n);
+	int64 sum = 0;
+	char name_op[32];
+
+#define BENCH_KEY(i) ( strkeys ? db_str2key(strkeys + (i)*16) : ( type == DB_UINT ? db_ui2key((unsigned int)bench_key(i)) : db_i2key(bench_key(i)) ) )
+#define BENCH_OP(op) ( safesnprintf(name_op, sizeof(name_op), "%s.%s", name, op), name_op )
+
+	bench_start = gettick_usec();
+	for( i = 0; i < n; ++i )
+		db->put(db, BENCH_KEY(i), db_i2data(i+1), NULL);
+	bench_result("db", BENCH_OP("put"), variant, n, n);
+
+	for( i = 0, j = 0; i < n; ++i, j = (j+stride)%n )
+		sum += db_data2i(db->get(db, BENCH_KEY(j)));
+	bench_result("db", BENCH_OP("get"), variant, n, n);
+
+	for( i = n; i < 2*n; ++i )
+	{
+		if( strkeys )
+		{// a key that is not in the database, same length as the others
+			char miss[16];
+			safesnprintf(miss, sizeof(miss), "miss%010d", i);
+			key = db_str2key(miss);
+		}
+		else
+			key = BENCH_KEY(i);
+		sum += ( db->get(db, key) != NULL );
+	}
+	bench_result("db", BENCH_OP("miss"), variant, n, n);
+
+	iter = db_iterator(db);
+	for( dbi_first(iter); dbi_exists(iter); dbi_next(iter) )
+		++sum;
+	dbi_destroy(iter);
+	bench_result("db", BENCH_OP("iterate"), variant, n, n);
+
+	sum += db->foreach(db, bench_db_count);
+	bench_result("db", BENCH_OP("foreach"), variant, n, n);
+
+	for( i = 0, j = 0; i < n; ++i, j = (j+stride)%n )
+		db->remove(db, BENCH_KEY(j), NULL);
+	bench_result("db", BENCH_OP("remove"), variant, n, n);
+
+	bench_sink = sum;
+	if( db_size(db) != 0 )
+		ShowWarning("bench_db: %s (%s) is not empty after removing all the keys.\n", name, variant);
+	db_destroy(db);
+
+#undef BENCH_KEY
+#undef BENCH_OP
+}
+
+static void bench_db_all(int n)
+{
+	char* strkeys;
+	int i;
+
+	bench_db("idb", "tree", idb_alloc(DB_OPT_BASE), n, NULL);
+	bench_db("idb", "flat", idb_alloc(DB_OPT_FLAT), n, NULL);
+	bench_db("uidb", "tree", uidb_alloc(DB_OPT_BASE), n, NULL);
+	bench_db("uidb", "flat", uidb_alloc(DB_OPT_FLAT), n, NULL);
+
+	// 15 characters, like character and map names
+	CREATE(strkeys, char, (size_t)n*16);
+	for( i = 0; i < n; ++i )
+		safesnprintf(strkeys + (size_t)i*16, 16, "Key%012X", (uint32)bench_key(i));
+	bench_db("strdb", "tree", strdb_alloc(DB_OPT_BASE, 16), n, strkeys);
+	bench_db("istrdb", "tree", stridb_alloc(DB_OPT_BASE, 16), n, strkeys);
+	aFree(strkeys);
+}
+
+/*==========================================
+ * ers
+ *------------------------------------------*/
+#define BENCH_ERS_WINDOW 1024
+
+static void bench_ers(int n)
+{
+	ERS ers = ers_new(64, "benchmarks.c::bench_ers", ERS_OPT_NONE);
+	void** entries;
+	void* window[BENCH_ERS_WINDOW];
+	int i;
+
+	CREATE(entries, void*, n);
+
+	// n entries alive at the same time
+	bench_start = gettick_usec();
+	for( i = 0; i < n; ++i )
+		entries[i] = ers_alloc(ers, char);
+	for( i = 0; i < n; ++i )
+		ers_free(ers, entries[i]);
+	bench_result("ers", "alloc_free", "ers", n, 2*n);
+
+	for( i = 0; i < n; ++i )
+		entries[i] = aMalloc(64);
+	for( i = 0; i < n; ++i )
+		aFree(entries[i]);
+	bench_result("ers", "alloc_free", "malloc", n, 2*n);
+
+	// churn, a random entry of a small live set is replaced every operation
+	for( i = 0; i < BENCH_ERS_WINDOW; ++i )
+		window[i] = ers_alloc(ers, char);
+	bench_start = gettick_usec();
+	for( i = 0; i < n; ++i )
+	{
+		int j = bench_rand()%BENCH_ERS_WINDOW;
+		ers_free(ers, window[j]);
+		window[j] = ers_alloc(ers, char);
+	}
+	bench_result("ers", "churn", "ers", n, 2*n);
+	for( i = 0; i < BENCH_ERS_WINDOW; ++i )
+		ers_free(ers, window[i]);
+
+	for( i = 0; i < BENCH_ERS_WINDOW; ++i )
+		window[i] = aMalloc(64);
+	bench_start = gettick_usec();
+	for( i = 0; i < n; ++i )
+	{
+		int j = bench_rand()%BENCH_ERS_WINDOW;
+		aFree(window[j]);
+		window[j] = aMalloc(64);
+	}
+	bench_result("ers", "churn", "malloc", n, 2*n);
+	for( i = 0; i < BENCH_ERS_WINDOW; ++i )
+		aFree(window[i]);
+
+	aFree(entries);
+	ers_destroy(ers);
+}
+
+/*==========================================
+ * timer
+ *------------------------------------------*/
+int timer_fired;
+
+static int bench_timer(int tid, unsigned int tick, int id, intptr_t data)
+{
+	++timer_fired;
+	return 0;
+}
+
+static void bench_timer_all(int n)
+{
+	int* tids;
+	unsigned int now, tick;
+	int i, count;
+
+	CREATE(tids, int, n);
+	now = gettick_nocache();
+
+	bench_start = gettick_usec();
+	for( i = 0; i < n; ++i )
+		tids[i] = add_timer(now + 1 + bench_rand()%60000, bench_timer, i, 0);
+	bench_result("timer", "add", TIMER_ENGINE, n, n);
+
+	// a quarter of the timers is restarted, like walk timers
+	for( i = 0, count = 0; i < n; i += 4, ++count )
+	{
+		delete_timer(tids[i], bench_timer);
+		tids[i] = add_timer(now + 1 + bench_rand()%60000, bench_timer, i, 0);
+	}
+	bench_result("timer", "delete_add", TIMER_ENGINE, n, count);
+
+	for( i = 0, count = 0; i < n; i += 16, ++count )
+		settick_timer(tids[i], now + 1 + bench_rand()%60000);
+	bench_result("timer", "settick", TIMER_ENGINE, n, count);
+
+	// fire everything, time is simulated in steps of the minimum timer interval
+	timer_fired = 0;
+	for( tick = now; DIFF_TICK(now + 60020, tick) >= 0; tick += 20 )
+		do_timer(tick);
+	bench_result("timer", "fire", TIMER_ENGINE, n, timer_fired);
+
+	if( timer_fired != n )
+		ShowWarning("bench_timer_all: %d of %d timers fired.\n", timer_fired, n);
+	aFree(tids);
+}
+
+/*==========================================
+ * strlib
+ *------------------------------------------*/
+static void bench_strlib(int n)
+{
+	StringBuf buf;
+	int i;
+
+	StringBuf_Init(&buf);
+
+	// queries are built with printf and sent every few rows
+	bench_start = gettick_usec();
+	for( i = 0; i < n; ++i )
+	{
+		if( i%64 == 0 )
+			StringBuf_Clear(&buf);
+		StringBuf_Printf(&buf, "%s('%d','%s','%d')", ( i%64 ? "," : "" ), i, "Poring", i%100);
+	}
+	bench_result("strlib", "printf", "stringbuf", n, n);
+
+	for( i = 0; i < n; ++i )
+	{
+		if( i%64 == 0 )
+			StringBuf_Clear(&buf);
+		StringBuf_AppendStr(&buf, ",('0','Poring','0')");
+	}
+	bench_result("strlib", "append", "stringbuf", n, n);
+
+	// a buffer that grows without being cleared, up to 1.6MB (growth is linear)
+	StringBuf_Clear(&buf);
+	n = min(n, 100000);
+	bench_start = gettick_usec();
+	for( i = 0; i < n; ++i )
+		StringBuf_AppendStr(&buf, "0123456789abcdef");
+	bench_result("strlib", "grow", "stringbuf", n, n);
+
+	StringBuf_Destroy(&buf);
+}
+
+/*==========================================
+ * main
+ *------------------------------------------*/
+static void process_args(int argc, char** argv)
+{
+	int i;
+
+	for( i = 0; i < argc; i++ )
+	{
+		if( strcmp(argv[i], "-keys") == 0 && argc > i+1 )
+		{
+			char* str = argv[++i];
+			key_count_num = 0;
+			while( key_count_num < MAX_KEY_COUNTS && *str )
+			{
+				key_counts[key_count_num++] = cap_value(atoi(str), 1, 10000000);
+				if( (str = strchr(str, ',')) == NULL )
+					break;
+				++str;
+			}
+		}
+		else if( strcmp(argv[i], "-max_timers") == 0 && argc > i+1 )
+		{
+			max_timers = atoi(argv[++i]);
+			max_timers = max(1, max_timers);
+		}
+		else if( strcmp(argv[i], "-only") == 0 && argc > i+1 )
+			only_group = argv[++i];
+		else if( strcmp(argv[i], "-out") == 0 && argc > i+1 )
+			out_file = argv[++i];
+	}
+}
+
+int do_init(int argc, char** argv)
+{
+	FILE* fp;
+	int i;
+
+	process_args(argc, argv);
+	db_init();
+	timer_init();
+	add_timer_func_list(bench_timer, "bench_timer");
+	StringBuf_Init(&results);
+
+	for( i = 0; i < key_count_num; ++i )
+	{
+		int n = key_counts[i];
+
+		bench_seed = 1;
+		if( bench_enabled("db") )
+			bench_db_all(n);
+		if( bench_enabled("ers") )
+			bench_ers(n);
+		if( bench_enabled("timer") && (i == 0 || key_counts[i-1] < max_timers) )
+			bench_timer_all(min(n, max_timers));
+		if( bench_enabled("strlib") )
+			bench_strlib(n);
+	}
+
+	if( (fp = fopen(out_file, "w")) == NULL )
+		ShowError("do_init: Cannot write the results to '%s'.\n", out_file);
+	else
+	{
+		fprintf(fp, "{\n\t\"timer_engine\":\"%s\",\n\t\"results\":[%s\n\t]\n}\n", TIMER_ENGINE, StringBuf_Value(&results));
+		fclose(fp);
+		ShowStatus("Wrote %d results to '"CL_WHITE"%s"CL_RESET"'.\n", result_count, out_file);
+	}
+	StringBuf_Destroy(&results);
+	timer_final();
+	db_final();
+	return 0;
+}
+
+void do_final(void)
+{
+}
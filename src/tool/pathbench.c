@@ -0,0 +1,307 @@
+// Copyright (c) Athena Dev Teams - Licensed under GNU GPL
+// For more information, see LICENCE in the main folder
+
+// Walk path search benchmark.
+// Loads every map of a map cache, runs the same random searches with the
+// original A* and with the fast one (battle_config.fast_pathfinding), checks
+// that both find the same paths and compares their times.
+// Links ../map/path.c with the few map-server functions it needs.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../common/cbasetypes.h"
+#include "../common/grfio.h"
+#include "../common/malloc.h"
+#include "../common/showmsg.h"
+#include "../common/strlib.h"
+#include "../common/timer.h"
+#include "../common/utils.h"
+#include "../map/map.h"
+#include "../map/battle.h"
+#include "../map/path.h"
+
+struct map_cache_main_header {
+	uint32 file_size;
+	uint16 map_count;
+};
+
+struct map_cache_map_info {
+	char name[MAP_NAME_LENGTH];
+	int16 xs;
+	int16 ys;
+	int32 len;
+};
+
+char map_cache_file[256] = "db/re/map_cache.dat";
+int search_count = 2000; // searches per map
+int search_range = 15; // max distance of the destination
+
+/// Search from (x0,y0) to (x1,y1) on map m.
+struct bench_search {
+	int16 m, x0, y0, x1, y1;
+};
+
+struct map_data map[MAX_MAP_PER_SERVER];
+int map_num = 0;
+struct Battle_Config battle_config;
+
+/// path.c uses rnd() for knockbacks only.
+int32 rnd(void)
+{
+	return rand();
+}
+
+/// Same as map_gat2cell.
+static struct mapcell bench_gat2cell(int gat)
+{
+	struct mapcell cell;
+
+	memset(&cell, 0, sizeof(cell));
+	switch( gat ) {
+		case 1: break; // non-walkable ground
+		case 5: cell.shootable = 1; break; // gap (snipable)
+		case 3: cell.walkable = 1; cell.shootable = 1; cell.water = 1; break; // walkable water
+		default: cell.walkable = 1; cell.shootable = 1; break;
+	}
+	return cell;
+}
+
+/// Same as map_getcellp, for the checks of the path searches.
+int map_getcellp(struct map_data* m, int16 x, int16 y, cell_chk cellchk)
+{
+	struct mapcell cell;
+
+	if( x < 0 || x >= m->xs-1 || y < 0 || y >= m->ys-1 )
+		return( cellchk == CELL_CHKNOPASS );
+
+	cell = m->cell[x + y*m->xs];
+	switch( cellchk ) {
+		case CELL_CHKWALL: return (!cell.walkable && !cell.shootable);
+		case CELL_CHKPASS:
+		case CELL_CHKREACH: return (cell.walkable);
+		case CELL_CHKNOPASS:
+		case CELL_CHKNOREACH: return (!cell.walkable);
+		default: return 0;
+	}
+}
+
+/// The maps of the benchmark are always loaded.
+bool map_cell_load(struct map_data *m)
+{
+	return true;
+}
+
+/// The connected components are not part of this benchmark, both
+/// implementations run every search.
+bool map_cell_reachable(struct map_data *m, int16 x0, int16 y0, int16 x1, int16 y1)
+{
+	return true;
+}
+
+/// Same as map_cellbits_rect.
+bool map_cellbits_rect(struct map_data *m, enum e_cellbits plane, int16 x0, int16 y0, int16 x1, int16 y1)
+{
+	int16 x, y;
+
+	if( x0 > x1 ) swap(x0, x1);
+	if( y0 > y1 ) swap(y0, y1);
+	for( y = max(y0, 0); y <= min(y1, m->ys-1); y++ )
+		for( x = max(x0, 0); x <= min(x1, m->xs-1); x++ )
+			if( map_cellbits_get(m, plane, x, y) )
+				return true;
+	return false;
+}
+
+/// Same as map_cellbits_build.
+static void bench_cellbits_build(struct map_data *m)
+{
+	int16 x, y;
+	int i;
+
+	m->cellbits_stride = (m->xs + 31) / 32;
+	for( i = 0; i < CELLBITS_MAX; i++ )
+		CREATE(m->cellbits[i], uint32, m->cellbits_stride * m->ys);
+
+	for( y = 0; y < m->ys; y++ ) {
+		for( x = 0; x < m->xs; x++ ) {
+			int bit = y*m->cellbits_stride + (x>>5);
+			if( map_getcellp(m, x, y, CELL_CHKWALL) )
+				m->cellbits[CELLBITS_WALL][bit] |= 1u<<(x&31);
+			if( map_getcellp(m, x, y, CELL_CHKNOPASS) )
+				m->cellbits[CELLBITS_NOPASS][bit] |= 1u<<(x&31);
+		}
+	}
+}
+
+/// Loads every map of the map cache.
+static bool bench_load_maps(void)
+{
+	struct map_cache_main_header header;
+	struct map_cache_map_info info;
+	unsigned char *zip = NULL, *gat = NULL;
+	FILE *fp;
+	int i;
+
+	if( (fp = fopen(map_cache_file, "rb")) == NULL ) {
+		ShowError("Unable to open map cache '%s'.\n", map_cache_file);
+		return false;
+	}
+	if( fread(&header, sizeof(header), 1, fp) != 1 ) {
+		ShowError("Unable to read the header of '%s'.\n", map_cache_file);
+		fclose(fp);
+		return false;
+	}
+
+	for( i = 0; i < header.map_count && map_num < MAX_MAP_PER_SERVER; i++ ) {
+		struct map_data *m = &map[map_num];
+		unsigned long size;
+		int xy;
+
+		if( fread(&info, sizeof(info), 1, fp) != 1 )
+			break;
+		size = (unsigned long)info.xs * (unsigned long)info.ys;
+		RECREATE(zip, unsigned char, info.len);
+		RECREATE(gat, unsigned char, size);
+		if( fread(zip, info.len, 1, fp) != 1 || decode_zip(gat, &size, zip, info.len) != 0 || size != (unsigned long)info.xs*info.ys )
+			continue;
+
+		memset(m, 0, sizeof(*m));
+		safestrncpy(m->name, info.name, sizeof(m->name));
+		m->index = map_num;
+		m->xs = info.xs;
+		m->ys = info.ys;
+		CREATE(m->cell, struct mapcell, size);
+		for( xy = 0; xy < (int)size; xy++ )
+			m->cell[xy] = bench_gat2cell(gat[xy]);
+		bench_cellbits_build(m);
+		map_num++;
+	}
+
+	fclose(fp);
+	aFree(zip);
+	aFree(gat);
+	return map_num > 0;
+}
+
+static void bench_free_maps(void)
+{
+	int i, j;
+
+	for( i = 0; i < map_num; i++ ) {
+		aFree(map[i].cell);
+		for( j = 0; j < CELLBITS_MAX; j++ )
+			aFree(map[i].cellbits[j]);
+	}
+}
+
+/// Random walkable cell of map m, false if none was found.
+static bool bench_random_cell(int16 m, int16 *x, int16 *y)
+{
+	int tries;
+
+	for( tries = 0; tries < 100; tries++ ) {
+		*x = rand() % map[m].xs;
+		*y = rand() % map[m].ys;
+		if( !map_getcellp(&map[m], *x, *y, CELL_CHKNOPASS) )
+			return true;
+	}
+	return false;
+}
+
+static void process_args(int argc, char** argv)
+{
+	int i;
+
+	for(i = 0; i < argc; i++) {
+		if(strcmp(argv[i], "-map-cache") == 0 && argc > i+1)
+			safestrncpy(map_cache_file, argv[++i], sizeof(map_cache_file));
+		else if(strcmp(argv[i], "-searches") == 0 && argc > i+1) {
+			search_count = atoi(argv[++i]);
+			search_count = max(1, search_count);
+		} else if(strcmp(argv[i], "-range") == 0 && argc > i+1) {
+			search_range = atoi(argv[++i]);
+			search_range = max(1, search_range);
+		}
+	}
+}
+
+/// Runs every search with one implementation, returns the time in microseconds.
+static uint64 bench_run(struct bench_search *searches, int total, struct walkpath_data *wpd, bool *ok, int fast)
+{
+	uint64 start = gettick_usec();
+	int i;
+
+	battle_config.fast_pathfinding = fast;
+	for( i = 0; i < total; i++ )
+		ok[i] = path_search(&wpd[i], searches[i].m, searches[i].x0, searches[i].y0, searches[i].x1, searches[i].y1, 0, CELL_CHKNOPASS);
+	return gettick_usec() - start;
+}
+
+int do_init(int argc, char** argv)
+{
+	struct walkpath_data *wpd_ref, *wpd_fast;
+	bool *ok_ref, *ok_fast;
+	uint64 time_ref, time_fast;
+	struct bench_search *searches;
+	int found = 0, mismatch = 0, total;
+	int16 m;
+	int i;
+
+	process_args(argc, argv);
+	if( !bench_load_maps() )
+		return 1;
+	srand(1);
+
+	// the same searches for both implementations, from walkable cells to cells in range
+	total = map_num * search_count;
+	CREATE(searches, struct bench_search, total);
+	for( i = 0; i < total; i++ ) {
+		struct bench_search *s = &searches[i];
+
+		s->m = m = i / search_count;
+		if( !bench_random_cell(m, &s->x0, &s->y0) )
+			continue; // (0,0)->(0,0)
+		s->x1 = cap_value(s->x0 + rand() % (2*search_range+1) - search_range, 0, map[m].xs-1);
+		s->y1 = cap_value(s->y0 + rand() % (2*search_range+1) - search_range, 0, map[m].ys-1);
+	}
+	CREATE(wpd_ref, struct walkpath_data, total);
+	CREATE(wpd_fast, struct walkpath_data, total);
+	CREATE(ok_ref, bool, total);
+	CREATE(ok_fast, bool, total);
+
+	ShowStatus("Path search: "CL_WHITE"%d"CL_RESET" maps, %d searches per map, range %d\n", map_num, search_count, search_range);
+
+	time_ref = bench_run(searches, total, wpd_ref, ok_ref, 0);
+	time_fast = bench_run(searches, total, wpd_fast, ok_fast, 1);
+
+	for( i = 0; i < total; i++ ) {
+		if( ok_ref[i] )
+			found++;
+		if( ok_ref[i] != ok_fast[i] || (ok_ref[i] && (wpd_ref[i].path_len != wpd_fast[i].path_len || memcmp(wpd_ref[i].path, wpd_fast[i].path, wpd_ref[i].path_len) != 0)) ) {
+			if( mismatch++ < 10 )
+				ShowWarning("Different paths on '%s' (%d,%d)->(%d,%d).\n", map[searches[i].m].name, searches[i].x0, searches[i].y0, searches[i].x1, searches[i].y1);
+		}
+	}
+
+	ShowInfo("original A*    : %u us\n", (unsigned int)time_ref);
+	ShowInfo("fast A*        : %u us\n", (unsigned int)time_fast);
+	ShowInfo("paths found    : %d / %d\n", found, total);
+	if( mismatch )
+		ShowError("different paths: %d\n", mismatch);
+	else
+		ShowStatus("Both implementations found the same paths.\n");
+
+	aFree(searches);
+	aFree(wpd_ref);
+	aFree(wpd_fast);
+	aFree(ok_ref);
+	aFree(ok_fast);
+	bench_free_maps();
+	return mismatch ? 1 : 0;
+}
+
+void do_final(void)
+{
+}
@@ -0,0 +1,130 @@
+// Copyright (c) Athena Dev Teams - Licensed under GNU GPL
+// For more information, see LICENCE in the main folder
+
+// Prepared statement cache test.
+// Connects to a MySQL server, caches a statement with Sql_PrepareCached and
+// runs it twice, checking that the second call reuses the same statement and
+// that both runs return the expected rows.
+// The test data lives in a temporary table, nothing is left on the server.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../common/cbasetypes.h"
+#include "../common/core.h"
+#include "../common/malloc.h"
+#include "../common/showmsg.h"
+#include "../common/sql.h"
+#include "../common/strlib.h"
+
+char sql_host[64] = "127.0.0.1";
+uint16 sql_port = 3306;
+char sql_user[32] = "ragnarok";
+char sql_pass[32] = "ragnarok";
+char sql_db[32] = "ragnarok";
+
+static bool test_failed = false;
+
+static void process_args(int argc, char** argv)
+{
+	int i;
+
+	for(i = 0; i < argc; i++) {
+		if(strcmp(argv[i], "-host") == 0 && argc > i+1)
+			safestrncpy(sql_host, argv[++i], sizeof(sql_host));
+		else if(strcmp(argv[i], "-port") == 0 && argc > i+1)
+			sql_port = (uint16)atoi(argv[++i]);
+		else if(strcmp(argv[i], "-user") == 0 && argc > i+1)
+			safestrncpy(sql_user, argv[++i], sizeof(sql_user));
+		else if(strcmp(argv[i], "-pass") == 0 && argc > i+1)
+			safestrncpy(sql_pass, argv[++i], sizeof(sql_pass));
+		else if(strcmp(argv[i], "-db") == 0 && argc > i+1)
+			safestrncpy(sql_db, argv[++i], sizeof(sql_db));
+	}
+}
+
+/// Runs the cached statement for one id and checks the name it returns.
+static bool test_cached_select(Sql* sql_handle, SqlStmt** prev, int id, const char* expected)
+{
+	SqlStmt* stmt;
+	char name[32];
+	bool ok;
+
+	stmt = Sql_PrepareCached(sql_handle, "SELECT `name` FROM `%s` WHERE `id` = ?", "sqltest");
+	if( stmt == NULL ) {
+		ShowError("Sql_PrepareCached failed for id %d.\n", id);
+		return false;
+	}
+	if( *prev != NULL && stmt != *prev ) {
+		ShowError("The cached statement was prepared again for id %d.\n", id);
+		SqlStmt_Free(stmt);
+		return false;
+	}
+	*prev = stmt;
+
+	memset(name, 0, sizeof(name));
+	if( SQL_ERROR == SqlStmt_BindParam(stmt, 0, SQLDT_INT, &id, 0)
+	||  SQL_ERROR == SqlStmt_Execute(stmt)
+	||  SQL_ERROR == SqlStmt_BindColumn(stmt, 0, SQLDT_STRING, name, sizeof(name), NULL, NULL) ) {
+		SqlStmt_ShowDebug(stmt);
+		SqlStmt_Free(stmt);
+		return false;
+	}
+
+	ok = ( SQL_SUCCESS == SqlStmt_NextRow(stmt) && strcmp(name, expected) == 0 );
+	if( !ok )
+		ShowError("Id %d returned '%s' instead of '%s'.\n", id, name, expected);
+	SqlStmt_Free(stmt); // only frees the result of a cached statement
+	return ok;
+}
+
+int do_init(int argc, char** argv)
+{
+	Sql* sql_handle;
+	SqlStmt* stmt = NULL;
+
+	process_args(argc, argv);
+	runflag = CORE_ST_STOP; // single pass, no main loop
+
+	sql_handle = Sql_Malloc();
+	if( SQL_ERROR == Sql_Connect(sql_handle, sql_user, sql_pass, sql_host, sql_port, sql_db) ) {
+		ShowError("Couldn't connect with uname='%s',host='%s',port='%d',database='%s'\n", sql_user, sql_host, sql_port, sql_db);
+		Sql_ShowDebug(sql_handle);
+		Sql_Free(sql_handle);
+		test_failed = true;
+		return 1;
+	}
+
+	if( SQL_ERROR == Sql_QueryStr(sql_handle, "CREATE TEMPORARY TABLE `sqltest` (`id` INT NOT NULL PRIMARY KEY, `name` VARCHAR(23) NOT NULL)")
+	||  SQL_ERROR == Sql_QueryStr(sql_handle, "INSERT INTO `sqltest` (`id`, `name`) VALUES (1, 'Poring'), (2, 'Drops')") ) {
+		Sql_ShowDebug(sql_handle);
+		test_failed = true;
+	}
+	else if( !test_cached_select(sql_handle, &stmt, 1, "Poring")
+	||  !test_cached_select(sql_handle, &stmt, 2, "Drops") )
+		test_failed = true;
+
+	Sql_Free(sql_handle); // frees the statement cache and its keys
+
+	if( test_failed )
+		ShowError("Prepared statement cache test failed.\n");
+	else
+		ShowStatus("The cached statement was run twice.\n");
+	return test_failed ? 1 : 0;
+}
+
+void do_final(void)
+{
+	if( test_failed )
+		exit(EXIT_FAILURE);
+}
+
+void do_abort(void)
+{
+}
+
+void set_server_type(void)
+{
+	SERVER_TYPE = ATHENA_SERVER_NONE;
+}
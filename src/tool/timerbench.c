@@ -0,0 +1,118 @@
+// Copyright (c) Athena Dev Teams - Licensed under GNU GPL
+// For more information, see LICENCE in the main folder
+
+// Timer engine benchmark.
+// Built twice, as timerbench-heap (binary heap) and timerbench-wheel (TIMER_WHEEL),
+// so both engines can be compared with the same workload.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../common/cbasetypes.h"
+#include "../common/malloc.h"
+#include "../common/showmsg.h"
+#include "../common/timer.h"
+
+#ifdef TIMER_WHEEL
+#define TIMER_ENGINE "wheel"
+#else
+#define TIMER_ENGINE "heap"
+#endif
+
+int timer_count = 200000; // live timers
+int settick_count = 2000; // settick_timer calls
+int run_time = 60000; // simulated time of the run phase, in ms
+
+int* timer_list; // tid of each live timer
+int timer_fired = 0;
+unsigned int run_end;
+
+/// Random delay of up to 'range' ms.
+static unsigned int bench_delay(int range)
+{
+	return (((unsigned int)rand() << 15) ^ (unsigned int)rand()) % (unsigned int)range;
+}
+
+/// Re-arms itself until the end of the run, like walk and status timers do.
+static int bench_timer(int tid, unsigned int tick, int id, intptr_t data)
+{
+	++timer_fired;
+	if( DIFF_TICK(run_end, tick) > 0 )
+		timer_list[id] = add_timer(tick + 1 + bench_delay(5000), bench_timer, id, 0);
+	else
+		timer_list[id] = INVALID_TIMER;
+	return 0;
+}
+
+static void process_args(int argc, char** argv)
+{
+	int i;
+
+	for(i = 0; i < argc; i++) {
+		if(strcmp(argv[i], "-timers") == 0 && argc > i+1) {
+			timer_count = atoi(argv[++i]);
+			timer_count = max(1, timer_count);
+		} else if(strcmp(argv[i], "-settick") == 0 && argc > i+1) {
+			settick_count = atoi(argv[++i]);
+			settick_count = max(0, settick_count);
+		} else if(strcmp(argv[i], "-time") == 0 && argc > i+1) {
+			run_time = atoi(argv[++i]);
+			run_time = max(1, run_time);
+		}
+	}
+}
+
+int do_init(int argc, char** argv)
+{
+	unsigned int start, now, tick;
+	int i;
+
+	process_args(argc, argv);
+	srand(1);
+	timer_init();
+	add_timer_func_list(bench_timer, "bench_timer");
+	CREATE(timer_list, int, timer_count);
+
+	ShowStatus("Timer engine: "CL_WHITE"%s"CL_RESET" (%d timers, %d settick, %d ms run)\n", TIMER_ENGINE, timer_count, settick_count, run_time);
+	now = gettick_nocache();
+	run_end = now + run_time;
+
+	// add
+	start = gettick_nocache();
+	for( i = 0; i < timer_count; ++i )
+		timer_list[i] = add_timer(now + 1 + bench_delay(60000), bench_timer, i, 0);
+	ShowInfo("add_timer      : %u ms\n", gettick_nocache() - start);
+
+	// settick
+	start = gettick_nocache();
+	for( i = 0; i < settick_count; ++i )
+	{
+		int tid = timer_list[bench_delay(timer_count)];
+		settick_timer(tid, now + 1 + bench_delay(60000));
+	}
+	ShowInfo("settick_timer  : %u ms\n", gettick_nocache() - start);
+
+	// delete a quarter of the timers and start them again
+	start = gettick_nocache();
+	for( i = 0; i < timer_count; i += 4 )
+	{
+		delete_timer(timer_list[i], bench_timer);
+		timer_list[i] = add_timer(now + 1 + bench_delay(60000), bench_timer, i, 0);
+	}
+	ShowInfo("delete_timer   : %u ms\n", gettick_nocache() - start);
+
+	// run, the time is simulated in steps of the minimum timer interval
+	start = gettick_nocache();
+	for( tick = now; DIFF_TICK(run_end, tick) >= 0; tick += 20 )
+		do_timer(tick);
+	ShowInfo("do_timer       : %u ms (%d timers fired)\n", gettick_nocache() - start, timer_fired);
+
+	aFree(timer_list);
+	timer_final();
+	return 0;
+}
+
+void do_final(void)
+{
+}